@@ -0,0 +1,82 @@
+#include "beacon.h"
+
+#include <inttypes.h>
+
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_now.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+
+#include "proto_beacon.h"
+
+#include "config.h"
+#include "metrics.h"
+
+static const char *const TAG = "beacon";
+static const uint8_t BROADCAST_MAC[ESP_NOW_ETH_ALEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+static esp_timer_handle_t s_timer;
+static proto_beacon_t s_beacon; // channel is filled in per send
+static int64_t s_last_us;       // last beacon sent, periodic or probed
+
+static void send_beacon(metric_t reason) {
+    uint8_t primary;
+    wifi_second_chan_t second;
+    if (unlikely(esp_wifi_get_channel(&primary, &second) != ESP_OK)) {
+        return;
+    }
+
+    proto_beacon_t beacon = s_beacon;
+    beacon.channel = primary;
+
+    uint8_t frame[PROTO_BEACON_LEN];
+    const size_t len = proto_beacon_write(frame, sizeof(frame), &beacon);
+
+    const esp_err_t err = esp_now_send(BROADCAST_MAC, frame, len);
+    if (unlikely(err != ESP_OK)) {
+        ESP_LOGD(TAG, "beacon not sent: %s", esp_err_to_name(err));
+        return;
+    }
+    __atomic_store_n(&s_last_us, esp_timer_get_time(), __ATOMIC_RELAXED);
+    metrics_inc(reason);
+}
+
+static void timer_cb(__attribute__((unused)) void *arg) {
+    send_beacon(METRIC_BEACON_PERIODIC);
+}
+
+esp_err_t beacon_start(void) {
+    ESP_RETURN_ON_ERROR(esp_wifi_get_mac(GATEWAY_WIFI_IF, s_beacon.mac_addr), TAG, "esp_wifi_get_mac");
+    // Never 0, so a node can use 0 for "no gateway seen yet".
+    s_beacon.epoch = esp_random() | 1;
+
+    const esp_timer_create_args_t args = {
+        .callback = timer_cb,
+        .name = "beacon",
+    };
+    ESP_RETURN_ON_ERROR(esp_timer_create(&args, &s_timer), TAG, "esp_timer_create");
+    ESP_RETURN_ON_ERROR(esp_timer_start_periodic(s_timer, (uint64_t)GATEWAY_BEACON_INTERVAL_MS * 1000), TAG,
+                        "esp_timer_start_periodic");
+
+    ESP_LOGI(TAG, "beacons every %d ms, epoch %08" PRIx32, GATEWAY_BEACON_INTERVAL_MS, s_beacon.epoch);
+    return ESP_OK;
+}
+
+void beacon_probe(void) {
+    if (s_timer == NULL) {
+        return;
+    }
+
+    const int64_t now = esp_timer_get_time();
+    int64_t last = __atomic_load_n(&s_last_us, __ATOMIC_RELAXED);
+    if (now - last < (int64_t)GATEWAY_BEACON_PROBE_GAP_MS * 1000) {
+        return;
+    }
+    // Workers of several shards may see probes at once, one of them answers.
+    if (!__atomic_compare_exchange_n(&s_last_us, &last, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+    }
+    send_beacon(METRIC_BEACON_PROBED);
+}
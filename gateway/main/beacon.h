@@ -0,0 +1,38 @@
+#ifndef _BEACON_H_
+#define _BEACON_H_
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Periodic proto_beacon broadcasts carrying the gateway MAC, the channel the
+ * radio is on right now and a random epoch chosen at boot. The channel
+ * follows the upstream AP, so nodes find it by scanning instead of being
+ * built for a fixed one. A scanning node sends a probe and is answered right
+ * away, so it only listens for a few milliseconds per channel.
+ */
+
+/**
+ * @brief Starts periodic beacons.
+ *
+ * Must be called after espnow_start().
+ */
+esp_err_t beacon_start(void);
+
+/**
+ * @brief Answers a probe with a beacon.
+ *
+ * Called by the uplink for probe frames. Answers closer together than
+ * GATEWAY_BEACON_PROBE_GAP_MS are merged, one broadcast serves all nodes
+ * scanning the channel.
+ */
+void beacon_probe(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BEACON_H_ */
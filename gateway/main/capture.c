@@ -0,0 +1,243 @@
+#include "capture.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "config.h"
+#include "metrics.h"
+
+static const char *const TAG = "capture";
+
+#define STACK_DEPTH 4096
+#define WAIT_TICKS pdMS_TO_TICKS(250) // how often an idle capture checks its deadline
+#define CHUNK_LEN 2048
+
+#define PCAP_MAGIC 0xA1B2C3D4 // microsecond timestamps
+#define PCAP_SNAPLEN 512
+#define LINKTYPE_IEEE802_11_RADIOTAP 127
+
+// Radiotap: version, pad, length, present flags, then channel (bit 3), antenna signal (5) and noise (6).
+#define RADIOTAP_LEN 14
+#define RADIOTAP_PRESENT (1u << 3 | 1u << 5 | 1u << 6)
+#define RADIOTAP_CHAN_2GHZ 0x0080
+
+// ESP-NOW as sent: 802.11 action frame, category "vendor specific", Espressif OUI, random value, then one vendor
+// specific element of type 4, version 1 holding the payload.
+#define WLAN_HDR_LEN 24
+#define ACTION_HDR_LEN (1 + 3 + 4)
+#define ELEMENT_HDR_LEN (2 + 3 + 1 + 1)
+#define FRAME_MAX_LEN (RADIOTAP_LEN + WLAN_HDR_LEN + ACTION_HDR_LEN + ELEMENT_HDR_LEN + ESP_NOW_MAX_DATA_LEN)
+#define RECORD_HDR_LEN 16
+
+_Static_assert(FRAME_MAX_LEN <= PCAP_SNAPLEN, "snap length too short for ESP-NOW frames");
+
+typedef struct {
+    int64_t time_us; // wall clock
+    uint8_t src_addr[ESP_NOW_ETH_ALEN];
+    uint8_t dst_addr[ESP_NOW_ETH_ALEN];
+    int8_t rssi;
+    int8_t noise_floor;
+    uint8_t channel;
+    uint16_t len;
+    uint8_t data[ESP_NOW_MAX_DATA_LEN];
+} slot_t;
+
+bool capture_armed = false;
+
+// Single producer, the Wi-Fi task, and single consumer, the capture task. s_head and s_tail count frames ever
+// written and read, each written by its own side only.
+static slot_t s_slots[GATEWAY_CAPTURE_SLOTS];
+static uint32_t s_head = 0;
+static uint32_t s_tail = 0;
+
+// Set up by capture_start() while disarmed, read-only while armed.
+static capture_filter_t s_filter;
+static httpd_req_t *s_req = NULL;
+static int64_t s_deadline_us;
+static uint32_t s_frame_limit;
+
+static TaskHandle_t s_task = NULL;
+static uint8_t s_chunk[CHUNK_LEN]; // capture task only
+
+static inline void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void put_u32(uint8_t *p, uint32_t v) {
+    put_u16(p, (uint16_t)v);
+    put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+static int64_t wall_clock_us(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void capture_frame(const esp_now_recv_info_t *recv_info, const uint8_t *data, size_t len) {
+    const capture_filter_t *f = &s_filter;
+    if (len < f->min_len || len > f->max_len || memcmp(recv_info->src_addr, f->mac_addr, f->mac_len) != 0) {
+        return;
+    }
+
+    const uint32_t head = s_head;
+    if (unlikely(head - __atomic_load_n(&s_tail, __ATOMIC_ACQUIRE) >= GATEWAY_CAPTURE_SLOTS)) {
+        metrics_inc(METRIC_CAPTURE_DROPPED);
+        return;
+    }
+
+    slot_t *slot = &s_slots[head % GATEWAY_CAPTURE_SLOTS];
+    slot->time_us = wall_clock_us();
+    memcpy(slot->src_addr, recv_info->src_addr, ESP_NOW_ETH_ALEN);
+    memcpy(slot->dst_addr, recv_info->des_addr, ESP_NOW_ETH_ALEN);
+    slot->rssi = (int8_t)recv_info->rx_ctrl->rssi;
+    slot->noise_floor = (int8_t)recv_info->rx_ctrl->noise_floor;
+    slot->channel = (uint8_t)recv_info->rx_ctrl->channel;
+    slot->len = (uint16_t)len;
+    memcpy(slot->data, data, len);
+
+    __atomic_store_n(&s_head, head + 1, __ATOMIC_RELEASE);
+    xTaskNotifyGive(s_task);
+}
+
+static size_t write_file_header(uint8_t *p) {
+    put_u32(p, PCAP_MAGIC);
+    put_u16(p + 4, 2); // version 2.4
+    put_u16(p + 6, 4);
+    put_u32(p + 8, 0); // UTC
+    put_u32(p + 12, 0);
+    put_u32(p + 16, PCAP_SNAPLEN);
+    put_u32(p + 20, LINKTYPE_IEEE802_11_RADIOTAP);
+    return 24;
+}
+
+static size_t write_record(uint8_t *p, const slot_t *slot) {
+    const size_t frame_len = FRAME_MAX_LEN - ESP_NOW_MAX_DATA_LEN + slot->len;
+    put_u32(p, (uint32_t)(slot->time_us / 1000000));
+    put_u32(p + 4, (uint32_t)(slot->time_us % 1000000));
+    put_u32(p + 8, (uint32_t)frame_len);
+    put_u32(p + 12, (uint32_t)frame_len);
+
+    uint8_t *r = p + RECORD_HDR_LEN;
+    r[0] = 0; // version
+    r[1] = 0;
+    put_u16(r + 2, RADIOTAP_LEN);
+    put_u32(r + 4, RADIOTAP_PRESENT);
+    put_u16(r + 8, slot->channel == 14 ? 2484 : (uint16_t)(2407 + 5 * slot->channel));
+    put_u16(r + 10, RADIOTAP_CHAN_2GHZ);
+    r[12] = (uint8_t)slot->rssi;
+    r[13] = (uint8_t)slot->noise_floor;
+
+    uint8_t *w = r + RADIOTAP_LEN;
+    memset(w, 0, WLAN_HDR_LEN);
+    w[0] = 0xD0; // management, action
+    memcpy(w + 4, slot->dst_addr, ESP_NOW_ETH_ALEN);
+    memcpy(w + 10, slot->src_addr, ESP_NOW_ETH_ALEN);
+    memset(w + 16, 0xFF, ESP_NOW_ETH_ALEN); // BSSID, broadcast like the ESP-NOW sender
+    w += WLAN_HDR_LEN;
+
+    const uint8_t action[ACTION_HDR_LEN] = {127, 0x18, 0xFE, 0x34, 0, 0, 0, 0};
+    memcpy(w, action, sizeof(action));
+    w += sizeof(action);
+
+    const uint8_t element[ELEMENT_HDR_LEN] = {221, (uint8_t)(5 + slot->len), 0x18, 0xFE, 0x34, 4, 1};
+    memcpy(w, element, sizeof(element));
+    w += sizeof(element);
+    memcpy(w, slot->data, slot->len);
+
+    return RECORD_HDR_LEN + frame_len;
+}
+
+// Writes what the ring holds, up to max frames, returns the number of frames or -1 once the client is gone.
+static int drain(uint32_t max) {
+    size_t len = 0;
+    int frames = 0;
+    const uint32_t head = __atomic_load_n(&s_head, __ATOMIC_ACQUIRE);
+    for (uint32_t tail = s_tail; tail != head && (uint32_t)frames < max; tail++) {
+        if (len + RECORD_HDR_LEN + FRAME_MAX_LEN > sizeof(s_chunk)) {
+            if (httpd_resp_send_chunk(s_req, (const char *)s_chunk, (ssize_t)len) != ESP_OK) {
+                return -1;
+            }
+            len = 0;
+        }
+        len += write_record(s_chunk + len, &s_slots[tail % GATEWAY_CAPTURE_SLOTS]);
+        __atomic_store_n(&s_tail, tail + 1, __ATOMIC_RELEASE); // copied out, the slot is free again
+        frames++;
+    }
+
+    if (len > 0 && httpd_resp_send_chunk(s_req, (const char *)s_chunk, (ssize_t)len) != ESP_OK) {
+        return -1;
+    }
+    return frames;
+}
+
+static void run(void) {
+    const size_t n = write_file_header(s_chunk);
+    uint32_t written = 0;
+    bool ok = httpd_resp_send_chunk(s_req, (const char *)s_chunk, (ssize_t)n) == ESP_OK;
+    __atomic_store_n(&capture_armed, ok, __ATOMIC_RELEASE);
+
+    while (ok && esp_timer_get_time() < s_deadline_us && (s_frame_limit == 0 || written < s_frame_limit)) {
+        ulTaskNotifyTake(pdTRUE, WAIT_TICKS);
+        const int frames = drain(s_frame_limit == 0 ? UINT32_MAX : s_frame_limit - written);
+        ok = frames >= 0;
+        written += ok ? (uint32_t)frames : 0;
+        metrics_add(METRIC_CAPTURE_FRAMES, ok ? (uint32_t)frames : 0);
+    }
+    __atomic_store_n(&capture_armed, false, __ATOMIC_RELEASE);
+
+    ESP_LOGI(TAG, "capture ended after %" PRIu32 " frames%s", written, ok ? "" : ", client gone");
+    if (ok) {
+        httpd_resp_send_chunk(s_req, NULL, 0); // End response
+    }
+    httpd_req_async_handler_complete(s_req);
+}
+
+// Lives on between captures: the receive callback may still notify it right after a capture ended.
+static void capture_task(void *arg) {
+    (void)arg;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (__atomic_load_n(&s_req, __ATOMIC_ACQUIRE) != NULL) {
+            run();
+            __atomic_store_n(&s_req, NULL, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+esp_err_t capture_start(httpd_req_t *req, const capture_filter_t *filter, uint32_t seconds, uint32_t frames) {
+    // Called from the httpd task only, so two starts cannot race.
+    if (__atomic_load_n(&s_req, __ATOMIC_ACQUIRE) != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s_task == NULL && xTaskCreate(capture_task, "capture", STACK_DEPTH, NULL, tskIDLE_PRIORITY + 1, &s_task) !=
+                              pdPASS) {
+        s_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    httpd_resp_set_type(req, "application/vnd.tcpdump.pcap");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"espnow.pcap\"");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    httpd_req_t *async = NULL;
+    ESP_RETURN_ON_ERROR(httpd_req_async_handler_begin(req, &async), TAG, "httpd_req_async_handler_begin");
+
+    s_filter = *filter;
+    s_deadline_us = esp_timer_get_time() + (int64_t)seconds * 1000000;
+    s_frame_limit = frames;
+    s_tail = __atomic_load_n(&s_head, __ATOMIC_ACQUIRE); // frames left from an earlier capture are not wanted
+    __atomic_store_n(&s_req, async, __ATOMIC_RELEASE);
+    xTaskNotifyGive(s_task);
+
+    ESP_LOGI(TAG, "capture started for %" PRIu32 " s", seconds);
+    return ESP_OK;
+}
@@ -0,0 +1,70 @@
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "esp_now.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Live capture of received ESP-NOW frames, streamed as a pcap file with
+ * radiotap headers (channel, RSSI, noise floor) in front of a rebuilt 802.11
+ * vendor specific action frame, which Wireshark's ESP-NOW dissector decodes.
+ *
+ * The receive callback offers every frame with one relaxed load while no
+ * capture runs. During a capture it applies the filter and copies matching
+ * frames into a fixed ring of GATEWAY_CAPTURE_SLOTS, or counts them as
+ * dropped when the ring is full; it never waits. One capture runs at a time.
+ */
+
+/**
+ * @brief Frames to keep.
+ */
+typedef struct {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN]; // source, compared on the first mac_len bytes
+    size_t mac_len;                     // 0 for any source, 3 for an OUI, 6 for one device
+    size_t min_len;                     // payload length bounds, inclusive
+    size_t max_len;
+} capture_filter_t;
+
+extern bool capture_armed; // written by capture.c only
+
+void capture_frame(const esp_now_recv_info_t *recv_info, const uint8_t *data, size_t len);
+
+/**
+ * @brief Offers a received frame, for the receive callback.
+ */
+static inline void capture_offer(const esp_now_recv_info_t *recv_info, const uint8_t *data, size_t len) {
+    if (unlikely(__atomic_load_n(&capture_armed, __ATOMIC_ACQUIRE))) {
+        capture_frame(recv_info, data, len);
+    }
+}
+
+/**
+ * @brief Streams a capture as the response to a request.
+ *
+ * Takes the request over as an async request and returns right away, the
+ * capture task sends the pcap file until the client goes away, @p seconds
+ * pass, or @p frames frames were written.
+ *
+ * @param req Request to answer, headers not sent yet.
+ * @param filter Frames to keep.
+ * @param seconds Capture duration.
+ * @param frames Frame limit, 0 for none.
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if a capture is running, ESP_ERR_NO_MEM if the capture task could not be
+ *         started, or an error of the HTTP server.
+ */
+esp_err_t capture_start(httpd_req_t *req, const capture_filter_t *filter, uint32_t seconds, uint32_t frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAPTURE_H_ */
@@ -20,8 +20,109 @@ extern "C" {
 #define GATEWAY_BROKER_URL CONFIG_ESPNOW_BROKER_URL
 #define GATEWAY_BROKER_USERNAME CONFIG_ESPNOW_BROKER_USERNAME
 #define GATEWAY_BROKER_PASSWORD CONFIG_ESPNOW_BROKER_PASSWORD
-#define GATEWAY_BROKER_QOS 0
-#define GATEWAY_BROKER_RETAIN 0
+#define GATEWAY_BROKER_QOS 0    // default of setting mqtt.qos
+#define GATEWAY_BROKER_RETAIN 0 // default of setting mqtt.retain
+#define GATEWAY_BROKER_TOPIC "{prefix}/{mac}"
+#define GATEWAY_BROKER_TOPIC_PREFIX "/device"
+
+#define GATEWAY_LOG_LEVEL 2 // default of setting log.level, ESP_LOG_WARN: no per-frame logging
+
+#define GATEWAY_RX_POOL_SIZE CONFIG_GATEWAY_RX_POOL_SIZE
+#define GATEWAY_DEVICE_CACHE_SIZE CONFIG_GATEWAY_DEVICE_CACHE_SIZE
+#define GATEWAY_ESPNOW_WORKERS CONFIG_GATEWAY_ESPNOW_WORKERS
+#define GATEWAY_ESPNOW_WORKER_PRIORITY CONFIG_GATEWAY_ESPNOW_WORKER_PRIORITY
+
+#define GATEWAY_REASM_SLOTS CONFIG_GATEWAY_REASM_SLOTS
+#define GATEWAY_REASM_MEM_CAP CONFIG_GATEWAY_REASM_MEM_CAP
+#define GATEWAY_REASM_TIMEOUT_MS CONFIG_GATEWAY_REASM_TIMEOUT_MS
+
+#if CONFIG_GATEWAY_TELEMETRY_JSON
+#define GATEWAY_TELEMETRY_JSON_LEN CONFIG_GATEWAY_TELEMETRY_JSON_LEN
+#endif
+
+#if CONFIG_GATEWAY_DELTA
+#define GATEWAY_DELTA_BUF_LEN CONFIG_GATEWAY_DELTA_BUF_LEN
+#endif
+
+#if CONFIG_GATEWAY_MQTT_BATCH
+#define GATEWAY_MQTT_BATCH_WINDOW_MS CONFIG_GATEWAY_MQTT_BATCH_WINDOW_MS
+#define GATEWAY_MQTT_BATCH_MAX_BYTES CONFIG_GATEWAY_MQTT_BATCH_MAX_BYTES
+#if CONFIG_GATEWAY_MQTT_BATCH_AGGREGATE
+#define GATEWAY_MQTT_BATCH_AGGREGATE 1
+#define GATEWAY_MQTT_BATCH_TOPIC CONFIG_GATEWAY_MQTT_BATCH_TOPIC
+#define GATEWAY_MQTT_BATCH_SLOTS 1
+#else
+#define GATEWAY_MQTT_BATCH_AGGREGATE 0
+#define GATEWAY_MQTT_BATCH_SLOTS CONFIG_GATEWAY_MQTT_BATCH_SLOTS
+#endif
+#endif
+
+#if CONFIG_GATEWAY_SPOOL
+#define GATEWAY_SPOOL_PARTITION CONFIG_GATEWAY_SPOOL_PARTITION
+#define GATEWAY_SPOOL_WRITE_BUFFER (CONFIG_GATEWAY_SPOOL_WRITE_BUFFER & ~3)
+#define GATEWAY_SPOOL_FLUSH_MS CONFIG_GATEWAY_SPOOL_FLUSH_MS
+#define GATEWAY_SPOOL_DRAIN_RATE CONFIG_GATEWAY_SPOOL_DRAIN_RATE
+#define GATEWAY_SPOOL_TASK_PRIORITY 1 // below the workers, draining yields to live traffic
+#endif
+
+#if CONFIG_GATEWAY_DOWNLINK
+#define GATEWAY_DOWNLINK_NODES CONFIG_GATEWAY_DOWNLINK_NODES
+#define GATEWAY_DOWNLINK_PEERS CONFIG_GATEWAY_DOWNLINK_PEERS
+#define GATEWAY_DOWNLINK_QUEUE_LEN CONFIG_GATEWAY_DOWNLINK_QUEUE_LEN
+#define GATEWAY_DOWNLINK_TTL_S CONFIG_GATEWAY_DOWNLINK_TTL_S
+#define GATEWAY_DOWNLINK_QOS 1 // subscription QoS, commands should survive a reconnect
+#define GATEWAY_DOWNLINK_TASK_PRIORITY GATEWAY_ESPNOW_WORKER_PRIORITY
+#endif
+
+#if CONFIG_GATEWAY_BEACON
+#define GATEWAY_BEACON_INTERVAL_MS CONFIG_GATEWAY_BEACON_INTERVAL_MS
+#define GATEWAY_BEACON_PROBE_GAP_MS CONFIG_GATEWAY_BEACON_PROBE_GAP_MS
+#endif
+
+#if CONFIG_GATEWAY_ENCRYPT
+#define GATEWAY_ENCRYPT_PMK CONFIG_GATEWAY_ENCRYPT_PMK
+#define GATEWAY_ENCRYPT_MASTER_KEY CONFIG_GATEWAY_ENCRYPT_MASTER_KEY
+#define GATEWAY_ENCRYPT_PEERS CONFIG_GATEWAY_ENCRYPT_PEERS
+#define GATEWAY_ENCRYPT_NODES CONFIG_GATEWAY_ENCRYPT_NODES
+#define GATEWAY_ENCRYPT_LEASE_S CONFIG_GATEWAY_ENCRYPT_LEASE_S
+#define GATEWAY_ENCRYPT_ROTATE_H CONFIG_GATEWAY_ENCRYPT_ROTATE_H
+#define GATEWAY_ENCRYPT_PAIR_WINDOW_S CONFIG_GATEWAY_ENCRYPT_PAIR_WINDOW_S
+#define GATEWAY_ENCRYPT_NVS_NAMESPACE "keys"
+#endif
+
+#if CONFIG_GATEWAY_LINKS
+#define GATEWAY_LINKS_SIZE CONFIG_GATEWAY_LINKS_SIZE
+#define GATEWAY_LINKS_MQTT_INTERVAL_S CONFIG_GATEWAY_LINKS_MQTT_INTERVAL_S
+#if CONFIG_GATEWAY_LINKS_MQTT_INTERVAL_S > 0
+#define GATEWAY_LINKS_MQTT_TOPIC CONFIG_GATEWAY_LINKS_MQTT_TOPIC
+#endif
+#endif
+
+#if CONFIG_GATEWAY_REGISTRY
+#define GATEWAY_REGISTRY_SIZE CONFIG_GATEWAY_REGISTRY_SIZE
+#define GATEWAY_REGISTRY_OFFLINE_S CONFIG_GATEWAY_REGISTRY_OFFLINE_S
+#define GATEWAY_REGISTRY_SNAPSHOT_S CONFIG_GATEWAY_REGISTRY_SNAPSHOT_S
+#define GATEWAY_REGISTRY_QOS 1 // presence is retained, it should reach the broker
+#endif
+
+#if CONFIG_GATEWAY_CAPTURE
+#define GATEWAY_CAPTURE_SLOTS CONFIG_GATEWAY_CAPTURE_SLOTS
+#define GATEWAY_CAPTURE_DEFAULT_S CONFIG_GATEWAY_CAPTURE_DEFAULT_S
+#define GATEWAY_CAPTURE_MAX_S CONFIG_GATEWAY_CAPTURE_MAX_S
+#endif
+
+#if CONFIG_GATEWAY_ENABLE_SSE_LOGS
+#define GATEWAY_SSE_LOGS_RECORDS CONFIG_GATEWAY_SSE_LOGS_RECORDS
+#define GATEWAY_SSE_LOGS_MAX_CLIENTS CONFIG_GATEWAY_SSE_LOGS_MAX_CLIENTS
+#define GATEWAY_SSE_LOGS_LINES CONFIG_GATEWAY_SSE_LOGS_LINES
+#define GATEWAY_SSE_LOGS_TAG_RATE CONFIG_GATEWAY_SSE_LOGS_TAG_RATE
+#define GATEWAY_SSE_LOGS_TAG_BURST CONFIG_GATEWAY_SSE_LOGS_TAG_BURST
+#endif
+
+#if CONFIG_GATEWAY_AUTH
+#define GATEWAY_AUTH_MASTER_KEY CONFIG_GATEWAY_AUTH_MASTER_KEY
+#define GATEWAY_AUTH_NODES CONFIG_GATEWAY_AUTH_NODES
+#endif
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,119 @@
+#include "devices.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+_Static_assert(GATEWAY_DEVICE_CACHE_SIZE < DEVICES_NONE, "device cache too large for 16-bit indices");
+
+static inline size_t bucket_of(const uint8_t *mac_addr) {
+    return devices_mac_hash(mac_addr) % DEVICES_INDEX_SIZE;
+}
+
+static void lru_unlink(devices_t *t, uint16_t i) {
+    device_t *e = &t->entries[i];
+
+    if (e->lru_prev != DEVICES_NONE) {
+        t->entries[e->lru_prev].lru_next = e->lru_next;
+    } else {
+        t->lru_head = e->lru_next;
+    }
+
+    if (e->lru_next != DEVICES_NONE) {
+        t->entries[e->lru_next].lru_prev = e->lru_prev;
+    } else {
+        t->lru_tail = e->lru_prev;
+    }
+}
+
+static void lru_push_front(devices_t *t, uint16_t i) {
+    device_t *e = &t->entries[i];
+
+    e->lru_prev = DEVICES_NONE;
+    e->lru_next = t->lru_head;
+
+    if (t->lru_head != DEVICES_NONE) {
+        t->entries[t->lru_head].lru_prev = i;
+    } else {
+        t->lru_tail = i;
+    }
+    t->lru_head = i;
+}
+
+// Returns bucket holding MAC, or the empty bucket where it would be inserted.
+static size_t probe(const devices_t *t, const uint8_t *mac_addr) {
+    size_t b = bucket_of(mac_addr);
+
+    while (t->index[b] != 0) {
+        const device_t *e = &t->entries[t->index[b] - 1];
+        if (memcmp(e->mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0) {
+            break;
+        }
+        b = (b + 1) % DEVICES_INDEX_SIZE;
+    }
+
+    return b;
+}
+
+// Backward-shift deletion keeps probe sequences intact without tombstones.
+static void index_remove(devices_t *t, size_t hole) {
+    size_t next = hole;
+
+    for (;;) {
+        next = (next + 1) % DEVICES_INDEX_SIZE;
+        if (t->index[next] == 0) {
+            break;
+        }
+
+        const size_t home = bucket_of(t->entries[t->index[next] - 1].mac_addr);
+        const bool movable = (hole <= next) ? (home <= hole || home > next) : (home <= hole && home > next);
+        if (movable) {
+            t->index[hole] = t->index[next];
+            hole = next;
+        }
+    }
+
+    t->index[hole] = 0;
+}
+
+void devices_init(devices_t *t) {
+    memset(t, 0, sizeof(*t));
+    t->lru_head = DEVICES_NONE;
+    t->lru_tail = DEVICES_NONE;
+}
+
+device_t *devices_find(devices_t *t, const uint8_t *mac_addr) {
+    const size_t b = probe(t, mac_addr);
+    return t->index[b] != 0 ? &t->entries[t->index[b] - 1] : NULL;
+}
+
+device_t *devices_lookup(devices_t *t, const uint8_t *mac_addr) {
+    size_t b = probe(t, mac_addr);
+
+    if (likely(t->index[b] != 0)) {
+        const uint16_t i = t->index[b] - 1;
+        if (t->lru_head != i) {
+            lru_unlink(t, i);
+            lru_push_front(t, i);
+        }
+        return &t->entries[i];
+    }
+
+    uint16_t i;
+    if (t->count < GATEWAY_DEVICE_CACHE_SIZE) {
+        i = t->count++;
+    } else {
+        i = t->lru_tail;
+        lru_unlink(t, i);
+        index_remove(t, probe(t, t->entries[i].mac_addr));
+        b = probe(t, mac_addr); // bucket may have moved during shift
+    }
+
+    device_t *e = &t->entries[i];
+    memset(e, 0, sizeof(*e));
+    memcpy(e->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+
+    t->index[b] = i + 1;
+    lru_push_front(t, i);
+
+    return e;
+}
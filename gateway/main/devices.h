@@ -0,0 +1,105 @@
+#ifndef _DEVICES_H_
+#define _DEVICES_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_now.h"
+
+#include "proto_seq.h"
+#include "proto_sha256.h"
+
+#include "config.h"
+#include "routes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DEVICES_INDEX_SIZE (2 * GATEWAY_DEVICE_CACHE_SIZE) // keeps load factor <= 0.5
+#define DEVICES_NONE UINT16_MAX
+
+/**
+ * @brief Per-device state cached by the gateway.
+ *
+ * Entries are recycled in LRU order, so pointers are only valid until the
+ * next devices_lookup() call on the same table.
+ */
+typedef struct {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    routes_target_t target; // valid while routes_gen == routes_generation()
+    uint32_t routes_gen;    // 0 until resolved
+    uint32_t rx_frames;
+    uint32_t rx_bytes;
+    proto_seq_t seq; // PROTO_FLAG_SEQ window, reset on eviction
+#if CONFIG_GATEWAY_AUTH
+    proto_hmac_key_t auth_key; // schedule of the device key, valid if auth_ready; the counters are in uplink.c
+    bool auth_ready;
+#endif
+    uint16_t lru_prev;
+    uint16_t lru_next;
+} device_t;
+
+/**
+ * @brief Fixed-capacity open-addressing table keyed by MAC with LRU eviction.
+ *
+ * Not thread-safe, callers must serialize access to one table.
+ */
+typedef struct {
+    device_t entries[GATEWAY_DEVICE_CACHE_SIZE];
+    uint16_t index[DEVICES_INDEX_SIZE]; // entry number + 1, 0 = empty bucket
+    uint16_t count;
+    uint16_t lru_head; // most recently used
+    uint16_t lru_tail; // least recently used, evicted first
+} devices_t;
+
+/**
+ * @brief Hashes 6-byte MAC address.
+ *
+ * The low bytes carry most of the entropy, so they are mixed with the OUI
+ * and finalized to spread sequential addresses.
+ */
+static inline uint32_t devices_mac_hash(const uint8_t *mac_addr) {
+    uint32_t h = ((uint32_t)mac_addr[2] << 24) | ((uint32_t)mac_addr[3] << 16) | ((uint32_t)mac_addr[4] << 8) |
+                 (uint32_t)mac_addr[5];
+    h ^= (((uint32_t)mac_addr[0] << 8) | mac_addr[1]) * 0x9E3779B1u;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    return h;
+}
+
+/**
+ * @brief Resets table to empty state.
+ *
+ * @param t Table instance.
+ */
+void devices_init(devices_t *t);
+
+/**
+ * @brief Returns entry for MAC, inserting it if missing.
+ *
+ * A new entry gets zeroed counters and an unresolved MQTT target. When the
+ * table is full, the least recently used entry is evicted. The returned entry
+ * becomes the most recently used one.
+ *
+ * @param t Table instance.
+ * @param mac_addr Device MAC address.
+ * @return Pointer to entry, never NULL.
+ */
+device_t *devices_lookup(devices_t *t, const uint8_t *mac_addr);
+
+/**
+ * @brief Finds entry for MAC without inserting or touching LRU order.
+ *
+ * @param t Table instance.
+ * @param mac_addr Device MAC address.
+ * @return Pointer to entry, or NULL if MAC is not cached.
+ */
+device_t *devices_find(devices_t *t, const uint8_t *mac_addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DEVICES_H_ */
@@ -0,0 +1,660 @@
+#include "downlink.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_now.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "proto.h"
+#include "proto_batch.h"
+
+#include "config.h"
+#if CONFIG_GATEWAY_ENCRYPT
+#include "keys.h"
+#endif
+#include "metrics.h"
+#include "settings.h"
+
+#define STACK_DEPTH 3072
+#define ACK_TIMEOUT_MS 100      // send callback of one frame, ESP-NOW retries at the MAC layer meanwhile
+#define EXPIRE_INTERVAL_MS 1000 // queues are checked for expired commands at least this often
+#define FILTER_MAX_LEN 48
+#define CMD_SUFFIX "/cmd"
+#define MAC_STR_LEN 17
+#define FRAME_HDR_LEN (PROTO_HDR_LEN + PROTO_SEQ_HDR_LEN)
+#define CMD_MAX_LEN (ESP_NOW_MAX_DATA_LEN - FRAME_HDR_LEN - PROTO_BATCH_REC_HDR_LEN)
+#define NVS_NAMESPACE "downlink"
+#define NVS_KEY_BOOTS "boots"
+#define SEQ_BOOT_STRIDE 0x8000 // first sequence numbers of consecutive boots are this far apart
+#define SEQ_MEMORY (4 * GATEWAY_DOWNLINK_NODES) // nodes without a slot whose next number is kept
+
+static const char *const TAG = "downlink";
+
+typedef struct {
+    int64_t received_us; // when the broker handed it over
+    uint8_t len;
+    uint8_t data[CMD_MAX_LEN];
+} command_t;
+
+typedef struct {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    bool used;
+    bool peer;          // registered with ESP-NOW
+    bool ready;         // worth a send: a new command arrived, or the node was just heard from
+    bool polled;        // waits for a reply, even an empty one
+    uint8_t head;       // oldest command
+    uint8_t count;      // queued commands
+    uint8_t inflight;   // commands of the unacknowledged frame, resent as they are
+    uint16_t seq;       // of the next frame, or of the unacknowledged one
+    uint32_t last_used; // LRU stamp for the node and peer tables
+    command_t queue[GATEWAY_DOWNLINK_QUEUE_LEN];
+} node_t;
+
+// Next sequence number of a node that lost its slot.
+typedef struct {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    uint16_t seq;
+} seq_memo_t;
+
+static SemaphoreHandle_t s_lock; // guards everything below up to s_filter
+static node_t s_nodes[GATEWAY_DOWNLINK_NODES];
+static size_t s_next; // round-robin start of the delivery scan
+static uint32_t s_clock;
+static uint32_t s_peers;
+static uint32_t s_queued;   // also read lock-free by downlink_seen()
+static uint16_t s_seq_fresh; // past every number sent since start, first number of a node not remembered
+static seq_memo_t s_seqs[SEQ_MEMORY];
+static size_t s_seqs_len;  // entries written so far, up to SEQ_MEMORY
+static size_t s_seqs_next; // entry overwritten when full, the one written longest ago
+static char s_filter[FILTER_MAX_LEN];
+
+static esp_mqtt_client_handle_t s_client;
+static TaskHandle_t s_task;
+static SemaphoreHandle_t s_send_lock;         // one unicast in flight, guards s_acks and s_dest
+static QueueHandle_t s_acks;                  // send status of the frame in flight
+static uint8_t s_dest[ESP_NOW_ETH_ALEN];      // destination of the frame in flight
+static uint8_t s_frame[ESP_NOW_MAX_DATA_LEN]; // downlink task only
+
+static inline command_t *cmd_at(node_t *n, size_t i) {
+    return &n->queue[(n->head + i) % GATEWAY_DOWNLINK_QUEUE_LEN];
+}
+
+static void pop(node_t *n, size_t count) {
+    n->head = (uint8_t)((n->head + count) % GATEWAY_DOWNLINK_QUEUE_LEN);
+    n->count -= (uint8_t)count;
+    __atomic_sub_fetch(&s_queued, (uint32_t)count, __ATOMIC_RELAXED);
+}
+
+static node_t *node_find(const uint8_t *mac_addr) {
+    for (size_t i = 0; i < GATEWAY_DOWNLINK_NODES; i++) {
+        if (s_nodes[i].used && memcmp(s_nodes[i].mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0) {
+            return &s_nodes[i];
+        }
+    }
+    return NULL;
+}
+
+static void peer_remove(node_t *n) {
+    if (n->peer) {
+#if CONFIG_GATEWAY_ENCRYPT
+        keys_release_peer(n->mac_addr);
+#else
+        esp_now_del_peer(n->mac_addr);
+#endif
+        n->peer = false;
+        s_peers--;
+    }
+}
+
+// Registers the node as ESP-NOW peer, removing the least recently used one when the table is full.
+static esp_err_t peer_ensure(node_t *n) {
+    if (n->peer) {
+        return ESP_OK;
+    }
+
+    if (s_peers >= GATEWAY_DOWNLINK_PEERS) {
+        node_t *lru = NULL;
+        for (size_t i = 0; i < GATEWAY_DOWNLINK_NODES; i++) {
+            node_t *c = &s_nodes[i];
+            if (c->peer && (lru == NULL || s_clock - c->last_used > s_clock - lru->last_used)) {
+                lru = c;
+            }
+        }
+        if (lru != NULL) {
+            peer_remove(lru);
+        }
+    }
+
+#if CONFIG_GATEWAY_ENCRYPT
+    // Nodes with a session keep their encrypted entry.
+    const esp_err_t err = keys_acquire_peer(n->mac_addr);
+#else
+    esp_now_peer_info_t peer = {
+        .channel = 0, // current channel, follows the AP when the station roams
+        .ifidx = GATEWAY_WIFI_IF,
+        .encrypt = false,
+    };
+    memcpy(peer.peer_addr, n->mac_addr, ESP_NOW_ETH_ALEN);
+
+    esp_err_t err = esp_now_add_peer(&peer);
+    if (err == ESP_ERR_ESPNOW_EXIST) {
+        err = ESP_OK;
+    }
+#endif
+    if (err == ESP_OK) {
+        n->peer = true;
+        s_peers++;
+    }
+    return err;
+}
+
+static seq_memo_t *seq_find(const uint8_t *mac_addr) {
+    for (size_t i = 0; i < s_seqs_len; i++) {
+        if (memcmp(s_seqs[i].mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0) {
+            return &s_seqs[i];
+        }
+    }
+    return NULL;
+}
+
+// Keeps the next number of a node losing its slot, so the node does not take its next frames for duplicates of
+// older ones when it gets a slot again.
+static void seq_remember(const node_t *n) {
+    seq_memo_t *m = seq_find(n->mac_addr);
+    if (m == NULL) {
+        m = &s_seqs[s_seqs_next];
+        s_seqs_next = (s_seqs_next + 1) % SEQ_MEMORY;
+        if (s_seqs_len < SEQ_MEMORY) {
+            s_seqs_len++;
+        }
+        memcpy(m->mac_addr, n->mac_addr, ESP_NOW_ETH_ALEN);
+    }
+    // The unacknowledged frame may have arrived, its number is used.
+    m->seq = (uint16_t)(n->seq + (n->inflight > 0));
+}
+
+// Number of the first frame to a node getting a slot. A node forgotten meanwhile continues past every number sent
+// since start, which its window takes for new.
+static uint16_t seq_recall(const uint8_t *mac_addr) {
+    const seq_memo_t *m = seq_find(mac_addr);
+    return m != NULL ? m->seq : s_seq_fresh;
+}
+
+// Finds the queue of a node, taking a free slot or the least recently used one for a new node.
+// Returns NULL when only slots with pending commands are left and evicting them is not allowed.
+static node_t *node_get(const uint8_t *mac_addr, bool evict_queued) {
+    node_t *n = node_find(mac_addr);
+    if (n != NULL) {
+        return n;
+    }
+
+    // Prefer slots without pending commands, then the oldest.
+    node_t *victim = NULL;
+    for (size_t i = 0; i < GATEWAY_DOWNLINK_NODES; i++) {
+        node_t *c = &s_nodes[i];
+        if (!c->used) {
+            victim = c;
+            break;
+        }
+        if (victim == NULL || (c->count == 0 && victim->count > 0) ||
+            ((c->count == 0) == (victim->count == 0) && s_clock - c->last_used > s_clock - victim->last_used)) {
+            victim = c;
+        }
+    }
+
+    if (victim->used) {
+        if (victim->count > 0 && !evict_queued) {
+            return NULL;
+        }
+        if (victim->count > 0) {
+            metrics_add(METRIC_DOWNLINK_DROP_EVICTED, victim->count);
+            ESP_LOGW(TAG, "%u commands for " MACSTR " dropped for a new node", victim->count,
+                     MAC2STR(victim->mac_addr));
+            pop(victim, victim->count);
+        }
+        peer_remove(victim);
+        seq_remember(victim);
+    }
+
+    memset(victim, 0, sizeof(*victim));
+    memcpy(victim->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+    victim->used = true;
+    victim->seq = seq_recall(mac_addr);
+    return victim;
+}
+
+static bool parse_hex(char c, uint8_t *out) {
+    if (c >= '0' && c <= '9') {
+        *out = (uint8_t)(c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+        *out = (uint8_t)(c - 'a' + 10);
+    } else if (c >= 'A' && c <= 'F') {
+        *out = (uint8_t)(c - 'A' + 10);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_mac(const char *s, uint8_t *out) {
+    for (size_t i = 0; i < ESP_NOW_ETH_ALEN; i++) {
+        const char *p = s + i * 3;
+        uint8_t hi, lo;
+        if (!parse_hex(p[0], &hi) || !parse_hex(p[1], &lo) || (i + 1 < ESP_NOW_ETH_ALEN && p[2] != ':')) {
+            return false;
+        }
+        out[i] = (uint8_t)(hi << 4 | lo);
+    }
+    return true;
+}
+
+// Extracts the node MAC from "<prefix>/<MAC>/cmd".
+static bool parse_topic(const char *topic, size_t topic_len, uint8_t *mac_addr) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    // The filter is "<prefix>/+/cmd", everything before the '+' must match.
+    const size_t prefix_len = strlen(s_filter) - (sizeof("+" CMD_SUFFIX) - 1);
+    const bool ok = topic_len == prefix_len + MAC_STR_LEN + sizeof(CMD_SUFFIX) - 1 &&
+                    memcmp(topic, s_filter, prefix_len) == 0 &&
+                    memcmp(topic + prefix_len + MAC_STR_LEN, CMD_SUFFIX, sizeof(CMD_SUFFIX) - 1) == 0;
+    xSemaphoreGive(s_lock);
+
+    return ok && parse_mac(topic + prefix_len, mac_addr);
+}
+
+static void enqueue(const esp_mqtt_event_t *event) {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    // Larger messages arrive in several events, only the first one has the topic.
+    if (event->current_data_offset != 0) {
+        return;
+    }
+    if (event->topic == NULL || !parse_topic(event->topic, (size_t)event->topic_len, mac_addr) ||
+        event->total_data_len > CMD_MAX_LEN || event->data_len != event->total_data_len) {
+        metrics_inc(METRIC_DOWNLINK_DROP_INVALID);
+        ESP_LOGW(TAG, "command on %.*s rejected, %d bytes", event->topic_len, event->topic ? event->topic : "",
+                 event->total_data_len);
+        return;
+    }
+
+    const int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    node_t *n = node_get(mac_addr, true);
+    const bool full = n->count >= GATEWAY_DOWNLINK_QUEUE_LEN;
+    if (!full) {
+        command_t *c = cmd_at(n, n->count);
+        c->received_us = now;
+        c->len = (uint8_t)event->data_len;
+        memcpy(c->data, event->data, (size_t)event->data_len);
+        n->count++;
+        __atomic_add_fetch(&s_queued, 1, __ATOMIC_RELAXED);
+        n->ready = true;
+    }
+    n->last_used = ++s_clock;
+    xSemaphoreGive(s_lock);
+
+    if (full) {
+        metrics_inc(METRIC_DOWNLINK_DROP_FULL);
+        ESP_LOGW(TAG, "command queue of " MACSTR " full, command dropped", MAC2STR(mac_addr));
+        return;
+    }
+
+    metrics_inc(METRIC_DOWNLINK_RECEIVED);
+    xTaskNotifyGive(s_task);
+}
+
+static void subscribe(esp_mqtt_client_handle_t client) {
+    char filter[FILTER_MAX_LEN];
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    strlcpy(filter, s_filter, sizeof(filter));
+    xSemaphoreGive(s_lock);
+
+    if (esp_mqtt_client_subscribe(client, filter, GATEWAY_DOWNLINK_QOS) < 0) {
+        ESP_LOGW(TAG, "subscribe to %s failed", filter);
+    } else {
+        ESP_LOGI(TAG, "subscribed to %s", filter);
+    }
+}
+
+static void mqtt_event_handler(__attribute__((unused)) void *arg, __attribute__((unused)) esp_event_base_t base,
+                               int32_t event_id, void *event_data) {
+    esp_mqtt_event_handle_t event = event_data;
+    switch (event_id) {
+    case MQTT_EVENT_CONNECTED:
+        subscribe(event->client);
+        break;
+    case MQTT_EVENT_DATA:
+        enqueue(event);
+        break;
+    default:
+        break;
+    }
+}
+
+static void build_filter(char *out, size_t cap) {
+    const int n = snprintf(out, cap, "%s/+" CMD_SUFFIX, settings_mqtt_prefix());
+    if (n < 0 || (size_t)n >= cap) {
+        snprintf(out, cap, "%s/+" CMD_SUFFIX, GATEWAY_BROKER_TOPIC_PREFIX);
+    }
+}
+
+static void on_settings_change(const char *key, __attribute__((unused)) void *ctx) {
+    if (strcmp(key, "mqtt.prefix") != 0) {
+        return;
+    }
+
+    char old[FILTER_MAX_LEN];
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    strlcpy(old, s_filter, sizeof(old));
+    build_filter(s_filter, sizeof(s_filter));
+    const bool changed = strcmp(old, s_filter) != 0;
+    xSemaphoreGive(s_lock);
+
+    esp_mqtt_client_handle_t client = __atomic_load_n(&s_client, __ATOMIC_ACQUIRE);
+    if (changed && client != NULL) {
+        esp_mqtt_client_unsubscribe(client, old);
+        subscribe(client);
+    }
+}
+
+static void send_cb(const esp_now_send_info_t *tx_info, esp_now_send_status_t status) {
+    // Every unicast goes through send_wait(), but a late callback of a timed out frame must not complete the next one.
+    if (tx_info == NULL || tx_info->des_addr == NULL || memcmp(tx_info->des_addr, s_dest, ESP_NOW_ETH_ALEN) != 0) {
+        return;
+    }
+    xQueueOverwrite(s_acks, &status);
+}
+
+// Sends one unicast frame and waits for its send callback. Unicasts are sent one at a time, so the status of one
+// frame is never taken for that of another to the same node.
+static esp_err_t send_wait(const uint8_t *dest, const uint8_t *data, size_t len, esp_now_send_status_t *status) {
+    xSemaphoreTake(s_send_lock, portMAX_DELAY);
+    memcpy(s_dest, dest, ESP_NOW_ETH_ALEN);
+    xQueueReset(s_acks);
+    const esp_err_t err = esp_now_send(dest, data, len);
+
+    *status = ESP_NOW_SEND_FAIL;
+    if (err == ESP_OK && xQueueReceive(s_acks, status, pdMS_TO_TICKS(ACK_TIMEOUT_MS)) != pdTRUE) {
+        *status = ESP_NOW_SEND_FAIL;
+    }
+    xSemaphoreGive(s_send_lock);
+    return err;
+}
+
+// Drops commands older than the time to live.
+static void expire(int64_t now) {
+    const int64_t ttl_us = (int64_t)GATEWAY_DOWNLINK_TTL_S * 1000000;
+
+    for (size_t i = 0; i < GATEWAY_DOWNLINK_NODES; i++) {
+        node_t *n = &s_nodes[i];
+        size_t expired = 0;
+        while (expired < n->count && now - cmd_at(n, expired)->received_us > ttl_us) {
+            expired++;
+        }
+        if (expired == 0) {
+            continue;
+        }
+
+        if (n->inflight > 0) {
+            // The frame is never resent, so its number is free for the next one.
+            n->inflight = 0;
+            n->seq++;
+        }
+        pop(n, expired);
+        metrics_add(METRIC_DOWNLINK_DROP_EXPIRED, (uint32_t)expired);
+        ESP_LOGW(TAG, "%u commands for " MACSTR " expired", (unsigned)expired, MAC2STR(n->mac_addr));
+    }
+}
+
+// Packs the commands of the next frame, or exactly those of the unacknowledged one. A polled node
+// without commands gets a frame without records.
+static size_t build_frame(node_t *n) {
+    size_t len = proto_write_hdr(s_frame, PROTO_FLAG_SEQ | PROTO_FLAG_BATCH);
+    proto_put_u16(s_frame + len, n->seq);
+    len += PROTO_SEQ_HDR_LEN;
+    s_seq_fresh++;
+
+    const size_t limit = n->inflight > 0 ? n->inflight : n->count;
+    size_t packed = 0;
+    while (packed < limit) {
+        const command_t *c = cmd_at(n, packed);
+        const size_t put = proto_batch_put(s_frame + len, sizeof(s_frame) - len, c->data, c->len);
+        if (put == 0) {
+            break;
+        }
+        len += put;
+        packed++;
+    }
+
+    n->inflight = (uint8_t)packed;
+    return len;
+}
+
+// Pops the acknowledged commands and records how long they took.
+static void delivered(node_t *n, int64_t now) {
+    for (size_t i = 0; i < n->inflight; i++) {
+        metrics_observe_downlink((uint32_t)((now - cmd_at(n, i)->received_us) / 1000));
+    }
+    metrics_add(METRIC_DOWNLINK_DELIVERED, n->inflight);
+    pop(n, n->inflight);
+
+    n->inflight = 0;
+    n->seq++;
+    n->ready = n->count > 0;
+}
+
+// Sends one frame to the next ready node and waits for its acknowledgement.
+static bool deliver_next(void) {
+    uint8_t dest[ESP_NOW_ETH_ALEN];
+    size_t len = 0;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    node_t *n = NULL;
+    for (size_t i = 0; i < GATEWAY_DOWNLINK_NODES && n == NULL; i++) {
+        node_t *c = &s_nodes[(s_next + i) % GATEWAY_DOWNLINK_NODES];
+        if (c->used && c->ready && (c->count > 0 || c->polled)) {
+            n = c;
+            s_next = (size_t)(c - s_nodes) + 1;
+        }
+    }
+
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    if (n != NULL) {
+        err = peer_ensure(n);
+        if (err == ESP_OK) {
+            len = build_frame(n);
+            memcpy(dest, n->mac_addr, ESP_NOW_ETH_ALEN);
+            n->ready = false;
+            n->last_used = ++s_clock;
+        } else {
+            ESP_LOGW(TAG, "peer " MACSTR " not added: %s", MAC2STR(n->mac_addr), esp_err_to_name(err));
+        }
+    }
+    xSemaphoreGive(s_lock);
+
+    if (err != ESP_OK) {
+        return false;
+    }
+
+    esp_now_send_status_t status;
+    err = send_wait(dest, s_frame, len, &status);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "send to " MACSTR " failed: %s", MAC2STR(dest), esp_err_to_name(err));
+    }
+
+    const int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    // The node may have been replaced by a new one meanwhile.
+    n = node_find(dest);
+    if (n != NULL && err == ESP_OK) {
+        // The poll is answered either way, the node sleeps again before a retry could reach it.
+        n->polled = false;
+        if (status == ESP_NOW_SEND_SUCCESS) {
+            delivered(n, now);
+        } else if (n->inflight == 0) {
+            // An empty frame is never resent and may have arrived with only its
+            // acknowledgement lost, its number must not carry commands later.
+            n->seq++;
+        }
+    } else if (n != NULL) {
+        n->ready = true; // not sent at all, try again on the next round
+    }
+    xSemaphoreGive(s_lock);
+
+    if (err == ESP_OK) {
+        metrics_inc(status == ESP_NOW_SEND_SUCCESS ? METRIC_DOWNLINK_FRAMES_OK : METRIC_DOWNLINK_FRAMES_FAILED);
+    }
+
+    // A local send error ends the round, the radio is busy.
+    return err == ESP_OK;
+}
+
+static void downlink_task(__attribute__((unused)) void *arg) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(EXPIRE_INTERVAL_MS));
+
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        expire(esp_timer_get_time());
+        xSemaphoreGive(s_lock);
+
+        while (deliver_next()) {
+        }
+    }
+}
+
+// Numbers start half the sequence space away from those of the last boot. A node that did not learn about the
+// restart from a beacon still holds its window at the last boot's numbers, and only takes a frame for a duplicate
+// when the gateway sent just over 32768 frames then. A random start would collide with its window at any time with
+// a chance of one in a thousand.
+static void seq_base_init(void) {
+    nvs_handle_t nvs;
+    uint32_t boots = 0;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        nvs_get_u32(nvs, NVS_KEY_BOOTS, &boots);
+        boots++;
+        err = nvs_set_u32(nvs, NVS_KEY_BOOTS, boots);
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+
+    if (err == ESP_OK) {
+        s_seq_fresh = (uint16_t)(boots * SEQ_BOOT_STRIDE);
+    } else {
+        ESP_LOGW(TAG, "boot counter not stored: %s, random sequence start", esp_err_to_name(err));
+        s_seq_fresh = (uint16_t)esp_random();
+    }
+}
+
+esp_err_t downlink_start(void) {
+    s_lock = xSemaphoreCreateMutex();
+    s_send_lock = xSemaphoreCreateMutex();
+    s_acks = xQueueCreate(1, sizeof(esp_now_send_status_t));
+    if (s_lock == NULL || s_send_lock == NULL || s_acks == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    seq_base_init();
+    build_filter(s_filter, sizeof(s_filter));
+    ESP_RETURN_ON_ERROR(settings_add_listener(on_settings_change, NULL), TAG, "settings_add_listener");
+    ESP_RETURN_ON_ERROR(esp_now_register_send_cb(send_cb), TAG, "esp_now_register_send_cb");
+
+    if (xTaskCreate(downlink_task, "downlink", STACK_DEPTH, NULL, GATEWAY_DOWNLINK_TASK_PRIORITY, &s_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create downlink task");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t downlink_set_mqtt_client(esp_mqtt_client_handle_t client) {
+    if (client != NULL) {
+        ESP_RETURN_ON_ERROR(esp_mqtt_client_register_event(client, MQTT_EVENT_ANY, mqtt_event_handler, NULL), TAG,
+                            "esp_mqtt_client_register_event");
+    }
+    __atomic_store_n(&s_client, client, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+esp_err_t downlink_send(const uint8_t *mac_addr, const uint8_t *data, size_t len) {
+    if (__atomic_load_n(&s_task, __ATOMIC_ACQUIRE) == NULL) {
+        // No send callback is registered yet, nothing waits for one.
+        return esp_now_send(mac_addr, data, len);
+    }
+
+    esp_now_send_status_t status;
+    const esp_err_t err = send_wait(mac_addr, data, len, &status);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return status == ESP_NOW_SEND_SUCCESS ? ESP_OK : ESP_FAIL;
+}
+
+void downlink_seen(const uint8_t *mac_addr) {
+    if (__atomic_load_n(&s_queued, __ATOMIC_RELAXED) == 0 || s_lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    node_t *n = node_find(mac_addr);
+    const bool wake = n != NULL && n->count > 0 && !n->ready;
+    if (n != NULL) {
+        n->last_used = ++s_clock;
+        n->ready = n->count > 0 || n->polled;
+    }
+    xSemaphoreGive(s_lock);
+
+    if (wake) {
+        xTaskNotifyGive(s_task);
+    }
+}
+
+void downlink_poll(const uint8_t *mac_addr) {
+    if (s_lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    node_t *n = node_get(mac_addr, false);
+    if (n != NULL) {
+        n->last_used = ++s_clock;
+        n->polled = true;
+        n->ready = true;
+    }
+    xSemaphoreGive(s_lock);
+
+    if (n != NULL) {
+        xTaskNotifyGive(s_task);
+    } else {
+        ESP_LOGW(TAG, "poll from " MACSTR " not answered, all queues busy", MAC2STR(mac_addr));
+    }
+}
+
+void downlink_stats(downlink_stats_t *out) {
+    memset(out, 0, sizeof(*out));
+    if (s_lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    out->queued = s_queued;
+    out->peers = s_peers;
+    for (size_t i = 0; i < GATEWAY_DOWNLINK_NODES; i++) {
+        out->nodes += s_nodes[i].used;
+    }
+    xSemaphoreGive(s_lock);
+}
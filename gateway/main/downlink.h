@@ -0,0 +1,100 @@
+#ifndef _DOWNLINK_H_
+#define _DOWNLINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * MQTT to ESP-NOW command path.
+ *
+ * The gateway subscribes to <mqtt.prefix>/+/cmd, the middle level being the
+ * node MAC as it appears in uplink topics. Every command is queued for its
+ * node, then everything queued is sent by unicast in one PROTO_FLAG_BATCH
+ * frame carrying a PROTO_FLAG_SEQ number. A frame the node does not
+ * acknowledge stays queued and is resent unchanged, with the same sequence
+ * number, once the node is heard from again: a node listens right after it
+ * sends. Commands not delivered within GATEWAY_DOWNLINK_TTL_S are dropped.
+ *
+ * A node that sets PROTO_FLAG_POLL sleeps as soon as it has its reply, so it
+ * is answered right away, with an empty frame when nothing is queued.
+ *
+ * ESP-NOW unicasts only to registered peers and its peer table is small, so
+ * only the GATEWAY_DOWNLINK_PEERS most recently used nodes are registered.
+ *
+ * Sequence numbers outlive the queue: a node whose slot is taken by another
+ * one continues with its next number when it gets a slot again, or past
+ * every number sent since start when it was forgotten meanwhile.
+ */
+
+/**
+ * @brief Current queue state.
+ */
+typedef struct {
+    uint32_t queued; // commands waiting for their node
+    uint32_t nodes;  // nodes with a queue
+    uint32_t peers;  // nodes registered as ESP-NOW peers
+} downlink_stats_t;
+
+/**
+ * @brief Starts the delivery task.
+ *
+ * Must be called after espnow_start(), it registers the ESP-NOW send callback.
+ */
+esp_err_t downlink_start(void);
+
+/**
+ * @brief Subscribes to commands through this client.
+ *
+ * Call before the client is started, the subscription is renewed on every
+ * connection.
+ */
+esp_err_t downlink_set_mqtt_client(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Sends a unicast frame of another module.
+ *
+ * The ESP-NOW send callback only tells the destination of a frame, so every
+ * unicast of the gateway must go through the downlink to not complete or
+ * fail one of its deliveries. Waits for the frame in flight, then for the
+ * send status of this one, at most twice the acknowledgement timeout.
+ * Sends right away before downlink_start().
+ *
+ * @return ESP_OK when the node acknowledged the frame, ESP_FAIL when it did
+ *         not, or the error of esp_now_send()
+ */
+esp_err_t downlink_send(const uint8_t *mac_addr, const uint8_t *data, size_t len);
+
+/**
+ * @brief Tells that a frame from this node was just received.
+ *
+ * Called by the uplink for every frame. Returns right away when no command
+ * is queued for any node.
+ */
+void downlink_seen(const uint8_t *mac_addr);
+
+/**
+ * @brief Tells that a node polls for its commands.
+ *
+ * Called by the uplink for frames with PROTO_FLAG_POLL. The reply is sent
+ * even when nothing is queued. A new node only takes a slot without pending
+ * commands, otherwise it gets no reply and polls again next time.
+ */
+void downlink_poll(const uint8_t *mac_addr);
+
+/**
+ * @brief Copies queue state.
+ */
+void downlink_stats(downlink_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DOWNLINK_H_ */
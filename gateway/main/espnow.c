@@ -1,18 +1,32 @@
 #include "esp_check.h"
 #include "esp_log.h"
+#include "esp_mac.h"
+
+#include <stdio.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "freertos/task.h"
 
 #include "mqtt_client.h"
 
 #include "config.h"
+#if CONFIG_GATEWAY_CAPTURE
+#include "capture.h"
+#endif
+#include "devices.h"
 #include "espnow.h"
-#include "settings.h"
+#if CONFIG_GATEWAY_LINKS
+#include "links.h"
+#endif
+#include "metrics.h"
+#include "rx_pool.h"
+
+#define QUEUE_SIZE GATEWAY_RX_POOL_SIZE // Queue holds pointers, one slot per pooled descriptor.
+#define MAXDELAY_MS 512                 // Max wait for the exit sentinel, the receive callback never blocks.
+#define STACK_DEPTH 4096                // Stack size for ESP-NOW worker task.
 
-#define QUEUE_SIZE 6     // Max pending ESP-NOW packets before drop.
-#define MAXDELAY_MS 512  // Max queue wait/send time to avoid blocking callbacks.
-#define STACK_DEPTH 4096 // Stack size for ESP-NOW task.
+#define FAIR_BUCKETS 32 // devices of one worker are folded into this many fair-share buckets
 
 static const char *const TAG = "esp_now_gateway";
 
@@ -23,77 +37,274 @@ static inline esp_err_t check_err(esp_err_t err, const char *what) {
     return err;
 }
 
-static QueueHandle_t s_event_queue = NULL;
+typedef struct {
+    QueueHandle_t queue;
+    TaskHandle_t task;
+    const espnow_handlers_t *handlers;
+    size_t shard;
+    uint32_t queue_hwm;
+#if CONFIG_GATEWAY_RX_OVERFLOW_FAIR_SHARE
+    uint8_t fair_inflight[FAIR_BUCKETS]; // queued frames per MAC bucket
+    uint32_t fair_active;                // buckets with queued frames
+#endif
+} espnow_worker_t;
+
+static espnow_worker_t s_workers[GATEWAY_ESPNOW_WORKERS];
+
+// High hash bits: the low ones pick the bucket in the worker's device table, a shard taken from them would leave
+// each worker only the buckets congruent to its number.
+static inline size_t espnow_shard_of(const uint8_t *mac_addr) {
+#if GATEWAY_ESPNOW_WORKERS > 1
+    return (devices_mac_hash(mac_addr) >> 16) % GATEWAY_ESPNOW_WORKERS;
+#else
+    (void)mac_addr;
+    return 0;
+#endif
+}
+
+static BaseType_t espnow_worker_core(size_t shard) {
+#if CONFIG_GATEWAY_ESPNOW_AFFINITY_SPREAD
+    return (BaseType_t)(shard % portNUM_PROCESSORS);
+#elif CONFIG_GATEWAY_ESPNOW_AFFINITY_PINNED
+    (void)shard;
+    return CONFIG_GATEWAY_ESPNOW_WORKER_CORE;
+#else
+    (void)shard;
+    return tskNO_AFFINITY;
+#endif
+}
+
+#if CONFIG_GATEWAY_RX_OVERFLOW_FAIR_SHARE
+static inline size_t fair_bucket(const uint8_t *mac_addr) {
+    return devices_mac_hash(mac_addr) % FAIR_BUCKETS; // independent of the shard, which uses the high bits
+}
+
+// Once the queue is half full, a device may only hold its share of the queue, so one chatty node cannot starve the
+// rest. Buckets with nothing queued always get in.
+static bool fair_admit(espnow_worker_t *w, size_t bucket, UBaseType_t waiting) {
+    const uint32_t held = __atomic_load_n(&w->fair_inflight[bucket], __ATOMIC_RELAXED);
+    if (waiting < QUEUE_SIZE / 2 || held == 0) {
+        return true;
+    }
+
+    const uint32_t active = __atomic_load_n(&w->fair_active, __ATOMIC_RELAXED);
+    const uint32_t share = active > 0 ? QUEUE_SIZE / active : QUEUE_SIZE;
+    return held < (share > 0 ? share : 1);
+}
+
+static void fair_acquire(espnow_worker_t *w, size_t bucket) {
+    if (__atomic_fetch_add(&w->fair_inflight[bucket], 1, __ATOMIC_RELAXED) == 0) {
+        __atomic_fetch_add(&w->fair_active, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void fair_release(espnow_worker_t *w, const uint8_t *mac_addr) {
+    if (__atomic_sub_fetch(&w->fair_inflight[fair_bucket(mac_addr)], 1, __ATOMIC_RELAXED) == 0) {
+        __atomic_sub_fetch(&w->fair_active, 1, __ATOMIC_RELAXED);
+    }
+}
+#endif
+
+#if CONFIG_GATEWAY_RX_OVERFLOW_DROP_OLDEST
+// Takes the oldest queued frame of the worker so its descriptor can carry the new one.
+static espnow_rx_t *evict_oldest(QueueHandle_t queue) {
+    espnow_rx_t *old = NULL;
+    if (xQueueReceive(queue, &old, 0) != pdTRUE) {
+        return NULL;
+    }
+    if (unlikely(old == NULL)) { // exit sentinel, keep it for the worker
+        xQueueSendToFront(queue, &old, 0);
+        return NULL;
+    }
+
+    metrics_inc(METRIC_RX_DROP_OLDEST);
+    return old;
+}
+#endif
 
 static esp_err_t espnow_deinit(void) {
-    espnow_rx_t rx = {0}; // sentinel for task exit
-    xQueueSend(s_event_queue, &rx, pdMS_TO_TICKS(MAXDELAY_MS));
+    for (size_t i = 0; i < GATEWAY_ESPNOW_WORKERS; i++) {
+        espnow_worker_t *w = &s_workers[i];
+        if (w->queue == NULL) {
+            continue;
+        }
+
+        espnow_rx_t *rx = NULL; // sentinel for task exit
+        xQueueSend(w->queue, &rx, pdMS_TO_TICKS(MAXDELAY_MS));
+
+        vQueueDelete(w->queue);
+        w->queue = NULL;
+        w->task = NULL;
+    }
 
-    vQueueDelete(s_event_queue);
-    s_event_queue = NULL;
     return esp_now_deinit();
 }
 
 static void espnow_recv_cb(const esp_now_recv_info_t *recv_info, const uint8_t *data, int len) {
     if (recv_info == NULL || data == NULL || len <= 0 || len > DATA_BUFFER_SIZE) {
+        metrics_inc(METRIC_RX_DROP_INVALID);
         ESP_LOGE(TAG, "Receive cb arg error");
         return;
     }
 
-    if (s_event_queue == NULL) {
+    metrics_inc(METRIC_RX_FRAMES);
+    metrics_add(METRIC_RX_BYTES, (uint32_t)len);
+#if CONFIG_GATEWAY_CAPTURE
+    capture_offer(recv_info, data, (size_t)len); // before any drop, a capture shows what the radio received
+#endif
+#if CONFIG_GATEWAY_LINKS
+    links_update(recv_info);
+#endif
+
+    espnow_worker_t *w = &s_workers[espnow_shard_of(recv_info->src_addr)];
+    QueueHandle_t queue = w->queue;
+    if (queue == NULL) {
         ESP_LOGW(TAG, "Receive queue not initialized");
         return;
     }
 
-    espnow_rx_t rx;
+#if CONFIG_GATEWAY_RX_OVERFLOW_FAIR_SHARE
+    const size_t bucket = fair_bucket(recv_info->src_addr);
+    if (!fair_admit(w, bucket, uxQueueMessagesWaiting(queue))) {
+        metrics_inc(METRIC_RX_DROP_FAIR);
+        ESP_LOGD(TAG, "fair share exceeded, frame from " MACSTR " dropped", MAC2STR(recv_info->src_addr));
+        return;
+    }
+#endif
+
+    espnow_rx_t *rx = rx_pool_acquire();
+#if CONFIG_GATEWAY_RX_OVERFLOW_DROP_OLDEST
+    if (rx == NULL) {
+        rx = evict_oldest(queue);
+    }
+#endif
+    if (unlikely(rx == NULL)) {
+        metrics_inc(METRIC_RX_DROP_POOL);
+        ESP_LOGD(TAG, "RX pool exhausted, frame dropped");
+        return;
+    }
 
     // TODO: add check dest_addr if needed
-    memcpy(rx.mac_addr, recv_info->src_addr, ESP_NOW_ETH_ALEN);
-    memcpy(rx.data, data, len);
-    rx.len = len;
+    memcpy(rx->mac_addr, recv_info->src_addr, ESP_NOW_ETH_ALEN);
+    memcpy(rx->data, data, len);
+    rx->len = len;
 
-    if (xQueueSend(s_event_queue, &rx, pdMS_TO_TICKS(MAXDELAY_MS)) != pdTRUE) {
-        ESP_LOGW(TAG, "Send receive queue fail");
+#if CONFIG_GATEWAY_RX_OVERFLOW_FAIR_SHARE
+    fair_acquire(w, bucket); // before the send, the worker may release it right away
+#endif
+
+    // Never block here: this runs in the Wi-Fi task, a stalled worker must not stall the radio.
+    BaseType_t sent = xQueueSend(queue, &rx, 0);
+#if CONFIG_GATEWAY_RX_OVERFLOW_DROP_OLDEST
+    if (sent != pdTRUE) {
+        espnow_rx_t *old = evict_oldest(queue);
+        if (old != NULL) {
+            rx_pool_release(old);
+            sent = xQueueSend(queue, &rx, 0);
+        }
     }
+#endif
+    if (sent != pdTRUE) {
+        metrics_inc(METRIC_RX_DROP_QUEUE);
+        ESP_LOGD(TAG, "receive queue full, frame dropped");
+#if CONFIG_GATEWAY_RX_OVERFLOW_FAIR_SHARE
+        fair_release(w, rx->mac_addr);
+#endif
+        rx_pool_release(rx);
+        return;
+    }
+
+#if CONFIG_GATEWAY_METRICS
+    // Only this callback raises the mark, so a plain compare-then-store cannot lose a higher value.
+    const uint32_t waiting = (uint32_t)uxQueueMessagesWaiting(queue);
+    if (waiting > __atomic_load_n(&w->queue_hwm, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&w->queue_hwm, waiting, __ATOMIC_RELAXED);
+    }
+#endif
 }
 
-static void espnow_task(void *handle_fn) {
-    espnow_rx_t rx;
+static void espnow_task(void *arg) {
+    espnow_worker_t *w = (espnow_worker_t *)arg;
+    const espnow_handlers_t *handlers = w->handlers;
+    TickType_t wait = portMAX_DELAY;
+    espnow_rx_t *rx;
 
-    ESP_LOGI(TAG, "start receive peer data task");
+    ESP_LOGI(TAG, "start receive peer data task, shard=%u", (unsigned)w->shard);
 
     for (;;) {
-        if (s_event_queue == NULL) {
+        if (w->queue == NULL) {
             break;
         }
 
-        if (xQueueReceive(s_event_queue, &rx, portMAX_DELAY) != pdTRUE) {
-            continue;
-        }
+        if (xQueueReceive(w->queue, &rx, wait) == pdTRUE) {
+            if (rx == NULL) { // sentinel for task exit
+                break;
+            }
 
-        if (rx.len == 0 && rx.data[0] == 0) { // sentinel for task exit
-            break;
+            (void)handlers->on_rx(rx, w->shard);
+#if CONFIG_GATEWAY_RX_OVERFLOW_FAIR_SHARE
+            fair_release(w, rx->mac_addr);
+#endif
+
+            if (unlikely(rx_pool_release(rx) != ESP_OK)) {
+                ESP_LOGE(TAG, "RX descriptor %p released twice or not pooled", (void *)rx);
+            }
         }
 
-        (void)((espnow_rx_handler_t)handle_fn)(&rx);
+        if (handlers->on_tick != NULL) {
+            wait = handlers->on_tick(w->shard);
+        }
     }
 
     vTaskDelete(NULL);
 }
 
-static esp_err_t espnow_init(espnow_rx_handler_t handle_fn) {
-    s_event_queue = xQueueCreate(QUEUE_SIZE, sizeof(espnow_rx_t));
-    if (unlikely(s_event_queue == NULL)) {
-        ESP_LOGE(TAG, "create queue fail");
-        return ESP_FAIL;
+static esp_err_t espnow_queues_create(const espnow_handlers_t *handlers) {
+    for (size_t i = 0; i < GATEWAY_ESPNOW_WORKERS; i++) {
+        espnow_worker_t *w = &s_workers[i];
+        w->handlers = handlers;
+        w->shard = i;
+        w->queue = xQueueCreate(QUEUE_SIZE, sizeof(espnow_rx_t *));
+        if (unlikely(w->queue == NULL)) {
+            ESP_LOGE(TAG, "create queue fail");
+            return ESP_FAIL;
+        }
     }
 
+    return ESP_OK;
+}
+
+static esp_err_t espnow_workers_start(void) {
+    for (size_t i = 0; i < GATEWAY_ESPNOW_WORKERS; i++) {
+        espnow_worker_t *w = &s_workers[i];
+
+        char name[16];
+        snprintf(name, sizeof(name), "espnow_task%u", (unsigned)i);
+
+        if (xTaskCreatePinnedToCore(espnow_task, name, STACK_DEPTH, w, GATEWAY_ESPNOW_WORKER_PRIORITY, &w->task,
+                                    espnow_worker_core(i)) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create %s", name);
+            return ESP_FAIL;
+        }
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t espnow_init(const espnow_handlers_t *handlers) {
+    if (unlikely(handlers == NULL || handlers->on_rx == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    rx_pool_reset();
+    ESP_RETURN_ON_ERROR(espnow_queues_create(handlers), TAG, "espnow_queues_create");
+
     /* Initialize ESPNOW and register sending and receiving callback function. */
     ESP_RETURN_ON_ERROR(esp_now_init(), TAG, "esp_now_init");
     ESP_RETURN_ON_ERROR(esp_now_register_recv_cb(espnow_recv_cb), TAG, "esp_now_register_recv_cb");
 
     const esp_now_peer_info_t peer = {
-        .channel = settings_wifi_channel(),
+        .channel = 0, // current channel, follows the AP when the station roams
         .ifidx = GATEWAY_WIFI_IF,
         .encrypt = false,
         .peer_addr = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
@@ -101,16 +312,29 @@ static esp_err_t espnow_init(espnow_rx_handler_t handle_fn) {
 
     ESP_RETURN_ON_ERROR(esp_now_add_peer(&peer), TAG, "esp_now_add_peer");
 
-    if (xTaskCreate(espnow_task, "espnow_task", STACK_DEPTH, handle_fn, tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
-        ESP_LOGE(TAG, "Failed to create espnow_task");
-        return ESP_FAIL;
-    }
+    return espnow_workers_start();
+}
+
+esp_err_t espnow_start(closer_handle_t closer, void *arg) {
+    DEFER(espnow_init((const espnow_handlers_t *)arg), closer, espnow_deinit);
 
     return ESP_OK;
 }
 
-esp_err_t espnow_start(closer_handle_t closer, void *arg) {
-    DEFER(espnow_init((espnow_rx_handler_t)arg), closer, espnow_deinit);
+esp_err_t espnow_worker_stats(size_t shard, espnow_worker_stats_t *out) {
+    if (shard >= GATEWAY_ESPNOW_WORKERS || out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const espnow_worker_t *w = &s_workers[shard];
+    QueueHandle_t queue = w->queue;
+    if (queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    out->task = w->task;
+    out->queue_len = uxQueueMessagesWaiting(queue);
+    out->queue_hwm = __atomic_load_n(&w->queue_hwm, __ATOMIC_RELAXED);
 
     return ESP_OK;
 }
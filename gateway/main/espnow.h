@@ -5,6 +5,8 @@
 
 #include "esp_err.h"
 #include "esp_now.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -21,20 +23,59 @@ typedef struct {
 /**
  * @brief Callback type for handling received ESP-NOW packets.
  *
+ * @p rx is a borrowed view into the RX pool: it is only valid for the duration
+ * of the call and is returned to the pool right after the handler returns.
+ *
+ * Packets from one source MAC always land in the same shard and are handled
+ * in arrival order by that shard's worker task.
+ *
  * @param rx Pointer to received packet data.
+ * @param shard Index of the worker handling the packet, < GATEWAY_ESPNOW_WORKERS.
  * @return ESP_OK on success, or an error code if handling failed.
  */
-typedef esp_err_t (*espnow_rx_handler_t)(const espnow_rx_t *rx);
+typedef esp_err_t (*espnow_rx_handler_t)(const espnow_rx_t *rx, size_t shard);
+
+/**
+ * @brief Callback type for periodic work driven by the receive task loop.
+ *
+ * Called by each worker after every received packet and whenever the
+ * previously requested wait expires.
+ *
+ * @param shard Index of the calling worker.
+ * @return Ticks until the callback must be invoked again, or portMAX_DELAY
+ *         if there is nothing to wait for.
+ */
+typedef TickType_t (*espnow_tick_handler_t)(size_t shard);
+
+typedef struct {
+    espnow_rx_handler_t on_rx;
+    espnow_tick_handler_t on_tick; // optional, may be NULL
+} espnow_handlers_t;
+
+typedef struct {
+    TaskHandle_t task;
+    UBaseType_t queue_len;
+    uint32_t queue_hwm; // highest queue length seen by the receive callback
+} espnow_worker_stats_t;
 
 /**
  * @brief Initializes ESP-NOW receive pipeline and starts background task.
  *
  * @param close Closer handle used to register cleanup routines.
- * @param arg User argument interpreted as @ref espnow_rx_handler_t callback.
+ * @param arg Pointer to @ref espnow_handlers_t, must outlive the receive task.
  * @return ESP_OK on success, or an error code on initialization failure.
  */
 esp_err_t espnow_start(closer_handle_t close, void *arg);
 
+/**
+ * @brief Reads queue and task state of one worker.
+ *
+ * @param shard Worker index, < GATEWAY_ESPNOW_WORKERS.
+ * @param[out] out Worker state.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for a bad index, or ESP_ERR_INVALID_STATE if the worker is not running.
+ */
+esp_err_t espnow_worker_stats(size_t shard, espnow_worker_stats_t *out);
+
 #ifdef __cplusplus
 }
 #endif
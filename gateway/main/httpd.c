@@ -1,25 +1,44 @@
 #include "httpd.h"
 
 #include <ctype.h>
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "esp_check.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
 #include "mbedtls/base64.h"
 
 #include "config.h"
+#if CONFIG_GATEWAY_CAPTURE
+#include "capture.h"
+#endif
+#if CONFIG_GATEWAY_ENCRYPT
+#include "keys.h"
+#endif
+#if CONFIG_GATEWAY_LINKS
+#include "links.h"
+#endif
 #if CONFIG_GATEWAY_ENABLE_SSE_LOGS
 #include "logs.h"
 #endif
+#if CONFIG_GATEWAY_METRICS
+#include "metrics.h"
+#endif
 #include "settings.h"
+#include "uplink.h"
 
 static const char *const TAG = "httpd";
 
 #define AUTH_PLAIN_MAX_LEN 128
 #define AUTH_HDR_MAX_LEN 192
-#define SETTINGS_CSV_MAX_LEN 512
+#define SETTINGS_CSV_MAX_LEN 1280
+#define STACK_SIZE 6144 // settings handlers keep the whole CSV on the stack
+#define MAX_URI_HANDLERS 16
 
 static char s_expected_auth_hdr[AUTH_HDR_MAX_LEN];
 static size_t s_expected_auth_hdr_len = 0;
@@ -162,42 +181,349 @@ static esp_err_t handle_settings_csv_post(httpd_req_t *req) {
     return httpd_resp_send(req, NULL, 0);
 }
 
-#if CONFIG_GATEWAY_ENABLE_SSE_LOGS
-static esp_err_t logs_handler(httpd_req_t *req) {
-    RingbufHandle_t log_rb;
-    esp_err_t err;
+// Percentage of part in total with two decimals, as integer hundredths.
+static unsigned percent_x100(uint32_t part, uint32_t total) {
+    return total == 0 ? 0 : (unsigned)(((uint64_t)part * 10000u + total / 2) / total);
+}
 
-    err = logs_init(&log_rb);
-    if (unlikely(err != ESP_OK)) {
-        ESP_LOGE(TAG, "logs_init failed: %s", esp_err_to_name(err));
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "logs_init failed");
+static esp_err_t handle_devices_csv(httpd_req_t *req) {
+    if (require_basic_auth(req) != ESP_OK) {
         return ESP_FAIL;
     }
 
-    httpd_resp_set_type(req, "text/event-stream");
-    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
-    httpd_resp_set_hdr(req, "Connection", "keep-alive");
+    uplink_device_stats_t *stats = malloc(GATEWAY_DEVICE_CACHE_SIZE * sizeof(*stats));
+    if (stats == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no memory");
+        return ESP_ERR_NO_MEM;
+    }
+
+    httpd_resp_set_type(req, "text/csv; charset=utf-8");
+    esp_err_t err = httpd_resp_sendstr_chunk(req, "mac,rx_frames,rx_bytes,accepted,duplicates,lost,resyncs,loss_pct,"
+                                                  "dup_pct\n");
+
+    for (size_t shard = 0; err == ESP_OK && shard < GATEWAY_ESPNOW_WORKERS; shard++) {
+        const size_t n = uplink_device_stats(shard, stats);
+        for (size_t i = 0; err == ESP_OK && i < n; i++) {
+            const uplink_device_stats_t *st = &stats[i];
+            const unsigned loss = percent_x100(st->lost, st->accepted + st->lost);
+            const unsigned dup = percent_x100(st->duplicates, st->accepted + st->duplicates);
+
+            char line[160];
+            int len = snprintf(line, sizeof(line), MACSTR ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32
+                                                          ",%" PRIu32 ",%" PRIu32 ",%u.%02u,%u.%02u\n",
+                               MAC2STR(st->mac_addr), st->rx_frames, st->rx_bytes, st->accepted, st->duplicates,
+                               st->lost, st->resyncs, loss / 100, loss % 100, dup / 100, dup % 100);
+            err = httpd_resp_send_chunk(req, line, len);
+        }
+    }
+
+    free(stats);
+    if (err != ESP_OK) {
+        return err;
+    }
 
-    size_t size;
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
 
-    while (1) {
-        char *data = (char *)xRingbufferReceive(log_rb, &size, pdMS_TO_TICKS(5000));
+#if CONFIG_GATEWAY_LINKS
+// Serves the link table, user_ctx selects CSV (non-NULL) or JSON.
+static esp_err_t handle_links(httpd_req_t *req) {
+    if (require_basic_auth(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
 
-        if (data) {
-            err = httpd_resp_send_chunk(req, data, size);
-            vRingbufferReturnItem(log_rb, data);
-        } else {
-            err = httpd_resp_send_chunk(req, ": ping\n\n", HTTPD_RESP_USE_STRLEN);
+    const bool csv = req->user_ctx != NULL;
+    links_entry_t *entries = malloc(GATEWAY_LINKS_SIZE * sizeof(*entries));
+    if (entries == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no memory");
+        return ESP_ERR_NO_MEM;
+    }
+    const size_t count = links_snapshot(entries);
+    const uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+
+    httpd_resp_set_type(req, csv ? "text/csv; charset=utf-8" : "application/json");
+    esp_err_t err = httpd_resp_sendstr_chunk(req, csv ? LINKS_CSV_HEADER : "[");
+    for (size_t i = 0; err == ESP_OK && i < count; i++) {
+        char line[LINKS_JSON_ENTRY_MAX_LEN];
+        size_t len = 0;
+        if (!csv && i > 0) {
+            line[len++] = ',';
         }
+        const int n = csv ? links_format_csv(&entries[i], now_ms, line + len, sizeof(line) - len)
+                          : links_format_json(&entries[i], now_ms, line + len, sizeof(line) - len);
+        len += n > 0 ? (size_t)n : 0;
+        err = httpd_resp_send_chunk(req, line, (ssize_t)len);
+    }
+    if (err == ESP_OK && !csv) {
+        err = httpd_resp_sendstr_chunk(req, "]");
+    }
+
+    free(entries);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+#endif
+
+#if CONFIG_GATEWAY_METRICS
+static esp_err_t send_chunk(void *ctx, const char *data, size_t len) {
+    return httpd_resp_send_chunk((httpd_req_t *)ctx, data, (ssize_t)len);
+}
+
+static esp_err_t handle_metrics(httpd_req_t *req) {
+    if (require_basic_auth(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4; charset=utf-8");
+    esp_err_t err = metrics_render(send_chunk, req);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+#endif
+
+#if CONFIG_GATEWAY_ENCRYPT
+static esp_err_t handle_pair(httpd_req_t *req) {
+    if (require_basic_auth(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    keys_pair_open();
+    return httpd_resp_send(req, NULL, 0);
+}
+#endif
+
+#if CONFIG_GATEWAY_CAPTURE
+#define CAPTURE_QUERY_MAX_LEN 128
 
-        if (unlikely(err != ESP_OK)) {
-            ESP_LOGE(TAG, "Failed to send sse ping (returned %02X)", err);
-            break;
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = (char)tolower((unsigned char)c);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// "aa:bb:cc" or "aa:bb:cc:dd:ee:ff", sets the filter's MAC prefix.
+static bool parse_mac_filter(const char *s, capture_filter_t *filter) {
+    const size_t len = strlen(s);
+    if (len != 8 && len != 17) {
+        return false;
+    }
+    filter->mac_len = (len + 1) / 3;
+    for (size_t i = 0; i < filter->mac_len; i++) {
+        const int hi = hex_digit(s[3 * i]);
+        const int lo = hex_digit(s[3 * i + 1]);
+        if (hi < 0 || lo < 0 || (i + 1 < filter->mac_len && s[3 * i + 2] != ':')) {
+            return false;
         }
+        filter->mac_addr[i] = (uint8_t)(hi << 4 | lo);
     }
+    return true;
+}
 
-    httpd_resp_send_chunk(req, NULL, 0); // End response
-    logs_deinit();
+static uint32_t query_u32(const char *query, const char *key, uint32_t def) {
+    char value[12];
+    if (httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK) {
+        return def;
+    }
+    return (uint32_t)strtoul(value, NULL, 10);
+}
+
+// GET /capture?mac=aa:bb:cc[:dd:ee:ff]&min=0&max=250&seconds=60&frames=0
+static esp_err_t handle_capture(httpd_req_t *req) {
+    if (require_basic_auth(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    char query[CAPTURE_QUERY_MAX_LEN] = "";
+    const size_t query_len = httpd_req_get_url_query_len(req);
+    if (query_len >= sizeof(query) ||
+        (query_len > 0 && httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK)) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "query too long");
+    }
+
+    capture_filter_t filter = {.mac_len = 0};
+    char mac[18];
+    if (httpd_query_key_value(query, "mac", mac, sizeof(mac)) == ESP_OK && !parse_mac_filter(mac, &filter)) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "mac must be an OUI or a full MAC address");
+    }
+    filter.min_len = query_u32(query, "min", 0);
+    filter.max_len = query_u32(query, "max", ESP_NOW_MAX_DATA_LEN);
+    uint32_t seconds = query_u32(query, "seconds", GATEWAY_CAPTURE_DEFAULT_S);
+    seconds = seconds == 0 || seconds > GATEWAY_CAPTURE_MAX_S ? GATEWAY_CAPTURE_MAX_S : seconds;
+
+    const esp_err_t err = capture_start(req, &filter, seconds, query_u32(query, "frames", 0));
+    if (err == ESP_ERR_INVALID_STATE) {
+        httpd_resp_set_status(req, "409 Conflict");
+        return httpd_resp_send(req, "capture already running", HTTPD_RESP_USE_STRLEN);
+    }
+    if (unlikely(err != ESP_OK)) {
+        ESP_LOGE(TAG, "capture_start failed: %s", esp_err_to_name(err));
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "capture failed");
+    }
+
+    return ESP_OK;
+}
+#endif
+
+#if CONFIG_GATEWAY_ENABLE_SSE_LOGS
+#define LOGS_POLL_US (100 * 1000)
+#define LOGS_PING_US (5000 * 1000)
+#define LOGS_BATCH 16
+#define LOGS_LINE_BATCH 8
+#define LOGS_BATCHES_PER_POLL 4 // bounds the time one subscriber holds the httpd task
+#define LOGS_EVENT_MAX_LEN 64
+#define LOGS_LINE_EVENT_MAX_LEN (64 + LOGS_TAG_MAX_LEN + LOGS_TEXT_MAX_LEN)
+
+// Subscribers are async requests, served from the httpd task by logs_pump() so /logs no longer ties up the server.
+typedef struct {
+    httpd_req_t *req; // NULL if the slot is free
+    logs_reader_t reader;
+    int64_t sent_at;
+} logs_subscriber_t;
+
+static httpd_handle_t s_server = NULL;
+static esp_timer_handle_t s_logs_timer = NULL;
+static bool s_logs_queued = false; // a logs_pump() is pending
+
+// httpd task only
+static logs_subscriber_t s_subscribers[GATEWAY_SSE_LOGS_MAX_CLIENTS];
+static logs_record_t s_logs_recs[LOGS_BATCH];
+static logs_line_t s_logs_lines[LOGS_LINE_BATCH];
+static char s_logs_buf[LOGS_LINE_BATCH * LOGS_LINE_EVENT_MAX_LEN + LOGS_EVENT_MAX_LEN];
+
+static void logs_unsubscribe(logs_subscriber_t *sub) {
+    httpd_resp_send_chunk(sub->req, NULL, 0); // End response
+    httpd_req_async_handler_complete(sub->req);
+    sub->req = NULL;
+}
+
+static size_t logs_format_skipped(const char *event, uint32_t skipped) {
+    return skipped > 0 ? (size_t)snprintf(s_logs_buf, sizeof(s_logs_buf), "event:%s\ndata:%" PRIu32 "\n\n", event,
+                                          skipped)
+                       : 0;
+}
+
+// Next chunk of published messages, formatted here rather than by the producers.
+static size_t logs_format_records(logs_subscriber_t *sub) {
+    uint32_t skipped;
+    const size_t count = logs_read(&sub->reader, s_logs_recs, LOGS_BATCH, &skipped);
+
+    size_t len = logs_format_skipped("skipped", skipped);
+    for (size_t i = 0; i < count; i++) {
+        const int n = logs_format_sse(&s_logs_recs[i], s_logs_buf + len, sizeof(s_logs_buf) - len);
+        len += n > 0 ? (size_t)n : 0;
+    }
+    return len;
+}
+
+static size_t logs_format_lines(logs_subscriber_t *sub) {
+    uint32_t skipped;
+    const size_t count = logs_read_lines(&sub->reader, s_logs_lines, LOGS_LINE_BATCH, &skipped);
+
+    size_t len = logs_format_skipped("log_skipped", skipped);
+    for (size_t i = 0; i < count; i++) {
+        const int n = logs_format_line_sse(&s_logs_lines[i], s_logs_buf + len, sizeof(s_logs_buf) - len);
+        len += n > 0 ? (size_t)n : 0;
+    }
+    return len;
+}
+
+static esp_err_t logs_send_pending(logs_subscriber_t *sub, int64_t now) {
+    size_t (*const formats[])(logs_subscriber_t *) = {logs_format_records, logs_format_lines};
+
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        for (size_t b = 0; b < LOGS_BATCHES_PER_POLL; b++) {
+            const size_t len = formats[f](sub);
+            if (len == 0) {
+                break;
+            }
+            ESP_RETURN_ON_ERROR(httpd_resp_send_chunk(sub->req, s_logs_buf, (ssize_t)len), TAG,
+                                "httpd_resp_send_chunk");
+            sub->sent_at = now;
+        }
+    }
+
+    if (now - sub->sent_at >= LOGS_PING_US) {
+        ESP_RETURN_ON_ERROR(httpd_resp_send_chunk(sub->req, ": ping\n\n", HTTPD_RESP_USE_STRLEN), TAG,
+                            "httpd_resp_send_chunk");
+        sub->sent_at = now;
+    }
+
+    return ESP_OK;
+}
+
+static void logs_pump(void *arg) {
+    (void)arg;
+    __atomic_store_n(&s_logs_queued, false, __ATOMIC_RELEASE);
+
+    const int64_t now = esp_timer_get_time();
+    size_t active = 0;
+    for (size_t i = 0; i < GATEWAY_SSE_LOGS_MAX_CLIENTS; i++) {
+        logs_subscriber_t *sub = &s_subscribers[i];
+        if (sub->req == NULL) {
+            continue;
+        }
+        if (unlikely(logs_send_pending(sub, now) != ESP_OK)) {
+            ESP_LOGI(TAG, "log subscriber %u gone", (unsigned)i);
+            logs_unsubscribe(sub);
+            continue;
+        }
+        active++;
+    }
+
+    if (active == 0) {
+        esp_timer_stop(s_logs_timer);
+    }
+}
+
+// esp_timer task: hands the work to the httpd task, at most one pump pending.
+static void logs_tick(void *arg) {
+    (void)arg;
+    if (__atomic_exchange_n(&s_logs_queued, true, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    if (unlikely(httpd_queue_work(s_server, logs_pump, NULL) != ESP_OK)) {
+        __atomic_store_n(&s_logs_queued, false, __ATOMIC_RELEASE);
+    }
+}
+
+static esp_err_t logs_handler(httpd_req_t *req) {
+    logs_subscriber_t *sub = NULL;
+    for (size_t i = 0; i < GATEWAY_SSE_LOGS_MAX_CLIENTS && sub == NULL; i++) {
+        sub = s_subscribers[i].req == NULL ? &s_subscribers[i] : NULL;
+    }
+    if (unlikely(sub == NULL)) {
+        ESP_LOGW(TAG, "all %d log subscriber slots busy", GATEWAY_SSE_LOGS_MAX_CLIENTS);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, "too many log subscribers", HTTPD_RESP_USE_STRLEN);
+    }
+
+    httpd_resp_set_type(req, "text/event-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_set_hdr(req, "Connection", "keep-alive");
+
+    // Headers go out with the first chunk, before the request is handed over.
+    ESP_RETURN_ON_ERROR(httpd_resp_send_chunk(req, ": subscribed\n\n", HTTPD_RESP_USE_STRLEN), TAG,
+                        "httpd_resp_send_chunk");
+    ESP_RETURN_ON_ERROR(httpd_req_async_handler_begin(req, &sub->req), TAG, "httpd_req_async_handler_begin");
+    logs_reader_init(&sub->reader);
+    sub->sent_at = esp_timer_get_time();
+
+    esp_err_t err = esp_timer_start_periodic(s_logs_timer, LOGS_POLL_US);
+    if (err == ESP_ERR_INVALID_STATE) {
+        err = ESP_OK; // running for other subscribers
+    }
+    if (unlikely(err != ESP_OK)) {
+        ESP_LOGE(TAG, "esp_timer_start_periodic failed: %s", esp_err_to_name(err));
+        logs_unsubscribe(sub);
+    }
 
     return ESP_OK;
 }
@@ -206,12 +532,19 @@ static esp_err_t logs_handler(httpd_req_t *req) {
 esp_err_t httpd_start_server(void) {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = GATEWAY_HTTP_PORT;
+    config.stack_size = STACK_SIZE;
+    config.max_uri_handlers = MAX_URI_HANDLERS;
 
     ESP_RETURN_ON_ERROR(build_expected_auth_hdr(settings_http_auth_user(), settings_http_auth_password()), TAG,
                         "build_expected_auth_hdr");
 
     httpd_handle_t server = NULL;
     ESP_RETURN_ON_ERROR(httpd_start(&server, &config), TAG, "httpd_start");
+#if CONFIG_GATEWAY_ENABLE_SSE_LOGS
+    s_server = server;
+    const esp_timer_create_args_t logs_timer = {.callback = logs_tick, .name = "logs"};
+    ESP_RETURN_ON_ERROR(esp_timer_create(&logs_timer, &s_logs_timer), TAG, "esp_timer_create");
+#endif
 
     httpd_uri_t root = {
         .uri = "/",
@@ -245,6 +578,57 @@ esp_err_t httpd_start_server(void) {
     };
     ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &settings_csv_post), TAG, "httpd_register_uri_handler");
 
+    httpd_uri_t devices_csv = {
+        .uri = "/devices.csv",
+        .method = HTTP_GET,
+        .handler = handle_devices_csv,
+        .user_ctx = NULL,
+    };
+    ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &devices_csv), TAG, "httpd_register_uri_handler");
+
+#if CONFIG_GATEWAY_LINKS
+    httpd_uri_t links_json = {
+        .uri = "/links.json",
+        .method = HTTP_GET,
+        .handler = handle_links,
+        .user_ctx = NULL,
+    };
+    ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &links_json), TAG, "httpd_register_uri_handler");
+
+    httpd_uri_t links_csv = {
+        .uri = "/links.csv",
+        .method = HTTP_GET,
+        .handler = handle_links,
+        .user_ctx = "csv",
+    };
+    ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &links_csv), TAG, "httpd_register_uri_handler");
+#endif
+
+#if CONFIG_GATEWAY_METRICS
+    httpd_uri_t metrics = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = handle_metrics,
+        .user_ctx = NULL,
+    };
+    ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &metrics), TAG, "httpd_register_uri_handler");
+#endif
+
+#if CONFIG_GATEWAY_ENCRYPT
+    httpd_uri_t pair = {
+        .uri = "/pair",
+        .method = HTTP_POST,
+        .handler = handle_pair,
+        .user_ctx = NULL,
+    };
+    ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &pair), TAG, "httpd_register_uri_handler");
+#endif
+
+#if CONFIG_GATEWAY_CAPTURE
+    const httpd_uri_t capture = {.uri = "/capture", .method = HTTP_GET, .handler = handle_capture, .user_ctx = NULL};
+    ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &capture), TAG, "httpd_register_uri_handler");
+#endif
+
 #if CONFIG_GATEWAY_ENABLE_SSE_LOGS
     const httpd_uri_t sse = {.uri = "/logs", .method = HTTP_GET, .handler = logs_handler, .user_ctx = NULL};
     ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &sse), TAG, "httpd_register_uri_handler");
@@ -0,0 +1,404 @@
+#include "keys.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_now.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "proto_key.h"
+
+#include "config.h"
+#include "replay.h"
+#if CONFIG_GATEWAY_DOWNLINK
+#include "downlink.h"
+#endif
+
+static const char *const TAG = "keys";
+static const uint8_t BROADCAST_MAC[ESP_NOW_ETH_ALEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+#define NVS_KEY_EPOCH "epoch"
+#define US_PER_S 1000000LL
+
+// Kconfig defaults, a gateway built with them would hand its keys to anyone who read the sources.
+#define PLACEHOLDER_PMK "pmk1234567890123"
+#define PLACEHOLDER_MASTER_KEY "change me"
+
+typedef struct {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    bool used;
+    bool shared; // the downlink uses the entry too, it turns into a plain peer when the session goes
+    uint32_t epoch;
+    int64_t expires_us;
+} session_t;
+
+static SemaphoreHandle_t s_lock; // guards everything below
+static session_t s_sessions[GATEWAY_ENCRYPT_PEERS];
+static proto_hmac_key_t s_master;
+static uint32_t s_epoch;
+static int64_t s_pair_until_us;
+static keys_stats_t s_stats;
+static esp_timer_handle_t s_rotate_timer;
+static replay_t s_counts; // of the last handshake of every node
+static replay_entry_t s_count_buckets[2 * GATEWAY_ENCRYPT_NODES];
+
+static void derive(const uint8_t *mac_addr, uint32_t epoch, uint8_t lmk[PROTO_KEY_LEN]) {
+    const int64_t start = esp_timer_get_time();
+    proto_key_derive(&s_master, mac_addr, epoch, lmk);
+    s_stats.derives++;
+    s_stats.derive_us += (uint32_t)(esp_timer_get_time() - start);
+}
+
+// Adds, changes or removes the peer entry of a session, timing the call.
+static esp_err_t peer_op(session_t *s, const uint8_t *lmk, bool exists) {
+    esp_now_peer_info_t peer = {
+        .channel = 0, // current channel, follows the AP when the station roams
+        .ifidx = GATEWAY_WIFI_IF,
+        .encrypt = lmk != NULL,
+    };
+    memcpy(peer.peer_addr, s->mac_addr, ESP_NOW_ETH_ALEN);
+    if (lmk != NULL) {
+        memcpy(peer.lmk, lmk, ESP_NOW_KEY_LEN);
+    }
+
+    const int64_t start = esp_timer_get_time();
+    esp_err_t err;
+    if (lmk == NULL && !s->shared) {
+        err = esp_now_del_peer(s->mac_addr);
+    } else if (exists) {
+        err = esp_now_mod_peer(&peer);
+    } else if ((err = esp_now_add_peer(&peer)) == ESP_ERR_ESPNOW_EXIST) {
+        // Registered as plain peer by the downlink, encrypt it for as long as the session lasts.
+        s->shared = true;
+        err = esp_now_mod_peer(&peer);
+    }
+    s_stats.peer_ops++;
+    s_stats.peer_us += (uint32_t)(esp_timer_get_time() - start);
+
+    return err;
+}
+
+static session_t *session_find(const uint8_t *mac_addr) {
+    for (size_t i = 0; i < GATEWAY_ENCRYPT_PEERS; i++) {
+        if (s_sessions[i].used && memcmp(s_sessions[i].mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0) {
+            return &s_sessions[i];
+        }
+    }
+    return NULL;
+}
+
+// Takes a free slot or the session that expired first, NULL while every lease runs.
+static session_t *session_take(const uint8_t *mac_addr, int64_t now) {
+    session_t *victim = NULL;
+    for (size_t i = 0; i < GATEWAY_ENCRYPT_PEERS; i++) {
+        session_t *c = &s_sessions[i];
+        if (!c->used) {
+            victim = c;
+            break;
+        }
+        if (c->expires_us <= now && (victim == NULL || c->expires_us < victim->expires_us)) {
+            victim = c;
+        }
+    }
+    if (victim == NULL) {
+        return NULL;
+    }
+
+    if (victim->used) {
+        peer_op(victim, NULL, true);
+        s_stats.swaps++;
+    }
+    memset(victim, 0, sizeof(*victim));
+    memcpy(victim->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+    return victim;
+}
+
+// Builds the answer to a handshake into reply, 0 if there is none.
+static size_t on_hello(const uint8_t *mac_addr, const proto_key_msg_t *hello, uint8_t *reply, size_t cap) {
+    const int64_t now = esp_timer_get_time();
+    const uint32_t epoch = hello->epoch;
+
+    // The previous epoch is still accepted, its nodes are moved on right away.
+    if (epoch != s_epoch && epoch + 1 != s_epoch) {
+        s_stats.rejected++;
+        ESP_LOGW(TAG, MACSTR " has key epoch %" PRIu32 ", current %" PRIu32 ", pair it again", MAC2STR(mac_addr),
+                 epoch, s_epoch);
+        return 0;
+    }
+
+    // Only the holder of the LMK gets a lease, and only once per handshake: a spoofed MAC or a recorded hello
+    // cannot take a peer entry away from a node.
+    uint8_t lmk[PROTO_KEY_LEN];
+    derive(mac_addr, epoch, lmk);
+    proto_hmac_key_t key;
+    proto_hmac_key_init(&key, lmk, sizeof(lmk));
+    if (proto_key_verify(&key, mac_addr, hello) != PROTO_OK) {
+        s_stats.forged++;
+        ESP_LOGD(TAG, "hello of " MACSTR " not signed with its key", MAC2STR(mac_addr));
+        return 0;
+    }
+    const esp_err_t counted = replay_advance(&s_counts, mac_addr, hello->count);
+    if (counted == ESP_ERR_NO_MEM) {
+        s_stats.rejected++;
+        ESP_LOGW(TAG, "hello of " MACSTR " rejected, %d nodes known", MAC2STR(mac_addr), GATEWAY_ENCRYPT_NODES);
+        return 0;
+    }
+    if (counted != ESP_OK) {
+        s_stats.replayed++;
+        ESP_LOGD(TAG, "hello %" PRIu32 " of " MACSTR " seen before", hello->count, MAC2STR(mac_addr));
+        return 0;
+    }
+
+    session_t *s = session_find(mac_addr);
+    const bool exists = s != NULL;
+    if (s == NULL && (s = session_take(mac_addr, now)) == NULL) {
+        s_stats.rejected++;
+        ESP_LOGD(TAG, "no free peer for " MACSTR, MAC2STR(mac_addr));
+        return 0;
+    }
+
+    if (!exists || s->epoch != epoch) {
+        const esp_err_t err = peer_op(s, lmk, exists);
+        if (unlikely(err != ESP_OK)) {
+            ESP_LOGW(TAG, "peer " MACSTR ": %s", MAC2STR(mac_addr), esp_err_to_name(err));
+            s->used = false;
+            return 0;
+        }
+    }
+    s->used = true;
+    s->epoch = epoch;
+    s->expires_us = now + GATEWAY_ENCRYPT_LEASE_S * US_PER_S;
+    s_stats.hellos++;
+
+    // Signed with the key of the hello and bound to its count, the node takes no answer it cannot check.
+    proto_key_msg_t msg = {.epoch = s_epoch, .count = hello->count};
+    if (epoch == s_epoch) {
+        msg.type = PROTO_KEY_READY;
+        msg.lease_s = GATEWAY_ENCRYPT_LEASE_S;
+        proto_key_sign(&key, mac_addr, &msg);
+    } else {
+        // Wrapped under the old key, the node says hello again with the new one.
+        msg.type = PROTO_KEY_REKEY;
+        uint8_t next[PROTO_KEY_LEN];
+        derive(mac_addr, s_epoch, next);
+        proto_key_wrap(&key, mac_addr, next, &msg);
+        s_stats.rekeys++;
+    }
+    return proto_key_write(reply, cap, &msg);
+}
+
+static size_t on_pair(const uint8_t *mac_addr, const proto_key_msg_t *req, uint8_t *reply, size_t cap) {
+    if (esp_timer_get_time() >= s_pair_until_us) {
+        ESP_LOGD(TAG, "pairing request of " MACSTR " outside the window", MAC2STR(mac_addr));
+        return 0;
+    }
+
+    // The pair key of the MAC signs the request and wraps the answer, only that node can use it.
+    uint8_t key[PROTO_KEY_LEN];
+    proto_key_derive_pair(&s_master, mac_addr, key);
+    proto_hmac_key_t pair;
+    proto_hmac_key_init(&pair, key, sizeof(key));
+    if (proto_key_verify(&pair, mac_addr, req) != PROTO_OK) {
+        s_stats.forged++;
+        ESP_LOGW(TAG, "pairing request of " MACSTR " not signed with its pair key", MAC2STR(mac_addr));
+        return 0;
+    }
+
+    proto_key_msg_t msg = {.type = PROTO_KEY_PAIR_RESP, .epoch = s_epoch};
+    memcpy(msg.nonce, req->nonce, PROTO_KEY_NONCE_LEN);
+
+    uint8_t lmk[PROTO_KEY_LEN];
+    derive(mac_addr, s_epoch, lmk);
+    proto_key_wrap(&pair, mac_addr, lmk, &msg);
+    s_stats.paired++;
+    // A node pairs again when it lost its key, its handshake count went with it.
+    replay_reset(&s_counts, mac_addr);
+
+    ESP_LOGI(TAG, "paired " MACSTR ", key epoch %" PRIu32, MAC2STR(mac_addr), s_epoch);
+    return proto_key_write(reply, cap, &msg);
+}
+
+void keys_handle(const uint8_t *mac_addr, const proto_frame_t *frame) {
+    proto_key_msg_t msg;
+    if (s_lock == NULL || proto_key_parse(frame->payload, frame->payload_len, &msg) != PROTO_OK) {
+        return;
+    }
+
+    uint8_t reply[PROTO_KEY_MAX_LEN];
+    size_t len = 0;
+    const uint8_t *dest = mac_addr;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (msg.type == PROTO_KEY_HELLO) {
+        len = on_hello(mac_addr, &msg, reply, sizeof(reply));
+    } else if (msg.type == PROTO_KEY_PAIR_REQ) {
+        // The node has no key for unicast yet, the answer is wrapped under its pair key and bound to its nonce.
+        len = on_pair(mac_addr, &msg, reply, sizeof(reply));
+        dest = BROADCAST_MAC;
+    }
+    xSemaphoreGive(s_lock);
+
+    if (len > 0) {
+#if CONFIG_GATEWAY_DOWNLINK
+        // A unicast reply through esp_now_send() would meet the send callback of the downlink.
+        const esp_err_t err = dest == mac_addr ? downlink_send(dest, reply, len) : esp_now_send(dest, reply, len);
+#else
+        const esp_err_t err = esp_now_send(dest, reply, len);
+#endif
+        if (unlikely(err != ESP_OK)) {
+            ESP_LOGD(TAG, "key reply to " MACSTR " not sent: %s", MAC2STR(mac_addr), esp_err_to_name(err));
+        }
+    }
+}
+
+void keys_pair_open(void) {
+    if (s_lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_pair_until_us = esp_timer_get_time() + GATEWAY_ENCRYPT_PAIR_WINDOW_S * US_PER_S;
+    xSemaphoreGive(s_lock);
+
+    ESP_LOGI(TAG, "pairing open for %d s", GATEWAY_ENCRYPT_PAIR_WINDOW_S);
+}
+
+esp_err_t keys_acquire_peer(const uint8_t *mac_addr) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    session_t *s = session_find(mac_addr);
+    esp_err_t err = ESP_OK;
+    if (s != NULL) {
+        s->shared = true;
+    } else {
+        esp_now_peer_info_t peer = {
+            .channel = 0, // current channel, follows the AP when the station roams
+            .ifidx = GATEWAY_WIFI_IF,
+            .encrypt = false,
+        };
+        memcpy(peer.peer_addr, mac_addr, ESP_NOW_ETH_ALEN);
+        err = esp_now_add_peer(&peer);
+        if (err == ESP_ERR_ESPNOW_EXIST) {
+            err = ESP_OK;
+        }
+    }
+    xSemaphoreGive(s_lock);
+
+    return err;
+}
+
+void keys_release_peer(const uint8_t *mac_addr) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    session_t *s = session_find(mac_addr);
+    if (s != NULL) {
+        s->shared = false;
+    } else {
+        esp_now_del_peer(mac_addr);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+void keys_stats(keys_stats_t *out) {
+    if (s_lock == NULL) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+
+    const int64_t now = esp_timer_get_time();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *out = s_stats;
+    out->epoch = s_epoch;
+    out->sessions = 0;
+    for (size_t i = 0; i < GATEWAY_ENCRYPT_PEERS; i++) {
+        if (s_sessions[i].used && s_sessions[i].expires_us > now) {
+            out->sessions++;
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
+
+static esp_err_t epoch_store(uint32_t epoch) {
+    nvs_handle_t nvs;
+    ESP_RETURN_ON_ERROR(nvs_open(GATEWAY_ENCRYPT_NVS_NAMESPACE, NVS_READWRITE, &nvs), TAG, "nvs_open");
+    esp_err_t err = nvs_set_u32(nvs, NVS_KEY_EPOCH, epoch);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return err;
+}
+
+static uint32_t epoch_load(void) {
+    nvs_handle_t nvs;
+    uint32_t epoch = 0;
+    if (nvs_open(GATEWAY_ENCRYPT_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        nvs_get_u32(nvs, NVS_KEY_EPOCH, &epoch);
+        nvs_close(nvs);
+    }
+    return epoch;
+}
+
+static void rotate_cb(__attribute__((unused)) void *arg) {
+    const int64_t start = esp_timer_get_time();
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    const uint32_t epoch = ++s_epoch;
+    s_stats.rotations++;
+    xSemaphoreGive(s_lock);
+
+    // Keys are derived on demand, the epoch is all there is to store.
+    const esp_err_t err = epoch_store(epoch);
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_stats.rotate_us = (uint32_t)(esp_timer_get_time() - start);
+    xSemaphoreGive(s_lock);
+
+    ESP_LOGI(TAG, "key epoch %" PRIu32 "%s", epoch, err == ESP_OK ? "" : ", not stored");
+}
+
+esp_err_t keys_start(void) {
+    ESP_RETURN_ON_FALSE(strlen(GATEWAY_ENCRYPT_PMK) == ESP_NOW_KEY_LEN, ESP_ERR_INVALID_ARG, TAG,
+                        "PMK must have %d characters", ESP_NOW_KEY_LEN);
+    ESP_RETURN_ON_FALSE(strcmp(GATEWAY_ENCRYPT_PMK, PLACEHOLDER_PMK) != 0 &&
+                            strcmp(GATEWAY_ENCRYPT_MASTER_KEY, PLACEHOLDER_MASTER_KEY) != 0 &&
+                            strlen(GATEWAY_ENCRYPT_MASTER_KEY) >= PROTO_KEY_LEN,
+                        ESP_ERR_INVALID_ARG, TAG, "set a PMK and a master key of at least %d characters of your own",
+                        PROTO_KEY_LEN);
+
+    replay_init(&s_counts, s_count_buckets, 2 * GATEWAY_ENCRYPT_NODES);
+    s_lock = xSemaphoreCreateMutex();
+    ESP_RETURN_ON_FALSE(s_lock != NULL, ESP_ERR_NO_MEM, TAG, "mutex");
+
+    ESP_RETURN_ON_ERROR(esp_now_set_pmk((const uint8_t *)GATEWAY_ENCRYPT_PMK), TAG, "esp_now_set_pmk");
+    proto_hmac_key_init(&s_master, (const uint8_t *)GATEWAY_ENCRYPT_MASTER_KEY, strlen(GATEWAY_ENCRYPT_MASTER_KEY));
+
+    s_epoch = epoch_load();
+    if (s_epoch == 0) {
+        s_epoch = 1;
+        ESP_RETURN_ON_ERROR(epoch_store(s_epoch), TAG, "epoch_store");
+    }
+
+#if CONFIG_GATEWAY_ENCRYPT_PAIR_AT_BOOT
+    s_pair_until_us = esp_timer_get_time() + GATEWAY_ENCRYPT_PAIR_WINDOW_S * US_PER_S;
+#endif
+
+    if (GATEWAY_ENCRYPT_ROTATE_H > 0) {
+        const esp_timer_create_args_t args = {
+            .callback = rotate_cb,
+            .name = "keys",
+        };
+        ESP_RETURN_ON_ERROR(esp_timer_create(&args, &s_rotate_timer), TAG, "esp_timer_create");
+        ESP_RETURN_ON_ERROR(
+            esp_timer_start_periodic(s_rotate_timer, (uint64_t)GATEWAY_ENCRYPT_ROTATE_H * 3600 * US_PER_S), TAG,
+            "esp_timer_start_periodic");
+    }
+
+    ESP_LOGI(TAG, "key epoch %" PRIu32 ", %d encrypted peers", s_epoch, GATEWAY_ENCRYPT_PEERS);
+    return ESP_OK;
+}
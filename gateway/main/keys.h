@@ -0,0 +1,94 @@
+#ifndef _KEYS_H_
+#define _KEYS_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Encrypted ESP-NOW sessions with paired nodes, see proto_key.h.
+ *
+ * Node keys are derived from GATEWAY_ENCRYPT_MASTER_KEY and the key epoch,
+ * only the epoch is kept in NVS. Pairing requests and handshakes must be
+ * signed with a key of their MAC, see proto_key.h, so a lease is only taken
+ * by the node itself. Handshakes count up, the last count of every node is
+ * kept for GATEWAY_ENCRYPT_NODES nodes and a recorded handshake sent again
+ * is rejected. Pairing lets a node start over at count 1, it may have lost
+ * its count along with its key. A session registers the node as encrypted
+ * peer for GATEWAY_ENCRYPT_LEASE_S, the table holds GATEWAY_ENCRYPT_PEERS
+ * sessions and expired ones are swapped out for new nodes. Rotation only
+ * bumps the epoch: running sessions keep their key, each node is moved to
+ * the new one at its next handshake, so traffic never waits for a rotation.
+ *
+ * With the downlink enabled, its peers go through keys_acquire_peer() and
+ * keys_release_peer(), so a node has one peer entry whoever registered it.
+ */
+
+typedef struct {
+    uint32_t epoch;     // current key epoch
+    uint32_t sessions;  // peers with a running lease
+    uint32_t paired;    // pairing requests answered
+    uint32_t hellos;    // handshakes answered
+    uint32_t rekeys;    // nodes moved to the current epoch
+    uint32_t rejected;  // handshakes with a stale epoch, while every peer was leased, or of a node too many
+    uint32_t forged;    // pairing requests and handshakes not signed with the key of their MAC
+    uint32_t replayed;  // signed handshakes with a count not above the last one of their node
+    uint32_t swaps;     // expired sessions removed for a new node
+    uint32_t rotations; // epochs started since boot
+    uint32_t derives;   // keys derived
+    uint32_t derive_us; // total time deriving keys
+    uint32_t peer_ops;  // ESP-NOW peer adds, changes and removals
+    uint32_t peer_us;   // total time spent in them
+    uint32_t rotate_us; // duration of the last rotation
+} keys_stats_t;
+
+/**
+ * @brief Sets the PMK, loads the key epoch and starts rotation.
+ *
+ * Refuses to start with the Kconfig placeholder keys.
+ *
+ * Must be called after espnow_start() and before downlink_start().
+ */
+esp_err_t keys_start(void);
+
+/**
+ * @brief Handles a PROTO_FLAG2_KEY frame.
+ *
+ * Called by the uplink workers.
+ */
+void keys_handle(const uint8_t *mac_addr, const proto_frame_t *frame);
+
+/**
+ * @brief Answers pairing requests for the next GATEWAY_ENCRYPT_PAIR_WINDOW_S.
+ */
+void keys_pair_open(void);
+
+/**
+ * @brief Registers a unicast peer for the downlink.
+ *
+ * A node with a session already has its encrypted entry, which is shared.
+ * Others are added as plain peers.
+ */
+esp_err_t keys_acquire_peer(const uint8_t *mac_addr);
+
+/**
+ * @brief Gives back a peer of the downlink, removed unless a session holds it.
+ */
+void keys_release_peer(const uint8_t *mac_addr);
+
+/**
+ * @brief Copies counters.
+ */
+void keys_stats(keys_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _KEYS_H_ */
@@ -0,0 +1,188 @@
+#include "links.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "config.h"
+#include "devices.h"
+
+static const char *const TAG = "links";
+
+#define PROBE 8                           // entries a MAC may land in
+#define EWMA_SHIFT 3                      // weight 1/8 for the newest sample
+#define INTERVAL_MAX_US (3600u * 1000000) // longer gaps are counted as this, gaps have millisecond resolution
+
+_Static_assert(GATEWAY_LINKS_SIZE >= PROBE, "GATEWAY_LINKS_SIZE too small");
+
+static links_entry_t s_links[GATEWAY_LINKS_SIZE]; // frames == 0 marks a free entry
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#if GATEWAY_LINKS_MQTT_INTERVAL_S > 0
+static esp_mqtt_client_handle_t s_client = NULL;
+static esp_timer_handle_t s_timer = NULL;
+#endif
+
+static int32_t ewma(int32_t avg, int32_t sample) {
+    return avg + ((sample - avg) >> EWMA_SHIFT);
+}
+
+// Intervals go up to INTERVAL_MAX_US, beyond INT32_MAX, so they are averaged in 64 bits.
+static uint32_t ewma_interval(uint32_t avg, uint32_t sample) {
+    return (uint32_t)((int64_t)avg + (((int64_t)sample - (int64_t)avg) >> EWMA_SHIFT));
+}
+
+// Entry of a MAC, or the entry to give it: a free one, else the least recently seen in its probe window.
+static links_entry_t *slot_of(const uint8_t *mac_addr) {
+    const size_t start = devices_mac_hash(mac_addr) % GATEWAY_LINKS_SIZE;
+    links_entry_t *victim = NULL;
+    for (size_t i = 0; i < PROBE; i++) {
+        links_entry_t *e = &s_links[(start + i) % GATEWAY_LINKS_SIZE];
+        if (e->frames == 0 || memcmp(e->mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0) {
+            return e;
+        }
+        if (victim == NULL || (int32_t)(e->last_seen_ms - victim->last_seen_ms) < 0) {
+            victim = e;
+        }
+    }
+    victim->frames = 0;
+    return victim;
+}
+
+void links_update(const esp_now_recv_info_t *recv_info) {
+    const uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    const wifi_pkt_rx_ctrl_t *rx_ctrl = recv_info->rx_ctrl;
+    const int8_t rssi = (int8_t)rx_ctrl->rssi;
+
+    portENTER_CRITICAL(&s_lock);
+    links_entry_t *e = slot_of(recv_info->src_addr);
+    if (e->frames == 0) {
+        memcpy(e->mac_addr, recv_info->src_addr, ESP_NOW_ETH_ALEN);
+        e->rssi_avg_x16 = (int16_t)(rssi * 16);
+        e->interval_us = 0;
+    } else {
+        e->rssi_avg_x16 = (int16_t)ewma(e->rssi_avg_x16, rssi * 16);
+        const uint32_t gap_ms = now_ms - e->last_seen_ms;
+        const uint32_t gap_us = gap_ms == 0 ? 500 : gap_ms > INTERVAL_MAX_US / 1000 ? INTERVAL_MAX_US : gap_ms * 1000;
+        e->interval_us = e->interval_us == 0 ? gap_us : ewma_interval(e->interval_us, gap_us);
+    }
+    e->rssi = rssi;
+    e->noise_floor = (int8_t)rx_ctrl->noise_floor;
+    e->rate = (uint8_t)rx_ctrl->rate;
+    e->channel = (uint8_t)rx_ctrl->channel;
+    e->frames++;
+    e->last_seen_ms = now_ms;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+size_t links_snapshot(links_entry_t *out) {
+    size_t n = 0;
+    portENTER_CRITICAL(&s_lock);
+    for (size_t i = 0; i < GATEWAY_LINKS_SIZE; i++) {
+        if (s_links[i].frames != 0) {
+            out[n++] = s_links[i];
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    return n;
+}
+
+// Packets per minute in hundredths, 0 until there is an interval.
+static uint32_t per_min_x100(const links_entry_t *e) {
+    return e->interval_us == 0 ? 0 : (uint32_t)(6000000000ull / e->interval_us);
+}
+
+static int checked(int n, size_t cap) {
+    return n < 0 || (size_t)n >= cap ? -1 : n;
+}
+
+int links_format_json(const links_entry_t *e, uint32_t now_ms, char *buf, size_t cap) {
+    const int32_t avg = e->rssi_avg_x16 * 10 / 16; // tenths of a dBm
+    const uint32_t per_min = per_min_x100(e);
+    return checked(snprintf(buf, cap,
+                            "{\"mac\":\"" MACSTR "\",\"rssi_avg\":%s%" PRId32 ".%" PRId32 ",\"rssi\":%d,"
+                            "\"noise_floor\":%d,\"rate\":%u,\"channel\":%u,\"frames\":%" PRIu32
+                            ",\"per_min\":%" PRIu32 ".%02" PRIu32 ",\"age_s\":%" PRIu32 "}",
+                            MAC2STR(e->mac_addr), avg < 0 ? "-" : "", abs(avg) / 10, abs(avg) % 10, e->rssi,
+                            e->noise_floor, e->rate, e->channel, e->frames, per_min / 100, per_min % 100,
+                            (now_ms - e->last_seen_ms) / 1000),
+                   cap);
+}
+
+int links_format_csv(const links_entry_t *e, uint32_t now_ms, char *buf, size_t cap) {
+    const int32_t avg = e->rssi_avg_x16 * 10 / 16;
+    const uint32_t per_min = per_min_x100(e);
+    return checked(snprintf(buf, cap,
+                            MACSTR ",%s%" PRId32 ".%" PRId32 ",%d,%d,%u,%u,%" PRIu32 ",%" PRIu32 ".%02" PRIu32
+                                   ",%" PRIu32 "\n",
+                            MAC2STR(e->mac_addr), avg < 0 ? "-" : "", abs(avg) / 10, abs(avg) % 10, e->rssi,
+                            e->noise_floor, e->rate, e->channel, e->frames, per_min / 100, per_min % 100,
+                            (now_ms - e->last_seen_ms) / 1000),
+                   cap);
+}
+
+#if GATEWAY_LINKS_MQTT_INTERVAL_S > 0
+// esp_timer task: the table as one JSON array, handed to the client's outbox without waiting for the broker.
+static void publish(void *arg) {
+    (void)arg;
+    esp_mqtt_client_handle_t client = __atomic_load_n(&s_client, __ATOMIC_ACQUIRE);
+    if (client == NULL) {
+        return;
+    }
+
+    const size_t cap = 2 + GATEWAY_LINKS_SIZE * LINKS_JSON_ENTRY_MAX_LEN;
+    links_entry_t *entries = malloc(GATEWAY_LINKS_SIZE * sizeof(*entries));
+    char *buf = malloc(cap);
+    if (unlikely(entries == NULL || buf == NULL)) {
+        ESP_LOGW(TAG, "no memory for link table");
+        goto out;
+    }
+
+    const size_t count = links_snapshot(entries);
+    const uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    size_t len = 0;
+    buf[len++] = '[';
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            buf[len++] = ',';
+        }
+        const int n = links_format_json(&entries[i], now_ms, buf + len, cap - len - 1);
+        len += n > 0 ? (size_t)n : 0;
+    }
+    buf[len++] = ']';
+
+    if (esp_mqtt_client_enqueue(client, GATEWAY_LINKS_MQTT_TOPIC, buf, (int)len, 0, 0, true) < 0) {
+        ESP_LOGW(TAG, "link table not queued for publishing");
+    }
+
+out:
+    free(buf);
+    free(entries);
+}
+#endif
+
+esp_err_t links_set_mqtt_client(esp_mqtt_client_handle_t client) {
+#if GATEWAY_LINKS_MQTT_INTERVAL_S > 0
+    __atomic_store_n(&s_client, client, __ATOMIC_RELEASE);
+    if (client == NULL) {
+        return s_timer != NULL ? esp_timer_stop(s_timer) : ESP_OK;
+    }
+    if (s_timer == NULL) {
+        const esp_timer_create_args_t args = {.callback = publish, .name = "links"};
+        ESP_RETURN_ON_ERROR(esp_timer_create(&args, &s_timer), TAG, "esp_timer_create");
+    }
+    esp_err_t err = esp_timer_start_periodic(s_timer, (uint64_t)GATEWAY_LINKS_MQTT_INTERVAL_S * 1000000);
+    return err == ESP_ERR_INVALID_STATE ? ESP_OK : err; // already running
+#else
+    (void)client;
+    return ESP_OK;
+#endif
+}
@@ -0,0 +1,83 @@
+#ifndef _LINKS_H_
+#define _LINKS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_now.h"
+#include "mqtt_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Link quality per transmitting MAC, taken from recv_info->rx_ctrl by the
+ * receive callback: EWMA and last RSSI, noise floor, PHY rate, a packet rate
+ * estimate from the EWMA of inter-arrival times, and the time last seen.
+ *
+ * The table holds GATEWAY_LINKS_SIZE entries of 24 bytes, hashed by MAC with
+ * a short linear probe; a new MAC takes the least recently seen entry of its
+ * probe window once all of them are in use.
+ */
+#define LINKS_JSON_ENTRY_MAX_LEN 160 // one entry as JSON, with separator
+#define LINKS_CSV_ENTRY_MAX_LEN 96
+#define LINKS_CSV_HEADER "mac,rssi_avg,rssi,noise_floor,rate,channel,frames,per_min,age_s\n"
+
+/**
+ * @brief Link quality of one MAC.
+ */
+typedef struct {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    int8_t rssi;           // dBm, last frame
+    int8_t noise_floor;    // dBm, last frame
+    int16_t rssi_avg_x16;  // 1/16 dBm, EWMA over about 8 frames
+    uint8_t rate;          // rx_ctrl rate of the last frame
+    uint8_t channel;       // rx_ctrl channel of the last frame
+    uint32_t frames;       // since the entry was taken
+    uint32_t interval_us;  // EWMA of the time between frames, 0 until the second frame
+    uint32_t last_seen_ms; // since boot
+} links_entry_t;
+
+/**
+ * @brief Records one received frame, for the receive callback.
+ */
+void links_update(const esp_now_recv_info_t *recv_info);
+
+/**
+ * @brief Copies the table.
+ *
+ * @param[out] out At least GATEWAY_LINKS_SIZE entries.
+ * @return Number of entries in use.
+ */
+size_t links_snapshot(links_entry_t *out);
+
+/**
+ * @brief Formats one entry as a JSON object.
+ *
+ * @param now_ms Milliseconds since boot, for the entry's age.
+ * @return Length written, or -1 if @p cap is too small.
+ */
+int links_format_json(const links_entry_t *e, uint32_t now_ms, char *buf, size_t cap);
+
+/**
+ * @brief Formats one entry as a CSV line matching LINKS_CSV_HEADER.
+ *
+ * @return Length written, or -1 if @p cap is too small.
+ */
+int links_format_csv(const links_entry_t *e, uint32_t now_ms, char *buf, size_t cap);
+
+/**
+ * @brief Publishes the table every GATEWAY_LINKS_MQTT_INTERVAL_S through this client.
+ *
+ * The table goes to GATEWAY_LINKS_MQTT_TOPIC as one JSON array. Does nothing
+ * when the interval is 0.
+ */
+esp_err_t links_set_mqtt_client(esp_mqtt_client_handle_t client);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LINKS_H_ */
@@ -1,49 +1,249 @@
 #include "logs.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
 #include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
 
-#define BUF_SIZE 1024
+#include "config.h"
+#include "metrics.h"
 
-static RingbufHandle_t log_rb = NULL;
-static const char *TAG = "logs";
+#define SCRATCH_LEN 192 // one formatted line with prefix and colors
+#define TAG_BUCKETS 32
+#define TOKEN 1000 // bucket levels are in thousandths of a line
 
-esp_err_t logs_init(RingbufHandle_t *out) {
-    if (unlikely(log_rb != NULL)) {
-        ESP_LOGW(TAG, "Log system already initialized");
-        return ESP_ERR_INVALID_STATE;
+_Static_assert((GATEWAY_SSE_LOGS_RECORDS & (GATEWAY_SSE_LOGS_RECORDS - 1)) == 0,
+               "GATEWAY_SSE_LOGS_RECORDS must be a power of two");
+_Static_assert((GATEWAY_SSE_LOGS_LINES & (GATEWAY_SSE_LOGS_LINES - 1)) == 0,
+               "GATEWAY_SSE_LOGS_LINES must be a power of two");
+
+typedef struct {
+    uint8_t *slots;
+    size_t size;   // bytes per record
+    uint32_t len;  // records, a power of two so that head may wrap
+    uint32_t head; // records ever pushed, the next one goes to slot head % len
+    uint32_t held; // records in the ring, up to len
+} ring_t;
+
+// Token bucket of one tag.
+typedef struct {
+    uint32_t hash; // of the tag, 0 if unused
+    uint32_t tokens;
+    int64_t refilled_us;
+    uint32_t dropped; // since the last line let through
+} bucket_t;
+
+static logs_record_t s_records[GATEWAY_SSE_LOGS_RECORDS];
+static logs_line_t s_lines[GATEWAY_SSE_LOGS_LINES];
+static ring_t s_record_ring = {(uint8_t *)s_records, sizeof(logs_record_t), GATEWAY_SSE_LOGS_RECORDS, 0, 0};
+static ring_t s_line_ring = {(uint8_t *)s_lines, sizeof(logs_line_t), GATEWAY_SSE_LOGS_LINES, 0, 0};
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED; // guards both rings
+
+static vprintf_like_t s_next_vprintf = NULL;
+static char s_scratch[portNUM_PROCESSORS][SCRATCH_LEN];
+static bool s_scratch_busy[portNUM_PROCESSORS];
+static bucket_t s_buckets[TAG_BUCKETS];
+static portMUX_TYPE s_bucket_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void ring_push(ring_t *ring, const void *rec) {
+    portENTER_CRITICAL(&s_lock);
+    memcpy(ring->slots + (ring->head % ring->len) * ring->size, rec, ring->size);
+    ring->head++;
+    ring->held += ring->held < ring->len;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+// Counted rather than derived from head, which wraps around.
+static uint32_t ring_oldest(const ring_t *ring) {
+    return ring->head - ring->held;
+}
+
+static size_t ring_read(const ring_t *ring, uint32_t *cursor, void *out, size_t max, uint32_t *skipped) {
+    size_t n = 0;
+    *skipped = 0;
+
+    portENTER_CRITICAL(&s_lock);
+    if (ring->head - *cursor > ring->len) {
+        *skipped = ring->head - *cursor - ring->len;
+        *cursor = ring->head - ring->len;
+    }
+    while (n < max && *cursor != ring->head) {
+        memcpy((uint8_t *)out + n * ring->size, ring->slots + (*cursor % ring->len) * ring->size, ring->size);
+        (*cursor)++;
+        n++;
     }
+    portEXIT_CRITICAL(&s_lock);
 
-    log_rb = xRingbufferCreate(BUF_SIZE, RINGBUF_TYPE_BYTEBUF);
-    if (unlikely(log_rb == NULL)) {
-        ESP_LOGE(TAG, "Failed to create ring buffer (%u bytes)", BUF_SIZE);
-        return ESP_ERR_NO_MEM;
+    return n;
+}
+
+void logs_push(const uint8_t *mac_addr, size_t len, int msg_id) {
+    logs_record_t rec = {
+        .time_us = esp_timer_get_time(),
+        .msg_id = msg_id,
+        .len = len > UINT16_MAX ? UINT16_MAX : (uint16_t)len,
+    };
+    if (mac_addr != NULL) {
+        memcpy(rec.mac_addr, mac_addr, sizeof(rec.mac_addr));
     }
 
-    *out = log_rb;
-    return ESP_OK;
+    ring_push(&s_record_ring, &rec);
 }
 
-esp_err_t logs_deinit(void) {
-    if (unlikely(log_rb == NULL)) {
-        ESP_LOGW(TAG, "Log system is not initialized");
-        return ESP_ERR_INVALID_STATE;
+void logs_reader_init(logs_reader_t *reader) {
+    portENTER_CRITICAL(&s_lock);
+    reader->cursor = ring_oldest(&s_record_ring);
+    reader->line_cursor = ring_oldest(&s_line_ring);
+    portEXIT_CRITICAL(&s_lock);
+}
+
+size_t logs_read(logs_reader_t *reader, logs_record_t *out, size_t max, uint32_t *skipped) {
+    return ring_read(&s_record_ring, &reader->cursor, out, max, skipped);
+}
+
+size_t logs_read_lines(logs_reader_t *reader, logs_line_t *out, size_t max, uint32_t *skipped) {
+    return ring_read(&s_line_ring, &reader->line_cursor, out, max, skipped);
+}
+
+// FNV-1a, never 0 so that 0 can mark a free bucket.
+static uint32_t tag_hash(const char *tag) {
+    uint32_t h = 2166136261u;
+    for (; *tag != '\0'; tag++) {
+        h = (h ^ (uint8_t)*tag) * 16777619u;
     }
+    return h | 1;
+}
 
-    vRingbufferDelete(log_rb);
-    log_rb = NULL;
-    return ESP_OK;
+// Takes a token for one line of a tag, *dropped receives the lines refused since the last one let through.
+static bool bucket_take(const char *tag, uint32_t *dropped) {
+    const uint32_t hash = tag_hash(tag);
+    const int64_t now = esp_timer_get_time();
+    bool ok;
+
+    portENTER_CRITICAL(&s_bucket_lock);
+    bucket_t *b = &s_buckets[hash % TAG_BUCKETS];
+    if (b->hash != hash) {
+        // Direct mapped: a colliding tag takes the slot over with a full bucket.
+        *b = (bucket_t){.hash = hash, .tokens = GATEWAY_SSE_LOGS_TAG_BURST * TOKEN, .refilled_us = now};
+    }
+
+    const uint64_t refill = (uint64_t)(now - b->refilled_us) * GATEWAY_SSE_LOGS_TAG_RATE * TOKEN / 1000000;
+    const uint64_t tokens = b->tokens + refill;
+    b->tokens = tokens > GATEWAY_SSE_LOGS_TAG_BURST * TOKEN ? GATEWAY_SSE_LOGS_TAG_BURST * TOKEN : (uint32_t)tokens;
+    if (refill > 0) {
+        b->refilled_us = now;
+    }
+
+    ok = b->tokens >= TOKEN;
+    if (ok) {
+        b->tokens -= TOKEN;
+        *dropped = b->dropped;
+        b->dropped = 0;
+    } else {
+        b->dropped++;
+    }
+    portEXIT_CRITICAL(&s_bucket_lock);
+
+    return ok;
 }
 
-esp_err_t logs_push(const char *msg, size_t len) {
-    if (log_rb == NULL || len == 0) {
-        return ESP_OK;
+// Copies up to cap - 1 bytes, leaving out color escapes and replacing other control characters.
+static const char *copy_text(char *dst, size_t cap, const char *src, const char *end, char stop) {
+    size_t n = 0;
+    while (src < end && *src != stop) {
+        if (*src == '\033') {
+            while (src < end && *src != 'm') {
+                src++;
+            }
+            src += src < end;
+            continue;
+        }
+        if (n + 1 < cap) {
+            dst[n++] = (uint8_t)*src < ' ' ? ' ' : *src;
+        }
+        src++;
+    }
+    while (n > 0 && dst[n - 1] == ' ') {
+        n--; // line end
+    }
+    dst[n] = '\0';
+
+    return src;
+}
+
+// Splits "I (123) tag: text" and stores it, unless its tag is over its rate.
+static void capture(const char *s, size_t len) {
+    const char *end = s + len;
+    while (s < end && *s == '\033') {
+        while (s < end && *s++ != 'm') {
+        }
+    }
+
+    logs_line_t line = {.level = '?'};
+    const char *rparen = end - s > 3 && s[1] == ' ' && s[2] == '(' ? memchr(s, ')', (size_t)(end - s)) : NULL;
+    const char *tag = rparen != NULL && end - rparen > 2 ? rparen + 2 : NULL;
+    if (tag != NULL && memchr(tag, ':', (size_t)(end - tag)) != NULL) {
+        line.level = s[0];
+        s = copy_text(line.tag, sizeof(line.tag), tag, end, ':') + 1;
+        s += s < end && *s == ' ';
     }
 
-    if (unlikely(msg == NULL)) {
-        ESP_LOGE(TAG, "logs_push called with NULL message");
-        return ESP_ERR_INVALID_ARG;
+    if (!bucket_take(line.tag, &line.dropped)) {
+        metrics_inc(METRIC_LOGS_RATE_LIMITED);
+        return;
     }
 
-    xRingbufferSend(log_rb, msg, len, 0);
+    copy_text(line.text, sizeof(line.text), s, end, '\0');
+    line.time_us = esp_timer_get_time();
+    ring_push(&s_line_ring, &line);
+    metrics_inc(METRIC_LOGS_CAPTURED);
+}
+
+static int capture_vprintf(const char *fmt, va_list ap) {
+    va_list copy;
+    va_copy(copy, ap);
+    const int ret = s_next_vprintf(fmt, ap);
+
+    // The task may be preempted, or even move to the other CPU, while it formats: whoever finds the buffer taken
+    // drops the line instead of waiting.
+    const int core = xPortGetCoreID();
+    if (unlikely(__atomic_exchange_n(&s_scratch_busy[core], true, __ATOMIC_ACQUIRE))) {
+        metrics_inc(METRIC_LOGS_BUSY);
+    } else {
+        const int n = vsnprintf(s_scratch[core], SCRATCH_LEN, fmt, copy);
+        if (n > 0) {
+            capture(s_scratch[core], (size_t)n < SCRATCH_LEN ? (size_t)n : SCRATCH_LEN - 1);
+        }
+        __atomic_store_n(&s_scratch_busy[core], false, __ATOMIC_RELEASE);
+    }
 
+    va_end(copy);
+    return ret;
+}
+
+esp_err_t logs_capture_start(void) {
+    if (unlikely(s_next_vprintf != NULL)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    s_next_vprintf = esp_log_set_vprintf(capture_vprintf);
     return ESP_OK;
 }
+
+int logs_format_sse(const logs_record_t *rec, char *buf, size_t cap) {
+    const int n = snprintf(buf, cap, "data:%" PRId64 "," MACSTR ",%u,%" PRId32 "\n\n", rec->time_us / 1000,
+                           MAC2STR(rec->mac_addr), (unsigned)rec->len, rec->msg_id);
+    return n < 0 || (size_t)n >= cap ? -1 : n;
+}
+
+int logs_format_line_sse(const logs_line_t *line, char *buf, size_t cap) {
+    const int n = snprintf(buf, cap, "event:log\ndata:%" PRId64 ",%c,%s,%" PRIu32 ",%s\n\n", line->time_us / 1000,
+                           line->level, line->tag, line->dropped, line->text);
+    return n < 0 || (size_t)n >= cap ? -1 : n;
+}
@@ -1,42 +1,116 @@
 #ifndef _LOGS_H_
 #define _LOGS_H_
 
-#include "esp_err.h"
-#include "freertos/ringbuf.h"
 #include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_now.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * Fixed-record event rings behind /logs: one of published messages, and one
+ * of ESP-IDF log lines captured by logs_capture_start(). Producers copy one
+ * record in and never wait, formatting is left to the readers. Every reader
+ * keeps its own cursors: a reader that falls further behind than a ring holds
+ * skips to the oldest record still there and is told how many it missed.
+ */
+#define LOGS_TAG_MAX_LEN 16
+#define LOGS_TEXT_MAX_LEN 96
+
+/**
+ * @brief One published message.
+ */
+typedef struct {
+    int64_t time_us;                    // esp_timer_get_time() of the publish
+    int32_t msg_id;                     // MQTT message id, negative if the client refused the message
+    uint16_t len;                       // payload length
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN]; // sender, all zero for batches and spooled messages
+} logs_record_t;
+
+/**
+ * @brief One captured log line, "I (123) tag: text" split up.
+ */
+typedef struct {
+    int64_t time_us;
+    uint32_t dropped;             // lines of the same tag rate limited right before this one
+    char level;                   // 'E', 'W', 'I', 'D', 'V', or '?' if the line had no ESP-IDF prefix
+    char tag[LOGS_TAG_MAX_LEN];   // truncated
+    char text[LOGS_TEXT_MAX_LEN]; // truncated, without line end and colors
+} logs_line_t;
+
+/**
+ * @brief Position of one reader in the rings.
+ */
+typedef struct {
+    uint32_t cursor;      // sequence number of the next record to read
+    uint32_t line_cursor; // sequence number of the next line to read
+} logs_reader_t;
+
+/**
+ * @brief Appends a record, overwriting the oldest one if the ring is full.
+ *
+ * Safe from any task, never blocks.
+ *
+ * @param mac_addr Sender, NULL if the message has none.
+ * @param len Payload length in bytes.
+ * @param msg_id MQTT message id.
+ */
+void logs_push(const uint8_t *mac_addr, size_t len, int msg_id);
+
 /**
- * @brief Initializes log ring buffer.
+ * @brief Copies ESP-IDF log output into the line ring as well.
  *
- * @param[out] out Pointer to receive created ring buffer handle.
- * @return ESP_OK on success, ESP_ERR_INVALID_STATE if already initialized,
- *         or ESP_ERR_NO_MEM on allocation failure.
+ * Installs an esp_log_set_vprintf() hook that keeps writing to the previous
+ * output. Lines are formatted into a per-CPU scratch buffer, nothing is
+ * allocated, and the calling task never waits: a line is dropped when the
+ * scratch buffer of its CPU is in use, or when its tag ran out of tokens
+ * (GATEWAY_SSE_LOGS_TAG_RATE lines per second, bursts of
+ * GATEWAY_SSE_LOGS_TAG_BURST).
+ *
+ * @return ESP_OK, or ESP_ERR_INVALID_STATE if already started.
+ */
+esp_err_t logs_capture_start(void);
+
+/**
+ * @brief Positions a reader at the oldest records still held.
  */
-esp_err_t logs_init(RingbufHandle_t *out);
+void logs_reader_init(logs_reader_t *reader);
 
 /**
- * @brief Deinitializes log ring buffer and releases its resources.
+ * @brief Copies the next records of a reader out of the ring.
  *
- * @return ESP_OK on success, or ESP_ERR_INVALID_STATE if not initialized.
+ * @param reader Reader, advanced past the copied records.
+ * @param[out] out Destination.
+ * @param max Capacity of @p out in records.
+ * @param[out] skipped Records overwritten before the reader got to them.
+ * @return Number of records copied, 0 if the reader is up to date.
  */
-esp_err_t logs_deinit(void);
+size_t logs_read(logs_reader_t *reader, logs_record_t *out, size_t max, uint32_t *skipped);
 
 /**
- * @brief Appends a log record to ring buffer.
+ * @brief Copies the next log lines of a reader out of the line ring.
  *
- * If logging is not initialized, message length is zero, or the ring buffer
- * is full, the message is silently dropped.
+ * Same as logs_read() for the line ring.
+ */
+size_t logs_read_lines(logs_reader_t *reader, logs_line_t *out, size_t max, uint32_t *skipped);
+
+/**
+ * @brief Formats a record as one SSE event.
+ *
+ * @return Length written without the terminator, or -1 if @p cap is too small.
+ */
+int logs_format_sse(const logs_record_t *rec, char *buf, size_t cap);
+
+/**
+ * @brief Formats a log line as one SSE event of type "log".
  *
- * @param msg Pointer to message bytes.
- * @param len Message length in bytes.
- * @return ESP_OK on success or when dropped silently, ESP_ERR_INVALID_ARG for
- *         invalid input (NULL message with non-zero length).
+ * @return Length written without the terminator, or -1 if @p cap is too small.
  */
-esp_err_t logs_push(const char *msg, size_t len);
+int logs_format_line_sse(const logs_line_t *line, char *buf, size_t cap);
 
 #ifdef __cplusplus
 }
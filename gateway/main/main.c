@@ -13,18 +13,32 @@ static const char *const TAG = "main_gateway";
 #include "closer.h"
 
 #include "config.h"
+#if CONFIG_GATEWAY_BEACON
+#include "beacon.h"
+#endif
+#if CONFIG_GATEWAY_DOWNLINK
+#include "downlink.h"
+#endif
 #include "espnow.h"
 #include "httpd.h"
+#if CONFIG_GATEWAY_LINKS
+#include "links.h"
+#endif
 #if CONFIG_GATEWAY_ENABLE_SSE_LOGS
 #include "logs.h"
 #endif
+#if CONFIG_GATEWAY_ENCRYPT
+#include "keys.h"
+#endif
+#if CONFIG_GATEWAY_REGISTRY
+#include "registry.h"
+#endif
 #include "settings.h"
+#include "uplink.h"
 #include "wifi.h"
 
 static esp_mqtt_client_handle_t s_client = NULL;
 
-#define MQTT_TOPIC_MAX_LEN 27 // "/device/" + MACSTR + '\0'
-
 __attribute__((cold)) static esp_err_t nvs_init(void) {
     esp_err_t ret = nvs_flash_init();
     if (unlikely(ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)) {
@@ -49,13 +63,42 @@ __attribute__((cold)) static esp_err_t mqtt_app_start(void) {
         return ESP_FAIL;
     }
 
-    err = esp_mqtt_client_start(s_client);
+    err = uplink_set_mqtt_client(s_client);
+#if CONFIG_GATEWAY_DOWNLINK
+    if (err == ESP_OK) {
+        err = downlink_set_mqtt_client(s_client);
+    }
+#endif
+#if CONFIG_GATEWAY_LINKS
+    if (err == ESP_OK) {
+        err = links_set_mqtt_client(s_client);
+    }
+#endif
+#if CONFIG_GATEWAY_REGISTRY
+    if (err == ESP_OK) {
+        err = registry_set_mqtt_client(s_client);
+    }
+#endif
+    if (err == ESP_OK) {
+        err = esp_mqtt_client_start(s_client);
+    }
     if (err != ESP_OK) {
+        uplink_set_mqtt_client(NULL);
+#if CONFIG_GATEWAY_DOWNLINK
+        downlink_set_mqtt_client(NULL);
+#endif
+#if CONFIG_GATEWAY_LINKS
+        links_set_mqtt_client(NULL);
+#endif
+#if CONFIG_GATEWAY_REGISTRY
+        registry_set_mqtt_client(NULL);
+#endif
         esp_mqtt_client_destroy(s_client);
         s_client = NULL;
+        return err;
     }
 
-    return err;
+    return ESP_OK;
 }
 
 static esp_err_t mdns_start(void) {
@@ -71,47 +114,27 @@ static esp_err_t mdns_start(void) {
     return ESP_OK;
 }
 
-static esp_err_t handle(const espnow_rx_t *rx) {
-    if (s_client == NULL) {
-        ESP_LOGW(TAG, "mqtt client is not initialized");
-        return ESP_OK;
-    }
-
-    char topic[MQTT_TOPIC_MAX_LEN];
-    int topic_n = snprintf(topic, sizeof(topic), "/device/" MACSTR "", MAC2STR(rx->mac_addr));
-    if (topic_n < 0 || (size_t)topic_n >= sizeof(topic)) {
-        ESP_LOGE(TAG, "Failed to format MQTT topic");
-        return ESP_FAIL;
-    }
-
-    int msg_id = esp_mqtt_client_publish(s_client, topic, (const char *)rx->data, rx->len, GATEWAY_BROKER_QOS,
-                                         GATEWAY_BROKER_RETAIN);
-
-    ESP_LOGI(TAG, "mqtt publish, topic=%s len=%u msg_id=%d", topic, (unsigned)rx->len, msg_id);
-
-    if (msg_id < 0) {
-        return ESP_FAIL;
-    }
-
+static esp_err_t app_run(void) {
 #if CONFIG_GATEWAY_ENABLE_SSE_LOGS
-    char line[256];
-    int n = snprintf(line, sizeof(line), "data:%s,%u,%d\n\n", topic, (unsigned)rx->len, msg_id);
-    if (n < 0 || (size_t)n >= sizeof(line)) {
-        ESP_LOGE(TAG, "Failed to format SSE log line");
-        return ESP_FAIL;
-    }
-
-    return logs_push(line, (size_t)n);
+    ESP_RETURN_ON_ERROR(logs_capture_start(), TAG, "logs_capture_start");
 #endif
-
-    return ESP_OK;
-}
-
-static esp_err_t app_run(void) {
     ESP_RETURN_ON_ERROR(nvs_init(), TAG, "nvs_init");
     ESP_RETURN_ON_ERROR(settings_init(), TAG, "settings_init");
+#if CONFIG_GATEWAY_REGISTRY
+    ESP_RETURN_ON_ERROR(registry_start(), TAG, "registry_start");
+#endif
     ESP_RETURN_ON_ERROR(with_closer(wifi_start, NULL), TAG, "wifi_start");
-    ESP_RETURN_ON_ERROR(with_closer(espnow_start, &handle), TAG, "espnow_start");
+    ESP_RETURN_ON_ERROR(uplink_init(), TAG, "uplink_init");
+    ESP_RETURN_ON_ERROR(with_closer(espnow_start, (void *)uplink_handlers()), TAG, "espnow_start");
+#if CONFIG_GATEWAY_BEACON
+    ESP_RETURN_ON_ERROR(beacon_start(), TAG, "beacon_start");
+#endif
+#if CONFIG_GATEWAY_ENCRYPT
+    ESP_RETURN_ON_ERROR(keys_start(), TAG, "keys_start");
+#endif
+#if CONFIG_GATEWAY_DOWNLINK
+    ESP_RETURN_ON_ERROR(downlink_start(), TAG, "downlink_start");
+#endif
     ESP_RETURN_ON_ERROR(mdns_start(), TAG, "mdns_start");
     ESP_RETURN_ON_ERROR(mqtt_app_start(), TAG, "mqtt_app_start");
     ESP_RETURN_ON_ERROR(httpd_start_server(), TAG, "httpd_start_server");
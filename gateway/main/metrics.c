@@ -0,0 +1,426 @@
+#include "metrics.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "esp_heap_caps.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+
+#include "config.h"
+#include "espnow.h"
+#include "rx_pool.h"
+#if CONFIG_GATEWAY_DOWNLINK
+#include "downlink.h"
+#endif
+#if CONFIG_GATEWAY_ENCRYPT
+#include "keys.h"
+#endif
+#if CONFIG_GATEWAY_REGISTRY
+#include "registry.h"
+#endif
+#if CONFIG_GATEWAY_SPOOL
+#include "spooler.h"
+#endif
+
+#define LINE_MAX_LEN 160
+
+metrics_core_t metrics_cores[portNUM_PROCESSORS];
+
+// Upper bounds of finite latency buckets, microseconds.
+static const uint32_t s_latency_le_us[METRICS_LATENCY_BUCKETS] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 50000, 250000,
+};
+
+// Upper bounds of downlink latency buckets, milliseconds. Commands may wait for a sleeping node.
+static const uint32_t s_downlink_le_ms[METRICS_DOWNLINK_BUCKETS] = {
+    10, 50, 100, 500, 1000, 5000, 30000, 300000,
+};
+
+// Tasks outside this component whose stack headroom is worth watching.
+static const char *const s_watched_tasks[] = {"mqtt_task", "httpd",   "tiT",      "wifi",    "sys_evt",
+                                              "esp_timer", "spooler", "downlink", "registry"};
+
+void metrics_observe_publish(uint32_t us) {
+    metrics_core_t *core = &metrics_cores[xPortGetCoreID()];
+
+    size_t b = 0;
+    while (b < METRICS_LATENCY_BUCKETS && us > s_latency_le_us[b]) {
+        b++;
+    }
+
+    __atomic_fetch_add(&core->latency[b], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&core->latency_sum_us, us, __ATOMIC_RELAXED);
+}
+
+void metrics_observe_downlink(uint32_t ms) {
+    metrics_core_t *core = &metrics_cores[xPortGetCoreID()];
+
+    size_t b = 0;
+    while (b < METRICS_DOWNLINK_BUCKETS && ms > s_downlink_le_ms[b]) {
+        b++;
+    }
+
+    __atomic_fetch_add(&core->downlink_latency[b], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&core->downlink_latency_sum_ms, ms, __ATOMIC_RELAXED);
+}
+
+static uint32_t load(const uint32_t *v) {
+    return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+static uint32_t counter(metric_t m) {
+    uint32_t total = 0;
+    for (size_t c = 0; c < portNUM_PROCESSORS; c++) {
+        total += load(&metrics_cores[c].counters[m]);
+    }
+    return total;
+}
+
+static uint32_t latency_bucket(size_t b) {
+    uint32_t total = 0;
+    for (size_t c = 0; c < portNUM_PROCESSORS; c++) {
+        total += load(&metrics_cores[c].latency[b]);
+    }
+    return total;
+}
+
+static uint32_t latency_sum_us(void) {
+    uint32_t total = 0;
+    for (size_t c = 0; c < portNUM_PROCESSORS; c++) {
+        total += load(&metrics_cores[c].latency_sum_us);
+    }
+    return total;
+}
+
+#if CONFIG_GATEWAY_DOWNLINK
+static uint32_t downlink_bucket(size_t b) {
+    uint32_t total = 0;
+    for (size_t c = 0; c < portNUM_PROCESSORS; c++) {
+        total += load(&metrics_cores[c].downlink_latency[b]);
+    }
+    return total;
+}
+
+static uint32_t downlink_sum_ms(void) {
+    uint32_t total = 0;
+    for (size_t c = 0; c < portNUM_PROCESSORS; c++) {
+        total += load(&metrics_cores[c].downlink_latency_sum_ms);
+    }
+    return total;
+}
+#endif
+
+typedef struct {
+    metrics_write_fn write;
+    void *ctx;
+    esp_err_t err;
+} renderer_t;
+
+__attribute__((format(printf, 2, 3))) static void emit(renderer_t *r, const char *fmt, ...) {
+    if (r->err != ESP_OK) {
+        return;
+    }
+
+    char line[LINE_MAX_LEN];
+    va_list ap;
+    va_start(ap, fmt);
+    const int n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    if (unlikely(n < 0 || (size_t)n >= sizeof(line))) {
+        r->err = ESP_ERR_INVALID_SIZE;
+        return;
+    }
+
+    r->err = r->write(r->ctx, line, (size_t)n);
+}
+
+static void header(renderer_t *r, const char *name, const char *type, const char *help) {
+    emit(r, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void render_rx(renderer_t *r) {
+    header(r, "gateway_rx_frames_total", "counter", "ESP-NOW frames received.");
+    emit(r, "gateway_rx_frames_total %" PRIu32 "\n", counter(METRIC_RX_FRAMES));
+
+    header(r, "gateway_rx_bytes_total", "counter", "ESP-NOW payload bytes received.");
+    emit(r, "gateway_rx_bytes_total %" PRIu32 "\n", counter(METRIC_RX_BYTES));
+
+    header(r, "gateway_rx_dropped_total", "counter", "Frames dropped before reaching a worker.");
+    emit(r, "gateway_rx_dropped_total{reason=\"invalid\"} %" PRIu32 "\n", counter(METRIC_RX_DROP_INVALID));
+    emit(r, "gateway_rx_dropped_total{reason=\"pool_exhausted\"} %" PRIu32 "\n", counter(METRIC_RX_DROP_POOL));
+    emit(r, "gateway_rx_dropped_total{reason=\"queue_full\"} %" PRIu32 "\n", counter(METRIC_RX_DROP_QUEUE));
+    emit(r, "gateway_rx_dropped_total{reason=\"evicted_oldest\"} %" PRIu32 "\n", counter(METRIC_RX_DROP_OLDEST));
+    emit(r, "gateway_rx_dropped_total{reason=\"fair_share\"} %" PRIu32 "\n", counter(METRIC_RX_DROP_FAIR));
+
+    header(r, "gateway_rx_duplicates_total", "counter", "Sequenced frames dropped as duplicates.");
+    emit(r, "gateway_rx_duplicates_total %" PRIu32 "\n", counter(METRIC_RX_DUPLICATES));
+
+#if CONFIG_GATEWAY_UNBATCH
+    header(r, "gateway_rx_batch_records_total", "counter", "Messages split out of node batch frames.");
+    emit(r, "gateway_rx_batch_records_total %" PRIu32 "\n", counter(METRIC_RX_BATCH_RECORDS));
+#endif
+
+#if CONFIG_GATEWAY_DELTA
+    header(r, "gateway_rx_delta_frames_total", "counter", "Delta encoded node batches restored.");
+    emit(r, "gateway_rx_delta_frames_total %" PRIu32 "\n", counter(METRIC_RX_DELTA_FRAMES));
+
+    header(r, "gateway_rx_delta_saved_bytes_total", "counter", "Bytes saved on air by delta encoded batches.");
+    emit(r, "gateway_rx_delta_saved_bytes_total %" PRIu32 "\n", counter(METRIC_RX_DELTA_BYTES));
+#endif
+
+#if CONFIG_GATEWAY_AUTH
+    header(r, "gateway_rx_auth_verified_total", "counter", "Authenticated node frames accepted.");
+    emit(r, "gateway_rx_auth_verified_total %" PRIu32 "\n", counter(METRIC_RX_AUTH_VERIFIED));
+
+    header(r, "gateway_rx_auth_dropped_total", "counter", "Frames dropped by authentication before publishing.");
+    emit(r, "gateway_rx_auth_dropped_total{reason=\"bad_tag\"} %" PRIu32 "\n", counter(METRIC_RX_AUTH_BAD_TAG));
+    emit(r, "gateway_rx_auth_dropped_total{reason=\"replayed\"} %" PRIu32 "\n", counter(METRIC_RX_AUTH_REPLAYED));
+    emit(r, "gateway_rx_auth_dropped_total{reason=\"missing\"} %" PRIu32 "\n", counter(METRIC_RX_AUTH_MISSING));
+    emit(r, "gateway_rx_auth_dropped_total{reason=\"full\"} %" PRIu32 "\n", counter(METRIC_RX_AUTH_FULL));
+#endif
+
+    header(r, "gateway_rx_pool_in_use", "gauge", "RX descriptors borrowed from the pool.");
+    emit(r, "gateway_rx_pool_in_use %u\n", (unsigned)rx_pool_in_use());
+
+    header(r, "gateway_espnow_queue_length", "gauge", "Frames waiting in a worker queue.");
+    for (size_t i = 0; i < GATEWAY_ESPNOW_WORKERS; i++) {
+        espnow_worker_stats_t st;
+        if (espnow_worker_stats(i, &st) == ESP_OK) {
+            emit(r, "gateway_espnow_queue_length{worker=\"%u\"} %u\n", (unsigned)i, (unsigned)st.queue_len);
+        }
+    }
+
+    header(r, "gateway_espnow_queue_high_water", "gauge", "Highest worker queue length seen since boot.");
+    for (size_t i = 0; i < GATEWAY_ESPNOW_WORKERS; i++) {
+        espnow_worker_stats_t st;
+        if (espnow_worker_stats(i, &st) == ESP_OK) {
+            emit(r, "gateway_espnow_queue_high_water{worker=\"%u\"} %" PRIu32 "\n", (unsigned)i, st.queue_hwm);
+        }
+    }
+}
+
+static void render_mqtt(renderer_t *r) {
+    header(r, "gateway_mqtt_publish_total", "counter", "MQTT publish calls by result.");
+    emit(r, "gateway_mqtt_publish_total{result=\"ok\"} %" PRIu32 "\n", counter(METRIC_MQTT_PUBLISHED));
+    emit(r, "gateway_mqtt_publish_total{result=\"error\"} %" PRIu32 "\n", counter(METRIC_MQTT_FAILED));
+
+    header(r, "gateway_mqtt_publish_seconds", "histogram", "Time spent in MQTT publish or enqueue calls.");
+    uint32_t cumulative = 0;
+    for (size_t b = 0; b < METRICS_LATENCY_BUCKETS; b++) {
+        cumulative += latency_bucket(b);
+        emit(r, "gateway_mqtt_publish_seconds_bucket{le=\"%" PRIu32 ".%06" PRIu32 "\"} %" PRIu32 "\n",
+             s_latency_le_us[b] / 1000000, s_latency_le_us[b] % 1000000, cumulative);
+    }
+    cumulative += latency_bucket(METRICS_LATENCY_BUCKETS);
+    emit(r, "gateway_mqtt_publish_seconds_bucket{le=\"+Inf\"} %" PRIu32 "\n", cumulative);
+
+    const uint32_t sum_us = latency_sum_us();
+    emit(r, "gateway_mqtt_publish_seconds_sum %" PRIu32 ".%06" PRIu32 "\n", sum_us / 1000000, sum_us % 1000000);
+    emit(r, "gateway_mqtt_publish_seconds_count %" PRIu32 "\n", cumulative);
+}
+
+#if CONFIG_GATEWAY_DOWNLINK
+static void render_downlink(renderer_t *r) {
+    header(r, "gateway_downlink_commands_total", "counter", "MQTT commands for nodes by outcome.");
+    emit(r, "gateway_downlink_commands_total{outcome=\"received\"} %" PRIu32 "\n", counter(METRIC_DOWNLINK_RECEIVED));
+    emit(r, "gateway_downlink_commands_total{outcome=\"delivered\"} %" PRIu32 "\n",
+         counter(METRIC_DOWNLINK_DELIVERED));
+    emit(r, "gateway_downlink_commands_total{outcome=\"invalid\"} %" PRIu32 "\n",
+         counter(METRIC_DOWNLINK_DROP_INVALID));
+    emit(r, "gateway_downlink_commands_total{outcome=\"queue_full\"} %" PRIu32 "\n",
+         counter(METRIC_DOWNLINK_DROP_FULL));
+    emit(r, "gateway_downlink_commands_total{outcome=\"evicted\"} %" PRIu32 "\n",
+         counter(METRIC_DOWNLINK_DROP_EVICTED));
+    emit(r, "gateway_downlink_commands_total{outcome=\"expired\"} %" PRIu32 "\n",
+         counter(METRIC_DOWNLINK_DROP_EXPIRED));
+
+    header(r, "gateway_downlink_frames_total", "counter", "ESP-NOW downlink frames by acknowledgement.");
+    emit(r, "gateway_downlink_frames_total{result=\"ok\"} %" PRIu32 "\n", counter(METRIC_DOWNLINK_FRAMES_OK));
+    emit(r, "gateway_downlink_frames_total{result=\"no_ack\"} %" PRIu32 "\n",
+         counter(METRIC_DOWNLINK_FRAMES_FAILED));
+
+    downlink_stats_t st;
+    downlink_stats(&st);
+    header(r, "gateway_downlink_queued", "gauge", "Commands waiting for their node.");
+    emit(r, "gateway_downlink_queued %" PRIu32 "\n", st.queued);
+    header(r, "gateway_downlink_peers", "gauge", "Nodes registered as ESP-NOW unicast peers.");
+    emit(r, "gateway_downlink_peers %" PRIu32 "\n", st.peers);
+
+    header(r, "gateway_downlink_latency_seconds", "histogram",
+           "Time from receiving a command from the broker to its node acknowledging it.");
+    uint32_t cumulative = 0;
+    for (size_t b = 0; b < METRICS_DOWNLINK_BUCKETS; b++) {
+        cumulative += downlink_bucket(b);
+        emit(r, "gateway_downlink_latency_seconds_bucket{le=\"%" PRIu32 ".%03" PRIu32 "\"} %" PRIu32 "\n",
+             s_downlink_le_ms[b] / 1000, s_downlink_le_ms[b] % 1000, cumulative);
+    }
+    cumulative += downlink_bucket(METRICS_DOWNLINK_BUCKETS);
+    emit(r, "gateway_downlink_latency_seconds_bucket{le=\"+Inf\"} %" PRIu32 "\n", cumulative);
+
+    const uint32_t sum_ms = downlink_sum_ms();
+    emit(r, "gateway_downlink_latency_seconds_sum %" PRIu32 ".%03" PRIu32 "\n", sum_ms / 1000, sum_ms % 1000);
+    emit(r, "gateway_downlink_latency_seconds_count %" PRIu32 "\n", cumulative);
+}
+#endif
+
+#if CONFIG_GATEWAY_BEACON
+static void render_beacon(renderer_t *r) {
+    header(r, "gateway_beacons_total", "counter", "Channel beacons broadcast by trigger.");
+    emit(r, "gateway_beacons_total{trigger=\"periodic\"} %" PRIu32 "\n", counter(METRIC_BEACON_PERIODIC));
+    emit(r, "gateway_beacons_total{trigger=\"probe\"} %" PRIu32 "\n", counter(METRIC_BEACON_PROBED));
+}
+#endif
+
+#if CONFIG_GATEWAY_ENCRYPT
+static void render_keys(renderer_t *r) {
+    keys_stats_t st;
+    keys_stats(&st);
+
+    header(r, "gateway_keys_epoch", "gauge", "Current key epoch.");
+    emit(r, "gateway_keys_epoch %" PRIu32 "\n", st.epoch);
+    header(r, "gateway_keys_sessions", "gauge", "Nodes with a leased encrypted peer.");
+    emit(r, "gateway_keys_sessions %" PRIu32 "\n", st.sessions);
+
+    header(r, "gateway_keys_handshakes_total", "counter", "Key messages from nodes by outcome.");
+    emit(r, "gateway_keys_handshakes_total{outcome=\"paired\"} %" PRIu32 "\n", st.paired);
+    emit(r, "gateway_keys_handshakes_total{outcome=\"ready\"} %" PRIu32 "\n", st.hellos - st.rekeys);
+    emit(r, "gateway_keys_handshakes_total{outcome=\"rekeyed\"} %" PRIu32 "\n", st.rekeys);
+    emit(r, "gateway_keys_handshakes_total{outcome=\"rejected\"} %" PRIu32 "\n", st.rejected);
+    emit(r, "gateway_keys_handshakes_total{outcome=\"forged\"} %" PRIu32 "\n", st.forged);
+    emit(r, "gateway_keys_handshakes_total{outcome=\"replayed\"} %" PRIu32 "\n", st.replayed);
+
+    header(r, "gateway_keys_swaps_total", "counter", "Expired sessions swapped out for another node.");
+    emit(r, "gateway_keys_swaps_total %" PRIu32 "\n", st.swaps);
+    header(r, "gateway_keys_rotations_total", "counter", "Key epochs started since boot.");
+    emit(r, "gateway_keys_rotations_total %" PRIu32 "\n", st.rotations);
+    header(r, "gateway_keys_rotation_seconds", "gauge", "Duration of the last rotation.");
+    emit(r, "gateway_keys_rotation_seconds %" PRIu32 ".%06" PRIu32 "\n", st.rotate_us / 1000000,
+         st.rotate_us % 1000000);
+
+    header(r, "gateway_keys_derive_seconds", "summary", "Time spent deriving node keys.");
+    emit(r, "gateway_keys_derive_seconds_sum %" PRIu32 ".%06" PRIu32 "\n", st.derive_us / 1000000,
+         st.derive_us % 1000000);
+    emit(r, "gateway_keys_derive_seconds_count %" PRIu32 "\n", st.derives);
+
+    header(r, "gateway_keys_peer_op_seconds", "summary", "Time spent adding, changing and removing ESP-NOW peers.");
+    emit(r, "gateway_keys_peer_op_seconds_sum %" PRIu32 ".%06" PRIu32 "\n", st.peer_us / 1000000,
+         st.peer_us % 1000000);
+    emit(r, "gateway_keys_peer_op_seconds_count %" PRIu32 "\n", st.peer_ops);
+}
+#endif
+
+#if CONFIG_GATEWAY_SPOOL
+static void render_spool(renderer_t *r) {
+    spool_stats_t st;
+    spooler_stats(&st);
+
+    header(r, "gateway_spool_pending", "gauge", "Messages spooled to flash and not yet republished.");
+    emit(r, "gateway_spool_pending %" PRIu32 "\n", st.pending);
+
+    header(r, "gateway_spool_messages_total", "counter", "Spooled messages by outcome.");
+    emit(r, "gateway_spool_messages_total{outcome=\"appended\"} %" PRIu32 "\n", st.appended);
+    emit(r, "gateway_spool_messages_total{outcome=\"republished\"} %" PRIu32 "\n", st.consumed);
+    emit(r, "gateway_spool_messages_total{outcome=\"overwritten\"} %" PRIu32 "\n", st.dropped);
+    emit(r, "gateway_spool_messages_total{outcome=\"too_large\"} %" PRIu32 "\n", st.too_large);
+
+    header(r, "gateway_spool_erases_total", "counter", "Flash sectors erased by the spool.");
+    emit(r, "gateway_spool_erases_total %" PRIu32 "\n", st.erases);
+}
+#endif
+
+#if CONFIG_GATEWAY_REGISTRY
+static void render_registry(renderer_t *r) {
+    header(r, "gateway_registry_transitions_total", "counter", "Node presence changes by new state.");
+    emit(r, "gateway_registry_transitions_total{state=\"online\"} %" PRIu32 "\n", counter(METRIC_REGISTRY_ONLINE));
+    emit(r, "gateway_registry_transitions_total{state=\"offline\"} %" PRIu32 "\n",
+         counter(METRIC_REGISTRY_OFFLINE));
+
+    header(r, "gateway_registry_full_total", "counter", "Frames from nodes not registered, the registry was full.");
+    emit(r, "gateway_registry_full_total %" PRIu32 "\n", counter(METRIC_REGISTRY_FULL));
+
+    registry_stats_t st;
+    registry_stats(&st);
+    header(r, "gateway_registry_nodes", "gauge", "Registered nodes by presence.");
+    emit(r, "gateway_registry_nodes{state=\"online\"} %" PRIu32 "\n", st.online);
+    emit(r, "gateway_registry_nodes{state=\"offline\"} %" PRIu32 "\n", st.known - st.online);
+}
+#endif
+
+#if CONFIG_GATEWAY_CAPTURE
+static void render_capture(renderer_t *r) {
+    header(r, "gateway_capture_frames_total", "counter", "Received frames matching a /capture filter by outcome.");
+    emit(r, "gateway_capture_frames_total{outcome=\"written\"} %" PRIu32 "\n", counter(METRIC_CAPTURE_FRAMES));
+    emit(r, "gateway_capture_frames_total{outcome=\"dropped\"} %" PRIu32 "\n", counter(METRIC_CAPTURE_DROPPED));
+}
+#endif
+
+#if CONFIG_GATEWAY_ENABLE_SSE_LOGS
+static void render_logs(renderer_t *r) {
+    header(r, "gateway_logs_lines_total", "counter", "ESP-IDF log lines offered to /logs by outcome.");
+    emit(r, "gateway_logs_lines_total{outcome=\"captured\"} %" PRIu32 "\n", counter(METRIC_LOGS_CAPTURED));
+    emit(r, "gateway_logs_lines_total{outcome=\"rate_limited\"} %" PRIu32 "\n", counter(METRIC_LOGS_RATE_LIMITED));
+    emit(r, "gateway_logs_lines_total{outcome=\"busy\"} %" PRIu32 "\n", counter(METRIC_LOGS_BUSY));
+}
+#endif
+
+static void render_system(renderer_t *r) {
+    header(r, "gateway_task_stack_free_min_bytes", "gauge", "Lowest free stack of a task since it started.");
+    for (size_t i = 0; i < GATEWAY_ESPNOW_WORKERS; i++) {
+        espnow_worker_stats_t st;
+        if (espnow_worker_stats(i, &st) == ESP_OK && st.task != NULL) {
+            emit(r, "gateway_task_stack_free_min_bytes{task=\"%s\"} %u\n", pcTaskGetName(st.task),
+                 (unsigned)uxTaskGetStackHighWaterMark(st.task));
+        }
+    }
+    for (size_t i = 0; i < sizeof(s_watched_tasks) / sizeof(s_watched_tasks[0]); i++) {
+        TaskHandle_t task = xTaskGetHandle(s_watched_tasks[i]);
+        if (task != NULL) {
+            emit(r, "gateway_task_stack_free_min_bytes{task=\"%s\"} %u\n", s_watched_tasks[i],
+                 (unsigned)uxTaskGetStackHighWaterMark(task));
+        }
+    }
+
+    header(r, "gateway_heap_free_bytes", "gauge", "Free heap.");
+    emit(r, "gateway_heap_free_bytes %u\n", (unsigned)heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+
+    header(r, "gateway_heap_free_min_bytes", "gauge", "Lowest free heap since boot.");
+    emit(r, "gateway_heap_free_min_bytes %" PRIu32 "\n", esp_get_minimum_free_heap_size());
+
+    header(r, "gateway_uptime_seconds", "counter", "Time since boot.");
+    emit(r, "gateway_uptime_seconds %" PRId64 "\n", esp_timer_get_time() / 1000000);
+}
+
+esp_err_t metrics_render(metrics_write_fn write, void *ctx) {
+    renderer_t r = {.write = write, .ctx = ctx, .err = ESP_OK};
+
+    render_rx(&r);
+    render_mqtt(&r);
+#if CONFIG_GATEWAY_DOWNLINK
+    render_downlink(&r);
+#endif
+#if CONFIG_GATEWAY_BEACON
+    render_beacon(&r);
+#endif
+#if CONFIG_GATEWAY_ENCRYPT
+    render_keys(&r);
+#endif
+#if CONFIG_GATEWAY_SPOOL
+    render_spool(&r);
+#endif
+#if CONFIG_GATEWAY_REGISTRY
+    render_registry(&r);
+#endif
+#if CONFIG_GATEWAY_CAPTURE
+    render_capture(&r);
+#endif
+#if CONFIG_GATEWAY_ENABLE_SSE_LOGS
+    render_logs(&r);
+#endif
+    render_system(&r);
+
+    return r.err;
+}
@@ -0,0 +1,130 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    METRIC_RX_FRAMES,
+    METRIC_RX_BYTES,
+    METRIC_RX_DROP_INVALID,
+    METRIC_RX_DROP_POOL,   // rx_pool exhausted
+    METRIC_RX_DROP_QUEUE,  // worker queue full, newest frame dropped
+    METRIC_RX_DROP_OLDEST, // oldest queued frame evicted for a new one
+    METRIC_RX_DROP_FAIR,   // device exceeded its share of a congested queue
+    METRIC_RX_DUPLICATES,
+    METRIC_RX_BATCH_RECORDS, // records split out of node batches
+    METRIC_RX_DELTA_FRAMES,  // delta encoded batches restored
+    METRIC_RX_DELTA_BYTES,   // bytes those batches grew by when restored
+    METRIC_RX_AUTH_VERIFIED, // frames whose PROTO_FLAG2_AUTH tag and counter checked out
+    METRIC_RX_AUTH_BAD_TAG,  // dropped, tag does not match the device key
+    METRIC_RX_AUTH_REPLAYED, // dropped, counter not above the last accepted one
+    METRIC_RX_AUTH_MISSING,  // dropped for lack of a tag, CONFIG_GATEWAY_AUTH_REQUIRE
+    METRIC_RX_AUTH_FULL,     // dropped, no room left for the counter of another node
+    METRIC_MQTT_PUBLISHED,
+    METRIC_MQTT_FAILED,
+    METRIC_DOWNLINK_RECEIVED,      // commands accepted from MQTT
+    METRIC_DOWNLINK_DELIVERED,     // commands acknowledged by their node
+    METRIC_DOWNLINK_FRAMES_OK,     // ESP-NOW frames acknowledged
+    METRIC_DOWNLINK_FRAMES_FAILED, // ESP-NOW frames not acknowledged, kept for the next wake
+    METRIC_DOWNLINK_DROP_INVALID,  // bad topic or oversized command
+    METRIC_DOWNLINK_DROP_FULL,     // oldest command of a full node queue dropped
+    METRIC_DOWNLINK_DROP_EVICTED,  // queue of the least recently used node dropped for a new node
+    METRIC_DOWNLINK_DROP_EXPIRED,  // command older than its time to live
+    METRIC_BEACON_PERIODIC,        // beacons sent by the timer
+    METRIC_BEACON_PROBED,          // beacons sent in answer to a node probe
+    METRIC_LOGS_CAPTURED,          // ESP-IDF log lines copied to the /logs line ring
+    METRIC_LOGS_RATE_LIMITED,      // log lines dropped, their tag ran out of tokens
+    METRIC_LOGS_BUSY,              // log lines dropped, scratch buffer of the CPU in use
+    METRIC_CAPTURE_FRAMES,         // frames written to a /capture stream
+    METRIC_CAPTURE_DROPPED,        // frames that matched a capture filter while its ring was full
+    METRIC_REGISTRY_ONLINE,        // nodes that came online, new or back from offline
+    METRIC_REGISTRY_OFFLINE,       // nodes not heard from within the offline timeout
+    METRIC_REGISTRY_FULL,          // frames from unregistered nodes, every registered node online
+    METRIC_COUNT,
+} metric_t;
+
+#define METRICS_LATENCY_BUCKETS 10 // finite buckets, +Inf is implicit
+#define METRICS_DOWNLINK_BUCKETS 8
+
+/**
+ * @brief Counters owned by one core.
+ *
+ * Writers only touch the slot of the core they run on, so increments are
+ * uncontended relaxed atomics; a reader sums all slots. Counters are 32-bit
+ * to stay native on both Xtensa and RISC-V and wrap around, which Prometheus
+ * treats as a counter reset.
+ */
+typedef struct {
+    uint32_t counters[METRIC_COUNT];
+    uint32_t latency[METRICS_LATENCY_BUCKETS + 1];
+    uint32_t latency_sum_us;
+    uint32_t downlink_latency[METRICS_DOWNLINK_BUCKETS + 1];
+    uint32_t downlink_latency_sum_ms;
+} metrics_core_t;
+
+#if CONFIG_GATEWAY_METRICS
+extern metrics_core_t metrics_cores[portNUM_PROCESSORS];
+
+static inline void metrics_add(metric_t m, uint32_t n) {
+    __atomic_fetch_add(&metrics_cores[xPortGetCoreID()].counters[m], n, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Records duration of one MQTT publish call.
+ *
+ * @param us Duration in microseconds.
+ */
+void metrics_observe_publish(uint32_t us);
+
+/**
+ * @brief Records time from receiving a command from the broker to its node acknowledging it.
+ *
+ * @param ms Duration in milliseconds.
+ */
+void metrics_observe_downlink(uint32_t ms);
+#else
+static inline void metrics_add(metric_t m, uint32_t n) {
+    (void)m;
+    (void)n;
+}
+
+static inline void metrics_observe_publish(uint32_t us) {
+    (void)us;
+}
+
+static inline void metrics_observe_downlink(uint32_t ms) {
+    (void)ms;
+}
+#endif
+
+static inline void metrics_inc(metric_t m) {
+    metrics_add(m, 1);
+}
+
+/**
+ * @brief Sink for rendered metrics text, e.g. an HTTP chunk writer.
+ */
+typedef esp_err_t (*metrics_write_fn)(void *ctx, const char *data, size_t len);
+
+/**
+ * @brief Renders all metrics in Prometheus text exposition format.
+ *
+ * @param write Called with consecutive pieces of the output.
+ * @param ctx Passed to @p write.
+ * @return ESP_OK, or the first error returned by @p write.
+ */
+esp_err_t metrics_render(metrics_write_fn write, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _METRICS_H_ */
@@ -0,0 +1,196 @@
+#include "mqtt_batch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char *const TAG = "mqtt_batch";
+
+#define WINDOW_TICKS pdMS_TO_TICKS(GATEWAY_MQTT_BATCH_WINDOW_MS)
+
+#if GATEWAY_MQTT_BATCH_AGGREGATE
+#define BATCH_FLAGS MQTT_BATCH_FLAG_MAC
+#else
+#define BATCH_FLAGS 0
+#endif
+
+static inline size_t record_len(size_t data_len) {
+    return ((BATCH_FLAGS & MQTT_BATCH_FLAG_MAC) ? ESP_NOW_ETH_ALEN : 0) + sizeof(uint16_t) + data_len;
+}
+
+static void batch_target(routes_target_t *target, const routes_target_t *to) {
+#if GATEWAY_MQTT_BATCH_AGGREGATE
+    strlcpy(target->topic, GATEWAY_MQTT_BATCH_TOPIC, sizeof(target->topic));
+    target->qos = to->qos;
+    target->retain = false;
+#else
+    *target = *to;
+#endif
+}
+
+static size_t record_write(uint8_t *p, const uint8_t *mac_addr, const uint8_t *data, size_t len) {
+    uint8_t *start = p;
+    if (BATCH_FLAGS & MQTT_BATCH_FLAG_MAC) {
+        memcpy(p, mac_addr, ESP_NOW_ETH_ALEN);
+        p += ESP_NOW_ETH_ALEN;
+    }
+    *p++ = (uint8_t)(len & 0xFF);
+    *p++ = (uint8_t)(len >> 8);
+    memcpy(p, data, len);
+    return (size_t)(p - start) + len;
+}
+
+static esp_err_t slot_flush(mqtt_batch_t *b, mqtt_batch_slot_t *slot) {
+    if (!slot->used) {
+        return ESP_OK;
+    }
+
+    esp_err_t err = b->publish(&slot->target, slot->buf, slot->len, b->ctx);
+    slot->used = false;
+    slot->len = 0;
+
+    return err;
+}
+
+static mqtt_batch_slot_t *slot_open(mqtt_batch_t *b, const uint8_t *mac_addr, const routes_target_t *to,
+                                    TickType_t now) {
+    mqtt_batch_slot_t *oldest = NULL;
+
+    for (size_t i = 0; i < GATEWAY_MQTT_BATCH_SLOTS; i++) {
+        mqtt_batch_slot_t *slot = &b->slots[i];
+        if (!slot->used) {
+            oldest = slot;
+            break;
+        }
+        if (oldest == NULL || (TickType_t)(now - slot->opened_at) > (TickType_t)(now - oldest->opened_at)) {
+            oldest = slot;
+        }
+    }
+
+    if (oldest->used) {
+        ESP_LOGD(TAG, "all slots busy, flushing oldest");
+        (void)slot_flush(b, oldest);
+    }
+
+    oldest->used = true;
+    oldest->opened_at = now;
+    memcpy(oldest->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+    batch_target(&oldest->target, to);
+    oldest->buf[0] = MQTT_BATCH_VERSION;
+    oldest->buf[1] = BATCH_FLAGS;
+    oldest->len = MQTT_BATCH_HDR_LEN;
+
+    return oldest;
+}
+
+static mqtt_batch_slot_t *slot_find(mqtt_batch_t *b, const uint8_t *mac_addr) {
+#if GATEWAY_MQTT_BATCH_AGGREGATE
+    (void)mac_addr;
+    return b->slots[0].used ? &b->slots[0] : NULL;
+#else
+    for (size_t i = 0; i < GATEWAY_MQTT_BATCH_SLOTS; i++) {
+        mqtt_batch_slot_t *slot = &b->slots[i];
+        if (slot->used && memcmp(slot->mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+#endif
+}
+
+void mqtt_batch_init(mqtt_batch_t *b, mqtt_batch_publish_fn_t publish, void *ctx) {
+    memset(b, 0, sizeof(*b));
+    b->publish = publish;
+    b->ctx = ctx;
+}
+
+// Message too large for a slot: publish it alone, after whatever is pending for the same topic.
+static esp_err_t publish_oversized(mqtt_batch_t *b, mqtt_batch_slot_t *pending, const uint8_t *mac_addr,
+                                   const routes_target_t *to, const uint8_t *data, size_t len) {
+    esp_err_t err = pending != NULL ? slot_flush(b, pending) : ESP_OK;
+
+    const size_t total = MQTT_BATCH_HDR_LEN + record_len(len);
+    uint8_t *buf = malloc(total);
+    if (unlikely(buf == NULL)) {
+        ESP_LOGE(TAG, "no memory for %u byte batch", (unsigned)total);
+        return ESP_ERR_NO_MEM;
+    }
+
+    buf[0] = MQTT_BATCH_VERSION;
+    buf[1] = BATCH_FLAGS;
+    record_write(buf + MQTT_BATCH_HDR_LEN, mac_addr, data, len);
+
+    routes_target_t target;
+    batch_target(&target, to);
+
+    esp_err_t pub_err = b->publish(&target, buf, total, b->ctx);
+    free(buf);
+
+    return err != ESP_OK ? err : pub_err;
+}
+
+esp_err_t mqtt_batch_add(mqtt_batch_t *b, const uint8_t *mac_addr, const routes_target_t *to, const uint8_t *data,
+                         size_t len, TickType_t now) {
+    if (unlikely(b == NULL || mac_addr == NULL || to == NULL || data == NULL || len > UINT16_MAX)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ESP_OK;
+    const size_t need = record_len(len);
+
+    mqtt_batch_slot_t *slot = slot_find(b, mac_addr);
+    if (unlikely(MQTT_BATCH_HDR_LEN + need > MQTT_BATCH_SLOT_CAPACITY)) {
+        return publish_oversized(b, slot, mac_addr, to, data, len);
+    }
+
+    if (slot != NULL && slot->len + need > GATEWAY_MQTT_BATCH_MAX_BYTES) {
+        err = slot_flush(b, slot);
+        slot = NULL;
+    }
+    if (slot == NULL) {
+        slot = slot_open(b, mac_addr, to, now);
+    } else if (to->qos > slot->target.qos) {
+        slot->target.qos = to->qos; // only differs for aggregate batches
+    }
+
+    slot->len += record_write(slot->buf + slot->len, mac_addr, data, len);
+
+    return err;
+}
+
+TickType_t mqtt_batch_poll(mqtt_batch_t *b, TickType_t now) {
+    TickType_t next = portMAX_DELAY;
+
+    for (size_t i = 0; i < GATEWAY_MQTT_BATCH_SLOTS; i++) {
+        mqtt_batch_slot_t *slot = &b->slots[i];
+        if (!slot->used) {
+            continue;
+        }
+
+        const TickType_t age = now - slot->opened_at;
+        if (age >= WINDOW_TICKS) {
+            (void)slot_flush(b, slot);
+            continue;
+        }
+
+        if (WINDOW_TICKS - age < next) {
+            next = WINDOW_TICKS - age;
+        }
+    }
+
+    return next;
+}
+
+esp_err_t mqtt_batch_flush(mqtt_batch_t *b) {
+    esp_err_t first_err = ESP_OK;
+
+    for (size_t i = 0; i < GATEWAY_MQTT_BATCH_SLOTS; i++) {
+        esp_err_t err = slot_flush(b, &b->slots[i]);
+        if (err != ESP_OK && first_err == ESP_OK) {
+            first_err = err;
+        }
+    }
+
+    return first_err;
+}
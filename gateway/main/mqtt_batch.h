@@ -0,0 +1,121 @@
+#ifndef _MQTT_BATCH_H_
+#define _MQTT_BATCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#include "config.h"
+#include "espnow.h"
+#include "routes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Batch payload layout (all integers little-endian):
+ *
+ *   u8  version       MQTT_BATCH_VERSION
+ *   u8  flags         MQTT_BATCH_FLAG_*
+ *   records...        until end of payload
+ *
+ * Each record:
+ *
+ *   u8  mac[6]        present only with MQTT_BATCH_FLAG_MAC
+ *   u16 len
+ *   u8  data[len]
+ */
+#define MQTT_BATCH_VERSION 1
+#define MQTT_BATCH_FLAG_MAC 0x01 // Records carry source MAC (aggregate topic).
+
+#define MQTT_BATCH_HDR_LEN 2
+#define MQTT_BATCH_REC_HDR_MAX_LEN (ESP_NOW_ETH_ALEN + sizeof(uint16_t))
+#define MQTT_BATCH_REC_MAX_LEN (MQTT_BATCH_REC_HDR_MAX_LEN + DATA_BUFFER_SIZE)
+
+// Slot buffer always fits at least one full frame, even if the byte budget is smaller.
+#define MQTT_BATCH_SLOT_CAPACITY                                                                                       \
+    (GATEWAY_MQTT_BATCH_MAX_BYTES > MQTT_BATCH_HDR_LEN + MQTT_BATCH_REC_MAX_LEN                                        \
+         ? GATEWAY_MQTT_BATCH_MAX_BYTES                                                                                \
+         : MQTT_BATCH_HDR_LEN + MQTT_BATCH_REC_MAX_LEN)
+
+/**
+ * @brief Callback used to publish a completed batch.
+ *
+ * @param to Topic, QoS and retain flag of the batch.
+ * @param data Batch payload.
+ * @param len Payload length in bytes.
+ * @param ctx User context passed to mqtt_batch_init().
+ * @return ESP_OK on success, or an error code if publish failed.
+ */
+typedef esp_err_t (*mqtt_batch_publish_fn_t)(const routes_target_t *to, const uint8_t *data, size_t len, void *ctx);
+
+typedef struct {
+    bool used;
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    routes_target_t target; // aggregate batches use the highest QoS of their records
+    TickType_t opened_at;
+    size_t len;
+    uint8_t buf[MQTT_BATCH_SLOT_CAPACITY];
+} mqtt_batch_slot_t;
+
+typedef struct {
+    mqtt_batch_publish_fn_t publish;
+    void *ctx;
+    mqtt_batch_slot_t slots[GATEWAY_MQTT_BATCH_SLOTS];
+} mqtt_batch_t;
+
+/**
+ * @brief Initializes batcher with empty slots.
+ *
+ * @param b Batcher instance.
+ * @param publish Callback invoked for every flushed batch.
+ * @param ctx User context forwarded to @p publish.
+ */
+void mqtt_batch_init(mqtt_batch_t *b, mqtt_batch_publish_fn_t publish, void *ctx);
+
+/**
+ * @brief Appends received message to the batch of its topic.
+ *
+ * Flushes the batch first if the message does not fit into the byte budget.
+ * When all slots are busy, the oldest one is flushed to make room. Messages
+ * larger than a slot (reassembled fragments) are published right away as a
+ * single-record batch.
+ *
+ * @param b Batcher instance.
+ * @param mac_addr Source MAC address.
+ * @param to Target of the source device.
+ * @param data Message payload.
+ * @param len Payload length, up to UINT16_MAX.
+ * @param now Current tick count.
+ * @return ESP_OK on success, or an error returned by a forced flush.
+ */
+esp_err_t mqtt_batch_add(mqtt_batch_t *b, const uint8_t *mac_addr, const routes_target_t *to, const uint8_t *data,
+                         size_t len, TickType_t now);
+
+/**
+ * @brief Flushes batches whose time window has expired.
+ *
+ * @param b Batcher instance.
+ * @param now Current tick count.
+ * @return Ticks until the next batch expires, or portMAX_DELAY if no batch
+ *         is pending.
+ */
+TickType_t mqtt_batch_poll(mqtt_batch_t *b, TickType_t now);
+
+/**
+ * @brief Flushes all pending batches regardless of their age.
+ *
+ * @param b Batcher instance.
+ * @return ESP_OK on success, or the first publish error.
+ */
+esp_err_t mqtt_batch_flush(mqtt_batch_t *b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MQTT_BATCH_H_ */
@@ -0,0 +1,459 @@
+#include "registry.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs.h"
+
+#include "config.h"
+#include "devices.h"
+#include "metrics.h"
+#include "routes.h"
+#include "settings.h"
+
+static const char *const TAG = "registry";
+
+#define NONE UINT16_MAX
+#define INDEX_SIZE (2 * GATEWAY_REGISTRY_SIZE) // keeps load factor <= 0.5
+#define WHEEL_SLOTS 64                          // deadlines further out wait in the last slot and are requeued
+#define TICK_MS 1000
+#define OFFLINE_MS ((uint32_t)GATEWAY_REGISTRY_OFFLINE_S * 1000)
+#define ANNOUNCE_BATCH 16 // presence messages queued per tick, the rest wait for the next one
+#define STACK_DEPTH 3072
+#define NVS_NAMESPACE "registry"
+#define NVS_KEY "nodes"
+#define SNAPSHOT_VERSION 1
+#define RECORD_LEN (ESP_NOW_ETH_ALEN + 1) // MAC, online
+#define TOPIC_SUFFIX "/presence"
+#define TOPIC_MAX_LEN (ROUTES_TOPIC_MAX_LEN + sizeof("/xx:xx:xx:xx:xx:xx" TOPIC_SUFFIX))
+
+_Static_assert(GATEWAY_REGISTRY_SIZE < NONE, "registry too large for 16-bit indices");
+_Static_assert((WHEEL_SLOTS & (WHEEL_SLOTS - 1)) == 0, "WHEEL_SLOTS must be a power of two");
+
+typedef struct {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    bool online;
+    bool announce;         // on the announce list
+    uint32_t last_seen_ms; // since boot
+    uint16_t next;         // wheel slot list while online, offline list while offline
+    uint16_t prev;         // offline list only
+    uint16_t announce_next;
+} entry_t;
+
+typedef struct {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    bool online;
+} change_t;
+
+static entry_t s_entries[GATEWAY_REGISTRY_SIZE];
+static uint16_t s_index[INDEX_SIZE]; // entry number + 1, 0 = empty bucket
+static uint16_t s_count = 0;
+static uint16_t s_online = 0;
+static uint16_t s_wheel[WHEEL_SLOTS];  // online entries by deadline, singly linked
+static uint32_t s_tick = 0;            // slot s_tick % WHEEL_SLOTS was processed last
+static uint16_t s_offline_head = NONE; // offline the longest, replaced first
+static uint16_t s_offline_tail = NONE;
+static uint16_t s_announce_head = NONE;
+static uint16_t s_announce_tail = NONE;
+static bool s_dirty = false; // changed since the last snapshot
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static esp_mqtt_client_handle_t s_client = NULL;
+static TaskHandle_t s_task = NULL;
+
+static inline uint32_t now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static inline size_t bucket_of(const uint8_t *mac_addr) {
+    return devices_mac_hash(mac_addr) % INDEX_SIZE;
+}
+
+// Returns bucket holding MAC, or the empty bucket where it would be inserted.
+static size_t probe(const uint8_t *mac_addr) {
+    size_t b = bucket_of(mac_addr);
+
+    while (s_index[b] != 0) {
+        if (memcmp(s_entries[s_index[b] - 1].mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0) {
+            break;
+        }
+        b = (b + 1) % INDEX_SIZE;
+    }
+
+    return b;
+}
+
+// Backward-shift deletion, as in devices.c.
+static void index_remove(size_t hole) {
+    size_t next = hole;
+
+    for (;;) {
+        next = (next + 1) % INDEX_SIZE;
+        if (s_index[next] == 0) {
+            break;
+        }
+
+        const size_t home = bucket_of(s_entries[s_index[next] - 1].mac_addr);
+        const bool movable = (hole <= next) ? (home <= hole || home > next) : (home <= hole && home > next);
+        if (movable) {
+            s_index[hole] = s_index[next];
+            hole = next;
+        }
+    }
+
+    s_index[hole] = 0;
+}
+
+// Queues an online entry in the slot of its deadline, at least one tick ahead.
+static void wheel_insert(uint16_t i, uint32_t now) {
+    entry_t *e = &s_entries[i];
+    const int32_t left_ms = (int32_t)(e->last_seen_ms + OFFLINE_MS - now);
+
+    uint32_t ticks = left_ms > 0 ? ((uint32_t)left_ms + TICK_MS - 1) / TICK_MS : 1;
+    if (ticks >= WHEEL_SLOTS) {
+        ticks = WHEEL_SLOTS - 1;
+    }
+
+    const size_t slot = (s_tick + ticks) % WHEEL_SLOTS;
+    e->next = s_wheel[slot];
+    s_wheel[slot] = i;
+}
+
+static void offline_push_back(uint16_t i) {
+    entry_t *e = &s_entries[i];
+
+    e->prev = s_offline_tail;
+    e->next = NONE;
+    if (s_offline_tail != NONE) {
+        s_entries[s_offline_tail].next = i;
+    } else {
+        s_offline_head = i;
+    }
+    s_offline_tail = i;
+}
+
+static void offline_unlink(uint16_t i) {
+    entry_t *e = &s_entries[i];
+
+    if (e->prev != NONE) {
+        s_entries[e->prev].next = e->next;
+    } else {
+        s_offline_head = e->next;
+    }
+
+    if (e->next != NONE) {
+        s_entries[e->next].prev = e->prev;
+    } else {
+        s_offline_tail = e->prev;
+    }
+}
+
+// An entry is listed once, its state is read when the message is built.
+static void announce(uint16_t i) {
+    entry_t *e = &s_entries[i];
+    if (e->announce) {
+        return;
+    }
+
+    e->announce = true;
+    e->announce_next = NONE;
+    if (s_announce_tail != NONE) {
+        s_entries[s_announce_tail].announce_next = i;
+    } else {
+        s_announce_head = i;
+    }
+    s_announce_tail = i;
+}
+
+// Entry for a new MAC, or NONE when every known node is online or about to be announced.
+static uint16_t take_entry(void) {
+    if (s_count < GATEWAY_REGISTRY_SIZE) {
+        return s_count++;
+    }
+
+    const uint16_t i = s_offline_head;
+    if (i == NONE || s_entries[i].announce) {
+        return NONE;
+    }
+
+    offline_unlink(i);
+    index_remove(probe(s_entries[i].mac_addr));
+    return i;
+}
+
+void registry_seen(const uint8_t *mac_addr) {
+    const uint32_t now = now_ms();
+
+    portENTER_CRITICAL(&s_lock);
+    size_t b = probe(mac_addr);
+    uint16_t i;
+    if (likely(s_index[b] != 0)) {
+        i = s_index[b] - 1;
+        s_entries[i].last_seen_ms = now; // the wheel reads it when the deadline comes up
+        if (likely(s_entries[i].online)) {
+            portEXIT_CRITICAL(&s_lock);
+            return;
+        }
+        offline_unlink(i);
+    } else {
+        i = take_entry();
+        if (unlikely(i == NONE)) {
+            portEXIT_CRITICAL(&s_lock);
+            metrics_inc(METRIC_REGISTRY_FULL);
+            return;
+        }
+
+        b = probe(mac_addr); // bucket may have moved during shift
+        entry_t *e = &s_entries[i];
+        memset(e, 0, sizeof(*e));
+        memcpy(e->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+        e->last_seen_ms = now;
+        s_index[b] = i + 1;
+    }
+
+    s_entries[i].online = true;
+    s_online++;
+    wheel_insert(i, now);
+    announce(i);
+    s_dirty = true;
+    portEXIT_CRITICAL(&s_lock);
+
+    metrics_inc(METRIC_REGISTRY_ONLINE);
+}
+
+// Processes the next wheel slot: expired entries go offline, the others move to their current deadline.
+static void advance(void) {
+    const uint32_t now = now_ms();
+    uint32_t offline = 0;
+
+    portENTER_CRITICAL(&s_lock);
+    s_tick++;
+    const size_t slot = s_tick % WHEEL_SLOTS;
+    uint16_t i = s_wheel[slot];
+    s_wheel[slot] = NONE;
+
+    while (i != NONE) {
+        entry_t *e = &s_entries[i];
+        const uint16_t next = e->next;
+        // Signed: a worker may have stored a time later than now since it was read.
+        if ((int32_t)(now - e->last_seen_ms) >= (int32_t)OFFLINE_MS) {
+            e->online = false;
+            s_online--;
+            offline_push_back(i);
+            announce(i);
+            offline++;
+        } else {
+            wheel_insert(i, now);
+        }
+        i = next;
+    }
+
+    if (offline > 0) {
+        s_dirty = true;
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    metrics_add(METRIC_REGISTRY_OFFLINE, offline);
+}
+
+static void publish_changes(void) {
+    esp_mqtt_client_handle_t client = __atomic_load_n(&s_client, __ATOMIC_ACQUIRE);
+    if (client == NULL) {
+        return; // kept on the announce list
+    }
+
+    change_t changes[ANNOUNCE_BATCH];
+    size_t count = 0;
+
+    portENTER_CRITICAL(&s_lock);
+    while (count < ANNOUNCE_BATCH && s_announce_head != NONE) {
+        entry_t *e = &s_entries[s_announce_head];
+        memcpy(changes[count].mac_addr, e->mac_addr, ESP_NOW_ETH_ALEN);
+        changes[count].online = e->online;
+        count++;
+
+        e->announce = false;
+        s_announce_head = e->announce_next;
+    }
+    if (s_announce_head == NONE) {
+        s_announce_tail = NONE;
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    for (size_t i = 0; i < count; i++) {
+        const change_t *c = &changes[i];
+        char topic[TOPIC_MAX_LEN];
+        snprintf(topic, sizeof(topic), "%s/" MACSTR TOPIC_SUFFIX, settings_mqtt_prefix(), MAC2STR(c->mac_addr));
+
+        const char *state = c->online ? "online" : "offline";
+        if (esp_mqtt_client_enqueue(client, topic, state, 0, GATEWAY_REGISTRY_QOS, 1, true) < 0) {
+            ESP_LOGW(TAG, MACSTR " %s not queued for publishing", MAC2STR(c->mac_addr), state);
+        }
+    }
+}
+
+// Offline entries first, longest offline first, so a restore keeps the replacement order.
+static size_t snapshot_build(uint8_t *buf) {
+    size_t len = 0;
+    buf[len++] = SNAPSHOT_VERSION;
+
+    for (uint16_t i = s_offline_head; i != NONE; i = s_entries[i].next) {
+        memcpy(buf + len, s_entries[i].mac_addr, ESP_NOW_ETH_ALEN);
+        buf[len + ESP_NOW_ETH_ALEN] = 0;
+        len += RECORD_LEN;
+    }
+    for (size_t i = 0; i < s_count; i++) {
+        if (s_entries[i].online) {
+            memcpy(buf + len, s_entries[i].mac_addr, ESP_NOW_ETH_ALEN);
+            buf[len + ESP_NOW_ETH_ALEN] = 1;
+            len += RECORD_LEN;
+        }
+    }
+
+    return len;
+}
+
+static esp_err_t snapshot_save(void) {
+    uint8_t *buf = malloc(1 + GATEWAY_REGISTRY_SIZE * RECORD_LEN);
+    if (buf == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    const size_t len = snapshot_build(buf);
+    s_dirty = false;
+    portEXIT_CRITICAL(&s_lock);
+
+    nvs_handle_t nvs = 0;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, NVS_KEY, buf, len);
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    free(buf);
+
+    if (err != ESP_OK) {
+        portENTER_CRITICAL(&s_lock);
+        s_dirty = true; // retried with the next snapshot
+        portEXIT_CRITICAL(&s_lock);
+    }
+    return err;
+}
+
+// Runs before the uplink starts, nothing else touches the table yet.
+static esp_err_t snapshot_restore(void) {
+    nvs_handle_t nvs = 0;
+    esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_ERROR(ret, TAG, "nvs_open");
+
+    uint8_t *buf = NULL;
+    size_t len = 0;
+    ret = nvs_get_blob(nvs, NVS_KEY, NULL, &len);
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        ret = ESP_OK;
+        goto out;
+    }
+    ESP_GOTO_ON_ERROR(ret, out, TAG, "nvs_get_blob");
+
+    buf = malloc(len);
+    ESP_GOTO_ON_FALSE(buf != NULL, ESP_ERR_NO_MEM, out, TAG, "no memory for snapshot");
+    ESP_GOTO_ON_ERROR(nvs_get_blob(nvs, NVS_KEY, buf, &len), out, TAG, "nvs_get_blob");
+    if (len < 1 || buf[0] != SNAPSHOT_VERSION) {
+        ESP_LOGW(TAG, "snapshot of unknown version ignored");
+        goto out;
+    }
+
+    const uint32_t now = now_ms();
+    for (size_t off = 1; off + RECORD_LEN <= len && s_count < GATEWAY_REGISTRY_SIZE; off += RECORD_LEN) {
+        const uint8_t *mac_addr = buf + off;
+        const size_t b = probe(mac_addr);
+        if (s_index[b] != 0) {
+            continue;
+        }
+
+        const uint16_t i = s_count++;
+        entry_t *e = &s_entries[i];
+        memcpy(e->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+        e->last_seen_ms = now;
+        s_index[b] = i + 1;
+
+        // Published online before the restart: confirmed by a frame, or published offline after one timeout.
+        e->online = buf[off + ESP_NOW_ETH_ALEN] != 0;
+        if (e->online) {
+            s_online++;
+            wheel_insert(i, now);
+        } else {
+            offline_push_back(i);
+        }
+    }
+    ESP_LOGI(TAG, "%u nodes restored, %u online before restart", s_count, s_online);
+
+out:
+    free(buf);
+    nvs_close(nvs);
+    return ret;
+}
+
+static void registry_task(__attribute__((unused)) void *arg) {
+    TickType_t wake = xTaskGetTickCount();
+    uint32_t since_snapshot_ms = 0;
+
+    for (;;) {
+        xTaskDelayUntil(&wake, pdMS_TO_TICKS(TICK_MS));
+
+        advance();
+        publish_changes();
+
+        if (since_snapshot_ms < (uint32_t)GATEWAY_REGISTRY_SNAPSHOT_S * 1000) {
+            since_snapshot_ms += TICK_MS;
+        } else if (__atomic_load_n(&s_dirty, __ATOMIC_RELAXED)) {
+            const esp_err_t err = snapshot_save();
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "snapshot not saved: %s", esp_err_to_name(err));
+            }
+            since_snapshot_ms = 0;
+        }
+    }
+}
+
+esp_err_t registry_start(void) {
+    memset(s_wheel, 0xff, sizeof(s_wheel)); // NONE
+
+    const esp_err_t err = snapshot_restore();
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "snapshot not restored: %s", esp_err_to_name(err));
+    }
+
+    if (xTaskCreate(registry_task, "registry", STACK_DEPTH, NULL, tskIDLE_PRIORITY + 1, &s_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create registry task");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t registry_set_mqtt_client(esp_mqtt_client_handle_t client) {
+    __atomic_store_n(&s_client, client, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+void registry_stats(registry_stats_t *out) {
+    portENTER_CRITICAL(&s_lock);
+    out->known = s_count;
+    out->online = s_online;
+    portEXIT_CRITICAL(&s_lock);
+}
@@ -0,0 +1,78 @@
+#ifndef _REGISTRY_H_
+#define _REGISTRY_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Registry of known nodes with presence tracking.
+ *
+ * Every node heard from is kept in a fixed table of GATEWAY_REGISTRY_SIZE
+ * entries. A node goes online with its first accepted frame and offline when
+ * nothing was accepted from it for GATEWAY_REGISTRY_OFFLINE_S. Each change
+ * is published as a retained "online" or "offline" message on
+ * <mqtt.prefix>/<MAC>/presence.
+ *
+ * Offline detection uses a timer wheel instead of a timer per node. An online
+ * node sits in the slot of its deadline. When the wheel reaches that slot,
+ * the node goes offline, or moves to its new deadline if it was heard from
+ * since. The receive path only stores the time, so it costs one hash lookup
+ * and no allocation.
+ *
+ * The table is saved to NVS at most every GATEWAY_REGISTRY_SNAPSHOT_S, and
+ * only after a change. The snapshot keeps 7 bytes per node: its MAC and its
+ * state. On boot, nodes that were online get one timeout to be heard from
+ * before they are published offline. Nodes that were offline stay known
+ * without publishing anything.
+ *
+ * When the table is full, a new node replaces the node that has been
+ * offline the longest. If every known node is online, the new node is not
+ * registered.
+ */
+
+/**
+ * @brief Current registry state.
+ */
+typedef struct {
+    uint32_t known;  // nodes in the table
+    uint32_t online; // of these, heard from within the offline timeout
+} registry_stats_t;
+
+/**
+ * @brief Restores the last snapshot and starts the wheel task.
+ *
+ * Must be called after NVS is initialized.
+ */
+esp_err_t registry_start(void);
+
+/**
+ * @brief Publishes presence changes through this client, NULL holds them back.
+ *
+ * Changes are kept until a client is set. Messages are queued with
+ * esp_mqtt_client_enqueue() so they survive a broker reconnect.
+ */
+esp_err_t registry_set_mqtt_client(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Records an accepted frame from this node.
+ *
+ * Called by the uplink workers. O(1), does not allocate or block.
+ */
+void registry_seen(const uint8_t *mac_addr);
+
+/**
+ * @brief Fills @p out with current counts.
+ */
+void registry_stats(registry_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _REGISTRY_H_ */
@@ -0,0 +1,55 @@
+#include "replay.h"
+
+#include <string.h>
+
+#include "devices.h"
+
+// Returns the bucket holding MAC, or the empty bucket where it would go.
+static replay_entry_t *probe(const replay_t *t, const uint8_t *mac_addr) {
+    size_t b = devices_mac_hash(mac_addr) % t->size;
+
+    while (t->buckets[b].used && memcmp(t->buckets[b].mac_addr, mac_addr, ESP_NOW_ETH_ALEN) != 0) {
+        b = (b + 1) % t->size;
+    }
+
+    return &t->buckets[b];
+}
+
+void replay_init(replay_t *t, replay_entry_t *buckets, size_t size) {
+    memset(buckets, 0, size * sizeof(*buckets));
+    t->buckets = buckets;
+    t->size = size;
+    t->count = 0;
+}
+
+esp_err_t replay_advance(replay_t *t, const uint8_t *mac_addr, uint32_t counter) {
+    replay_entry_t *e = probe(t, mac_addr);
+
+    if (!e->used) {
+        if (counter == 0) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        // At most half the buckets are used, so the probe above always ends on an empty one.
+        if (t->count >= t->size / 2) {
+            return ESP_ERR_NO_MEM;
+        }
+        memcpy(e->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+        e->used = true;
+        e->counter = 0;
+        t->count++;
+    }
+
+    if (counter <= e->counter) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    e->counter = counter;
+
+    return ESP_OK;
+}
+
+void replay_reset(replay_t *t, const uint8_t *mac_addr) {
+    replay_entry_t *e = probe(t, mac_addr);
+    if (e->used) {
+        e->counter = 0;
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_now.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Highest counter accepted from one node.
+ */
+typedef struct {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    bool used;
+    uint32_t counter;
+} replay_entry_t;
+
+/**
+ * @brief Replay counters by MAC, open addressing without eviction.
+ *
+ * Unlike the device cache, an entry is never dropped for another node, so
+ * once a counter was accepted an older one stays refused. Only nodes whose
+ * frames passed their tag may be added, a full table refuses further nodes
+ * instead. Not thread-safe, callers must serialize access to one table.
+ */
+typedef struct {
+    replay_entry_t *buckets;
+    size_t size;  // buckets, twice the nodes
+    size_t count; // nodes added
+} replay_t;
+
+/**
+ * @brief Sets up an empty table.
+ *
+ * @param buckets Storage for twice the number of nodes, which keeps probes short.
+ * @param size Number of buckets.
+ */
+void replay_init(replay_t *t, replay_entry_t *buckets, size_t size);
+
+/**
+ * @brief Accepts @p counter from @p mac_addr if it is above every one accepted before.
+ *
+ * A node not seen yet starts at 0, so its first counter must be at least 1.
+ *
+ * @return ESP_OK and the counter stored, ESP_ERR_INVALID_STATE for an old counter, or ESP_ERR_NO_MEM for a new
+ *         node while the table is full.
+ */
+esp_err_t replay_advance(replay_t *t, const uint8_t *mac_addr, uint32_t counter);
+
+/**
+ * @brief Lets @p mac_addr start over at counter 1, for a node that lost its counter along with its key.
+ *
+ * The entry keeps its bucket, a full table stays full.
+ */
+void replay_reset(replay_t *t, const uint8_t *mac_addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _REPLAY_H_ */
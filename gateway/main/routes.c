@@ -0,0 +1,379 @@
+#include "routes.h"
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_now.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "config.h"
+#include "settings.h"
+
+static const char *const TAG = "routes";
+
+#define MAC_STR_LEN 17 // MACSTR without terminator
+#define OUI_LEN 3
+
+typedef enum {
+    TOKEN_LITERAL,
+    TOKEN_PREFIX,
+    TOKEN_CLASS,
+    TOKEN_MAC,
+} token_kind_t;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t off; // TOKEN_LITERAL: text in routes_t.literals
+    uint8_t len;
+} token_t;
+
+typedef struct {
+    uint8_t addr[ESP_NOW_ETH_ALEN];
+    uint8_t addr_len; // OUI_LEN or ESP_NOW_ETH_ALEN
+    uint8_t qos;
+    bool retain;
+    bool raw;
+    char class_name[ROUTES_CLASS_MAX_LEN];
+} rule_t;
+
+// Compiled settings, rebuilt as a whole on every change.
+typedef struct {
+    token_t tokens[ROUTES_MAX_TOKENS];
+    size_t n_tokens;
+    char literals[ROUTES_TOPIC_MAX_LEN];
+    char prefix[ROUTES_TOPIC_MAX_LEN];
+    rule_t rules[ROUTES_MAX_RULES];
+    size_t n_rules;
+    uint8_t qos;
+    bool retain;
+} routes_t;
+
+static const char *const s_placeholders[] = {
+    [TOKEN_PREFIX] = "prefix",
+    [TOKEN_CLASS] = "class",
+    [TOKEN_MAC] = "mac",
+};
+
+static SemaphoreHandle_t s_lock;
+static routes_t s_routes;
+static routes_t s_scratch; // compile target, settings are changed by one task at a time
+static uint32_t s_generation; // 0 until compiled, so zeroed caches are stale
+
+// Publish topics must not carry wildcards or NUL.
+static bool topic_text_ok(const char *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] == '+' || p[i] == '#') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static esp_err_t compile_template(const char *tmpl, routes_t *r) {
+    size_t lit = 0;
+    r->n_tokens = 0;
+
+    for (const char *p = tmpl; *p != '\0';) {
+        if (r->n_tokens == ROUTES_MAX_TOKENS) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        token_t *t = &r->tokens[r->n_tokens];
+
+        if (*p == '{') {
+            const char *end = strchr(p, '}');
+            if (end == NULL) {
+                return ESP_ERR_INVALID_ARG;
+            }
+
+            const size_t name_len = (size_t)(end - p - 1);
+            t->kind = TOKEN_LITERAL;
+            for (size_t k = TOKEN_PREFIX; k <= TOKEN_MAC; k++) {
+                if (strlen(s_placeholders[k]) == name_len && memcmp(p + 1, s_placeholders[k], name_len) == 0) {
+                    t->kind = (uint8_t)k;
+                }
+            }
+            if (t->kind == TOKEN_LITERAL) {
+                return ESP_ERR_INVALID_ARG;
+            }
+
+            p = end + 1;
+        } else {
+            const size_t len = strcspn(p, "{}");
+            if (len == 0 || lit + len >= sizeof(r->literals) || !topic_text_ok(p, len)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+
+            memcpy(r->literals + lit, p, len);
+            t->kind = TOKEN_LITERAL;
+            t->off = (uint8_t)lit;
+            t->len = (uint8_t)len;
+            lit += len;
+            p += len;
+        }
+
+        r->n_tokens++;
+    }
+
+    return r->n_tokens > 0 ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = (char)tolower((unsigned char)c);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// "aa:bb:cc" or "aa:bb:cc:dd:ee:ff".
+static esp_err_t parse_addr(const char *p, size_t len, rule_t *rule) {
+    if (len != OUI_LEN * 3 - 1 && len != ESP_NOW_ETH_ALEN * 3 - 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    rule->addr_len = (uint8_t)((len + 1) / 3);
+    for (size_t i = 0; i < rule->addr_len; i++) {
+        const int hi = hex_digit(p[3 * i]);
+        const int lo = hex_digit(p[3 * i + 1]);
+        if (hi < 0 || lo < 0 || (i + 1 < rule->addr_len && p[3 * i + 2] != ':')) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        rule->addr[i] = (uint8_t)(hi << 4 | lo);
+    }
+
+    return ESP_OK;
+}
+
+static bool class_char_ok(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '-';
+}
+
+// One "addr=class[,qos[,retain[,raw]]]" rule.
+static esp_err_t parse_rule(const char *p, size_t len, uint8_t qos, bool retain, rule_t *rule) {
+    const char *eq = memchr(p, '=', len);
+    if (eq == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (parse_addr(p, (size_t)(eq - p), rule) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const char *cls = eq + 1;
+    const char *end = p + len;
+    const char *comma = memchr(cls, ',', (size_t)(end - cls));
+    const size_t cls_len = (size_t)((comma != NULL ? comma : end) - cls);
+    if (cls_len == 0 || cls_len >= sizeof(rule->class_name)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < cls_len; i++) {
+        if (!class_char_ok(cls[i])) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    memcpy(rule->class_name, cls, cls_len);
+    rule->class_name[cls_len] = '\0';
+
+    rule->qos = qos;
+    rule->retain = retain;
+    rule->raw = false;
+    if (comma == NULL) {
+        return ESP_OK;
+    }
+
+    // ",q", ",q,r" or ",q,r,raw" with single digits.
+    const size_t opt_len = (size_t)(end - comma);
+    if ((opt_len != 2 && opt_len != 4 && opt_len != 8) || comma[1] < '0' || comma[1] > '2') {
+        return ESP_ERR_INVALID_ARG;
+    }
+    rule->qos = (uint8_t)(comma[1] - '0');
+    if (opt_len >= 4) {
+        if (comma[2] != ',' || (comma[3] != '0' && comma[3] != '1')) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        rule->retain = comma[3] == '1';
+    }
+    if (opt_len == 8) {
+        if (memcmp(comma + 4, ",raw", 4) != 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        rule->raw = true;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t compile_rules(const char *rules, routes_t *r) {
+    r->n_rules = 0;
+
+    for (const char *p = rules; *p != '\0';) {
+        const size_t len = strcspn(p, ";");
+        if (len > 0) {
+            if (r->n_rules == ROUTES_MAX_RULES) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            if (parse_rule(p, len, r->qos, r->retain, &r->rules[r->n_rules]) != ESP_OK) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            r->n_rules++;
+        }
+        p += len;
+        if (*p == ';') {
+            p++;
+        }
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t compile(routes_t *r) {
+    memset(r, 0, sizeof(*r));
+
+    r->qos = settings_mqtt_qos();
+    r->retain = settings_mqtt_retain() != 0;
+
+    const char *prefix = settings_mqtt_prefix();
+    if (strlen(prefix) >= sizeof(r->prefix) || !topic_text_ok(prefix, strlen(prefix))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    strlcpy(r->prefix, prefix, sizeof(r->prefix));
+
+    const esp_err_t err = compile_template(settings_mqtt_topic(), r);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return compile_rules(settings_mqtt_classes(), r);
+}
+
+static const rule_t *match(const routes_t *r, const uint8_t *mac_addr) {
+    const rule_t *best = NULL;
+    for (size_t i = 0; i < r->n_rules; i++) {
+        const rule_t *rule = &r->rules[i];
+        if ((best == NULL || rule->addr_len > best->addr_len) &&
+            memcmp(rule->addr, mac_addr, rule->addr_len) == 0) {
+            best = rule;
+        }
+    }
+    return best;
+}
+
+static size_t append(char *out, size_t used, const char *src, size_t len) {
+    if (used + len >= ROUTES_TOPIC_MAX_LEN) {
+        len = ROUTES_TOPIC_MAX_LEN - 1 - used;
+    }
+    memcpy(out + used, src, len);
+    return used + len;
+}
+
+static void render(const routes_t *r, const char *class_name, const uint8_t *mac_addr, char *out) {
+    char mac[MAC_STR_LEN + 1];
+    size_t n = 0;
+
+    for (size_t i = 0; i < r->n_tokens; i++) {
+        const token_t *t = &r->tokens[i];
+        switch (t->kind) {
+        case TOKEN_LITERAL:
+            n = append(out, n, r->literals + t->off, t->len);
+            break;
+        case TOKEN_PREFIX:
+            n = append(out, n, r->prefix, strlen(r->prefix));
+            break;
+        case TOKEN_CLASS:
+            n = append(out, n, class_name, strlen(class_name));
+            break;
+        case TOKEN_MAC:
+            snprintf(mac, sizeof(mac), MACSTR, MAC2STR(mac_addr));
+            n = append(out, n, mac, MAC_STR_LEN);
+            break;
+        }
+    }
+
+    out[n] = '\0';
+}
+
+static void reload(void) {
+    routes_t *const compiled = &s_scratch;
+
+    esp_err_t err = compile(compiled);
+    if (err != ESP_OK) {
+        // Validators reject bad values on write, so only damaged NVS content ends up here.
+        ESP_LOGE(TAG, "routing settings rejected (%s), keeping previous ones", esp_err_to_name(err));
+        if (s_generation != 0) {
+            return;
+        }
+        // First compile failed: fall back to the historic "/device/<MAC>".
+        memset(compiled, 0, sizeof(*compiled));
+        compiled->tokens[0] = (token_t){.kind = TOKEN_PREFIX};
+        compiled->tokens[1] = (token_t){.kind = TOKEN_LITERAL, .off = 0, .len = 1};
+        compiled->tokens[2] = (token_t){.kind = TOKEN_MAC};
+        compiled->n_tokens = 3;
+        compiled->literals[0] = '/';
+        strlcpy(compiled->prefix, GATEWAY_BROKER_TOPIC_PREFIX, sizeof(compiled->prefix));
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_routes = *compiled;
+    // Skips 0 on wrap-around, it marks unresolved caches.
+    const uint32_t gen = s_generation + 1 != 0 ? s_generation + 1 : 1;
+    __atomic_store_n(&s_generation, gen, __ATOMIC_RELEASE);
+    xSemaphoreGive(s_lock);
+
+    ESP_LOGI(TAG, "routing generation %" PRIu32 ": %u tokens, %u class rules", gen, (unsigned)s_routes.n_tokens,
+             (unsigned)s_routes.n_rules);
+}
+
+static void on_settings_change(const char *key, __attribute__((unused)) void *ctx) {
+    if (strncmp(key, "mqtt.", 5) == 0) {
+        reload();
+    }
+}
+
+esp_err_t routes_init(void) {
+    if (s_lock != NULL) {
+        return ESP_OK;
+    }
+
+    s_lock = xSemaphoreCreateMutex();
+    if (s_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    reload();
+    return settings_add_listener(on_settings_change, NULL);
+}
+
+uint32_t routes_generation(void) {
+    return __atomic_load_n(&s_generation, __ATOMIC_ACQUIRE);
+}
+
+uint32_t routes_resolve(const uint8_t *mac_addr, routes_target_t *out) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+
+    const rule_t *rule = match(&s_routes, mac_addr);
+    render(&s_routes, rule != NULL ? rule->class_name : ROUTES_DEFAULT_CLASS, mac_addr, out->topic);
+    out->qos = rule != NULL ? rule->qos : s_routes.qos;
+    out->retain = rule != NULL ? rule->retain : s_routes.retain;
+    out->raw = rule != NULL && rule->raw;
+    const uint32_t gen = s_generation;
+
+    xSemaphoreGive(s_lock);
+    return gen;
+}
+
+esp_err_t routes_check_template(const char *tmpl) {
+    return compile_template(tmpl, &s_scratch);
+}
+
+esp_err_t routes_check_prefix(const char *prefix) {
+    return topic_text_ok(prefix, strlen(prefix)) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t routes_check_classes(const char *rules) {
+    memset(&s_scratch, 0, sizeof(s_scratch));
+    return compile_rules(rules, &s_scratch);
+}
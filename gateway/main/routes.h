@@ -0,0 +1,93 @@
+#ifndef _ROUTES_H_
+#define _ROUTES_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Maps a device to its MQTT topic, QoS and retain flag.
+ *
+ *   mqtt.topic     template with {prefix}, {class} and {mac} placeholders,
+ *                  e.g. "{prefix}/{class}/{mac}"
+ *   mqtt.prefix    value of {prefix}
+ *   mqtt.qos       QoS of devices without a class rule
+ *   mqtt.retain    retain flag of devices without a class rule
+ *   mqtt.classes   rules "addr=class[,qos[,retain[,raw]]]" separated by ';',
+ *                  addr is a full MAC or a 3-byte OUI, e.g.
+ *                  "24:0a:c4=telemetry;24:0a:c4:12:34:56=alarm,1,1"
+ *
+ * A rule ending in ",raw" marks nodes that do not use the frame format:
+ * their payloads are forwarded as they are even when the first byte
+ * happens to be PROTO_MAGIC.
+ *
+ * A full MAC rule wins over an OUI rule. Devices without a rule belong to
+ * class ROUTES_DEFAULT_CLASS. The settings are compiled into a token list
+ * and rule table whenever one of them changes, and every change bumps
+ * routes_generation(), so callers cache a resolved target per device and
+ * only resolve again when the generation moved.
+ */
+#define ROUTES_TOPIC_MAX_LEN 96
+#define ROUTES_CLASS_MAX_LEN 16
+#define ROUTES_MAX_TOKENS 16
+#define ROUTES_MAX_RULES 16
+#define ROUTES_DEFAULT_CLASS "default"
+
+/**
+ * @brief Where and how messages of one device are published.
+ */
+typedef struct {
+    char topic[ROUTES_TOPIC_MAX_LEN];
+    uint8_t qos;
+    bool retain;
+    bool raw; // never parse payloads as frames
+} routes_target_t;
+
+/**
+ * @brief Compiles routing settings and follows their changes.
+ *
+ * Must be called after settings_init().
+ */
+esp_err_t routes_init(void);
+
+/**
+ * @brief Returns the current routing generation, never 0.
+ *
+ * Lock-free, meant for the per-frame staleness check.
+ */
+uint32_t routes_generation(void);
+
+/**
+ * @brief Resolves target of one device.
+ *
+ * @param mac_addr Device MAC address.
+ * @param[out] out Resolved target.
+ * @return Generation the target belongs to.
+ */
+uint32_t routes_resolve(const uint8_t *mac_addr, routes_target_t *out);
+
+/**
+ * @brief Validates a topic template, for use by settings.
+ */
+esp_err_t routes_check_template(const char *tmpl);
+
+/**
+ * @brief Validates a topic prefix, for use by settings.
+ */
+esp_err_t routes_check_prefix(const char *prefix);
+
+/**
+ * @brief Validates class rules, for use by settings.
+ */
+esp_err_t routes_check_classes(const char *rules);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ROUTES_H_ */
@@ -0,0 +1,54 @@
+#include "rx_pool.h"
+
+#include <stdint.h>
+
+#include "config.h"
+
+#if GATEWAY_RX_POOL_SIZE < 1 || GATEWAY_RX_POOL_SIZE > 32
+#error "GATEWAY_RX_POOL_SIZE must be in range 1..32"
+#endif
+
+// One bit per slot, set while the slot is borrowed.
+#define POOL_MASK ((uint32_t)(UINT64_C(0xFFFFFFFF) >> (32 - GATEWAY_RX_POOL_SIZE)))
+
+static espnow_rx_t s_slots[GATEWAY_RX_POOL_SIZE];
+static uint32_t s_used = 0;
+
+void rx_pool_reset(void) {
+    __atomic_store_n(&s_used, 0, __ATOMIC_RELEASE);
+}
+
+espnow_rx_t *rx_pool_acquire(void) {
+    uint32_t used = __atomic_load_n(&s_used, __ATOMIC_ACQUIRE);
+
+    for (;;) {
+        const uint32_t free_bits = ~used & POOL_MASK;
+        if (unlikely(free_bits == 0)) {
+            return NULL;
+        }
+
+        const uint32_t bit = free_bits & (~free_bits + 1); // lowest free slot
+        if (__atomic_compare_exchange_n(&s_used, &used, used | bit, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return &s_slots[__builtin_ctz(bit)];
+        }
+        // CAS failed, `used` now holds the fresh value, retry.
+    }
+}
+
+esp_err_t rx_pool_release(espnow_rx_t *rx) {
+    if (unlikely(rx < &s_slots[0] || rx >= &s_slots[GATEWAY_RX_POOL_SIZE])) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const uint32_t bit = UINT32_C(1) << (size_t)(rx - s_slots);
+    const uint32_t prev = __atomic_fetch_and(&s_used, ~bit, __ATOMIC_RELEASE);
+    if (unlikely((prev & bit) == 0)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    return ESP_OK;
+}
+
+size_t rx_pool_in_use(void) {
+    return (size_t)__builtin_popcount(__atomic_load_n(&s_used, __ATOMIC_RELAXED));
+}
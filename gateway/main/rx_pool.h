@@ -0,0 +1,49 @@
+#ifndef _RX_POOL_H_
+#define _RX_POOL_H_
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+#include "espnow.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Marks every descriptor in the RX pool as free.
+ *
+ * Must not be called while descriptors are still borrowed by the receive
+ * pipeline.
+ */
+void rx_pool_reset(void);
+
+/**
+ * @brief Takes a free RX descriptor from the pool.
+ *
+ * Lock-free and non-blocking, safe to call from the Wi-Fi receive callback.
+ *
+ * @return Pointer to descriptor, or NULL when the pool is exhausted.
+ */
+espnow_rx_t *rx_pool_acquire(void);
+
+/**
+ * @brief Returns RX descriptor back to the pool.
+ *
+ * @param rx Descriptor previously obtained from rx_pool_acquire().
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if @p rx does not belong to
+ *         the pool, ESP_ERR_INVALID_STATE if it is already free (double free).
+ */
+esp_err_t rx_pool_release(espnow_rx_t *rx);
+
+/**
+ * @brief Returns number of descriptors currently borrowed from the pool.
+ */
+size_t rx_pool_in_use(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _RX_POOL_H_ */
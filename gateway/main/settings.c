@@ -10,11 +10,13 @@
 #include "nvs.h"
 
 #include "config.h"
+#include "routes.h"
 
 static const char *const TAG = "settings";
 
 #define SETTINGS_NAMESPACE "cfg"
-#define SETTINGS_MAX_VALUE_LEN (sizeof(s_settings.mqtt_uri))
+#define SETTINGS_MAX_VALUE_LEN (sizeof(s_settings.mqtt_classes)) // longest string setting
+#define SETTINGS_MAX_LISTENERS 4
 
 typedef enum {
     SETTING_TYPE_STR = 0,
@@ -31,14 +33,28 @@ typedef struct {
     setting_type_t type;
     setting_value_ptr_t value;
     size_t str_buf_len;
+    uint8_t u8_max;
+    esp_err_t (*check)(const char *value); // optional, for STR entries
 } setting_entry_t;
 
 #define SETTING_ENTRY_STR(k, b) {.key = (k), .type = SETTING_TYPE_STR, .value.str = (b), .str_buf_len = sizeof(b)}
 
-#define SETTING_ENTRY_U8(k, b) {.key = (k), .type = SETTING_TYPE_U8, .value.u8 = (b), .str_buf_len = 0}
+#define SETTING_ENTRY_STR_CHECKED(k, b, c)                                                                             \
+    {.key = (k), .type = SETTING_TYPE_STR, .value.str = (b), .str_buf_len = sizeof(b), .check = (c)}
+
+#define SETTING_ENTRY_U8(k, b) SETTING_ENTRY_U8_MAX(k, b, UINT8_MAX)
+
+#define SETTING_ENTRY_U8_MAX(k, b, m)                                                                                  \
+    {.key = (k), .type = SETTING_TYPE_U8, .value.u8 = (b), .str_buf_len = 0, .u8_max = (m)}
+
+typedef struct {
+    settings_listener_t cb;
+    void *ctx;
+} settings_listener_slot_t;
 
 static settings_t s_settings;
 static bool s_settings_loaded = false;
+static settings_listener_slot_t s_listeners[SETTINGS_MAX_LISTENERS];
 
 static setting_entry_t s_entries[] = {
     SETTING_ENTRY_STR("wifi.ssid", s_settings.wifi_ssid),
@@ -49,6 +65,12 @@ static setting_entry_t s_entries[] = {
     SETTING_ENTRY_STR("mqtt.uri", s_settings.mqtt_uri),
     SETTING_ENTRY_STR("mqtt.user", s_settings.mqtt_user),
     SETTING_ENTRY_STR("mqtt.password", s_settings.mqtt_password),
+    SETTING_ENTRY_U8_MAX("mqtt.qos", &s_settings.mqtt_qos, 2),
+    SETTING_ENTRY_U8_MAX("mqtt.retain", &s_settings.mqtt_retain, 1),
+    SETTING_ENTRY_STR_CHECKED("mqtt.topic", s_settings.mqtt_topic, routes_check_template),
+    SETTING_ENTRY_STR_CHECKED("mqtt.prefix", s_settings.mqtt_prefix, routes_check_prefix),
+    SETTING_ENTRY_STR_CHECKED("mqtt.classes", s_settings.mqtt_classes, routes_check_classes),
+    SETTING_ENTRY_U8_MAX("log.level", &s_settings.log_level, ESP_LOG_VERBOSE),
 };
 
 static esp_err_t settings_parse_u8(const char *value, uint8_t *out) {
@@ -75,6 +97,18 @@ static void settings_apply_defaults(settings_t *out) {
     strlcpy(out->mqtt_uri, GATEWAY_BROKER_URL, sizeof(out->mqtt_uri));
     strlcpy(out->mqtt_user, GATEWAY_BROKER_USERNAME, sizeof(out->mqtt_user));
     strlcpy(out->mqtt_password, GATEWAY_BROKER_PASSWORD, sizeof(out->mqtt_password));
+    out->mqtt_qos = GATEWAY_BROKER_QOS;
+    out->mqtt_retain = GATEWAY_BROKER_RETAIN;
+    strlcpy(out->mqtt_topic, GATEWAY_BROKER_TOPIC, sizeof(out->mqtt_topic));
+    strlcpy(out->mqtt_prefix, GATEWAY_BROKER_TOPIC_PREFIX, sizeof(out->mqtt_prefix));
+    out->mqtt_classes[0] = '\0';
+    out->log_level = GATEWAY_LOG_LEVEL;
+}
+
+static void settings_notify(const char *key) {
+    for (size_t i = 0; i < SETTINGS_MAX_LISTENERS && s_listeners[i].cb != NULL; i++) {
+        s_listeners[i].cb(key, s_listeners[i].ctx);
+    }
 }
 
 static setting_entry_t *settings_find_entry(const char *key) {
@@ -321,6 +355,45 @@ const char *settings_mqtt_password(void) {
     return settings_get()->mqtt_password;
 }
 
+uint8_t settings_mqtt_qos(void) {
+    return settings_get()->mqtt_qos;
+}
+
+uint8_t settings_mqtt_retain(void) {
+    return settings_get()->mqtt_retain;
+}
+
+const char *settings_mqtt_topic(void) {
+    return settings_get()->mqtt_topic;
+}
+
+const char *settings_mqtt_prefix(void) {
+    return settings_get()->mqtt_prefix;
+}
+
+const char *settings_mqtt_classes(void) {
+    return settings_get()->mqtt_classes;
+}
+
+uint8_t settings_log_level(void) {
+    return settings_get()->log_level;
+}
+
+esp_err_t settings_add_listener(settings_listener_t cb, void *ctx) {
+    if (cb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (size_t i = 0; i < SETTINGS_MAX_LISTENERS; i++) {
+        if (s_listeners[i].cb == NULL) {
+            s_listeners[i] = (settings_listener_slot_t){.cb = cb, .ctx = ctx};
+            return ESP_OK;
+        }
+    }
+
+    return ESP_ERR_NO_MEM;
+}
+
 const char *settings_get_value(const char *key) {
     static char value_buf[4];
 
@@ -363,6 +436,10 @@ esp_err_t settings_set(const char *key, const char *value) {
             ret = ESP_ERR_INVALID_SIZE;
             goto out;
         }
+        if (entry->check != NULL && entry->check(value) != ESP_OK) {
+            ret = ESP_ERR_INVALID_ARG;
+            goto out;
+        }
 
         ret = nvs_set_str(nvs, key, value);
         if (ret == ESP_OK) {
@@ -372,6 +449,10 @@ esp_err_t settings_set(const char *key, const char *value) {
     case SETTING_TYPE_U8: {
         uint8_t parsed = 0;
         ESP_GOTO_ON_ERROR(settings_parse_u8(value, &parsed), out, TAG, "invalid key");
+        if (parsed > entry->u8_max) {
+            ret = ESP_ERR_INVALID_ARG;
+            goto out;
+        }
 
         ret = nvs_set_u8(nvs, key, parsed);
         if (ret == ESP_OK) {
@@ -390,6 +471,9 @@ esp_err_t settings_set(const char *key, const char *value) {
 
 out:
     nvs_close(nvs);
+    if (ret == ESP_OK) {
+        settings_notify(key);
+    }
     return ret;
 }
 
@@ -422,5 +506,6 @@ esp_err_t settings_clear(const char *key) {
 
     settings_apply_defaults(&s_settings);
     settings_load_from_nvs();
+    settings_notify(key);
     return ESP_OK;
 }
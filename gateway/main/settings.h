@@ -19,8 +19,24 @@ typedef struct {
     char mqtt_uri[129];
     char mqtt_user[65];
     char mqtt_password[65];
+    uint8_t mqtt_qos;
+    uint8_t mqtt_retain;
+    char mqtt_topic[65];
+    char mqtt_prefix[33];
+    char mqtt_classes[257];
+    uint8_t log_level;
 } settings_t;
 
+/**
+ * @brief Called after a setting was changed or cleared.
+ *
+ * Runs in the task that changed the setting.
+ *
+ * @param key Setting key.
+ * @param ctx Context passed to settings_add_listener().
+ */
+typedef void (*settings_listener_t)(const char *key, void *ctx);
+
 /**
  * @brief Loads runtime settings from defaults and NVS.
  *
@@ -77,6 +93,45 @@ const char *settings_mqtt_user(void);
  */
 const char *settings_mqtt_password(void);
 
+/**
+ * @brief Returns default MQTT QoS.
+ */
+uint8_t settings_mqtt_qos(void);
+
+/**
+ * @brief Returns default MQTT retain flag.
+ */
+uint8_t settings_mqtt_retain(void);
+
+/**
+ * @brief Returns MQTT topic template.
+ */
+const char *settings_mqtt_topic(void);
+
+/**
+ * @brief Returns MQTT topic prefix.
+ */
+const char *settings_mqtt_prefix(void);
+
+/**
+ * @brief Returns per-device MQTT class rules.
+ */
+const char *settings_mqtt_classes(void);
+
+/**
+ * @brief Returns level of per-frame logging, an esp_log_level_t.
+ */
+uint8_t settings_log_level(void);
+
+/**
+ * @brief Registers a callback for setting changes.
+ *
+ * @param cb Listener.
+ * @param ctx Passed to @p cb.
+ * @return ESP_OK, or ESP_ERR_NO_MEM when all listener slots are taken.
+ */
+esp_err_t settings_add_listener(settings_listener_t cb, void *ctx);
+
 /**
  * @brief Sets configuration value by key and persists it in NVS.
  *
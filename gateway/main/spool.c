@@ -0,0 +1,487 @@
+#include "spool.h"
+
+#include <string.h>
+
+#include "proto.h"
+
+#define SECTOR_MAGIC 0x4C4F4F50 // "POOL" in flash byte order
+#define STATE_PENDING 0xFF
+#define STATE_CONSUMED 0x00
+#define ALIGN4(n) (((n) + 3) & ~(size_t)3)
+#define CRC_CHUNK_LEN 64
+
+typedef enum {
+    REC_OK,
+    REC_END, // erased space or end of sector
+    REC_BAD, // torn or corrupt, nothing after it in the sector is trusted
+} rec_status_t;
+
+typedef struct {
+    uint8_t state;
+    uint8_t flags;
+    uint16_t len; // body length
+    uint32_t crc;
+} rec_hdr_t;
+
+static size_t addr(const spool_t *s, size_t sector, size_t off) {
+    return sector * s->flash->sector_size + off;
+}
+
+static size_t max_body(const spool_t *s) {
+    const size_t n = s->flash->sector_size - SPOOL_SECTOR_HDR_LEN - SPOOL_RECORD_HDR_LEN;
+    return n < UINT16_MAX ? n : UINT16_MAX - 1;
+}
+
+static size_t record_size(size_t body_len) {
+    return ALIGN4(SPOOL_RECORD_HDR_LEN + body_len);
+}
+
+static void encode_hdr(uint8_t *p, uint8_t flags, uint16_t len, uint32_t crc) {
+    p[0] = STATE_PENDING;
+    p[1] = (uint8_t)~(flags & SPOOL_FLAGS_MASK);
+    proto_put_u16(p + 2, len);
+    proto_put_u32(p + 4, crc);
+}
+
+static uint32_t body_crc(uint16_t len, const char *topic, size_t topic_len, const uint8_t *data, size_t data_len) {
+    uint8_t prefix[3];
+    proto_put_u16(prefix, len);
+    prefix[2] = (uint8_t)topic_len;
+
+    uint32_t crc = proto_crc32(0, prefix, sizeof(prefix));
+    crc = proto_crc32(crc, (const uint8_t *)topic, topic_len);
+    return proto_crc32(crc, data, data_len);
+}
+
+// Checks the body in place, in small chunks, so recovery needs no record-sized buffer.
+static esp_err_t verify_in_flash(const spool_t *s, size_t at, const rec_hdr_t *hdr, bool *ok) {
+    uint8_t chunk[CRC_CHUNK_LEN];
+    proto_put_u16(chunk, hdr->len);
+    uint32_t crc = proto_crc32(0, chunk, 2);
+
+    for (size_t done = 0; done < hdr->len;) {
+        const size_t n = hdr->len - done < sizeof(chunk) ? hdr->len - done : sizeof(chunk);
+        const esp_err_t err = s->flash->read(s->flash->ctx, at + SPOOL_RECORD_HDR_LEN + done, chunk, n);
+        if (err != ESP_OK) {
+            return err;
+        }
+        crc = proto_crc32(crc, chunk, n);
+        done += n;
+    }
+
+    *ok = crc == hdr->crc;
+    return ESP_OK;
+}
+
+static esp_err_t read_hdr(const spool_t *s, size_t sector, size_t off, rec_hdr_t *out, rec_status_t *status) {
+    if (off + SPOOL_RECORD_HDR_LEN > s->flash->sector_size) {
+        *status = REC_END;
+        return ESP_OK;
+    }
+
+    uint8_t raw[SPOOL_RECORD_HDR_LEN];
+    const esp_err_t err = s->flash->read(s->flash->ctx, addr(s, sector, off), raw, sizeof(raw));
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    static const uint8_t erased[SPOOL_RECORD_HDR_LEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    if (memcmp(raw, erased, sizeof(raw)) == 0) {
+        *status = REC_END;
+        return ESP_OK;
+    }
+
+    out->state = raw[0];
+    out->flags = (uint8_t)~raw[1];
+    out->len = proto_get_u16(raw + 2);
+    out->crc = proto_get_u32(raw + 4);
+
+    const bool sane = (out->flags & ~SPOOL_FLAGS_MASK) == 0 && out->len > 0 && out->len <= max_body(s) &&
+                      off + record_size(out->len) <= s->flash->sector_size;
+    *status = sane ? REC_OK : REC_BAD;
+    return ESP_OK;
+}
+
+typedef struct {
+    size_t end;           // offset after the last valid record
+    bool torn;            // scan stopped at a bad record
+    uint32_t pending;     // pending records found
+    size_t first_pending; // offset of the first one, valid if pending > 0
+} scan_t;
+
+static esp_err_t scan_sector(const spool_t *s, size_t sector, scan_t *out) {
+    *out = (scan_t){.end = SPOOL_SECTOR_HDR_LEN};
+
+    for (;;) {
+        rec_hdr_t hdr;
+        rec_status_t status;
+        esp_err_t err = read_hdr(s, sector, out->end, &hdr, &status);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (status == REC_END) {
+            return ESP_OK;
+        }
+
+        bool ok = false;
+        if (status == REC_OK) {
+            err = verify_in_flash(s, addr(s, sector, out->end), &hdr, &ok);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+        if (!ok) {
+            out->torn = true;
+            return ESP_OK;
+        }
+
+        if (hdr.state == STATE_PENDING) {
+            if (out->pending++ == 0) {
+                out->first_pending = out->end;
+            }
+        }
+        out->end += record_size(hdr.len);
+    }
+}
+
+static esp_err_t read_sector_seq(const spool_t *s, size_t sector, bool *valid, uint32_t *seq) {
+    uint8_t raw[SPOOL_SECTOR_HDR_LEN];
+    const esp_err_t err = s->flash->read(s->flash->ctx, addr(s, sector, 0), raw, sizeof(raw));
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    *valid = proto_get_u32(raw) == SECTOR_MAGIC;
+    *seq = proto_get_u32(raw + 4);
+    return ESP_OK;
+}
+
+static esp_err_t erase_sector(spool_t *s, size_t sector) {
+    const esp_err_t err = s->flash->erase(s->flash->ctx, addr(s, sector, 0), s->flash->sector_size);
+    if (err == ESP_OK) {
+        s->stats.erases++;
+    }
+    return err;
+}
+
+esp_err_t spool_open(spool_t *s, const spool_flash_t *flash, uint8_t *wbuf, size_t wbuf_cap) {
+    if (s == NULL || flash == NULL || wbuf == NULL || wbuf_cap < 64 || wbuf_cap % 4 != 0 ||
+        flash->sector_size < 256 || flash->sector_size % 4 != 0 || flash->size % flash->sector_size != 0 ||
+        flash->size / flash->sector_size < 2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *s = (spool_t){
+        .flash = flash,
+        .sectors = flash->size / flash->sector_size,
+        .next_sector_seq = 1,
+        .wbuf = wbuf,
+        .wbuf_cap = wbuf_cap < flash->sector_size - SPOOL_SECTOR_HDR_LEN ? wbuf_cap
+                                                                         : flash->sector_size - SPOOL_SECTOR_HDR_LEN,
+    };
+
+    // The newest sector is the write head, older ones follow it around the ring.
+    for (size_t i = 0; i < s->sectors; i++) {
+        bool valid;
+        uint32_t seq;
+        const esp_err_t err = read_sector_seq(s, i, &valid, &seq);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (valid && (!s->has_head || seq >= s->next_sector_seq)) {
+            s->has_head = true;
+            s->head_sector = i;
+            s->next_sector_seq = seq + 1;
+        }
+    }
+
+    if (!s->has_head) {
+        return ESP_OK;
+    }
+
+    for (size_t n = 1; n <= s->sectors; n++) {
+        const size_t i = (s->head_sector + n) % s->sectors;
+
+        bool valid;
+        uint32_t seq;
+        esp_err_t err = read_sector_seq(s, i, &valid, &seq);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (!valid) {
+            continue;
+        }
+
+        scan_t scan;
+        err = scan_sector(s, i, &scan);
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        if (scan.pending > 0 && s->stats.pending == 0) {
+            s->tail_sector = i;
+            s->tail_off = scan.first_pending;
+        }
+        s->stats.pending += scan.pending;
+
+        if (i == s->head_sector) {
+            // Never append behind a torn record, the next append opens a fresh sector.
+            s->head_off = scan.torn ? s->flash->sector_size : scan.end;
+        } else if (scan.pending == 0) {
+            err = erase_sector(s, i);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+    }
+
+    s->stats.recovered = s->stats.pending;
+    return ESP_OK;
+}
+
+// Counts pending records from the tail to the end of its sector, which is about to be erased.
+static esp_err_t drop_tail_sector(spool_t *s) {
+    size_t off = s->tail_off;
+    for (;;) {
+        rec_hdr_t hdr;
+        rec_status_t status;
+        const esp_err_t err = read_hdr(s, s->tail_sector, off, &hdr, &status);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (status != REC_OK) {
+            break;
+        }
+        if (hdr.state == STATE_PENDING && s->stats.pending > 0) {
+            s->stats.pending--;
+            s->stats.dropped++;
+        }
+        off += record_size(hdr.len);
+    }
+
+    s->tail_sector = (s->tail_sector + 1) % s->sectors;
+    s->tail_off = SPOOL_SECTOR_HDR_LEN;
+    s->peek_size = 0;
+    return ESP_OK;
+}
+
+static esp_err_t open_sector(spool_t *s) {
+    const size_t next = s->has_head ? (s->head_sector + 1) % s->sectors : 0;
+
+    esp_err_t err;
+    if (s->stats.pending > 0 && next == s->tail_sector) {
+        err = drop_tail_sector(s);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    err = erase_sector(s, next);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    uint8_t raw[SPOOL_SECTOR_HDR_LEN];
+    proto_put_u32(raw, SECTOR_MAGIC);
+    proto_put_u32(raw + 4, s->next_sector_seq);
+    err = s->flash->write(s->flash->ctx, addr(s, next, 0), raw, sizeof(raw));
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    s->has_head = true;
+    s->head_sector = next;
+    s->head_off = SPOOL_SECTOR_HDR_LEN;
+    s->next_sector_seq++;
+    return ESP_OK;
+}
+
+esp_err_t spool_flush(spool_t *s) {
+    if (s->wbuf_len == 0) {
+        return ESP_OK;
+    }
+
+    const esp_err_t err = s->flash->write(s->flash->ctx, addr(s, s->head_sector, s->head_off), s->wbuf, s->wbuf_len);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    s->head_off += s->wbuf_len;
+    s->wbuf_len = 0;
+    return ESP_OK;
+}
+
+size_t spool_max_message(const spool_t *s) {
+    return max_body(s) - 1;
+}
+
+esp_err_t spool_append(spool_t *s, const char *topic, const uint8_t *data, size_t len, uint8_t flags) {
+    const size_t topic_len = strlen(topic);
+    if (topic_len > UINT8_MAX || len > spool_max_message(s) || topic_len > spool_max_message(s) - len) {
+        s->stats.too_large++;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    const uint16_t body_len = (uint16_t)(1 + topic_len + len);
+    const size_t size = record_size(body_len);
+    const uint32_t crc = body_crc(body_len, topic, topic_len, data, len);
+
+    esp_err_t err;
+    if (!s->has_head || s->head_off + s->wbuf_len + size > s->flash->sector_size) {
+        err = spool_flush(s);
+        if (err == ESP_OK) {
+            err = open_sector(s);
+        }
+    } else if (s->wbuf_len + size > s->wbuf_cap) {
+        err = spool_flush(s);
+    } else {
+        err = ESP_OK;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    const size_t off = s->head_off + s->wbuf_len;
+
+    if (size <= s->wbuf_cap) {
+        uint8_t *p = s->wbuf + s->wbuf_len;
+        encode_hdr(p, flags, body_len, crc);
+        p[SPOOL_RECORD_HDR_LEN] = (uint8_t)topic_len;
+        memcpy(p + SPOOL_RECORD_HDR_LEN + 1, topic, topic_len);
+        memcpy(p + SPOOL_RECORD_HDR_LEN + 1 + topic_len, data, len);
+        memset(p + SPOOL_RECORD_HDR_LEN + body_len, 0xFF, size - SPOOL_RECORD_HDR_LEN - body_len);
+        s->wbuf_len += size;
+    } else {
+        // Larger than the batch buffer (flushed above): program in place, header last so a torn write fails the CRC.
+        uint8_t prefix[SPOOL_RECORD_HDR_LEN + 1 + UINT8_MAX];
+        encode_hdr(prefix, flags, body_len, crc);
+        prefix[SPOOL_RECORD_HDR_LEN] = (uint8_t)topic_len;
+        memcpy(prefix + SPOOL_RECORD_HDR_LEN + 1, topic, topic_len);
+
+        const size_t at = addr(s, s->head_sector, off);
+        const size_t prefix_len = SPOOL_RECORD_HDR_LEN + 1 + topic_len;
+        err = s->flash->write(s->flash->ctx, at + SPOOL_RECORD_HDR_LEN, prefix + SPOOL_RECORD_HDR_LEN,
+                              prefix_len - SPOOL_RECORD_HDR_LEN);
+        if (err == ESP_OK) {
+            err = s->flash->write(s->flash->ctx, at + prefix_len, data, len);
+        }
+        if (err == ESP_OK) {
+            err = s->flash->write(s->flash->ctx, at, prefix, SPOOL_RECORD_HDR_LEN);
+        }
+        // Whatever was programmed is skipped over, the sector is closed.
+        s->head_off = err == ESP_OK ? off + size : s->flash->sector_size;
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    if (s->stats.pending++ == 0) {
+        s->tail_sector = s->head_sector;
+        s->tail_off = off;
+    }
+    s->stats.appended++;
+    return ESP_OK;
+}
+
+esp_err_t spool_peek(spool_t *s, spool_record_t *out, uint8_t *buf, size_t cap) {
+    s->peek_size = 0;
+
+    for (;;) {
+        if (s->stats.pending == 0) {
+            return ESP_ERR_NOT_FOUND;
+        }
+
+        esp_err_t err;
+        const bool in_head = s->tail_sector == s->head_sector;
+        if (in_head && s->tail_off >= s->head_off) {
+            // The reader caught up with records still in the write buffer.
+            if (s->wbuf_len == 0) {
+                s->stats.pending = 0;
+                return ESP_ERR_NOT_FOUND;
+            }
+            err = spool_flush(s);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+
+        rec_hdr_t hdr;
+        rec_status_t status;
+        err = read_hdr(s, s->tail_sector, s->tail_off, &hdr, &status);
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        if (status != REC_OK) {
+            if (in_head) {
+                s->stats.pending = 0;
+                return ESP_ERR_NOT_FOUND;
+            }
+            // Done with this sector. It stays as it is until the write head enters it and erases it.
+            s->tail_sector = (s->tail_sector + 1) % s->sectors;
+            s->tail_off = SPOOL_SECTOR_HDR_LEN;
+            continue;
+        }
+
+        if (hdr.state != STATE_PENDING) {
+            s->tail_off += record_size(hdr.len);
+            continue;
+        }
+
+        if (hdr.len > cap) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        err = s->flash->read(s->flash->ctx, addr(s, s->tail_sector, s->tail_off + SPOOL_RECORD_HDR_LEN), buf,
+                             hdr.len);
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        uint8_t len_le[2];
+        proto_put_u16(len_le, hdr.len);
+        const size_t topic_len = buf[0];
+        if (proto_crc32(proto_crc32(0, len_le, sizeof(len_le)), buf, hdr.len) != hdr.crc ||
+            1 + topic_len > hdr.len) {
+            // Corrupted after it was written, skip it rather than stall the drain.
+            s->peek_size = record_size(hdr.len);
+            err = spool_consume(s);
+            if (err != ESP_OK) {
+                return err;
+            }
+            s->stats.consumed--;
+            s->stats.dropped++;
+            continue;
+        }
+
+        // Shift the topic over its length byte to make room for the terminator.
+        memmove(buf, buf + 1, topic_len);
+        buf[topic_len] = '\0';
+
+        out->topic = (const char *)buf;
+        out->data = buf + 1 + topic_len;
+        out->len = hdr.len - 1 - topic_len;
+        out->flags = hdr.flags;
+
+        s->peek_size = record_size(hdr.len);
+        return ESP_OK;
+    }
+}
+
+esp_err_t spool_consume(spool_t *s) {
+    if (s->peek_size == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    const uint8_t state = STATE_CONSUMED;
+    const esp_err_t err = s->flash->write(s->flash->ctx, addr(s, s->tail_sector, s->tail_off), &state, 1);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    s->tail_off += s->peek_size;
+    s->peek_size = 0;
+    s->stats.pending--;
+    s->stats.consumed++;
+    return ESP_OK;
+}
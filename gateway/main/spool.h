@@ -0,0 +1,148 @@
+#ifndef _SPOOL_H_
+#define _SPOOL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Append-only log of MQTT messages kept in a flash region, used as a ring of
+ * erase sectors:
+ *
+ *   sector   magic u32, sequence u32, then records up to the first erased byte
+ *   record   state u8 (0xFF pending, 0x00 consumed), inverted flags u8,
+ *            length u16, crc32 u32 over length and body, body, 0xFF padding
+ *            to 4 bytes
+ *   body     topic length u8, topic, data
+ *
+ * Appends are collected in a RAM buffer and programmed in one write, so flash
+ * sees few large writes instead of one per message. Sectors are erased only
+ * when the write head enters them, which spreads wear evenly over the region.
+ * Consuming a record clears its state byte, a 1 -> 0 transition that needs no
+ * erase. When the ring is full the oldest sector is erased and its pending
+ * records are counted as dropped.
+ *
+ * The region is reached through spool_flash_t only, so the same code runs on
+ * a partition and on a file or RAM backed emulator.
+ */
+#define SPOOL_SECTOR_HDR_LEN 8
+#define SPOOL_RECORD_HDR_LEN 8
+#define SPOOL_FLAGS_MASK 0x07 // caller defined record flags, stored inverted so 0 is the erased value
+
+/**
+ * @brief Flash region accessed by the spool.
+ *
+ * Offsets are relative to the region start. Writes may only clear bits of
+ * erased (0xFF) bytes, like NOR flash.
+ */
+typedef struct {
+    void *ctx;
+    size_t size;        // multiple of sector_size, at least two sectors
+    size_t sector_size; // erase unit
+    esp_err_t (*read)(void *ctx, size_t off, void *dst, size_t len);
+    esp_err_t (*write)(void *ctx, size_t off, const void *src, size_t len);
+    esp_err_t (*erase)(void *ctx, size_t off, size_t len);
+} spool_flash_t;
+
+typedef struct {
+    uint32_t pending;   // records appended and not yet consumed
+    uint32_t appended;  // since open
+    uint32_t consumed;  // since open
+    uint32_t dropped;   // pending records overwritten by a full ring
+    uint32_t too_large; // appends rejected because a record would not fit a sector
+    uint32_t erases;    // sectors erased since open
+    uint32_t recovered; // pending records found by spool_open()
+} spool_stats_t;
+
+/**
+ * @brief Spool state, not thread-safe.
+ */
+typedef struct {
+    const spool_flash_t *flash;
+    size_t sectors;
+    uint32_t next_sector_seq;
+    bool has_head;    // a sector is open for writing
+    size_t head_sector;
+    size_t head_off;  // end of programmed data in the head sector
+    size_t tail_sector;
+    size_t tail_off;  // oldest pending record, valid while pending > 0
+    size_t peek_size; // record returned by the last spool_peek(), 0 if none
+    uint8_t *wbuf;    // records waiting to be programmed at head_off
+    size_t wbuf_cap;
+    size_t wbuf_len;
+    spool_stats_t stats;
+} spool_t;
+
+/**
+ * @brief Message returned by spool_peek(), pointing into the caller buffer.
+ */
+typedef struct {
+    const char *topic; // NUL terminated
+    const uint8_t *data;
+    size_t len;
+    uint8_t flags; // as given to spool_append()
+} spool_record_t;
+
+/**
+ * @brief Opens the spool and recovers pending records left in flash.
+ *
+ * Records with a bad checksum end their sector, so a write torn by a reset
+ * loses at most the batch that was being programmed.
+ *
+ * @param flash Region, must outlive the spool.
+ * @param wbuf Write batch buffer, multiple of 4 bytes and at least 64.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for a bad geometry, or a flash error.
+ */
+esp_err_t spool_open(spool_t *s, const spool_flash_t *flash, uint8_t *wbuf, size_t wbuf_cap);
+
+/**
+ * @brief Appends one message.
+ *
+ * The message reaches flash on the next spool_flush(), when the write buffer
+ * fills up, or when a reader catches up with it.
+ *
+ * @param flags Caller defined bits within SPOOL_FLAGS_MASK, returned by spool_peek().
+ * @return ESP_OK, ESP_ERR_INVALID_SIZE if the record does not fit a sector,
+ *         or a flash error.
+ */
+esp_err_t spool_append(spool_t *s, const char *topic, const uint8_t *data, size_t len, uint8_t flags);
+
+/**
+ * @brief Programs buffered records to flash.
+ */
+esp_err_t spool_flush(spool_t *s);
+
+/**
+ * @brief Reads the oldest pending message without consuming it.
+ *
+ * @param buf Receives topic and data, spool_max_message() + 1 bytes fit any record.
+ * @return ESP_OK, ESP_ERR_NOT_FOUND when the spool is empty,
+ *         ESP_ERR_INVALID_SIZE if @p buf is too small, or a flash error.
+ */
+esp_err_t spool_peek(spool_t *s, spool_record_t *out, uint8_t *buf, size_t cap);
+
+/**
+ * @brief Marks the message returned by the last spool_peek() as consumed.
+ */
+esp_err_t spool_consume(spool_t *s);
+
+/**
+ * @brief Largest topic plus data length accepted by spool_append().
+ */
+size_t spool_max_message(const spool_t *s);
+
+static inline bool spool_empty(const spool_t *s) {
+    return s->stats.pending == 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SPOOL_H_ */
@@ -0,0 +1,192 @@
+#include "spooler.h"
+
+#include <string.h>
+
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "config.h"
+
+#define STACK_DEPTH 3072
+#define READ_BUF_LEN 4096 // one record of a 4 KiB sector, the flash erase unit
+#define FLAG_QOS_MASK 0x03
+#define FLAG_RETAIN 0x04
+
+static const char *const TAG = "spooler";
+
+static SemaphoreHandle_t s_lock; // guards s_spool, held for flash access only, never across a publish
+static spool_t s_spool;
+static spool_flash_t s_flash;
+static uint8_t s_wbuf[GATEWAY_SPOOL_WRITE_BUFFER];
+static uint8_t s_rbuf[READ_BUF_LEN]; // drain task only
+static routes_target_t s_target;     // drain task only
+static spooler_publish_fn s_publish;
+static TaskHandle_t s_task;
+static bool s_online;
+
+static esp_err_t part_read(void *ctx, size_t off, void *dst, size_t len) {
+    return esp_partition_read(ctx, off, dst, len);
+}
+
+static esp_err_t part_write(void *ctx, size_t off, const void *src, size_t len) {
+    return esp_partition_write(ctx, off, src, len);
+}
+
+static esp_err_t part_erase(void *ctx, size_t off, size_t len) {
+    return esp_partition_erase_range(ctx, off, len);
+}
+
+bool spooler_online(void) {
+    return __atomic_load_n(&s_online, __ATOMIC_ACQUIRE);
+}
+
+// Republishes the oldest message, it is consumed only once the client took it.
+static esp_err_t drain_one(void) {
+    spool_record_t rec;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    esp_err_t err = spool_peek(&s_spool, &rec, s_rbuf, sizeof(s_rbuf));
+    xSemaphoreGive(s_lock);
+    if (err != ESP_OK) {
+        if (err != ESP_ERR_NOT_FOUND) {
+            ESP_LOGW(TAG, "spool read failed: %s", esp_err_to_name(err));
+        }
+        return err;
+    }
+
+    strlcpy(s_target.topic, rec.topic, sizeof(s_target.topic));
+    s_target.qos = rec.flags & FLAG_QOS_MASK;
+    s_target.retain = (rec.flags & FLAG_RETAIN) != 0;
+
+    err = s_publish(&s_target, rec.data, rec.len);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    // Fails harmlessly if a full ring overwrote the record meanwhile.
+    err = spool_consume(&s_spool);
+    xSemaphoreGive(s_lock);
+
+    return err;
+}
+
+static void spooler_task(__attribute__((unused)) void *arg) {
+    const TickType_t drain_interval = pdMS_TO_TICKS(1000 / GATEWAY_SPOOL_DRAIN_RATE) > 0
+                                          ? pdMS_TO_TICKS(1000 / GATEWAY_SPOOL_DRAIN_RATE)
+                                          : 1;
+    const TickType_t flush_interval = pdMS_TO_TICKS(GATEWAY_SPOOL_FLUSH_MS);
+
+    for (;;) {
+        TickType_t wait = flush_interval;
+
+        if (spooler_online()) {
+            if (drain_one() == ESP_OK) {
+                wait = drain_interval;
+            }
+        } else {
+            xSemaphoreTake(s_lock, portMAX_DELAY);
+            const esp_err_t err = spool_flush(&s_spool);
+            xSemaphoreGive(s_lock);
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "spool flush failed: %s", esp_err_to_name(err));
+            }
+        }
+
+        // Woken early on reconnect.
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+static void mqtt_event_handler(__attribute__((unused)) void *arg, __attribute__((unused)) esp_event_base_t base,
+                               int32_t event_id, __attribute__((unused)) void *event_data) {
+    switch (event_id) {
+    case MQTT_EVENT_CONNECTED:
+        __atomic_store_n(&s_online, true, __ATOMIC_RELEASE);
+        if (s_task != NULL) {
+            xTaskNotifyGive(s_task);
+        }
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        __atomic_store_n(&s_online, false, __ATOMIC_RELEASE);
+        break;
+    default:
+        break;
+    }
+}
+
+esp_err_t spooler_init(spooler_publish_fn publish) {
+    if (publish == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const esp_partition_t *part =
+        esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, GATEWAY_SPOOL_PARTITION);
+    if (part == NULL) {
+        ESP_LOGE(TAG, "partition '%s' not found", GATEWAY_SPOOL_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (part->erase_size > READ_BUF_LEN) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    s_flash = (spool_flash_t){
+        .ctx = (void *)part,
+        .size = part->size - part->size % part->erase_size,
+        .sector_size = part->erase_size,
+        .read = part_read,
+        .write = part_write,
+        .erase = part_erase,
+    };
+    ESP_RETURN_ON_ERROR(spool_open(&s_spool, &s_flash, s_wbuf, sizeof(s_wbuf)), TAG, "spool_open");
+    ESP_LOGI(TAG, "spool %u KiB, %u messages pending", (unsigned)(s_flash.size / 1024),
+             (unsigned)s_spool.stats.recovered);
+
+    s_lock = xSemaphoreCreateMutex();
+    if (s_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    s_publish = publish;
+    if (xTaskCreate(spooler_task, "spooler", STACK_DEPTH, NULL, GATEWAY_SPOOL_TASK_PRIORITY, &s_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create spooler task");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t spooler_set_client(esp_mqtt_client_handle_t client) {
+    return esp_mqtt_client_register_event(client, MQTT_EVENT_ANY, mqtt_event_handler, NULL);
+}
+
+esp_err_t spooler_put(const routes_target_t *to, const uint8_t *data, size_t len) {
+    if (s_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    const uint8_t flags = (to->qos & FLAG_QOS_MASK) | (to->retain ? FLAG_RETAIN : 0);
+    const esp_err_t err = spool_append(&s_spool, to->topic, data, len, flags);
+    xSemaphoreGive(s_lock);
+
+    if (unlikely(err != ESP_OK)) {
+        ESP_LOGW(TAG, "message to %s not spooled: %s", to->topic, esp_err_to_name(err));
+    }
+    return err;
+}
+
+void spooler_stats(spool_stats_t *out) {
+    if (s_lock == NULL) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *out = s_spool.stats;
+    xSemaphoreGive(s_lock);
+}
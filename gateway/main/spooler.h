@@ -0,0 +1,60 @@
+#ifndef _SPOOLER_H_
+#define _SPOOLER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+#include "routes.h"
+#include "spool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Publishes one message directly, bypassing the spool.
+ */
+typedef esp_err_t (*spooler_publish_fn)(const routes_target_t *to, const uint8_t *data, size_t len);
+
+/**
+ * @brief Opens the spool partition and starts the drain task.
+ *
+ * @param publish Used by the drain task to republish spooled messages.
+ * @return ESP_OK, ESP_ERR_NOT_FOUND without a spool partition, or an error.
+ */
+esp_err_t spooler_init(spooler_publish_fn publish);
+
+/**
+ * @brief Follows connection state of the MQTT client.
+ *
+ * Until the client reports a connection, spooler_online() returns false.
+ */
+esp_err_t spooler_set_client(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Tells whether messages can be published directly.
+ */
+bool spooler_online(void);
+
+/**
+ * @brief Stores one message for later publishing.
+ *
+ * Safe to call from any task. Does not wait for flash unless the write
+ * batch is full. Topic, QoS and retain flag are kept with the message.
+ */
+esp_err_t spooler_put(const routes_target_t *to, const uint8_t *data, size_t len);
+
+/**
+ * @brief Copies spool counters.
+ */
+void spooler_stats(spool_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SPOOLER_H_ */
@@ -0,0 +1,589 @@
+#include "uplink.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "proto.h"
+#if CONFIG_GATEWAY_AUTH
+#include "proto_auth.h"
+#endif
+#include "proto_batch.h"
+#if CONFIG_GATEWAY_DELTA
+#include "proto_delta.h"
+#endif
+#include "proto_frag.h"
+#if CONFIG_GATEWAY_TELEMETRY_JSON || CONFIG_GATEWAY_TELEMETRY_FIELDS
+#include "proto_schema.h"
+#endif
+
+#include "config.h"
+#if CONFIG_GATEWAY_BEACON
+#include "beacon.h"
+#endif
+#include "devices.h"
+#if CONFIG_GATEWAY_AUTH
+#include "replay.h"
+#endif
+#if CONFIG_GATEWAY_DOWNLINK
+#include "downlink.h"
+#endif
+#if CONFIG_GATEWAY_ENCRYPT
+#include "keys.h"
+#endif
+#include "metrics.h"
+#if CONFIG_GATEWAY_REGISTRY
+#include "registry.h"
+#endif
+#include "routes.h"
+#include "settings.h"
+#if CONFIG_GATEWAY_ENABLE_SSE_LOGS
+#include "logs.h"
+#endif
+#if CONFIG_GATEWAY_MQTT_BATCH
+#include "mqtt_batch.h"
+#endif
+#if CONFIG_GATEWAY_SPOOL
+#include "spooler.h"
+#endif
+
+static const char *const TAG = "uplink";
+
+#if CONFIG_GATEWAY_AUTH
+// Kconfig default, device keys derived from it can be computed by anyone who read the sources.
+#define PLACEHOLDER_AUTH_MASTER_KEY "change me"
+#endif
+
+#if CONFIG_GATEWAY_DELTA
+#define UPLINK_FLAGS_KNOWN PROTO_FLAGS_KNOWN
+#else
+#define UPLINK_FLAGS_KNOWN (PROTO_FLAGS_KNOWN & ~PROTO_FLAG_DELTA) // delta batches are forwarded raw
+#endif
+
+// Per-worker state, each shard only sees devices hashed to it.
+typedef struct {
+    SemaphoreHandle_t lock; // the worker writes devices under it, other tasks read under it
+    devices_t devices;
+#if CONFIG_GATEWAY_AUTH
+    replay_t replay; // PROTO_FLAG2_AUTH counters, kept when the device leaves the cache
+    replay_entry_t replay_buckets[2 * GATEWAY_AUTH_NODES];
+#endif
+    proto_reasm_t reasm;
+    proto_reasm_slot_t reasm_slots[GATEWAY_REASM_SLOTS];
+#if CONFIG_GATEWAY_MQTT_BATCH
+    mqtt_batch_t batch;
+#endif
+#if CONFIG_GATEWAY_TELEMETRY_JSON
+    char json[GATEWAY_TELEMETRY_JSON_LEN];
+#endif
+#if CONFIG_GATEWAY_DELTA
+    uint8_t delta[GATEWAY_DELTA_BUF_LEN]; // restored batch, valid during one deliver()
+#endif
+} shard_t;
+
+static shard_t s_shards[GATEWAY_ESPNOW_WORKERS];
+static esp_mqtt_client_handle_t s_client = NULL;
+static uint8_t s_log_level = GATEWAY_LOG_LEVEL; // setting log.level
+
+// Per-frame logging, checked against setting log.level before anything is formatted.
+#define HOT_LOG(level, fmt, ...)                                                                                       \
+    do {                                                                                                               \
+        if (unlikely((level) <= __atomic_load_n(&s_log_level, __ATOMIC_RELAXED))) {                                    \
+            ESP_LOG_LEVEL_LOCAL((level), TAG, fmt, ##__VA_ARGS__);                                                     \
+        }                                                                                                              \
+    } while (0)
+#if CONFIG_GATEWAY_AUTH
+static proto_hmac_key_t s_auth_master; // read-only after uplink_init()
+#endif
+
+static inline uint32_t now_ms(TickType_t now) {
+    return (uint32_t)pdTICKS_TO_MS(now);
+}
+
+// Hands one message to the MQTT client, mac_addr is only logged and NULL if the message has no single sender.
+static esp_err_t mqtt_send_from(const uint8_t *mac_addr, const routes_target_t *to, const uint8_t *data, size_t len) {
+    esp_mqtt_client_handle_t client = __atomic_load_n(&s_client, __ATOMIC_ACQUIRE);
+    if (client == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    const int64_t started = esp_timer_get_time();
+#if CONFIG_GATEWAY_MQTT_ENQUEUE
+    int msg_id = esp_mqtt_client_enqueue(client, to->topic, (const char *)data, len, to->qos, to->retain, true);
+#else
+    int msg_id = esp_mqtt_client_publish(client, to->topic, (const char *)data, len, to->qos, to->retain);
+#endif
+    metrics_observe_publish((uint32_t)(esp_timer_get_time() - started));
+
+    HOT_LOG(ESP_LOG_INFO, "mqtt publish, topic=%s len=%u msg_id=%d", to->topic, (unsigned)len, msg_id);
+
+    if (msg_id < 0) {
+        metrics_inc(METRIC_MQTT_FAILED);
+        return ESP_FAIL;
+    }
+    metrics_inc(METRIC_MQTT_PUBLISHED);
+
+#if CONFIG_GATEWAY_ENABLE_SSE_LOGS
+    logs_push(mac_addr, len, msg_id);
+#else
+    (void)mac_addr;
+#endif
+
+    return ESP_OK;
+}
+
+#if CONFIG_GATEWAY_SPOOL
+// Republishes a spooled message for the drain task.
+static esp_err_t mqtt_send(const routes_target_t *to, const uint8_t *data, size_t len) {
+    return mqtt_send_from(NULL, to, data, len);
+}
+#endif
+
+// ctx is the sender's MAC address, NULL for batches.
+static esp_err_t publish(const routes_target_t *to, const uint8_t *data, size_t len, void *ctx) {
+#if CONFIG_GATEWAY_SPOOL
+    // Offline, or the client refused the message: keep it for the drain task.
+    if (!spooler_online() || mqtt_send_from(ctx, to, data, len) != ESP_OK) {
+        return spooler_put(to, data, len);
+    }
+    return ESP_OK;
+#else
+    return mqtt_send_from(ctx, to, data, len);
+#endif
+}
+
+// Forwards one complete application message of a device.
+static esp_err_t forward(shard_t *shard, const device_t *dev, const uint8_t *data, size_t len, TickType_t now) {
+#if CONFIG_GATEWAY_MQTT_BATCH
+    return mqtt_batch_add(&shard->batch, dev->mac_addr, &dev->target, data, len, now);
+#else
+    (void)shard;
+    (void)now;
+    return publish(&dev->target, data, len, (void *)dev->mac_addr);
+#endif
+}
+
+#if CONFIG_GATEWAY_TELEMETRY_JSON
+static esp_err_t forward_telemetry(shard_t *shard, const device_t *dev, const uint8_t *data, size_t len,
+                                   TickType_t now) {
+    const int n = proto_schema_to_json(data, len, shard->json, sizeof(shard->json));
+    if (unlikely(n < 0)) {
+        HOT_LOG(ESP_LOG_WARN, "telemetry from " MACSTR " not decoded, forwarding raw", MAC2STR(dev->mac_addr));
+        return forward(shard, dev, data, len, now);
+    }
+
+    return forward(shard, dev, (const uint8_t *)shard->json, (size_t)n, now);
+}
+#elif CONFIG_GATEWAY_TELEMETRY_FIELDS
+static esp_err_t forward_telemetry(shard_t *shard, const device_t *dev, const uint8_t *data, size_t len,
+                                   TickType_t now) {
+    (void)shard;
+    (void)now;
+
+    proto_tlv_reader_t r;
+    proto_tlv_reader_init(&r, data, len);
+
+    proto_tlv_field_t field;
+    proto_err_t err;
+    esp_err_t ret = ESP_OK;
+    routes_target_t to = {.qos = dev->target.qos, .retain = dev->target.retain};
+    while ((err = proto_tlv_next(&r, &field)) == PROTO_OK) {
+        const proto_field_desc_t *desc = proto_schema_find(field.id);
+        int n = desc != NULL ? snprintf(to.topic, sizeof(to.topic), "%s/%s", dev->target.topic, desc->name)
+                             : snprintf(to.topic, sizeof(to.topic), "%s/f%" PRIu32, dev->target.topic, field.id);
+        if (unlikely(n < 0 || (size_t)n >= sizeof(to.topic))) {
+            ret = ESP_ERR_INVALID_SIZE;
+            continue;
+        }
+
+        char value[128];
+        n = proto_schema_format_value(&field, value, sizeof(value));
+        if (unlikely(n < 0)) {
+            ret = ESP_ERR_INVALID_SIZE;
+            continue;
+        }
+
+        const esp_err_t pub = publish(&to, (const uint8_t *)value, (size_t)n, (void *)dev->mac_addr);
+        ret = ret == ESP_OK ? pub : ret;
+    }
+
+    if (unlikely(err != PROTO_ERR_END)) {
+        HOT_LOG(ESP_LOG_WARN, "malformed telemetry from " MACSTR ": %d", MAC2STR(dev->mac_addr), err);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ret;
+}
+#endif
+
+// Forwards one message, decoding telemetry when configured.
+static esp_err_t deliver_message(shard_t *shard, const device_t *dev, uint8_t flags, const uint8_t *data, size_t len,
+                                 TickType_t now) {
+#if CONFIG_GATEWAY_TELEMETRY_JSON || CONFIG_GATEWAY_TELEMETRY_FIELDS
+    if (flags & PROTO_FLAG_TLV) {
+        return forward_telemetry(shard, dev, data, len, now);
+    }
+#else
+    (void)flags;
+#endif
+
+    return forward(shard, dev, data, len, now);
+}
+
+#if CONFIG_GATEWAY_UNBATCH
+// Forwards every record of a node batch as a message of its own.
+static esp_err_t deliver_batch(shard_t *shard, const device_t *dev, uint8_t flags, const uint8_t *data, size_t len,
+                               TickType_t now) {
+    proto_batch_reader_t r;
+    proto_batch_reader_init(&r, data, len);
+
+    esp_err_t ret = ESP_OK;
+    const uint8_t *rec;
+    size_t rec_len;
+    proto_err_t err;
+    uint32_t records = 0;
+    while ((err = proto_batch_next(&r, &rec, &rec_len)) == PROTO_OK) {
+        const esp_err_t e = deliver_message(shard, dev, flags, rec, rec_len, now);
+        ret = ret == ESP_OK ? e : ret;
+        records++;
+    }
+    metrics_add(METRIC_RX_BATCH_RECORDS, records);
+
+    if (unlikely(err != PROTO_ERR_END)) {
+        HOT_LOG(ESP_LOG_WARN, "batch from " MACSTR " truncated after %" PRIu32 " records", MAC2STR(dev->mac_addr),
+                records);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    return ret;
+}
+#endif
+
+// Forwards a complete message, splitting node batches when configured.
+static esp_err_t deliver(shard_t *shard, const device_t *dev, uint8_t flags, const uint8_t *data, size_t len,
+                         TickType_t now) {
+#if CONFIG_GATEWAY_DELTA
+    if (flags & PROTO_FLAG_DELTA) {
+        // Restored in place of the frame, from here on it is a plain telemetry batch.
+        size_t plain_len = 0;
+        const proto_err_t err = (flags & PROTO_FLAG_BATCH) && (flags & PROTO_FLAG_TLV)
+                                    ? proto_delta_unpack(data, len, shard->delta, sizeof(shard->delta), &plain_len)
+                                    : PROTO_ERR_INVALID_ARG;
+        if (unlikely(err != PROTO_OK)) {
+            HOT_LOG(ESP_LOG_WARN, "delta batch from " MACSTR " not restored: %d", MAC2STR(dev->mac_addr), err);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        metrics_inc(METRIC_RX_DELTA_FRAMES);
+        metrics_add(METRIC_RX_DELTA_BYTES, (uint32_t)(plain_len > len ? plain_len - len : 0));
+
+        flags &= (uint8_t)~PROTO_FLAG_DELTA;
+        data = shard->delta;
+        len = plain_len;
+    }
+#endif
+
+#if CONFIG_GATEWAY_UNBATCH
+    if (flags & PROTO_FLAG_BATCH) {
+        return deliver_batch(shard, dev, flags, data, len, now);
+    }
+#endif
+
+    return deliver_message(shard, dev, flags, data, len, now);
+}
+
+static esp_err_t handle_fragment(shard_t *shard, const device_t *dev, const espnow_rx_t *rx, const proto_frame_t *frame,
+                                 TickType_t now) {
+    proto_frag_hdr_t hdr;
+    if (unlikely(proto_frag_hdr_parse(frame->ext, frame->ext_len, &hdr) != PROTO_OK)) {
+        // Not a fragment a node could have sent, a raw payload starting with PROTO_MAGIC.
+        return forward(shard, dev, rx->data, rx->len, now);
+    }
+
+    proto_msg_t msg;
+    proto_err_t err = proto_reasm_push(&shard->reasm, dev->mac_addr, &hdr, frame->payload, frame->payload_len,
+                                       now_ms(now), &msg);
+    if (err == PROTO_ERR_INCOMPLETE || err == PROTO_ERR_DUPLICATE) {
+        return ESP_OK;
+    }
+    if (err == PROTO_ERR_INVALID_ARG || (err == PROTO_ERR_CRC && hdr.count == 1)) {
+        // Length or CRC of a single frame do not match the header: raw as well.
+        return forward(shard, dev, rx->data, rx->len, now);
+    }
+    if (unlikely(err != PROTO_OK)) {
+        HOT_LOG(ESP_LOG_WARN, "fragment %u/%u of msg %u from " MACSTR " dropped: %d", hdr.index, hdr.count,
+                hdr.msg_id, MAC2STR(dev->mac_addr), err);
+        return ESP_FAIL;
+    }
+
+    esp_err_t ret = deliver(shard, dev, frame->flags, msg.data, msg.len, now);
+    proto_reasm_release(&shard->reasm, &msg);
+
+    return ret;
+}
+
+#if CONFIG_GATEWAY_AUTH
+// Checks tag and counter under the shard lock, before the device is cached or moved up in it: frames from spoofed MACs
+// must not push a node out, and its counter is kept in shard->replay, which nothing pushes out. A device key derived
+// on the way is left in *key with *derived set. Returns the reason to drop the frame or METRIC_COUNT to accept it.
+static metric_t auth_check(shard_t *shard, const espnow_rx_t *rx, bool sealed, const proto_frame_t *frame,
+                           proto_hmac_key_t *key, bool *derived) {
+    *derived = false;
+    if (!sealed) {
+#if CONFIG_GATEWAY_AUTH_REQUIRE
+        return METRIC_RX_AUTH_MISSING;
+#else
+        return METRIC_COUNT;
+#endif
+    }
+
+    // A cached device starts from the precomputed HMAC midstates, others derive their key for this frame.
+    const device_t *dev = devices_find(&shard->devices, rx->mac_addr);
+    const proto_hmac_key_t *k = key;
+    if (dev != NULL && dev->auth_ready) {
+        k = &dev->auth_key;
+    } else {
+        uint8_t raw[PROTO_AUTH_KEY_LEN];
+        proto_auth_derive(&s_auth_master, rx->mac_addr, raw);
+        proto_hmac_key_init(key, raw, sizeof(raw));
+        *derived = true;
+    }
+
+    if (proto_auth_verify(k, rx->data, rx->len) != PROTO_OK) {
+        return METRIC_RX_AUTH_BAD_TAG;
+    }
+    // Only verified counters advance, a forged one cannot lock the device out.
+    const esp_err_t err = replay_advance(&shard->replay, rx->mac_addr, frame->counter);
+    if (err != ESP_OK) {
+        return err == ESP_ERR_NO_MEM ? METRIC_RX_AUTH_FULL : METRIC_RX_AUTH_REPLAYED;
+    }
+    metrics_inc(METRIC_RX_AUTH_VERIFIED);
+
+    return METRIC_COUNT;
+}
+#endif
+
+static esp_err_t handle(const espnow_rx_t *rx, size_t shard_idx) {
+#if !CONFIG_GATEWAY_SPOOL
+    if (s_client == NULL) {
+        HOT_LOG(ESP_LOG_WARN, "mqtt client is not initialized");
+        return ESP_OK;
+    }
+#endif
+
+    shard_t *shard = &s_shards[shard_idx];
+    const TickType_t now = xTaskGetTickCount();
+
+    proto_frame_t frame;
+    const proto_err_t perr = proto_parse(rx->data, rx->len, &frame);
+    // Raw payload, or framing this gateway does not understand: forward as is. Truncated frames are raw payloads
+    // that happen to start with PROTO_MAGIC, a node never sends them.
+    bool raw = perr != PROTO_OK || (frame.flags & ~UPLINK_FLAGS_KNOWN) != 0 ||
+               (frame.flags2 & ~PROTO_FLAGS2_KNOWN) != 0;
+    bool duplicate = false;
+
+    xSemaphoreTake(shard->lock, portMAX_DELAY);
+#if CONFIG_GATEWAY_AUTH
+    proto_hmac_key_t key;
+    bool derived;
+    const metric_t rejected = auth_check(shard, rx, !raw && (frame.flags2 & PROTO_FLAG2_AUTH), &frame, &key, &derived);
+    if (unlikely(rejected != METRIC_COUNT)) {
+        xSemaphoreGive(shard->lock);
+        // Before anything reacts to it: no publish, no beacon, no downlink delivery.
+        metrics_inc(rejected);
+        HOT_LOG(ESP_LOG_DEBUG, "unauthenticated frame from " MACSTR " dropped", MAC2STR(rx->mac_addr));
+        return ESP_OK;
+    }
+#endif
+    // Only this worker modifies the table, so dev stays valid after the lock is released.
+    device_t *dev = devices_lookup(&shard->devices, rx->mac_addr);
+#if CONFIG_GATEWAY_AUTH
+    if (derived) {
+        // Once per cached device, every later frame starts from the precomputed HMAC midstates.
+        dev->auth_key = key;
+        dev->auth_ready = true;
+    }
+#endif
+    dev->rx_frames++;
+    dev->rx_bytes += rx->len;
+    if (unlikely(dev->routes_gen != routes_generation())) {
+        // New device, or routing settings changed since its target was resolved.
+        dev->routes_gen = routes_resolve(dev->mac_addr, &dev->target);
+    }
+    raw = raw || dev->target.raw;
+    if (!raw && (frame.flags & PROTO_FLAG_SEQ)) {
+        duplicate = proto_seq_check(&dev->seq, frame.seq) == PROTO_ERR_DUPLICATE;
+    }
+    xSemaphoreGive(shard->lock);
+
+    if (!raw && (frame.flags & PROTO_FLAG_BEACON)) {
+#if CONFIG_GATEWAY_BEACON
+        if (frame.payload_len == 0) {
+            beacon_probe();
+        }
+#endif
+        return ESP_OK; // probes and beacons of other gateways carry no data
+    }
+
+    if (!raw && (frame.flags2 & PROTO_FLAG2_KEY)) {
+#if CONFIG_GATEWAY_ENCRYPT
+        keys_handle(rx->mac_addr, &frame);
+#endif
+        return ESP_OK; // key exchange, no data
+    }
+
+#if CONFIG_GATEWAY_DOWNLINK
+    if (!raw && (frame.flags & PROTO_FLAG_POLL)) {
+        // A sleepy node stays awake for the reply only, answer even when nothing is queued.
+        downlink_poll(rx->mac_addr);
+    } else {
+        // The node listens right after it sent, deliver what is queued for it.
+        downlink_seen(rx->mac_addr);
+    }
+#endif
+
+    if (duplicate) {
+        metrics_inc(METRIC_RX_DUPLICATES);
+        HOT_LOG(ESP_LOG_DEBUG, "duplicate seq %u from " MACSTR, frame.seq, MAC2STR(dev->mac_addr));
+        return ESP_OK;
+    }
+
+#if CONFIG_GATEWAY_REGISTRY
+    registry_seen(rx->mac_addr);
+#endif
+
+    if (raw) {
+        return forward(shard, dev, rx->data, rx->len, now);
+    }
+
+    if ((frame.flags & PROTO_FLAG_POLL) && frame.payload_len == 0) {
+        return ESP_OK; // mailbox check without data
+    }
+
+    if (frame.flags & PROTO_FLAG_FRAG) {
+        return handle_fragment(shard, dev, rx, &frame, now);
+    }
+
+    return deliver(shard, dev, frame.flags, frame.payload, frame.payload_len, now);
+}
+
+static TickType_t tick(size_t shard_idx) {
+    shard_t *shard = &s_shards[shard_idx];
+    const TickType_t now = xTaskGetTickCount();
+
+    const uint32_t reasm_ms = proto_reasm_expire(&shard->reasm, now_ms(now));
+    TickType_t next = reasm_ms == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(reasm_ms) + 1;
+
+#if CONFIG_GATEWAY_MQTT_BATCH
+    const TickType_t batch_next = mqtt_batch_poll(&shard->batch, now);
+    if (batch_next < next) {
+        next = batch_next;
+    }
+#endif
+
+    return next;
+}
+
+static const espnow_handlers_t s_handlers = {
+    .on_rx = handle,
+    .on_tick = tick,
+};
+
+static void on_settings_change(const char *key, __attribute__((unused)) void *ctx) {
+    if (strcmp(key, "log.level") == 0) {
+        __atomic_store_n(&s_log_level, settings_log_level(), __ATOMIC_RELAXED);
+    }
+}
+
+esp_err_t uplink_init(void) {
+#if CONFIG_GATEWAY_AUTH
+    ESP_RETURN_ON_FALSE(strcmp(GATEWAY_AUTH_MASTER_KEY, PLACEHOLDER_AUTH_MASTER_KEY) != 0 &&
+                            strlen(GATEWAY_AUTH_MASTER_KEY) >= PROTO_AUTH_KEY_LEN,
+                        ESP_ERR_INVALID_ARG, TAG, "set an auth master key of at least %d characters of your own",
+                        PROTO_AUTH_KEY_LEN);
+#endif
+    ESP_RETURN_ON_ERROR(routes_init(), TAG, "routes_init");
+    __atomic_store_n(&s_log_level, settings_log_level(), __ATOMIC_RELAXED);
+    ESP_RETURN_ON_ERROR(settings_add_listener(on_settings_change, NULL), TAG, "settings_add_listener");
+
+    for (size_t i = 0; i < GATEWAY_ESPNOW_WORKERS; i++) {
+        shard_t *shard = &s_shards[i];
+
+        shard->lock = xSemaphoreCreateMutex();
+        if (shard->lock == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+
+        devices_init(&shard->devices);
+#if CONFIG_GATEWAY_AUTH
+        replay_init(&shard->replay, shard->replay_buckets, 2 * GATEWAY_AUTH_NODES);
+#endif
+        if (proto_reasm_init(&shard->reasm, shard->reasm_slots, GATEWAY_REASM_SLOTS, GATEWAY_REASM_MEM_CAP,
+                             GATEWAY_REASM_TIMEOUT_MS) != PROTO_OK) {
+            return ESP_ERR_INVALID_ARG;
+        }
+#if CONFIG_GATEWAY_MQTT_BATCH
+        mqtt_batch_init(&shard->batch, publish, NULL);
+#endif
+    }
+
+#if CONFIG_GATEWAY_SPOOL
+    ESP_RETURN_ON_ERROR(spooler_init(mqtt_send), TAG, "spooler_init");
+#endif
+#if CONFIG_GATEWAY_AUTH
+    proto_hmac_key_init(&s_auth_master, (const uint8_t *)GATEWAY_AUTH_MASTER_KEY, strlen(GATEWAY_AUTH_MASTER_KEY));
+#endif
+
+    return ESP_OK;
+}
+
+esp_err_t uplink_set_mqtt_client(esp_mqtt_client_handle_t client) {
+#if CONFIG_GATEWAY_SPOOL
+    if (client != NULL) {
+        ESP_RETURN_ON_ERROR(spooler_set_client(client), TAG, "spooler_set_client");
+    }
+#endif
+    __atomic_store_n(&s_client, client, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+const espnow_handlers_t *uplink_handlers(void) {
+    return &s_handlers;
+}
+
+size_t uplink_device_stats(size_t shard_idx, uplink_device_stats_t *out) {
+    if (shard_idx >= GATEWAY_ESPNOW_WORKERS || out == NULL) {
+        return 0;
+    }
+
+    shard_t *shard = &s_shards[shard_idx];
+    if (shard->lock == NULL) {
+        return 0;
+    }
+
+    xSemaphoreTake(shard->lock, portMAX_DELAY);
+    const size_t n = shard->devices.count;
+    for (size_t i = 0; i < n; i++) {
+        const device_t *dev = &shard->devices.entries[i];
+        uplink_device_stats_t *st = &out[i];
+
+        memcpy(st->mac_addr, dev->mac_addr, sizeof(st->mac_addr));
+        st->rx_frames = dev->rx_frames;
+        st->rx_bytes = dev->rx_bytes;
+        st->accepted = dev->seq.accepted;
+        st->duplicates = dev->seq.duplicates;
+        st->lost = dev->seq.lost;
+        st->resyncs = dev->seq.resyncs;
+    }
+    xSemaphoreGive(shard->lock);
+
+    return n;
+}
@@ -0,0 +1,74 @@
+#ifndef _UPLINK_H_
+#define _UPLINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_now.h"
+#include "mqtt_client.h"
+
+#include "espnow.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Receive counters of one cached device.
+ */
+typedef struct {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    uint32_t rx_frames;  // all frames, including duplicates
+    uint32_t rx_bytes;   // all bytes, including duplicates
+    uint32_t accepted;   // sequenced frames passed on
+    uint32_t duplicates; // sequenced frames dropped as already seen
+    uint32_t lost;       // sequence numbers never received
+    uint32_t resyncs;    // sender restarts detected
+} uplink_device_stats_t;
+
+/**
+ * @brief Initializes per-shard state of the ESP-NOW to MQTT pipeline.
+ *
+ * Must be called before the ESP-NOW workers are started. With
+ * CONFIG_GATEWAY_AUTH, refuses the Kconfig placeholder master key.
+ *
+ * @return ESP_OK on success, or an error code on initialization failure.
+ */
+esp_err_t uplink_init(void);
+
+/**
+ * @brief Sets MQTT client used for publishing.
+ *
+ * Frames received before the client is set are dropped, or spooled when
+ * CONFIG_GATEWAY_SPOOL is enabled. Set it before the client is started so
+ * the spool sees the first connection.
+ *
+ * @param client MQTT client, or NULL to stop publishing.
+ * @return ESP_OK, or an error registering for client events.
+ */
+esp_err_t uplink_set_mqtt_client(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Returns ESP-NOW worker handlers implementing the pipeline.
+ *
+ * @return Pointer to static handlers, suitable as espnow_start() argument.
+ */
+const espnow_handlers_t *uplink_handlers(void);
+
+/**
+ * @brief Copies counters of devices cached by one shard.
+ *
+ * Safe to call from any task while workers run.
+ *
+ * @param shard Shard index, below GATEWAY_ESPNOW_WORKERS.
+ * @param out Destination with room for GATEWAY_DEVICE_CACHE_SIZE entries.
+ * @return Number of entries written.
+ */
+size_t uplink_device_stats(size_t shard, uplink_device_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UPLINK_H_ */
@@ -0,0 +1,312 @@
+#include <stdint.h>
+#include <string.h>
+
+// The ring and the capture task loop are static, the test runs them from inside.
+#include "capture.c"
+
+#include "check.h"
+
+// capture pcap stream: a file header, then one record per kept frame whose
+// lengths frame it exactly, holding a radiotap header with channel, RSSI and
+// noise floor, a rebuilt 802.11 action frame and the payload. The stream is
+// parsed back record by record across several chunks. The filter, the full
+// ring, the frame limit and a client that goes away end up as they should.
+
+#define SLOTS GATEWAY_CAPTURE_SLOTS
+#define STREAM_CAP 65536
+#define FILE_HDR_LEN 24
+#define FRAME_OVERHEAD (RADIOTAP_LEN + WLAN_HDR_LEN + ACTION_HDR_LEN + ELEMENT_HDR_LEN)
+
+struct httpd_req {
+    int unused;
+};
+
+metrics_core_t metrics_cores[portNUM_PROCESSORS];
+
+static int64_t s_now_us;
+static struct httpd_req s_request;
+static uint8_t s_stream[STREAM_CAP];
+static size_t s_stream_len;
+static size_t s_chunks;
+static bool s_ended;    // empty chunk sent
+static bool s_complete; // async request handed back
+static size_t s_fail_after = SIZE_MAX; // bytes accepted before the client goes away
+
+int64_t esp_timer_get_time(void) {
+    return s_now_us;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *out, BaseType_t core) {
+    (void)fn, (void)name, (void)stack_depth, (void)arg, (void)priority, (void)core;
+    *out = (TaskHandle_t)&s_request; // never runs, the test calls run() itself
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    (void)task;
+    return pdPASS;
+}
+
+// The capture task waits a whole period each time.
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+    (void)clear;
+    s_now_us += (int64_t)ticks * 1000;
+    return 0;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type) {
+    (void)r, (void)type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value) {
+    (void)r, (void)field, (void)value;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t len) {
+    CHECK(r == &s_request);
+    if (len == 0) {
+        s_ended = true;
+        return ESP_OK;
+    }
+    if (s_stream_len + (size_t)len > s_fail_after || s_stream_len + (size_t)len > sizeof(s_stream)) {
+        return ESP_FAIL;
+    }
+    memcpy(s_stream + s_stream_len, buf, (size_t)len);
+    s_stream_len += (size_t)len;
+    s_chunks++;
+    return ESP_OK;
+}
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *r, httpd_req_t **out) {
+    *out = r;
+    return ESP_OK;
+}
+
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *r) {
+    CHECK(r == &s_request);
+    s_complete = true;
+    return ESP_OK;
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return get_u16(p) | (uint32_t)get_u16(p + 2) << 16;
+}
+
+static const uint8_t s_src[ESP_NOW_ETH_ALEN] = {0x24, 0x6F, 0x28, 0x00, 0x00, 0x01};
+static const uint8_t s_other[ESP_NOW_ETH_ALEN] = {0x30, 0xAE, 0xA4, 0x00, 0x00, 0x02};
+static const uint8_t s_dst[ESP_NOW_ETH_ALEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+// Payload i is i + 1 bytes counting up from i, so each record tells which frame it holds.
+static void offer(const uint8_t *src, uint8_t i, size_t len, unsigned channel) {
+    uint8_t data[ESP_NOW_MAX_DATA_LEN];
+    for (size_t k = 0; k < len; k++) {
+        data[k] = (uint8_t)(i + k);
+    }
+    wifi_pkt_rx_ctrl_t rx_ctrl = {.rssi = -40 - i % 50, .channel = channel, .noise_floor = -95};
+    esp_now_recv_info_t info = {
+        .src_addr = (uint8_t *)src,
+        .des_addr = (uint8_t *)s_dst,
+        .rx_ctrl = &rx_ctrl,
+    };
+    capture_offer(&info, data, len);
+}
+
+static void begin(const capture_filter_t *filter, uint32_t seconds, uint32_t frames) {
+    s_stream_len = 0;
+    s_chunks = 0;
+    s_ended = false;
+    s_complete = false;
+    s_fail_after = SIZE_MAX;
+    memset(metrics_cores, 0, sizeof(metrics_cores));
+    CHECK_EQ(capture_start(&s_request, filter, seconds, frames), ESP_OK);
+    CHECK_EQ(capture_start(&s_request, filter, seconds, frames), ESP_ERR_INVALID_STATE);
+    // As the task does: armed once the file header is out.
+    __atomic_store_n(&capture_armed, true, __ATOMIC_RELEASE);
+}
+
+static void end(void) {
+    run();
+    __atomic_store_n(&s_req, NULL, __ATOMIC_RELEASE);
+    CHECK(!capture_armed);
+    CHECK(s_complete);
+}
+
+// Walks the stream, checking the file header and every record, returns the number of records. ids receives the
+// index each payload was made from.
+static size_t parse(uint8_t *ids, size_t max, unsigned channel) {
+    CHECK(s_stream_len >= FILE_HDR_LEN);
+    CHECK_EQ(get_u32(s_stream), 0xA1B2C3D4);
+    CHECK_EQ(get_u16(s_stream + 4), 2);
+    CHECK_EQ(get_u16(s_stream + 6), 4);
+    CHECK_EQ(get_u32(s_stream + 16), PCAP_SNAPLEN);
+    CHECK_EQ(get_u32(s_stream + 20), LINKTYPE_IEEE802_11_RADIOTAP);
+
+    size_t n = 0;
+    const uint8_t *p = s_stream + FILE_HDR_LEN;
+    const uint8_t *end_of_stream = s_stream + s_stream_len;
+    while (p < end_of_stream && n < max) {
+        CHECK(end_of_stream - p >= RECORD_HDR_LEN);
+        CHECK(get_u32(p + 4) < 1000000);
+        const uint32_t incl = get_u32(p + 8);
+        CHECK_EQ(incl, get_u32(p + 12));
+        CHECK(incl <= PCAP_SNAPLEN && incl > FRAME_OVERHEAD);
+        CHECK((size_t)(end_of_stream - p) >= RECORD_HDR_LEN + incl);
+        const uint8_t *r = p + RECORD_HDR_LEN;
+
+        // Radiotap: fields in the order of their present bits.
+        CHECK_EQ(r[0], 0);
+        CHECK_EQ(get_u16(r + 2), RADIOTAP_LEN);
+        CHECK_EQ(get_u32(r + 4), RADIOTAP_PRESENT);
+        CHECK_EQ(get_u16(r + 8), channel == 14 ? 2484 : 2407 + 5 * channel);
+        CHECK_EQ(get_u16(r + 10), RADIOTAP_CHAN_2GHZ);
+        CHECK_EQ((int8_t)r[13], -95);
+
+        const uint8_t *w = r + RADIOTAP_LEN;
+        CHECK_EQ(w[0], 0xD0);
+        CHECK(memcmp(w + 4, s_dst, ESP_NOW_ETH_ALEN) == 0);
+        CHECK(memcmp(w + 10, s_src, ESP_NOW_ETH_ALEN) == 0);
+        w += WLAN_HDR_LEN;
+        CHECK_EQ(w[0], 127);
+        CHECK(memcmp(w + 1, "\x18\xFE\x34", 3) == 0);
+        w += ACTION_HDR_LEN;
+
+        // The element length covers OUI, type, version and payload, and ends where the record does.
+        const size_t payload_len = incl - FRAME_OVERHEAD;
+        CHECK_EQ(w[0], 221);
+        CHECK_EQ(w[1], 5 + payload_len);
+        CHECK(memcmp(w + 2, "\x18\xFE\x34\x04\x01", 5) == 0);
+        w += ELEMENT_HDR_LEN;
+
+        const uint8_t id = w[0];
+        CHECK_EQ(payload_len, (size_t)id + 1);
+        CHECK_EQ((int8_t)r[12], -40 - id % 50);
+        for (size_t k = 0; k < payload_len; k++) {
+            CHECK_EQ(w[k], (uint8_t)(id + k));
+        }
+        ids[n++] = id;
+        p += RECORD_HDR_LEN + incl;
+    }
+    CHECK(p == end_of_stream);
+    return n;
+}
+
+static uint32_t metric(metric_t m) {
+    return metrics_cores[0].counters[m];
+}
+
+// Sizes from a single byte to a full frame, more than one chunk holds.
+static void test_framing(void) {
+    const capture_filter_t any = {.max_len = ESP_NOW_MAX_DATA_LEN};
+    begin(&any, 1, 0);
+    uint8_t want[SLOTS];
+    for (size_t i = 0; i < SLOTS; i++) {
+        want[i] = i + 1 < SLOTS ? (uint8_t)(i * 16) : ESP_NOW_MAX_DATA_LEN - 1;
+        offer(s_src, want[i], (size_t)want[i] + 1, 6);
+    }
+    end();
+
+    uint8_t ids[SLOTS + 1];
+    CHECK_EQ(parse(ids, SLOTS + 1, 6), SLOTS);
+    CHECK(memcmp(ids, want, SLOTS) == 0);
+    CHECK(s_chunks > 2);
+    CHECK(s_ended);
+    CHECK_EQ(metric(METRIC_CAPTURE_FRAMES), SLOTS);
+    CHECK_EQ(metric(METRIC_CAPTURE_DROPPED), 0);
+
+    // Channel 14 is off the 5 MHz raster.
+    begin(&any, 1, 0);
+    offer(s_src, 3, 4, 14);
+    end();
+    CHECK_EQ(parse(ids, SLOTS, 14), 1);
+}
+
+static void test_filter(void) {
+    const capture_filter_t oui = {.mac_addr = {0x24, 0x6F, 0x28}, .mac_len = 3, .min_len = 10, .max_len = 100};
+    begin(&oui, 1, 0);
+    offer(s_src, 8, 9, 1);
+    offer(s_src, 9, 10, 1);
+    offer(s_other, 50, 51, 1);
+    offer(s_src, 99, 100, 1);
+    offer(s_src, 100, 101, 1);
+    end();
+
+    uint8_t ids[SLOTS];
+    CHECK_EQ(parse(ids, SLOTS, 1), 2);
+    CHECK_EQ(ids[0], 9);
+    CHECK_EQ(ids[1], 99);
+
+    // Nothing is offered while disarmed.
+    offer(s_src, 9, 10, 1);
+    CHECK_EQ(s_head, s_tail);
+}
+
+// A full ring counts what it cannot hold and keeps the frames it has.
+static void test_full(void) {
+    const capture_filter_t any = {.max_len = ESP_NOW_MAX_DATA_LEN};
+    begin(&any, 1, 0);
+    for (size_t i = 0; i < SLOTS + 5; i++) {
+        offer(s_src, (uint8_t)i, i + 1, 11);
+    }
+    CHECK_EQ(metric(METRIC_CAPTURE_DROPPED), 5);
+    end();
+
+    uint8_t ids[SLOTS + 5];
+    CHECK_EQ(parse(ids, SLOTS + 5, 11), SLOTS);
+    for (size_t i = 0; i < SLOTS; i++) {
+        CHECK_EQ(ids[i], i);
+    }
+}
+
+// No more frames than asked for, even when more are waiting.
+static void test_frame_limit(void) {
+    const capture_filter_t any = {.max_len = ESP_NOW_MAX_DATA_LEN};
+    begin(&any, 10, 3);
+    for (size_t i = 0; i < SLOTS; i++) {
+        offer(s_src, (uint8_t)i, i + 1, 1);
+    }
+    const int64_t started = s_now_us;
+    end();
+
+    uint8_t ids[SLOTS];
+    CHECK_EQ(parse(ids, SLOTS, 1), 3);
+    CHECK_EQ(ids[2], 2);
+    CHECK(s_ended);
+    CHECK(s_now_us - started < 1000000);
+}
+
+// A client that goes away ends the capture without the closing chunk, the next capture starts afresh.
+static void test_client_gone(void) {
+    const capture_filter_t any = {.max_len = ESP_NOW_MAX_DATA_LEN};
+    begin(&any, 10, 0);
+    s_fail_after = FILE_HDR_LEN + 100;
+    for (size_t i = 0; i < 4; i++) {
+        offer(s_src, (uint8_t)(100 + i), 101 + i, 1);
+    }
+    const int64_t started = s_now_us;
+    end();
+    CHECK(!s_ended);
+    CHECK_EQ(s_stream_len, FILE_HDR_LEN);
+    CHECK(s_now_us - started < 1000000);
+
+    const capture_filter_t none = {.max_len = ESP_NOW_MAX_DATA_LEN};
+    begin(&none, 1, 0);
+    end();
+    CHECK_EQ(s_stream_len, FILE_HDR_LEN);
+    CHECK(s_ended);
+}
+
+int main(void) {
+    test_framing();
+    test_filter();
+    test_full();
+    test_frame_limit();
+    test_client_gone();
+    return check_result("capture_test");
+}
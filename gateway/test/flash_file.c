@@ -0,0 +1,141 @@
+#include "flash_file.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static esp_err_t seek(flash_file_t *f, size_t off, size_t len) {
+    if (f->off) {
+        return ESP_FAIL;
+    }
+    if (off > f->flash.size || len > f->flash.size - off) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return fseek(f->file, (long)off, SEEK_SET) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t file_read(void *ctx, size_t off, void *dst, size_t len) {
+    flash_file_t *f = ctx;
+    const esp_err_t err = seek(f, off, len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return fread(dst, 1, len, f->file) == len ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t file_write(void *ctx, size_t off, const void *src, size_t len) {
+    flash_file_t *f = ctx;
+    esp_err_t err = seek(f, off, len);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    uint8_t old[256];
+    const uint8_t *p = src;
+    for (size_t done = 0; done < len;) {
+        size_t n = len - done < sizeof(old) ? len - done : sizeof(old);
+        fseek(f->file, (long)(off + done), SEEK_SET);
+        if (fread(old, 1, n, f->file) != n) {
+            return ESP_FAIL;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if ((old[i] & p[done + i]) != p[done + i]) {
+                f->violations++;
+                return ESP_ERR_INVALID_STATE;
+            }
+            old[i] = p[done + i];
+        }
+
+        const bool cut = n >= f->budget;
+        if (cut) {
+            n = f->budget;
+        }
+        fseek(f->file, (long)(off + done), SEEK_SET);
+        if (fwrite(old, 1, n, f->file) != n) {
+            return ESP_FAIL;
+        }
+        if (f->budget != SIZE_MAX) {
+            f->budget -= n;
+        }
+        if (cut) {
+            f->off = true;
+            return ESP_FAIL;
+        }
+        done += n;
+    }
+
+    return fflush(f->file) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t file_erase(void *ctx, size_t off, size_t len) {
+    flash_file_t *f = ctx;
+    const esp_err_t err = seek(f, off, len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (off % f->flash.sector_size != 0 || len % f->flash.sector_size != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint8_t ones[256];
+    memset(ones, 0xFF, sizeof(ones));
+    for (size_t done = 0; done < len; done += sizeof(ones)) {
+        const size_t n = len - done < sizeof(ones) ? len - done : sizeof(ones);
+        if (fwrite(ones, 1, n, f->file) != n) {
+            return ESP_FAIL;
+        }
+    }
+    for (size_t i = off / f->flash.sector_size; i < (off + len) / f->flash.sector_size; i++) {
+        f->erases[i]++;
+    }
+    return fflush(f->file) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+bool flash_file_open(flash_file_t *f, size_t sectors, size_t sector_size) {
+    *f = (flash_file_t){
+        .file = tmpfile(),
+        .erases = calloc(sectors, sizeof(uint32_t)),
+        .budget = SIZE_MAX,
+    };
+    f->flash = (spool_flash_t){
+        .ctx = f,
+        .size = sectors * sector_size,
+        .sector_size = sector_size,
+        .read = file_read,
+        .write = file_write,
+        .erase = file_erase,
+    };
+    if (f->file == NULL || f->erases == NULL) {
+        flash_file_close(f);
+        return false;
+    }
+
+    // A new chip comes erased, which does not count as wear.
+    const bool ok = file_erase(f, 0, f->flash.size) == ESP_OK;
+    memset(f->erases, 0, sectors * sizeof(uint32_t));
+    return ok;
+}
+
+void flash_file_close(flash_file_t *f) {
+    if (f->file != NULL) {
+        fclose(f->file);
+    }
+    free(f->erases);
+    *f = (flash_file_t){0};
+}
+
+void flash_file_power_loss(flash_file_t *f, size_t bytes) {
+    f->budget = bytes;
+}
+
+void flash_file_power_on(flash_file_t *f) {
+    f->budget = SIZE_MAX;
+    f->off = false;
+}
+
+uint32_t flash_file_erases(const flash_file_t *f) {
+    uint32_t total = 0;
+    for (size_t i = 0; i < f->flash.size / f->flash.sector_size; i++) {
+        total += f->erases[i];
+    }
+    return total;
+}
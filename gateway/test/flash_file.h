@@ -0,0 +1,47 @@
+#ifndef _FLASH_FILE_H_
+#define _FLASH_FILE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "spool.h"
+
+/*
+ * NOR flash emulator backed by a temporary file, for spool_flash_t users.
+ *
+ * Erase sets whole sectors to 0xFF, writes only clear bits. A write that
+ * would set a bit is refused and counted. A power loss can be scheduled
+ * after a number of programmed bytes: the write in progress stops there and
+ * every later access fails until flash_file_power_on().
+ */
+typedef struct {
+    FILE *file;
+    spool_flash_t flash;
+    uint32_t *erases;    // per sector
+    uint32_t violations; // writes that tried to set bits
+    size_t budget;       // bytes programmed until the power loss, SIZE_MAX for none
+    bool off;
+} flash_file_t;
+
+/**
+ * @brief Creates an erased region of @p sectors sectors.
+ */
+bool flash_file_open(flash_file_t *f, size_t sectors, size_t sector_size);
+
+void flash_file_close(flash_file_t *f);
+
+/**
+ * @brief Cuts the power after @p bytes more bytes are programmed.
+ */
+void flash_file_power_loss(flash_file_t *f, size_t bytes);
+
+/**
+ * @brief Restores power, the content stays as it was when it was cut.
+ */
+void flash_file_power_on(flash_file_t *f);
+
+uint32_t flash_file_erases(const flash_file_t *f);
+
+#endif /* _FLASH_FILE_H_ */
@@ -0,0 +1,176 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+// FreeRTOS tasks and queues on pthreads, enough for the modules under test.
+// Priorities and core affinity are ignored.
+
+struct QueueDefinition {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    size_t item_size;
+    size_t cap;
+    size_t head;
+    size_t count;
+    uint8_t *items;
+};
+
+struct tskTaskControlBlock {
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *arg;
+};
+
+// Absolute deadline of a wait, false for portMAX_DELAY.
+static bool deadline(TickType_t ticks, struct timespec *out) {
+    if (ticks == portMAX_DELAY) {
+        return false;
+    }
+    clock_gettime(CLOCK_REALTIME, out);
+    out->tv_sec += ticks / 1000;
+    out->tv_nsec += (long)(ticks % 1000) * 1000000;
+    if (out->tv_nsec >= 1000000000) {
+        out->tv_sec++;
+        out->tv_nsec -= 1000000000;
+    }
+    return true;
+}
+
+// Waits for the queue to change, false once the deadline passed. Called with the lock held.
+static bool queue_wait(QueueHandle_t q, TickType_t ticks, const struct timespec *until, bool timed) {
+    if (ticks == 0) {
+        return false;
+    }
+    if (!timed) {
+        pthread_cond_wait(&q->changed, &q->lock);
+        return true;
+    }
+    return pthread_cond_timedwait(&q->changed, &q->lock, until) != ETIMEDOUT;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    QueueHandle_t q = calloc(1, sizeof(*q));
+    if (q == NULL) {
+        return NULL;
+    }
+    q->items = calloc(length, item_size);
+    if (q->items == NULL) {
+        free(q);
+        return NULL;
+    }
+    q->item_size = item_size;
+    q->cap = length;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->changed, NULL);
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t q) {
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->changed);
+    free(q->items);
+    free(q);
+}
+
+static BaseType_t queue_put(QueueHandle_t q, const void *item, TickType_t ticks, bool front) {
+    struct timespec until;
+    const bool timed = deadline(ticks, &until);
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->cap) {
+        if (!queue_wait(q, ticks, &until, timed)) {
+            pthread_mutex_unlock(&q->lock);
+            return pdFALSE;
+        }
+    }
+    size_t slot;
+    if (front) {
+        q->head = (q->head + q->cap - 1) % q->cap;
+        slot = q->head;
+    } else {
+        slot = (q->head + q->count) % q->cap;
+    }
+    memcpy(q->items + slot * q->item_size, item, q->item_size);
+    q->count++;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks) {
+    return queue_put(q, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t q, const void *item, TickType_t ticks) {
+    return queue_put(q, item, ticks, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks) {
+    struct timespec until;
+    const bool timed = deadline(ticks, &until);
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0) {
+        if (!queue_wait(q, ticks, &until, timed)) {
+            pthread_mutex_unlock(&q->lock);
+            return pdFALSE;
+        }
+    }
+    memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    q->head = (q->head + 1) % q->cap;
+    q->count--;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+    pthread_mutex_lock(&q->lock);
+    const size_t count = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return (UBaseType_t)count;
+}
+
+static void *task_main(void *arg) {
+    struct tskTaskControlBlock *t = arg;
+    t->fn(t->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *out, BaseType_t core) {
+    (void)name;
+    (void)stack_depth;
+    (void)priority;
+    (void)core;
+
+    struct tskTaskControlBlock *t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        return pdFAIL;
+    }
+    t->fn = fn;
+    t->arg = arg;
+    if (pthread_create(&t->thread, NULL, task_main, t) != 0) {
+        free(t);
+        return pdFAIL;
+    }
+    pthread_detach(t->thread);
+    if (out != NULL) {
+        *out = t;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    (void)task;
+    pthread_exit(NULL);
+}
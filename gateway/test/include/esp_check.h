@@ -0,0 +1,40 @@
+#ifndef _ESP_CHECK_H_
+#define _ESP_CHECK_H_
+
+// Host stand-in: the ESP-IDF headers also bring in <stdlib.h> and <string.h>.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+#define ESP_RETURN_ON_ERROR(x, tag, fmt, ...)                                                                          \
+    do {                                                                                                               \
+        const esp_err_t err_rc_ = (x);                                                                                 \
+        if (unlikely(err_rc_ != ESP_OK)) {                                                                             \
+            ESP_LOGE(tag, "%s: " fmt, __func__, ##__VA_ARGS__);                                                        \
+            return err_rc_;                                                                                            \
+        }                                                                                                              \
+    } while (0)
+
+#define ESP_GOTO_ON_ERROR(x, goto_tag, log_tag, fmt, ...)                                                              \
+    do {                                                                                                               \
+        const esp_err_t err_rc_ = (x);                                                                                 \
+        if (unlikely(err_rc_ != ESP_OK)) {                                                                             \
+            ESP_LOGE(log_tag, "%s: " fmt, __func__, ##__VA_ARGS__);                                                    \
+            ret = err_rc_;                                                                                             \
+            goto goto_tag;                                                                                             \
+        }                                                                                                              \
+    } while (0)
+
+#define ESP_GOTO_ON_FALSE(a, err_code, goto_tag, log_tag, fmt, ...)                                                    \
+    do {                                                                                                               \
+        if (unlikely(!(a))) {                                                                                          \
+            ESP_LOGE(log_tag, "%s: " fmt, __func__, ##__VA_ARGS__);                                                    \
+            ret = (err_code);                                                                                          \
+            goto goto_tag;                                                                                             \
+        }                                                                                                              \
+    } while (0)
+
+#endif /* _ESP_CHECK_H_ */
@@ -0,0 +1,9 @@
+#ifndef _ESP_COMPILER_H_
+#define _ESP_COMPILER_H_
+
+// Host stand-in: branch hints.
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#endif /* _ESP_COMPILER_H_ */
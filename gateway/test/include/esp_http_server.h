@@ -0,0 +1,18 @@
+#ifndef _ESP_HTTP_SERVER_H_
+#define _ESP_HTTP_SERVER_H_
+
+// Host stand-in: the response calls capture.c makes, a test implements them.
+
+#include <sys/types.h>
+
+#include "esp_err.h"
+
+typedef struct httpd_req httpd_req_t;
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type);
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value);
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t len);
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *r, httpd_req_t **out);
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *r);
+
+#endif /* _ESP_HTTP_SERVER_H_ */
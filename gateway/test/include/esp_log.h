@@ -0,0 +1,19 @@
+#ifndef _ESP_LOG_H_
+#define _ESP_LOG_H_
+
+// Host stand-in: errors and warnings go to stderr, the rest is dropped. A
+// test implements esp_log_set_vprintf() to see the output hook.
+
+#include <stdarg.h>
+#include <stdio.h>
+
+typedef int (*vprintf_like_t)(const char *fmt, va_list ap);
+
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func);
+
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) ((void)(tag))
+#define ESP_LOGD(tag, fmt, ...) ((void)(tag))
+
+#endif /* _ESP_LOG_H_ */
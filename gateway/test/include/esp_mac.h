@@ -0,0 +1,9 @@
+#ifndef _ESP_MAC_H_
+#define _ESP_MAC_H_
+
+// Host stand-in: MAC formatting.
+
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+
+#endif /* _ESP_MAC_H_ */
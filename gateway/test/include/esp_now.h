@@ -0,0 +1,51 @@
+#ifndef _ESP_NOW_H_
+#define _ESP_NOW_H_
+
+// Host stand-in: frame limits and the calls espnow.c makes. A test
+// implements the calls and delivers frames through the registered
+// callback.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define ESP_NOW_ETH_ALEN 6
+#define ESP_NOW_MAX_DATA_LEN 250
+#define ESP_NOW_KEY_LEN 16
+
+typedef enum {
+    ESP_IF_WIFI_STA,
+    ESP_IF_WIFI_AP,
+} wifi_interface_t;
+
+// Radio metadata of a received frame, bit fields on the chip.
+typedef struct {
+    int rssi;
+    unsigned rate;
+    unsigned channel;
+    int noise_floor;
+} wifi_pkt_rx_ctrl_t;
+
+typedef struct {
+    uint8_t *src_addr;
+    uint8_t *des_addr;
+    wifi_pkt_rx_ctrl_t *rx_ctrl;
+} esp_now_recv_info_t;
+
+typedef struct {
+    uint8_t peer_addr[ESP_NOW_ETH_ALEN];
+    uint8_t lmk[ESP_NOW_KEY_LEN];
+    uint8_t channel;
+    wifi_interface_t ifidx;
+    bool encrypt;
+} esp_now_peer_info_t;
+
+typedef void (*esp_now_recv_cb_t)(const esp_now_recv_info_t *recv_info, const uint8_t *data, int len);
+
+esp_err_t esp_now_init(void);
+esp_err_t esp_now_deinit(void);
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb);
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer);
+
+#endif /* _ESP_NOW_H_ */
@@ -0,0 +1,10 @@
+#ifndef _ESP_TIMER_H_
+#define _ESP_TIMER_H_
+
+// Host stand-in: microseconds since boot, the test implements the clock.
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
+
+#endif /* _ESP_TIMER_H_ */
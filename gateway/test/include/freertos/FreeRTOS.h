@@ -0,0 +1,40 @@
+#ifndef _FREERTOS_H_
+#define _FREERTOS_H_
+
+// Host stand-in: one core, a tick of 1 ms. Tasks and queues are pthreads
+// underneath, see host_rtos.c. Critical sections spin on their lock.
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef unsigned long UBaseType_t;
+typedef long BaseType_t;
+
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFFu)
+#define portNUM_PROCESSORS 1
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+typedef struct {
+    int locked;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+
+static inline BaseType_t xPortGetCoreID(void) {
+    return 0;
+}
+
+static inline void portENTER_CRITICAL(portMUX_TYPE *mux) {
+    while (__atomic_exchange_n(&mux->locked, 1, __ATOMIC_ACQUIRE)) {
+    }
+}
+
+static inline void portEXIT_CRITICAL(portMUX_TYPE *mux) {
+    __atomic_store_n(&mux->locked, 0, __ATOMIC_RELEASE);
+}
+
+#endif /* _FREERTOS_H_ */
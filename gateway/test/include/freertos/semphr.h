@@ -0,0 +1,14 @@
+#ifndef _FREERTOS_SEMPHR_H_
+#define _FREERTOS_SEMPHR_H_
+
+// Host stand-in: mutexes, implemented by the tests that need them.
+
+#include "freertos/queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+
+#endif /* _FREERTOS_SEMPHR_H_ */
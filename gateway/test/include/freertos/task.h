@@ -0,0 +1,31 @@
+#ifndef _FREERTOS_TASK_H_
+#define _FREERTOS_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+
+#define tskNO_AFFINITY ((BaseType_t)0x7FFFFFFF)
+#define tskIDLE_PRIORITY ((UBaseType_t)0)
+
+typedef struct tskTaskControlBlock *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *out, BaseType_t core);
+
+#define xTaskCreate(fn, name, stack_depth, arg, priority, out)                                                         \
+    xTaskCreatePinnedToCore((fn), (name), (stack_depth), (arg), (priority), (out), tskNO_AFFINITY)
+
+/**
+ * @brief Ends the calling task, only NULL is supported.
+ */
+void vTaskDelete(TaskHandle_t task);
+
+// Periodic waits, implemented by the tests that need them.
+TickType_t xTaskGetTickCount(void);
+BaseType_t xTaskDelayUntil(TickType_t *previous_wake, TickType_t increment);
+
+// Task notifications, implemented by the tests that need them.
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+
+#endif /* _FREERTOS_TASK_H_ */
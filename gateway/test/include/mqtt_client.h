@@ -0,0 +1,13 @@
+#ifndef _MQTT_CLIENT_H_
+#define _MQTT_CLIENT_H_
+
+// Host stand-in: the client handle type, enqueue is implemented by the tests that publish.
+
+#include <stdbool.h>
+
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos,
+                            int retain, bool store);
+
+#endif /* _MQTT_CLIENT_H_ */
@@ -0,0 +1,200 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// The table is static, the test reads the entries from inside.
+#include "links.c"
+
+#include "check.h"
+
+// links table: RSSI and inter-arrival EWMAs follow what each MAC sends, also
+// across gaps long enough that the interval average needs 64 bits and across
+// the millisecond clock wrapping; a new MAC takes the least recently seen
+// entry once the probe window is full; entries format as JSON and CSV.
+
+#define SIZE GATEWAY_LINKS_SIZE
+
+static int64_t s_now_us;
+
+int64_t esp_timer_get_time(void) {
+    return s_now_us;
+}
+
+static void receive(uint8_t id, int rssi) {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN] = {0x24, 0x6F, 0x28, 0x00, 0x00, id};
+    wifi_pkt_rx_ctrl_t rx_ctrl = {.rssi = rssi, .rate = 11, .channel = 6, .noise_floor = -95};
+    esp_now_recv_info_t info = {.src_addr = mac_addr, .rx_ctrl = &rx_ctrl};
+    links_update(&info);
+}
+
+static const links_entry_t *entry(uint8_t id) {
+    for (size_t i = 0; i < SIZE; i++) {
+        if (s_links[i].frames != 0 && s_links[i].mac_addr[5] == id) {
+            return &s_links[i];
+        }
+    }
+    return NULL;
+}
+
+static void reset(int64_t now_us) {
+    memset(s_links, 0, sizeof(s_links));
+    s_now_us = now_us;
+}
+
+static void test_rssi(void) {
+    reset(0);
+    receive(1, -50);
+    const links_entry_t *e = entry(1);
+    CHECK(e != NULL);
+    CHECK_EQ(e->rssi_avg_x16, -50 * 16);
+    CHECK_EQ(e->interval_us, 0);
+
+    // A step down is followed all the way, each frame moving an eighth of the way.
+    int16_t prev = e->rssi_avg_x16;
+    for (int i = 0; i < 64; i++) {
+        receive(1, -70);
+        CHECK(e->rssi_avg_x16 <= prev);
+        prev = e->rssi_avg_x16;
+    }
+    CHECK_EQ(e->rssi_avg_x16, -70 * 16);
+    CHECK_EQ(e->rssi, -70);
+
+    // A step up ends within a dB.
+    for (int i = 0; i < 64; i++) {
+        receive(1, -50);
+    }
+    CHECK(e->rssi_avg_x16 > -51 * 16 && e->rssi_avg_x16 <= -50 * 16);
+    CHECK_EQ(e->frames, 129);
+}
+
+static void test_interval(void) {
+    reset(1000000);
+    receive(1, -60);
+    const links_entry_t *e = entry(1);
+    for (int i = 0; i < 16; i++) {
+        s_now_us += 100000;
+        receive(1, -60);
+    }
+    CHECK_EQ(e->interval_us, 100000);
+    CHECK_EQ(per_min_x100(e), 60000);
+
+    // Frames within the same millisecond count as half of one.
+    receive(1, -60);
+    CHECK_EQ(e->interval_us, 100000 + ((500 - 100000) >> EWMA_SHIFT));
+
+    // The millisecond clock wraps after 2^32 ms, gaps across it stay as long as they were.
+    reset(((int64_t)UINT32_MAX - 50) * 1000);
+    receive(2, -60);
+    e = entry(2);
+    s_now_us += 100000;
+    receive(2, -60);
+    CHECK(e->last_seen_ms < 100);
+    CHECK_EQ(e->interval_us, 100000);
+}
+
+// Gaps up to an hour are beyond INT32_MAX microseconds, the average moves both ways without wrapping.
+static void test_long_gaps(void) {
+    _Static_assert(INTERVAL_MAX_US > INT32_MAX, "long gaps no longer exceed 32 signed bits");
+
+    reset(0);
+    receive(1, -60);
+    const links_entry_t *e = entry(1);
+    s_now_us += 1000000;
+    receive(1, -60);
+    CHECK_EQ(e->interval_us, 1000000);
+
+    // Two hours count as one.
+    s_now_us += 7200ll * 1000000;
+    receive(1, -60);
+    CHECK_EQ(e->interval_us, 1000000 + (INTERVAL_MAX_US - 1000000) / 8);
+
+    uint32_t prev = e->interval_us;
+    for (int i = 0; i < 200; i++) {
+        s_now_us += 3600ll * 1000000;
+        receive(1, -60);
+        CHECK(e->interval_us >= prev && e->interval_us <= INTERVAL_MAX_US);
+        prev = e->interval_us;
+    }
+    CHECK(e->interval_us > INT32_MAX);
+    CHECK(e->interval_us > INTERVAL_MAX_US - 8);
+    CHECK_EQ(per_min_x100(e), 1);
+
+    // Back to a frame a second, from above INT32_MAX.
+    for (int i = 0; i < 200; i++) {
+        s_now_us += 1000000;
+        receive(1, -60);
+        CHECK(e->interval_us <= prev && e->interval_us >= 1000000);
+        prev = e->interval_us;
+    }
+    CHECK(e->interval_us < 1000008);
+}
+
+// With the whole table one probe window, a new MAC takes the entry seen longest ago.
+static void test_evict(void) {
+    _Static_assert(SIZE == PROBE, "test_evict expects a single probe window");
+
+    reset(0);
+    for (uint8_t id = 0; id < SIZE; id++) {
+        s_now_us += 1000;
+        receive(id, -60);
+    }
+    s_now_us += 1000;
+    receive(0, -60); // 1 is now the least recently seen
+
+    s_now_us += 1000;
+    receive(100, -40);
+    links_entry_t out[SIZE];
+    CHECK_EQ(links_snapshot(out), SIZE);
+    CHECK(entry(1) == NULL);
+    CHECK(entry(0) != NULL && entry(0)->frames == 2);
+    const links_entry_t *e = entry(100);
+    CHECK(e != NULL);
+    CHECK_EQ(e->frames, 1);
+    CHECK_EQ(e->rssi_avg_x16, -40 * 16);
+    CHECK_EQ(e->interval_us, 0);
+}
+
+static void test_format(void) {
+    reset(0);
+    receive(7, -61);
+    s_now_us += 250000;
+    receive(7, -62);
+    const links_entry_t *e = entry(7);
+    const uint32_t now_ms = e->last_seen_ms + 3500;
+
+    char buf[LINKS_JSON_ENTRY_MAX_LEN];
+    int n = links_format_json(e, now_ms, buf, sizeof(buf));
+    CHECK_EQ(n, (int)strlen(buf));
+    CHECK(strcmp(buf, "{\"mac\":\"24:6f:28:00:00:07\",\"rssi_avg\":-61.1,\"rssi\":-62,\"noise_floor\":-95,"
+                      "\"rate\":11,\"channel\":6,\"frames\":2,\"per_min\":240.00,\"age_s\":3}") == 0);
+
+    n = links_format_csv(e, now_ms, buf, sizeof(buf));
+    CHECK_EQ(n, (int)strlen(buf));
+    CHECK(strcmp(buf, "24:6f:28:00:00:07,-61.1,-62,-95,11,6,2,240.00,3\n") == 0);
+    CHECK_EQ(links_format_csv(e, now_ms, buf, (size_t)n), -1);
+
+    // The longest entry fits the documented bounds, with the separator; intervals are never below half a
+    // millisecond.
+    links_entry_t wide = {
+        .mac_addr = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
+        .rssi = INT8_MIN,
+        .noise_floor = INT8_MIN,
+        .rssi_avg_x16 = INT8_MIN * 16,
+        .rate = UINT8_MAX,
+        .channel = UINT8_MAX,
+        .frames = UINT32_MAX,
+        .interval_us = 500,
+        .last_seen_ms = 1,
+    };
+    CHECK(links_format_json(&wide, 0, buf, LINKS_JSON_ENTRY_MAX_LEN - 1) > 0);
+    CHECK(links_format_csv(&wide, 0, buf, LINKS_CSV_ENTRY_MAX_LEN) > 0);
+}
+
+int main(void) {
+    test_rssi();
+    test_interval();
+    test_long_gaps();
+    test_evict();
+    test_format();
+    return check_result("links_test");
+}
@@ -0,0 +1,356 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+
+// The rings are static, the test starts their counters anywhere from inside.
+#include "logs.c"
+
+#include "check.h"
+
+// logs rings: every reader keeps its own cursors and reads every record in
+// push order; a reader that falls behind skips to the oldest record still
+// held and is told exactly how many it missed, also when the record counter
+// wraps around 2^32 in between. Records and log lines are separate rings.
+// Captured lines are rate limited per tag: a burst, then the refill rate,
+// with the lines refused in between reported on the next one let through.
+
+#define RECORDS GATEWAY_SSE_LOGS_RECORDS
+#define LINES GATEWAY_SSE_LOGS_LINES
+#define RATE GATEWAY_SSE_LOGS_TAG_RATE
+#define BURST GATEWAY_SSE_LOGS_TAG_BURST
+
+_Static_assert(RECORDS >= LINES + 2, "test_lines expects every record to stay in the ring");
+
+metrics_core_t metrics_cores[portNUM_PROCESSORS];
+
+static int64_t s_now_us;
+static vprintf_like_t s_hook;
+
+int64_t esp_timer_get_time(void) {
+    return s_now_us;
+}
+
+static int discard(const char *fmt, va_list ap) {
+    (void)fmt;
+    (void)ap;
+    return 0;
+}
+
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func) {
+    s_hook = func;
+    return discard;
+}
+
+static void log_line(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    s_hook(fmt, ap);
+    va_end(ap);
+}
+
+// Empties both rings, the next record and line get number head.
+static void rings_reset(uint32_t head) {
+    s_record_ring.head = head;
+    s_record_ring.held = 0;
+    s_line_ring.head = head;
+    s_line_ring.held = 0;
+}
+
+// The message id numbers the records.
+static void push(int32_t id) {
+    logs_push(NULL, 1, id);
+}
+
+// Reads everything available, max records at a time, checking that the ids go on from *next.
+static size_t read_all(logs_reader_t *r, size_t max, int32_t *next, uint32_t *skipped) {
+    logs_record_t out[RECORDS];
+    size_t total = 0, n;
+    uint32_t missed;
+    *skipped = 0;
+    while ((n = logs_read(r, out, max, &missed)) > 0) {
+        *next += (int32_t)missed;
+        *skipped += missed;
+        for (size_t i = 0; i < n; i++) {
+            CHECK_EQ(out[i].msg_id, *next);
+            (*next)++;
+        }
+        total += n;
+    }
+    CHECK_EQ(missed, 0);
+    return total;
+}
+
+static void test_readers(void) {
+    rings_reset(0);
+    logs_reader_t a, b;
+    logs_reader_init(&a);
+    logs_record_t out[RECORDS];
+    uint32_t skipped = 1;
+    CHECK_EQ(logs_read(&a, out, RECORDS, &skipped), 0);
+    CHECK_EQ(skipped, 0);
+
+    const uint8_t mac[ESP_NOW_ETH_ALEN] = {0x24, 0x6F, 0x28, 0x00, 0x00, 0x01};
+    s_now_us = 1234;
+    logs_push(mac, 70000, -1);
+    CHECK_EQ(logs_read(&a, out, RECORDS, &skipped), 1);
+    CHECK(memcmp(out[0].mac_addr, mac, sizeof(mac)) == 0);
+    CHECK_EQ(out[0].len, UINT16_MAX);
+    CHECK_EQ(out[0].msg_id, -1);
+    CHECK_EQ(out[0].time_us, 1234);
+
+    // Cursors are independent, a late reader starts at the oldest record.
+    rings_reset(0);
+    logs_reader_init(&a);
+    for (int32_t id = 0; id < 5; id++) {
+        push(id);
+    }
+    logs_reader_init(&b);
+    int32_t next_a = 0, next_b = 0;
+    CHECK_EQ(logs_read(&a, out, 2, &skipped), 2);
+    CHECK_EQ(out[0].msg_id, 0);
+    CHECK_EQ(out[1].msg_id, 1);
+    next_a = 2;
+    CHECK_EQ(read_all(&b, RECORDS, &next_b, &skipped), 5);
+    CHECK_EQ(read_all(&a, 1, &next_a, &skipped), 3);
+    CHECK_EQ(next_a, 5);
+    CHECK_EQ(next_b, 5);
+}
+
+static void test_overrun(void) {
+    rings_reset(0);
+    logs_reader_t slow, fast;
+    logs_reader_init(&slow);
+    logs_reader_init(&fast);
+
+    int32_t id = 0, next_slow = 0, next_fast = 0;
+    uint32_t skipped;
+    while (id < 3 * RECORDS + 3) {
+        push(id++);
+        if (id % (RECORDS / 2) == 0) {
+            CHECK_EQ(read_all(&fast, RECORDS, &next_fast, &skipped), RECORDS / 2);
+            CHECK_EQ(skipped, 0);
+        }
+    }
+
+    // The slow reader gets the last RECORDS in order and the count of the rest.
+    CHECK_EQ(read_all(&slow, 3, &next_slow, &skipped), RECORDS);
+    CHECK_EQ(skipped, 2 * RECORDS + 3);
+    CHECK_EQ(next_slow, id);
+    CHECK_EQ(read_all(&fast, RECORDS, &next_fast, &skipped), 3);
+    CHECK_EQ(skipped, 0);
+
+    // Halfway through, the ring laps the reader once more.
+    for (int32_t i = 0; i < RECORDS; i++) {
+        push(id++);
+    }
+    logs_record_t out[RECORDS];
+    CHECK_EQ(logs_read(&slow, out, RECORDS / 2, &skipped), RECORDS / 2);
+    CHECK_EQ(skipped, 0);
+    next_slow += RECORDS / 2;
+    for (int32_t i = 0; i < RECORDS; i++) {
+        push(id++);
+    }
+    CHECK_EQ(read_all(&slow, RECORDS, &next_slow, &skipped), RECORDS);
+    CHECK_EQ(skipped, RECORDS / 2);
+    CHECK_EQ(next_slow, id);
+}
+
+// Record numbers are uint32_t, a reader on either side of the wrap sees no difference.
+static void test_wraparound(void) {
+    rings_reset(UINT32_MAX - RECORDS / 2);
+    logs_reader_t early, lagging;
+    logs_reader_init(&early);
+    logs_reader_init(&lagging);
+
+    int32_t id = 0, next_early = 0, next_lagging = 0;
+    uint32_t skipped;
+    for (int32_t round = 0; round < 4; round++) {
+        for (int32_t i = 0; i < RECORDS / 2; i++) {
+            push(id++);
+        }
+        CHECK_EQ(read_all(&early, RECORDS, &next_early, &skipped), RECORDS / 2);
+        CHECK_EQ(skipped, 0);
+
+        if (round == 1) {
+            // Just past the wrap, the full ring is still held.
+            CHECK(s_record_ring.head < RECORDS);
+            logs_reader_t fresh;
+            logs_reader_init(&fresh);
+            int32_t next_fresh = id - RECORDS;
+            CHECK_EQ(read_all(&fresh, RECORDS, &next_fresh, &skipped), RECORDS);
+            CHECK_EQ(skipped, 0);
+        }
+    }
+
+    CHECK_EQ(read_all(&lagging, RECORDS, &next_lagging, &skipped), RECORDS);
+    CHECK_EQ(skipped, RECORDS);
+    CHECK_EQ(next_lagging, id);
+
+    // A reader started after the wrap still gets the full ring.
+    logs_reader_t late;
+    logs_reader_init(&late);
+    int32_t next_late = id - RECORDS;
+    CHECK_EQ(read_all(&late, RECORDS, &next_late, &skipped), RECORDS);
+    CHECK_EQ(skipped, 0);
+}
+
+// Lines have their own ring and cursor, records do not move them.
+static void test_lines(void) {
+    rings_reset(UINT32_MAX - 1);
+    logs_reader_t r;
+    logs_reader_init(&r);
+
+    for (int i = 0; i < LINES + 2; i++) {
+        s_now_us += 1000000; // keeps the tag within its rate
+        log_line("I (%d) main: line %d\n", i, i);
+        push(i);
+    }
+
+    logs_line_t lines[LINES];
+    uint32_t skipped;
+    CHECK_EQ(logs_read_lines(&r, lines, LINES, &skipped), LINES);
+    CHECK_EQ(skipped, 2);
+    for (int i = 0; i < LINES; i++) {
+        char want[LOGS_TEXT_MAX_LEN];
+        snprintf(want, sizeof(want), "line %d", i + 2);
+        CHECK_EQ(lines[i].level, 'I');
+        CHECK(strcmp(lines[i].tag, "main") == 0);
+        CHECK(strcmp(lines[i].text, want) == 0);
+    }
+    CHECK_EQ(logs_read_lines(&r, lines, LINES, &skipped), 0);
+
+    logs_record_t out[RECORDS];
+    CHECK_EQ(logs_read(&r, out, RECORDS, &skipped), LINES + 2);
+    CHECK_EQ(skipped, 0);
+}
+
+static uint32_t metric(metric_t m) {
+    return metrics_cores[0].counters[m];
+}
+
+// Logs one line of tag, true if it reached the ring. *dropped is what the line reports.
+static bool let_through(logs_reader_t *r, const char *tag, uint32_t *dropped) {
+    log_line("W (%d) %s: text\n", 0, tag);
+    logs_line_t line;
+    uint32_t skipped;
+    if (logs_read_lines(r, &line, 1, &skipped) == 0) {
+        return false;
+    }
+    CHECK(strcmp(line.tag, tag) == 0);
+    *dropped = line.dropped;
+    return true;
+}
+
+static void limiter_reset(logs_reader_t *r) {
+    rings_reset(0);
+    memset(s_buckets, 0, sizeof(s_buckets));
+    memset(metrics_cores, 0, sizeof(metrics_cores));
+    logs_reader_init(r);
+}
+
+static void test_rate(void) {
+    logs_reader_t r;
+    limiter_reset(&r);
+    s_now_us = 1000000;
+
+    // A burst, then every line is refused and counted.
+    uint32_t dropped = 99;
+    for (int i = 0; i < BURST; i++) {
+        CHECK(let_through(&r, "wifi", &dropped));
+        CHECK_EQ(dropped, 0);
+    }
+    for (int i = 0; i < 6; i++) {
+        CHECK(!let_through(&r, "wifi", &dropped));
+    }
+    CHECK_EQ(metric(METRIC_LOGS_RATE_LIMITED), 6);
+    CHECK_EQ(metric(METRIC_LOGS_CAPTURED), BURST);
+
+    // Refills below one line add up, the next line carries the count of those refused.
+    s_now_us += 1000000 / RATE - 1000;
+    CHECK(!let_through(&r, "wifi", &dropped));
+    s_now_us += 1000;
+    CHECK(let_through(&r, "wifi", &dropped));
+    CHECK_EQ(dropped, 7);
+    CHECK(!let_through(&r, "wifi", &dropped));
+
+    // A long pause refills up to the burst only.
+    s_now_us += 3600LL * 1000000;
+    for (int i = 0; i < BURST; i++) {
+        CHECK(let_through(&r, "wifi", &dropped));
+        CHECK_EQ(dropped, i == 0 ? 1 : 0);
+    }
+    CHECK(!let_through(&r, "wifi", &dropped));
+
+    // At the refill rate, every line gets through.
+    for (int i = 0; i < 20; i++) {
+        s_now_us += 1000000 / RATE;
+        CHECK(let_through(&r, "wifi", &dropped));
+    }
+}
+
+static void test_tags(void) {
+    logs_reader_t r;
+    limiter_reset(&r);
+    s_now_us = 1000000;
+
+    // Tags in different buckets do not share tokens, lines without a prefix count as one tag.
+    CHECK(tag_hash("wifi") % TAG_BUCKETS != tag_hash("mqtt") % TAG_BUCKETS);
+    uint32_t dropped;
+    for (int i = 0; i < BURST; i++) {
+        CHECK(let_through(&r, "wifi", &dropped));
+    }
+    CHECK(!let_through(&r, "wifi", &dropped));
+    CHECK(let_through(&r, "mqtt", &dropped));
+
+    for (int i = 0; i < BURST + 2; i++) {
+        log_line("no prefix %d\n", i);
+    }
+    logs_line_t lines[LINES];
+    uint32_t skipped;
+    CHECK_EQ(logs_read_lines(&r, lines, LINES, &skipped), BURST);
+    CHECK_EQ(lines[0].level, '?');
+    CHECK(strcmp(lines[0].tag, "") == 0);
+    CHECK(strcmp(lines[0].text, "no prefix 0") == 0);
+
+    // A tag landing in the bucket of another takes it over with a full burst.
+    char other[LOGS_TAG_MAX_LEN];
+    int n = 0;
+    do {
+        snprintf(other, sizeof(other), "t%d", n++);
+    } while (tag_hash(other) % TAG_BUCKETS != tag_hash("wifi") % TAG_BUCKETS);
+    for (int i = 0; i < BURST; i++) {
+        CHECK(let_through(&r, other, &dropped));
+    }
+    CHECK(let_through(&r, "wifi", &dropped));
+    CHECK_EQ(dropped, 0);
+}
+
+// A line logged while the scratch buffer of its CPU is taken is dropped, not waited for.
+static void test_busy(void) {
+    logs_reader_t r;
+    limiter_reset(&r);
+    s_now_us = 1000000;
+
+    uint32_t dropped;
+    s_scratch_busy[0] = true;
+    CHECK(!let_through(&r, "wifi", &dropped));
+    CHECK_EQ(metric(METRIC_LOGS_BUSY), 1);
+    CHECK_EQ(metric(METRIC_LOGS_RATE_LIMITED), 0);
+    s_scratch_busy[0] = false;
+    CHECK(let_through(&r, "wifi", &dropped));
+    CHECK_EQ(dropped, 0);
+}
+
+int main(void) {
+    CHECK_EQ(logs_capture_start(), ESP_OK);
+    CHECK_EQ(logs_capture_start(), ESP_ERR_INVALID_STATE);
+
+    test_readers();
+    test_overrun();
+    test_wraparound();
+    test_lines();
+    test_rate();
+    test_tags();
+    test_busy();
+    return check_result("logs_test");
+}
@@ -0,0 +1,258 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define CLOSER_IMPLEMENTATION
+#include "config.h"
+#include "espnow.h"
+#include "metrics.h"
+#include "rx_pool.h"
+
+#include "check.h"
+
+// espnow.c under overload: one worker with a 1 ms handler is offered frames at
+// a multiple of its rate from eight devices, device 0 sending half of them.
+// Whatever the overflow policy, every offered frame is delivered or counted by
+// exactly one drop counter, each device is delivered in order, the receive
+// callback never blocks, and the pool drains. Then the policy specific drops:
+// the newest frame, the oldest queued one, or the share of the chatty device.
+
+#define DEVICES 8
+#define HANDLER_US 1000
+#define DRAIN_MS 5000
+#define MAX_CALLBACK_US 20000
+
+typedef struct {
+    double ratio; // offered rate over handler rate
+    uint32_t frames;
+} load_t;
+
+typedef struct {
+    uint32_t offered[DEVICES];
+    uint32_t delivered[DEVICES];
+    uint32_t counters[METRIC_COUNT]; // metrics during the run
+    uint32_t max_callback_us;
+} run_t;
+
+metrics_core_t metrics_cores[portNUM_PROCESSORS];
+
+static esp_now_recv_cb_t s_recv_cb;
+static uint32_t s_sent_seq[DEVICES];
+static uint32_t s_delivered[DEVICES];
+static uint32_t s_last_seq[DEVICES]; // 1 based, 0 before the first frame
+static uint32_t s_bad_frames;  // out of order or not as sent
+static uint32_t s_last_global; // global sequence of the last delivered frame
+
+esp_err_t esp_now_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_now_deinit(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb) {
+    s_recv_cb = cb;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer) {
+    (void)peer;
+    return ESP_OK;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void sleep_us(uint32_t us) {
+    const struct timespec ts = {.tv_sec = us / 1000000, .tv_nsec = (long)(us % 1000000) * 1000};
+    nanosleep(&ts, NULL);
+}
+
+static uint32_t counter(metric_t m) {
+    return __atomic_load_n(&metrics_cores[0].counters[m], __ATOMIC_RELAXED);
+}
+
+// Payload: device, its sequence number, the global sequence number.
+static esp_err_t on_rx(const espnow_rx_t *rx, size_t shard) {
+    (void)shard;
+    const uint8_t dev = rx->data[0];
+    const uint32_t seq = get_u32(&rx->data[1]);
+    if (rx->len != 9 || dev >= DEVICES || memcmp(rx->mac_addr + 1, "\x10\x20\x30\x40", 4) != 0 ||
+        rx->mac_addr[5] != dev) {
+        __atomic_fetch_add(&s_bad_frames, 1, __ATOMIC_RELAXED);
+        return ESP_FAIL;
+    }
+
+    if (seq <= __atomic_load_n(&s_last_seq[dev], __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&s_bad_frames, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&s_last_seq[dev], seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&s_last_global, get_u32(&rx->data[5]), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s_delivered[dev], 1, __ATOMIC_RELAXED);
+
+    sleep_us(HANDLER_US);
+    return ESP_OK;
+}
+
+static const espnow_handlers_t s_handlers = {.on_rx = on_rx};
+
+static uint32_t delivered_total(void) {
+    uint32_t n = 0;
+    for (size_t d = 0; d < DEVICES; d++) {
+        n += __atomic_load_n(&s_delivered[d], __ATOMIC_RELAXED);
+    }
+    return n;
+}
+
+static uint32_t dropped_total(const uint32_t *base) {
+    return counter(METRIC_RX_DROP_POOL) - base[METRIC_RX_DROP_POOL] + counter(METRIC_RX_DROP_QUEUE) -
+           base[METRIC_RX_DROP_QUEUE] + counter(METRIC_RX_DROP_OLDEST) - base[METRIC_RX_DROP_OLDEST] +
+           counter(METRIC_RX_DROP_FAIR) - base[METRIC_RX_DROP_FAIR];
+}
+
+// Waits until the worker handled or dropped every offered frame and returned its descriptors.
+static bool drain(uint32_t offered, const uint32_t *base) {
+    espnow_worker_stats_t stats;
+    for (uint32_t waited = 0; waited < DRAIN_MS; waited += 5) {
+        if (delivered_total() + dropped_total(base) == offered && rx_pool_in_use() == 0 &&
+            espnow_worker_stats(0, &stats) == ESP_OK && stats.queue_len == 0) {
+            return true;
+        }
+        sleep_us(5000);
+    }
+    return false;
+}
+
+static void run(const load_t *load, run_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (size_t d = 0; d < DEVICES; d++) {
+        __atomic_store_n(&s_delivered[d], 0, __ATOMIC_RELAXED);
+    }
+    uint32_t base[METRIC_COUNT];
+    for (size_t m = 0; m < METRIC_COUNT; m++) {
+        base[m] = counter((metric_t)m);
+    }
+
+    uint8_t mac[ESP_NOW_ETH_ALEN] = {0x24, 0x10, 0x20, 0x30, 0x40, 0x00};
+    uint8_t data[9];
+    const esp_now_recv_info_t info = {.src_addr = mac, .des_addr = mac};
+    const uint64_t period_ns = (uint64_t)(HANDLER_US * 1000 / load->ratio);
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (uint32_t i = 0; i < load->frames; i++) {
+        const uint8_t dev = i % 2 == 0 ? 0 : (uint8_t)(1 + (i / 2) % (DEVICES - 1));
+        mac[5] = dev;
+        data[0] = dev;
+        put_u32(&data[1], ++s_sent_seq[dev]);
+        put_u32(&data[5], i + 1);
+        out->offered[dev]++;
+
+        const uint64_t start = now_us();
+        s_recv_cb(&info, data, sizeof(data));
+        const uint32_t took = (uint32_t)(now_us() - start);
+        if (took > out->max_callback_us) {
+            out->max_callback_us = took;
+        }
+
+        next.tv_nsec += (long)period_ns;
+        while (next.tv_nsec >= 1000000000) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+    CHECK(drain(load->frames, base));
+    for (size_t d = 0; d < DEVICES; d++) {
+        out->delivered[d] = __atomic_load_n(&s_delivered[d], __ATOMIC_RELAXED);
+    }
+    for (size_t m = 0; m < METRIC_COUNT; m++) {
+        out->counters[m] = counter((metric_t)m) - base[m];
+    }
+}
+
+// Delivered share of the offered frames, in percent.
+static uint32_t percent(uint32_t delivered, uint32_t offered) {
+    return offered > 0 ? (uint32_t)((uint64_t)delivered * 100 / offered) : 0;
+}
+
+static void check_run(const load_t *load, const run_t *r) {
+    uint32_t delivered = 0, quiet_offered = 0, quiet_delivered = 0;
+    for (size_t d = 0; d < DEVICES; d++) {
+        delivered += r->delivered[d];
+        if (d > 0) {
+            quiet_offered += r->offered[d];
+            quiet_delivered += r->delivered[d];
+        }
+    }
+    const uint32_t pool = r->counters[METRIC_RX_DROP_POOL], queue = r->counters[METRIC_RX_DROP_QUEUE];
+    const uint32_t oldest = r->counters[METRIC_RX_DROP_OLDEST], fair = r->counters[METRIC_RX_DROP_FAIR];
+
+    printf("%4.1fx  offered %5u  delivered %5u  drop pool %5u queue %5u oldest %5u fair %5u  "
+           "chatty %3u%%  quiet %3u%%  callback max %u us\n",
+           load->ratio, (unsigned)load->frames, (unsigned)delivered, (unsigned)pool, (unsigned)queue,
+           (unsigned)oldest, (unsigned)fair, (unsigned)percent(r->delivered[0], r->offered[0]),
+           (unsigned)percent(quiet_delivered, quiet_offered), (unsigned)r->max_callback_us);
+
+    CHECK_EQ(r->counters[METRIC_RX_FRAMES], load->frames);
+    CHECK_EQ(delivered + pool + queue + oldest + fair, load->frames);
+    CHECK_EQ(__atomic_load_n(&s_bad_frames, __ATOMIC_RELAXED), 0);
+    CHECK(r->max_callback_us < MAX_CALLBACK_US);
+    CHECK_EQ(rx_pool_in_use(), 0);
+
+    // Below capacity only a scheduling hiccup of the host fills the queue far enough for a drop.
+    if (load->ratio < 1) {
+        CHECK(percent(delivered, load->frames) >= 98);
+        return;
+    }
+    CHECK(delivered < load->frames);
+
+#if CONFIG_GATEWAY_RX_OVERFLOW_DROP_OLDEST
+    CHECK(oldest > 0);
+    CHECK_EQ(pool + queue + fair, 0);
+    CHECK_EQ(__atomic_load_n(&s_last_global, __ATOMIC_RELAXED), load->frames);
+#elif CONFIG_GATEWAY_RX_OVERFLOW_FAIR_SHARE
+    CHECK(fair > 0);
+    CHECK_EQ(oldest, 0);
+    CHECK(percent(quiet_delivered, quiet_offered) > percent(r->delivered[0], r->offered[0]));
+#else
+    CHECK(pool + queue > 0);
+    CHECK_EQ(oldest + fair, 0);
+#endif
+}
+
+int main(void) {
+    closer_handle_t closer = NULL;
+    CHECK_EQ(closer_create(&closer), ESP_OK);
+    CHECK_EQ(espnow_start(closer, (void *)&s_handlers), ESP_OK);
+    CHECK(s_recv_cb != NULL);
+
+    // The worker keeps running until exit and the closer is dropped without closing it: espnow_deinit() deletes the
+    // queue the worker waits on.
+    const load_t loads[] = {{0.5, 500}, {2, 2000}, {4, 2000}, {8, 2000}};
+    for (size_t i = 0; i < sizeof(loads) / sizeof(loads[0]); i++) {
+        run_t r;
+        run(&loads[i], &r);
+        check_run(&loads[i], &r);
+    }
+    closer_destroy(closer);
+    return check_result("overflow_load");
+}
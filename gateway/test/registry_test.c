@@ -0,0 +1,351 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// The wheel is static, the test turns it in place of the registry task.
+#include "registry.c"
+
+#include "check.h"
+
+// registry presence: a node goes offline exactly one timeout after it was
+// last heard from, also with a timeout longer than the wheel, across the
+// millisecond clock wrapping and when a worker stores a time later than the
+// wheel read; a full table replaces the node offline the longest once its
+// change is out; a snapshot brings the table back, online nodes get one
+// timeout to be heard from.
+
+#define SIZE GATEWAY_REGISTRY_SIZE
+#define OFFLINE_TICKS ((int)(OFFLINE_MS / TICK_MS))
+#define MAX_MESSAGES 32
+
+_Static_assert(OFFLINE_TICKS > WHEEL_SLOTS, "the timeout should wrap the wheel");
+
+typedef struct {
+    char topic[TOPIC_MAX_LEN];
+    bool online;
+} message_t;
+
+metrics_core_t metrics_cores[portNUM_PROCESSORS];
+
+static int64_t s_now_us;
+static message_t s_messages[MAX_MESSAGES];
+static size_t s_message_count;
+static size_t s_message_read;
+static uint8_t s_blob[1 + SIZE * RECORD_LEN];
+static size_t s_blob_len; // 0 = nothing saved
+
+int64_t esp_timer_get_time(void) {
+    return s_now_us;
+}
+
+const char *settings_mqtt_prefix(void) {
+    return "gw";
+}
+
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos,
+                            int retain, bool store) {
+    (void)client, (void)len, (void)qos, (void)store;
+    CHECK_EQ(retain, 1);
+    CHECK(s_message_count < MAX_MESSAGES);
+    message_t *m = &s_messages[s_message_count++];
+    snprintf(m->topic, sizeof(m->topic), "%s", topic);
+    m->online = strcmp(data, "online") == 0;
+    CHECK(m->online || strcmp(data, "offline") == 0);
+    return 0;
+}
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle) {
+    (void)namespace_name;
+    *out_handle = 1;
+    return open_mode == NVS_READONLY && s_blob_len == 0 ? ESP_ERR_NVS_NOT_FOUND : ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length) {
+    (void)handle, (void)key;
+    if (out_value != NULL) {
+        CHECK(*length >= s_blob_len);
+        memcpy(out_value, s_blob, s_blob_len);
+    }
+    *length = s_blob_len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length) {
+    (void)handle, (void)key;
+    CHECK(length <= sizeof(s_blob));
+    memcpy(s_blob, value, length);
+    s_blob_len = length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    (void)handle;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) {
+    (void)handle;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *out, BaseType_t core) {
+    (void)fn, (void)name, (void)stack_depth, (void)arg, (void)priority, (void)core;
+    *out = (TaskHandle_t)&s_now_us; // never runs, the test calls advance() itself
+    return pdPASS;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return 0;
+}
+
+BaseType_t xTaskDelayUntil(TickType_t *previous_wake, TickType_t increment) {
+    *previous_wake += increment;
+    return pdTRUE;
+}
+
+static void mac_of(uint8_t id, uint8_t *mac_addr) {
+    const uint8_t mac[ESP_NOW_ETH_ALEN] = {0x24, 0x6F, 0x28, 0x00, 0x00, id};
+    memcpy(mac_addr, mac, ESP_NOW_ETH_ALEN);
+}
+
+static void seen(uint8_t id) {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    mac_of(id, mac_addr);
+    registry_seen(mac_addr);
+}
+
+static entry_t *entry(uint8_t id) {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    mac_of(id, mac_addr);
+    const size_t b = probe(mac_addr);
+    return s_index[b] != 0 ? &s_entries[s_index[b] - 1] : NULL;
+}
+
+// One turn of the registry task.
+static void tick(void) {
+    s_now_us += TICK_MS * 1000;
+    advance();
+    publish_changes();
+}
+
+// Takes the oldest message not yet looked at, checking whose it is.
+static bool message(uint8_t id, bool *online) {
+    if (s_message_read >= s_message_count) {
+        s_message_read = s_message_count = 0;
+        return false;
+    }
+
+    char topic[TOPIC_MAX_LEN];
+    snprintf(topic, sizeof(topic), "gw/24:6f:28:00:00:%02x/presence", id);
+    const message_t *m = &s_messages[s_message_read++];
+    *online = m->online;
+    return strcmp(m->topic, topic) == 0;
+}
+
+static void expect(uint8_t id, bool online) {
+    bool was = !online;
+    CHECK(message(id, &was));
+    CHECK_EQ(was, online);
+}
+
+static void expect_none(void) {
+    bool online;
+    CHECK(!message(0, &online));
+}
+
+static uint32_t metric(metric_t m) {
+    return metrics_cores[0].counters[m];
+}
+
+static void reset(int64_t now_us) {
+    memset(s_entries, 0, sizeof(s_entries));
+    memset(s_index, 0, sizeof(s_index));
+    memset(s_wheel, 0xff, sizeof(s_wheel)); // NONE
+    s_count = s_online = 0;
+    s_tick = 0;
+    s_offline_head = s_offline_tail = NONE;
+    s_announce_head = s_announce_tail = NONE;
+    s_dirty = false;
+    s_now_us = now_us;
+    memset(metrics_cores, 0, sizeof(metrics_cores));
+    registry_set_mqtt_client((esp_mqtt_client_handle_t)&s_messages);
+    s_message_read = s_message_count = 0;
+}
+
+// Ticks until the node is published offline, returns how many it took.
+static int ticks_to_offline(uint8_t id) {
+    for (int n = 1; n <= 2 * OFFLINE_TICKS; n++) {
+        tick();
+        if (s_message_count > 0) {
+            expect(id, false);
+            expect_none();
+            return n;
+        }
+    }
+    return 0;
+}
+
+static void test_presence(void) {
+    reset(0);
+    seen(1);
+    tick();
+    expect(1, true);
+    expect_none();
+    CHECK_EQ(metric(METRIC_REGISTRY_ONLINE), 1);
+
+    // Heard from well within the timeout, nothing changes.
+    for (int i = 0; i < 3 * OFFLINE_TICKS; i++) {
+        if (i % (OFFLINE_TICKS / 2) == 0) {
+            seen(1);
+        }
+        tick();
+    }
+    expect_none();
+    CHECK_EQ(metric(METRIC_REGISTRY_ONLINE), 1);
+
+    seen(1);
+    CHECK_EQ(ticks_to_offline(1), OFFLINE_TICKS);
+    CHECK(s_dirty);
+    CHECK_EQ(metric(METRIC_REGISTRY_OFFLINE), 1);
+
+    // With ticks half way between, the first one past the deadline takes it offline.
+    seen(1);
+    s_now_us += TICK_MS * 500;
+    tick();
+    expect(1, true);
+    expect_none();
+    CHECK_EQ(1 + ticks_to_offline(1), OFFLINE_TICKS);
+    CHECK_EQ(now_ms() - entry(1)->last_seen_ms, OFFLINE_MS + TICK_MS / 2);
+
+    registry_stats_t stats;
+    registry_stats(&stats);
+    CHECK_EQ(stats.known, 1);
+    CHECK_EQ(stats.online, 0);
+}
+
+// The millisecond clock wraps after 2^32 ms, a node seen before goes offline on time after it.
+static void test_clock_wrap(void) {
+    reset(((int64_t)UINT32_MAX - 30000) * 1000);
+    seen(1);
+    tick();
+    expect(1, true);
+    expect_none();
+    CHECK_EQ(1 + ticks_to_offline(1), OFFLINE_TICKS);
+    CHECK(now_ms() < OFFLINE_MS);
+
+    // Seen again after the wrap.
+    reset(((int64_t)UINT32_MAX - 30000) * 1000);
+    seen(1);
+    tick();
+    expect(1, true);
+    expect_none();
+    for (int i = 0; i < 59; i++) {
+        tick();
+    }
+    CHECK(now_ms() < TICK_MS * 30);
+    seen(1);
+    CHECK_EQ(ticks_to_offline(1), OFFLINE_TICKS);
+}
+
+// A worker may store a time later than the one the wheel read, the node is then not yet due.
+static void test_seen_ahead(void) {
+    reset(0);
+    seen(1);
+    for (int i = 0; i < OFFLINE_TICKS - 1; i++) {
+        tick();
+    }
+    expect(1, true);
+    expect_none();
+
+    entry(1)->last_seen_ms = now_ms() + TICK_MS + TICK_MS / 2;
+    tick();
+    expect_none();
+    CHECK(entry(1)->online);
+    CHECK_EQ(ticks_to_offline(1), OFFLINE_TICKS + 1);
+}
+
+static void test_full(void) {
+    reset(0);
+    seen(1);
+    s_now_us += 10 * TICK_MS * 1000;
+    for (uint8_t id = 2; id <= SIZE; id++) {
+        seen(id);
+    }
+    seen(SIZE + 1);
+    CHECK_EQ(metric(METRIC_REGISTRY_FULL), 1);
+    CHECK(entry(SIZE + 1) == NULL);
+
+    // Held back, node 1 stays until its change is out.
+    registry_set_mqtt_client(NULL);
+    for (int i = 0; i < OFFLINE_TICKS - 10; i++) {
+        tick();
+    }
+    CHECK(!entry(1)->online);
+    seen(SIZE + 1);
+    CHECK_EQ(metric(METRIC_REGISTRY_FULL), 2);
+    CHECK(entry(1) != NULL);
+
+    registry_set_mqtt_client((esp_mqtt_client_handle_t)&s_messages);
+    publish_changes();
+    expect(1, false); // its state when the message is built
+    for (uint8_t id = 2; id <= SIZE; id++) {
+        expect(id, true);
+    }
+    expect_none();
+
+    seen(SIZE + 1);
+    CHECK(entry(1) == NULL);
+    CHECK(entry(SIZE + 1) != NULL);
+    seen(1);
+    CHECK_EQ(metric(METRIC_REGISTRY_FULL), 3);
+
+    registry_stats_t stats;
+    registry_stats(&stats);
+    CHECK_EQ(stats.known, SIZE);
+    CHECK_EQ(stats.online, SIZE);
+}
+
+static void test_snapshot(void) {
+    reset(0);
+    s_blob_len = 0;
+    seen(1);
+    s_now_us += 5 * TICK_MS * 1000;
+    seen(2);
+    s_now_us += 5 * TICK_MS * 1000;
+    seen(3);
+    for (int i = 0; i < OFFLINE_TICKS - 3; i++) {
+        tick();
+    }
+    CHECK(!entry(1)->online && !entry(2)->online && entry(3)->online);
+    CHECK_EQ(snapshot_save(), ESP_OK);
+    CHECK(!s_dirty);
+    CHECK_EQ(s_blob_len, 1 + 3 * RECORD_LEN);
+
+    reset(1000000);
+    CHECK_EQ(registry_start(), ESP_OK);
+    registry_stats_t stats;
+    registry_stats(&stats);
+    CHECK_EQ(stats.known, 3);
+    CHECK_EQ(stats.online, 1);
+    CHECK(entry(3)->online);
+
+    // Nothing is published again, node 3 is offline after one timeout without a frame.
+    CHECK_EQ(ticks_to_offline(3), OFFLINE_TICKS);
+
+    // The free entry first, then offline the longest first.
+    seen(4);
+    CHECK(entry(1) != NULL);
+    seen(5);
+    CHECK(entry(1) == NULL && entry(2) != NULL);
+    seen(6);
+    CHECK(entry(2) == NULL && entry(3) != NULL);
+}
+
+int main(void) {
+    test_presence();
+    test_clock_wrap();
+    test_seen_ahead();
+    test_full();
+    test_snapshot();
+    return check_result("registry_test");
+}
@@ -0,0 +1,104 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "replay.h"
+
+#include "check.h"
+
+// replay counters: each node only moves forward, a full table refuses new
+// nodes but never gives up a counter it holds, so the frames a node sent
+// before stay refused however many other MACs show up. A reset lets a node
+// start over without taking another slot.
+
+#define NODES 64
+
+static replay_entry_t s_buckets[2 * NODES];
+
+static void mac_of(uint32_t i, uint8_t mac[ESP_NOW_ETH_ALEN]) {
+    const uint8_t m[ESP_NOW_ETH_ALEN] = {0x24, 0x6F, 0x28, (uint8_t)(i >> 16), (uint8_t)(i >> 8), (uint8_t)i};
+    memcpy(mac, m, ESP_NOW_ETH_ALEN);
+}
+
+static void test_counters(void) {
+    replay_t t;
+    replay_init(&t, s_buckets, 2 * NODES);
+
+    uint8_t a[ESP_NOW_ETH_ALEN], b[ESP_NOW_ETH_ALEN];
+    mac_of(1, a);
+    mac_of(2, b);
+
+    // Counters start at 1, a refused first frame does not take a slot.
+    CHECK_EQ(replay_advance(&t, a, 0), ESP_ERR_INVALID_STATE);
+    CHECK_EQ(t.count, 0);
+    CHECK_EQ(replay_advance(&t, a, 1), ESP_OK);
+    CHECK_EQ(replay_advance(&t, a, 1), ESP_ERR_INVALID_STATE);
+    CHECK_EQ(replay_advance(&t, a, 5), ESP_OK);
+    CHECK_EQ(replay_advance(&t, a, 4), ESP_ERR_INVALID_STATE);
+    CHECK_EQ(replay_advance(&t, a, 5), ESP_ERR_INVALID_STATE);
+
+    // Nodes are independent.
+    CHECK_EQ(replay_advance(&t, b, 3), ESP_OK);
+    CHECK_EQ(replay_advance(&t, a, 6), ESP_OK);
+    CHECK_EQ(replay_advance(&t, b, 3), ESP_ERR_INVALID_STATE);
+    CHECK_EQ(t.count, 2);
+
+    // The whole counter range, a wrapped counter is a replay.
+    CHECK_EQ(replay_advance(&t, b, UINT32_MAX), ESP_OK);
+    CHECK_EQ(replay_advance(&t, b, 1), ESP_ERR_INVALID_STATE);
+}
+
+// The case the device cache got wrong: a flood of other MACs must not reopen the counters of a node.
+static void test_flood(void) {
+    replay_t t;
+    replay_init(&t, s_buckets, 2 * NODES);
+
+    uint8_t node[ESP_NOW_ETH_ALEN], mac[ESP_NOW_ETH_ALEN];
+    mac_of(0, node);
+    for (uint32_t c = 1; c <= 100; c++) {
+        CHECK_EQ(replay_advance(&t, node, c), ESP_OK);
+    }
+
+    // Sequential and scattered MACs up to capacity, then every further one is refused.
+    size_t added = 1, refused = 0;
+    for (uint32_t i = 1; i < 10 * NODES; i++) {
+        mac_of(i % 2 ? i : i * 0x9E37u, mac);
+        const esp_err_t err = replay_advance(&t, mac, 1);
+        if (err == ESP_OK) {
+            added++;
+        } else {
+            CHECK_EQ(err, ESP_ERR_NO_MEM);
+            refused++;
+        }
+    }
+    CHECK_EQ(added, NODES);
+    CHECK_EQ(t.count, NODES);
+    CHECK_EQ(refused, 10 * NODES - NODES);
+
+    // Every captured frame of the node stays refused, its next one is taken.
+    size_t replayed = 0;
+    for (uint32_t c = 1; c <= 100; c++) {
+        replayed += replay_advance(&t, node, c) == ESP_ERR_INVALID_STATE;
+    }
+    CHECK_EQ(replayed, 100);
+    CHECK_EQ(replay_advance(&t, node, 101), ESP_OK);
+
+    // Nodes already in a full table keep advancing.
+    mac_of(1, mac);
+    CHECK_EQ(replay_advance(&t, mac, 1), ESP_ERR_INVALID_STATE);
+    CHECK_EQ(replay_advance(&t, mac, 2), ESP_OK);
+
+    // A reset node starts over in its own bucket, an unknown one is not added.
+    replay_reset(&t, node);
+    CHECK_EQ(replay_advance(&t, node, 1), ESP_OK);
+    CHECK_EQ(replay_advance(&t, node, 1), ESP_ERR_INVALID_STATE);
+    mac_of(10 * NODES, mac);
+    replay_reset(&t, mac);
+    CHECK_EQ(t.count, NODES);
+    CHECK_EQ(replay_advance(&t, mac, 1), ESP_ERR_NO_MEM);
+}
+
+int main(void) {
+    test_counters();
+    test_flood();
+    return check_result("replay_test");
+}
@@ -0,0 +1,252 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if !defined(__GLIBC__) || !__GLIBC_PREREQ(2, 38)
+// newlib has it, older glibc does not.
+size_t strlcpy(char *dst, const char *src, size_t size) {
+    const size_t len = strlen(src);
+    if (size > 0) {
+        const size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#endif
+
+// The compiled routes are static, the test checks the token list from inside.
+#include "routes.c"
+
+#include "check.h"
+
+// routes templates and class rules: templates compile into literal and
+// placeholder tokens or are refused whole, rules parse with their optional
+// QoS, retain and raw flags, a full MAC wins over an OUI whatever the order,
+// topics are cut at ROUTES_TOPIC_MAX_LEN, and a change that does not compile
+// keeps the previous routing and its generation.
+
+static const char *s_topic = "{prefix}/{class}/{mac}";
+static const char *s_prefix = "gw";
+static const char *s_classes = "";
+static uint8_t s_qos;
+static uint8_t s_retain;
+static settings_listener_t s_listener;
+static int s_held; // mutex depth
+
+uint8_t settings_mqtt_qos(void) {
+    return s_qos;
+}
+
+uint8_t settings_mqtt_retain(void) {
+    return s_retain;
+}
+
+const char *settings_mqtt_topic(void) {
+    return s_topic;
+}
+
+const char *settings_mqtt_prefix(void) {
+    return s_prefix;
+}
+
+const char *settings_mqtt_classes(void) {
+    return s_classes;
+}
+
+esp_err_t settings_add_listener(settings_listener_t cb, void *ctx) {
+    (void)ctx;
+    s_listener = cb;
+    return ESP_OK;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    return (SemaphoreHandle_t)&s_held;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    (void)ticks;
+    CHECK(sem == (SemaphoreHandle_t)&s_held);
+    CHECK_EQ(s_held++, 0);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    (void)sem;
+    CHECK_EQ(--s_held, 0);
+    return pdTRUE;
+}
+
+static const uint8_t s_mac[ESP_NOW_ETH_ALEN] = {0x24, 0x0A, 0xC4, 0x12, 0x34, 0x56};
+static const uint8_t s_sibling[ESP_NOW_ETH_ALEN] = {0x24, 0x0A, 0xC4, 0x00, 0x00, 0x01};
+static const uint8_t s_stranger[ESP_NOW_ETH_ALEN] = {0x30, 0xAE, 0xA4, 0x00, 0x00, 0x02};
+
+// Compiles the settings as a change would and resolves one device.
+static uint32_t resolve(const uint8_t *mac_addr, routes_target_t *out) {
+    s_listener("mqtt.topic", NULL);
+    return routes_resolve(mac_addr, out);
+}
+
+static void test_template(void) {
+    routes_t r;
+    CHECK_EQ(compile_template("{prefix}/{class}/{mac}", &r), ESP_OK);
+    CHECK_EQ(r.n_tokens, 5);
+    CHECK_EQ(r.tokens[0].kind, TOKEN_PREFIX);
+    CHECK_EQ(r.tokens[1].kind, TOKEN_LITERAL);
+    CHECK_EQ(r.tokens[2].kind, TOKEN_CLASS);
+    CHECK_EQ(r.tokens[4].kind, TOKEN_MAC);
+    CHECK(memcmp(r.literals + r.tokens[3].off, "/", r.tokens[3].len) == 0);
+
+    CHECK_EQ(compile_template("sensors/{mac}{class}", &r), ESP_OK);
+    CHECK_EQ(r.n_tokens, 3);
+    CHECK_EQ(r.tokens[0].len, strlen("sensors/"));
+    CHECK_EQ(compile_template("fixed/topic", &r), ESP_OK);
+    CHECK_EQ(r.n_tokens, 1);
+
+    const char *const bad[] = {
+        "", "{", "{prefix", "{}", "{foo}/{mac}", "{Mac}", "a}b", "{{mac}}", "a/+/{mac}", "a/#", "{mac}}", "{mac}/{",
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        CHECK_EQ(routes_check_template(bad[i]), ESP_ERR_INVALID_ARG);
+    }
+
+    // Token and literal space run out.
+    char tmpl[2 * ROUTES_TOPIC_MAX_LEN];
+    tmpl[0] = '\0';
+    for (int i = 0; i <= ROUTES_MAX_TOKENS; i++) {
+        strcat(tmpl, "{mac}");
+    }
+    CHECK_EQ(routes_check_template(tmpl), ESP_ERR_INVALID_SIZE);
+    memset(tmpl, 'a', ROUTES_TOPIC_MAX_LEN);
+    tmpl[ROUTES_TOPIC_MAX_LEN] = '\0';
+    CHECK_EQ(routes_check_template(tmpl), ESP_ERR_INVALID_ARG);
+    tmpl[ROUTES_TOPIC_MAX_LEN - 1] = '\0';
+    CHECK_EQ(routes_check_template(tmpl), ESP_OK);
+}
+
+static void test_rules(void) {
+    routes_t r = {.qos = 1, .retain = true};
+    CHECK_EQ(compile_rules("24:0A:c4=telemetry;;30:ae:a4:00:00:02=alarm,2;"
+                           "24:0a:c4:12:34:56=raw_cam,0,0,raw",
+                           &r),
+             ESP_OK);
+    CHECK_EQ(r.n_rules, 3);
+    const rule_t *oui = &r.rules[0];
+    CHECK_EQ(oui->addr_len, OUI_LEN);
+    CHECK(memcmp(oui->addr, s_mac, OUI_LEN) == 0);
+    CHECK(strcmp(oui->class_name, "telemetry") == 0);
+    CHECK_EQ(oui->qos, 1);
+    CHECK(oui->retain && !oui->raw);
+    CHECK_EQ(r.rules[1].qos, 2);
+    CHECK(r.rules[1].retain);
+    CHECK_EQ(r.rules[2].addr_len, ESP_NOW_ETH_ALEN);
+    CHECK_EQ(r.rules[2].qos, 0);
+    CHECK(!r.rules[2].retain && r.rules[2].raw);
+
+    // The full MAC wins over the OUI listed before it, the sibling keeps the OUI rule.
+    CHECK(match(&r, s_mac) == &r.rules[2]);
+    CHECK(match(&r, s_sibling) == &r.rules[0]);
+    CHECK(match(&r, s_stranger) == &r.rules[1]);
+    CHECK_EQ(compile_rules("24:0a:c4:12:34:56=cam;24:0a:c4=telemetry", &r), ESP_OK);
+    CHECK(match(&r, s_mac) == &r.rules[0]);
+    CHECK(match(&r, (const uint8_t[]){0x24, 0x0A, 0xC5, 0, 0, 0}) == NULL);
+    CHECK_EQ(compile_rules("", &r), ESP_OK);
+    CHECK_EQ(r.n_rules, 0);
+
+    const char *const bad[] = {
+        "24:0a:c4",
+        "24:0a:c4=",
+        "24:0a=short",
+        "24:0a:c4:12=partial",
+        "24-0a-c4=dashes",
+        "24:0a:g4=hex",
+        "24:0a:c4=a/b",
+        "24:0a:c4=0123456789abcdef",
+        "24:0a:c4=c,3",
+        "24:0a:c4=c,1,2",
+        "24:0a:c4=c,1,1,rawx",
+        "24:0a:c4=c,1,raw",
+        "24:0a:c4=c,",
+        "24:0a:c4=ok;bad",
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        CHECK_EQ(routes_check_classes(bad[i]), ESP_ERR_INVALID_ARG);
+    }
+    CHECK_EQ(routes_check_classes("24:0a:c4=0123456789abcde"), ESP_OK);
+
+    char rules[ROUTES_MAX_RULES * 16 + 16] = "";
+    for (int i = 0; i <= ROUTES_MAX_RULES; i++) {
+        strcat(rules, "24:0a:c4=c;");
+    }
+    CHECK_EQ(routes_check_classes(rules), ESP_ERR_INVALID_SIZE);
+}
+
+static void test_resolve(void) {
+    s_classes = "24:0a:c4=telemetry,0;24:0a:c4:12:34:56=alarm,1,1";
+    s_qos = 2;
+    routes_target_t t;
+    const uint32_t gen = resolve(s_mac, &t);
+    CHECK_EQ(gen, routes_generation());
+    CHECK(strcmp(t.topic, "gw/alarm/24:0a:c4:12:34:56") == 0);
+    CHECK_EQ(t.qos, 1);
+    CHECK(t.retain && !t.raw);
+
+    CHECK_EQ(routes_resolve(s_sibling, &t), gen);
+    CHECK(strcmp(t.topic, "gw/telemetry/24:0a:c4:00:00:01") == 0);
+    CHECK_EQ(t.qos, 0);
+    CHECK(!t.retain);
+
+    CHECK_EQ(routes_resolve(s_stranger, &t), gen);
+    CHECK(strcmp(t.topic, "gw/" ROUTES_DEFAULT_CLASS "/30:ae:a4:00:00:02") == 0);
+    CHECK_EQ(t.qos, 2);
+
+    // Cut to the longest topic, still terminated.
+    char prefix[ROUTES_TOPIC_MAX_LEN];
+    memset(prefix, 'p', sizeof(prefix) - 10);
+    prefix[sizeof(prefix) - 10] = '\0';
+    s_prefix = prefix;
+    resolve(s_mac, &t);
+    CHECK_EQ(strlen(t.topic), ROUTES_TOPIC_MAX_LEN - 1);
+    CHECK(memcmp(t.topic + strlen(prefix), "/alarm/2", 8) == 0);
+    s_prefix = "gw";
+}
+
+// A change that does not compile keeps what was there, other keys do not recompile.
+static void test_reload(void) {
+    s_topic = "{prefix}/{class}/{mac}";
+    s_classes = "";
+    routes_target_t t;
+    const uint32_t gen = resolve(s_mac, &t);
+
+    s_topic = "{nope}";
+    CHECK_EQ(resolve(s_mac, &t), gen);
+    CHECK(strcmp(t.topic, "gw/" ROUTES_DEFAULT_CLASS "/24:0a:c4:12:34:56") == 0);
+    s_topic = "{prefix}/{mac}";
+    s_listener("wifi.ssid", NULL);
+    CHECK_EQ(routes_generation(), gen);
+    CHECK_EQ(resolve(s_mac, &t), gen + 1);
+    CHECK(strcmp(t.topic, "gw/24:0a:c4:12:34:56") == 0);
+
+    // The generation skips 0 when it wraps, 0 marks caches never resolved.
+    s_generation = UINT32_MAX;
+    CHECK_EQ(resolve(s_mac, &t), 1);
+}
+
+int main(void) {
+    test_template();
+    test_rules();
+
+    // Settings damaged in NVS: the first compile falls back to "/device/<MAC>".
+    s_topic = "{";
+    CHECK_EQ(routes_init(), ESP_OK);
+    CHECK_EQ(routes_generation(), 1);
+    routes_target_t t;
+    CHECK_EQ(routes_resolve(s_mac, &t), 1);
+    CHECK(strcmp(t.topic, GATEWAY_BROKER_TOPIC_PREFIX "/24:0a:c4:12:34:56") == 0);
+    s_topic = "{prefix}/{class}/{mac}";
+
+    test_resolve();
+    test_reload();
+    CHECK_EQ(s_held, 0);
+    return check_result("routes_test");
+}
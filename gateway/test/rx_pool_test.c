@@ -0,0 +1,147 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include "rx_pool.h"
+
+#include "check.h"
+
+// rx_pool against a shadow of the borrowed slots: every slot is handed out
+// once until it comes back, none is lost, double and foreign releases are
+// refused. Then several threads hammer the pool at the same time, the way the
+// receive callback and the workers do.
+
+#define THREADS 4
+#define ROUNDS 200000
+
+static uint32_t s_rng = 1;
+
+static uint32_t rnd(uint32_t n) {
+    s_rng = s_rng * 1103515245u + 12345u;
+    return (s_rng >> 8) % n;
+}
+
+static void test_exhaust(void) {
+    rx_pool_reset();
+    espnow_rx_t *held[GATEWAY_RX_POOL_SIZE];
+    for (size_t i = 0; i < GATEWAY_RX_POOL_SIZE; i++) {
+        held[i] = rx_pool_acquire();
+        CHECK(held[i] != NULL);
+        for (size_t k = 0; k < i; k++) {
+            CHECK(held[k] != held[i]);
+        }
+    }
+    CHECK(rx_pool_acquire() == NULL);
+    CHECK_EQ(rx_pool_in_use(), GATEWAY_RX_POOL_SIZE);
+
+    for (size_t i = 0; i < GATEWAY_RX_POOL_SIZE; i++) {
+        CHECK_EQ(rx_pool_release(held[i]), ESP_OK);
+        CHECK_EQ(rx_pool_release(held[i]), ESP_ERR_INVALID_STATE);
+    }
+    CHECK_EQ(rx_pool_in_use(), 0);
+
+    espnow_rx_t foreign;
+    CHECK_EQ(rx_pool_release(&foreign), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(rx_pool_release(NULL), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(rx_pool_in_use(), 0);
+}
+
+// Random acquire and release, including releases of slots already returned.
+static void test_shadow(void) {
+    rx_pool_reset();
+    espnow_rx_t *held[GATEWAY_RX_POOL_SIZE] = {0};
+    size_t count = 0;
+    espnow_rx_t *returned = NULL;
+
+    for (int round = 0; round < 100000; round++) {
+        const uint32_t op = rnd(5);
+        if (op < 2) {
+            espnow_rx_t *rx = rx_pool_acquire();
+            CHECK_EQ(rx == NULL, count == GATEWAY_RX_POOL_SIZE);
+            if (rx != NULL) {
+                for (size_t k = 0; k < count; k++) {
+                    CHECK(held[k] != rx);
+                }
+                held[count++] = rx;
+            }
+        } else if (op < 4 && count > 0) {
+            const size_t i = rnd((uint32_t)count);
+            returned = held[i];
+            CHECK_EQ(rx_pool_release(returned), ESP_OK);
+            held[i] = held[--count];
+        } else if (returned != NULL) {
+            bool borrowed = false;
+            for (size_t k = 0; k < count; k++) {
+                borrowed |= held[k] == returned;
+            }
+            CHECK_EQ(rx_pool_release(returned), borrowed ? ESP_OK : ESP_ERR_INVALID_STATE);
+            if (borrowed) {
+                for (size_t k = 0; k < count; k++) {
+                    if (held[k] == returned) {
+                        held[k] = held[--count];
+                        break;
+                    }
+                }
+            }
+        }
+        CHECK_EQ(rx_pool_in_use(), count);
+    }
+
+    while (count > 0) {
+        CHECK_EQ(rx_pool_release(held[--count]), ESP_OK);
+    }
+    CHECK_EQ(rx_pool_in_use(), 0);
+}
+
+// Each thread stamps the slots it holds and checks the stamp before it gives them back: a slot handed to two
+// threads at once shows up as a foreign stamp.
+static uint32_t s_collisions;
+static uint32_t s_failures;
+
+static void *worker(void *arg) {
+    const uint8_t id = (uint8_t)(uintptr_t)arg;
+    espnow_rx_t *held[2];
+    for (int round = 0; round < ROUNDS; round++) {
+        size_t n = 0;
+        for (; n < 2; n++) {
+            if ((held[n] = rx_pool_acquire()) == NULL) {
+                break;
+            }
+            memset(held[n]->mac_addr, id, sizeof(held[n]->mac_addr));
+            held[n]->len = id;
+        }
+        while (n > 0) {
+            espnow_rx_t *rx = held[--n];
+            if (rx->mac_addr[0] != id || rx->mac_addr[5] != id || rx->len != id) {
+                __atomic_add_fetch(&s_collisions, 1, __ATOMIC_RELAXED);
+            }
+            if (rx_pool_release(rx) != ESP_OK) {
+                __atomic_add_fetch(&s_failures, 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void test_threads(void) {
+    rx_pool_reset();
+    pthread_t threads[THREADS];
+    for (uintptr_t i = 0; i < THREADS; i++) {
+        CHECK_EQ(pthread_create(&threads[i], NULL, worker, (void *)(i + 1)), 0);
+    }
+    for (size_t i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    CHECK_EQ(s_collisions, 0);
+    CHECK_EQ(s_failures, 0);
+    CHECK_EQ(rx_pool_in_use(), 0);
+}
+
+int main(void) {
+    test_exhaust();
+    test_shadow();
+    test_threads();
+    return check_result("rx_pool_test");
+}
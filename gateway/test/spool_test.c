@@ -0,0 +1,216 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "spool.h"
+
+#include "check.h"
+#include "flash_file.h"
+
+// spool on the file backed NOR emulator: order and content through the
+// ring, recovery after a reopen and after writes torn by a power loss, the
+// oldest sector given up when full, and one erase per sector entered.
+
+#define SECTOR_SIZE 1024
+#define SECTORS 4
+#define WBUF_LEN 256
+
+typedef struct {
+    char topic[16];
+    uint8_t data[128];
+    size_t len;
+} msg_t;
+
+static void make(uint32_t i, msg_t *m) {
+    snprintf(m->topic, sizeof(m->topic), "dev/%u", (unsigned)i);
+    m->len = 5 + (i * 13) % 80;
+    for (size_t k = 0; k < m->len; k++) {
+        m->data[k] = (uint8_t)(i * 31 + k);
+    }
+}
+
+static esp_err_t append(spool_t *s, uint32_t i) {
+    msg_t m;
+    make(i, &m);
+    return spool_append(s, m.topic, m.data, m.len, (uint8_t)(i & SPOOL_FLAGS_MASK));
+}
+
+// Peeks the next record and returns the index it was made from, or -1 when the spool is empty or the record is not
+// one of ours.
+static long next(spool_t *s, bool consume) {
+    static uint8_t buf[SECTOR_SIZE];
+    spool_record_t rec;
+    if (spool_peek(s, &rec, buf, sizeof(buf)) != ESP_OK) {
+        return -1;
+    }
+
+    unsigned i;
+    if (sscanf(rec.topic, "dev/%u", &i) != 1) {
+        return -1;
+    }
+    msg_t m;
+    make(i, &m);
+    CHECK(strcmp(rec.topic, m.topic) == 0);
+    CHECK_EQ(rec.len, m.len);
+    CHECK(rec.len == m.len && memcmp(rec.data, m.data, m.len) == 0);
+    CHECK_EQ(rec.flags, i & SPOOL_FLAGS_MASK);
+
+    if (consume) {
+        CHECK_EQ(spool_consume(s), ESP_OK);
+    }
+    return (long)i;
+}
+
+static void test_round_trip(void) {
+    flash_file_t f;
+    CHECK(flash_file_open(&f, SECTORS, SECTOR_SIZE));
+    static uint8_t wbuf[WBUF_LEN];
+    spool_t s;
+    CHECK_EQ(spool_open(&s, &f.flash, wbuf, sizeof(wbuf)), ESP_OK);
+
+    for (uint32_t i = 0; i < 20; i++) {
+        CHECK_EQ(append(&s, i), ESP_OK);
+    }
+    for (long i = 0; i < 20; i++) {
+        CHECK_EQ(next(&s, true), i);
+    }
+    CHECK_EQ(next(&s, true), -1);
+    CHECK(spool_empty(&s));
+    CHECK_EQ(s.stats.appended, 20);
+    CHECK_EQ(s.stats.consumed, 20);
+
+    // Too large for a sector.
+    static uint8_t big[SECTOR_SIZE];
+    CHECK_EQ(spool_append(&s, "t", big, sizeof(big), 0), ESP_ERR_INVALID_SIZE);
+    CHECK_EQ(spool_append(&s, "t", big, spool_max_message(&s) - 1, 0), ESP_OK);
+    CHECK_EQ(f.violations, 0);
+    flash_file_close(&f);
+}
+
+static void test_reopen(void) {
+    flash_file_t f;
+    CHECK(flash_file_open(&f, SECTORS, SECTOR_SIZE));
+    static uint8_t wbuf[WBUF_LEN];
+    spool_t s;
+    CHECK_EQ(spool_open(&s, &f.flash, wbuf, sizeof(wbuf)), ESP_OK);
+
+    for (uint32_t i = 0; i < 30; i++) {
+        append(&s, i);
+    }
+    for (long i = 0; i < 10; i++) {
+        CHECK_EQ(next(&s, true), i);
+    }
+    CHECK_EQ(spool_flush(&s), ESP_OK);
+
+    CHECK_EQ(spool_open(&s, &f.flash, wbuf, sizeof(wbuf)), ESP_OK);
+    CHECK_EQ(s.stats.recovered, 20);
+    for (long i = 10; i < 30; i++) {
+        CHECK_EQ(next(&s, true), i);
+    }
+
+    // Appends continue after the recovered records.
+    append(&s, 30);
+    CHECK_EQ(next(&s, true), 30);
+    CHECK_EQ(next(&s, true), -1);
+    CHECK_EQ(f.violations, 0);
+    flash_file_close(&f);
+}
+
+static void test_ring_full(void) {
+    flash_file_t f;
+    CHECK(flash_file_open(&f, SECTORS, SECTOR_SIZE));
+    static uint8_t wbuf[WBUF_LEN];
+    spool_t s;
+    CHECK_EQ(spool_open(&s, &f.flash, wbuf, sizeof(wbuf)), ESP_OK);
+
+    const uint32_t count = 300;
+    for (uint32_t i = 0; i < count; i++) {
+        CHECK_EQ(append(&s, i), ESP_OK);
+    }
+    CHECK(s.stats.dropped > 0);
+    CHECK_EQ(s.stats.pending + s.stats.dropped, count);
+
+    // The newest records survive, in order.
+    long expect = (long)(count - s.stats.pending);
+    long got;
+    while ((got = next(&s, true)) >= 0) {
+        CHECK_EQ(got, expect);
+        expect++;
+    }
+    CHECK_EQ(expect, count);
+    CHECK_EQ(f.violations, 0);
+    flash_file_close(&f);
+}
+
+// A reader keeping up with the writer: every sector the head enters is erased once, drained sectors are left as
+// they are until then.
+static void test_erase_once(void) {
+    flash_file_t f;
+    CHECK(flash_file_open(&f, SECTORS, SECTOR_SIZE));
+    static uint8_t wbuf[WBUF_LEN];
+    spool_t s;
+    CHECK_EQ(spool_open(&s, &f.flash, wbuf, sizeof(wbuf)), ESP_OK);
+
+    for (uint32_t i = 0; i < 500; i++) {
+        append(&s, i);
+        if (i % 3 == 2) {
+            for (uint32_t k = i - 2; k <= i; k++) {
+                CHECK_EQ(next(&s, true), k);
+            }
+        }
+    }
+    const uint32_t opened = s.next_sector_seq - 1;
+    CHECK(opened > 3 * SECTORS);
+    CHECK_EQ(s.stats.erases, opened);
+    CHECK_EQ(flash_file_erases(&f), opened);
+    CHECK_EQ(s.stats.dropped, 0);
+    CHECK_EQ(f.violations, 0);
+    flash_file_close(&f);
+}
+
+// Power lost at every point of a batch write: after the reboot the records written before come back complete, then
+// a prefix of the torn batch, nothing else, and the spool keeps working.
+static void test_power_loss(void) {
+    for (size_t cut = 0; cut < 2 * WBUF_LEN; cut += 5) {
+        flash_file_t f;
+        CHECK(flash_file_open(&f, SECTORS, SECTOR_SIZE));
+        static uint8_t wbuf[WBUF_LEN];
+        spool_t s;
+        CHECK_EQ(spool_open(&s, &f.flash, wbuf, sizeof(wbuf)), ESP_OK);
+
+        for (uint32_t i = 0; i < 10; i++) {
+            append(&s, i);
+        }
+        CHECK_EQ(spool_flush(&s), ESP_OK);
+
+        flash_file_power_loss(&f, cut);
+        for (uint32_t i = 10; i < 20 && append(&s, i) == ESP_OK; i++) {
+        }
+        spool_flush(&s);
+        flash_file_power_on(&f);
+
+        CHECK_EQ(spool_open(&s, &f.flash, wbuf, sizeof(wbuf)), ESP_OK);
+        long expect = 0;
+        long got;
+        while ((got = next(&s, true)) >= 0) {
+            CHECK_EQ(got, expect);
+            expect++;
+        }
+        CHECK(expect >= 10 && expect <= 20);
+
+        append(&s, 100);
+        CHECK_EQ(next(&s, true), 100);
+        CHECK_EQ(next(&s, true), -1);
+        CHECK_EQ(f.violations, 0);
+        flash_file_close(&f);
+    }
+}
+
+int main(void) {
+    test_round_trip();
+    test_reopen();
+    test_ring_full();
+    test_erase_once();
+    test_power_loss();
+    return check_result("spool_test");
+}
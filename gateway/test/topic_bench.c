@@ -0,0 +1,111 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "devices.h"
+
+// Host benchmark of the per-device topic cache:
+//
+//   topic_bench
+//
+// Replays a trace of frames from a number of devices through the two ways a
+// worker can get the MQTT topic of a frame: formatting "<prefix>/<MAC>" with
+// snprintf() for every frame, and devices_lookup() with the target resolved
+// once per device. Device counts below, at and above
+// CONFIG_GATEWAY_DEVICE_CACHE_SIZE show the hit path and the eviction path.
+// Prints host time per frame and checks that both paths give the same
+// topics.
+
+#define FRAMES 2000000
+#define PREFIX "/device"
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+
+static const size_t s_device_counts[] = {4, 16, GATEWAY_DEVICE_CACHE_SIZE, 2 * GATEWAY_DEVICE_CACHE_SIZE};
+
+static uint8_t s_trace[FRAMES][ESP_NOW_ETH_ALEN];
+static devices_t s_devices;
+static uint32_t s_resolves;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// Devices report at different rates: device d sends about twice as often as device 2d.
+static void make_trace(size_t devices) {
+    uint32_t rng = 12345;
+    for (size_t i = 0; i < FRAMES; i++) {
+        rng = rng * 1103515245u + 12345u;
+        size_t d = (rng >> 8) % devices;
+        if ((rng >> 28) & 1) {
+            d /= 2;
+        }
+        const uint8_t mac[ESP_NOW_ETH_ALEN] = {0x24, 0x6F, 0x28, 0x00, (uint8_t)(d >> 8), (uint8_t)d};
+        memcpy(s_trace[i], mac, sizeof(mac));
+    }
+}
+
+// What routes_resolve() does for a device without a class rule.
+static uint32_t resolve(const uint8_t *mac_addr, routes_target_t *out) {
+    s_resolves++;
+    snprintf(out->topic, sizeof(out->topic), PREFIX "/" MACSTR, MAC2STR(mac_addr));
+    return 1;
+}
+
+static uint32_t run_snprintf(void) {
+    char topic[ROUTES_TOPIC_MAX_LEN];
+    uint32_t sum = 0;
+    for (size_t i = 0; i < FRAMES; i++) {
+        snprintf(topic, sizeof(topic), PREFIX "/" MACSTR, MAC2STR(s_trace[i]));
+        sum += (uint8_t)topic[sizeof(PREFIX) + 15] + (uint8_t)topic[sizeof(PREFIX) + 16];
+    }
+    return sum;
+}
+
+static uint32_t run_cache(void) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < FRAMES; i++) {
+        device_t *dev = devices_lookup(&s_devices, s_trace[i]);
+        if (unlikely(dev->routes_gen != 1)) {
+            dev->routes_gen = resolve(dev->mac_addr, &dev->target);
+        }
+        const char *topic = dev->target.topic;
+        sum += (uint8_t)topic[sizeof(PREFIX) + 15] + (uint8_t)topic[sizeof(PREFIX) + 16];
+    }
+    return sum;
+}
+
+int main(void) {
+    printf("cache           %d devices, %zu bytes per table\n", GATEWAY_DEVICE_CACHE_SIZE, sizeof(devices_t));
+    printf("%-8s %12s %12s %10s %10s\n", "devices", "snprintf ns", "cache ns", "speedup", "resolves");
+
+    for (size_t k = 0; k < sizeof(s_device_counts) / sizeof(s_device_counts[0]); k++) {
+        const size_t devices = s_device_counts[k];
+        make_trace(devices);
+
+        double start = now_ns();
+        const uint32_t expect = run_snprintf();
+        const double snprintf_ns = (now_ns() - start) / FRAMES;
+
+        devices_init(&s_devices);
+        s_resolves = 0;
+        start = now_ns();
+        const uint32_t got = run_cache();
+        const double cache_ns = (now_ns() - start) / FRAMES;
+
+        if (got != expect) {
+            fprintf(stderr, "topics differ with %zu devices\n", devices);
+            return 1;
+        }
+        printf("%-8zu %12.1f %12.1f %9.1fx %10" PRIu32 "\n", devices, snprintf_ns, cache_ns, snprintf_ns / cache_ns,
+               s_resolves);
+    }
+    return 0;
+}
@@ -17,7 +17,7 @@ function createItem({ initPromise, menu, setValue }) {
 
   const input = document.createElement('input');
   input.name = input.id = menu.key;
-  input.required = true;
+  input.required = !menu.optional;
   input.type = menu.type;
 
   input.addEventListener('input', () => {
@@ -80,6 +80,57 @@ export const menuConfig = Object.freeze({
           default: 'mqtt_password',
           help: 'Password for authenticating with the MQTT broker',
         },
+        {
+          key: 'mqtt.qos',
+          title: 'QoS',
+          type: 'number',
+          default: 0,
+          range: [0, 2],
+          help: 'QoS of published messages, unless a class rule sets another one',
+        },
+        {
+          key: 'mqtt.retain',
+          title: 'Retain',
+          type: 'number',
+          default: 0,
+          range: [0, 1],
+          help: 'Set to 1 to publish retained messages, unless a class rule says otherwise',
+        },
+        {
+          key: 'mqtt.topic',
+          title: 'Topic template',
+          type: 'text',
+          default: '{prefix}/{mac}',
+          help: 'Topic of each device, built from {prefix}, {class} and {mac}',
+        },
+        {
+          key: 'mqtt.prefix',
+          title: 'Topic prefix',
+          type: 'text',
+          default: '/device',
+          help: 'Value of {prefix} in the topic template',
+        },
+        {
+          key: 'mqtt.classes',
+          title: 'Device classes',
+          type: 'text',
+          default: '',
+          optional: true,
+          help: 'Rules "addr=class[,qos[,retain[,raw]]]" separated by ";", addr is a MAC or a 3-byte OUI, raw for nodes without frame format',
+        },
+      ],
+    },
+    {
+      legend: 'Logging',
+      items: [
+        {
+          key: 'log.level',
+          title: 'Per-frame log level',
+          type: 'number',
+          default: 2,
+          range: [0, 5],
+          help: 'Most verbose level of logging per received frame and publish: 0 none, 2 warnings, 3 info, 4 debug',
+        },
       ],
     },
   ],
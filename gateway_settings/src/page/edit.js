@@ -74,8 +74,10 @@ export default function ({ main, auth, backHandler }) {
       const trimmed = line.trim();
       if (!trimmed || trimmed.startsWith('#')) continue;
 
-      const [key, value] = trimmed.split('=', 2);
-      cacheValues[key] = value;
+      // Values may contain '=' themselves, e.g. mqtt.classes.
+      const eq = trimmed.indexOf('=');
+      if (eq < 0) continue;
+      cacheValues[trimmed.slice(0, eq)] = trimmed.slice(eq + 1);
     }
   })();
 
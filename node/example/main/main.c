@@ -1,35 +1,57 @@
 #include "esp_check.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
 
 #include "node.h"
+#include "proto_schema.h"
 
 #include "freertos/FreeRTOS.h"
 
 #define WAIT_NOTIFICATION pdMS_TO_TICKS(512)
-#define ESPNOW_CHANNEL 6
+#define SCAN_RETRY_DELAY pdMS_TO_TICKS(5000)
 
 static const char *TAG = "MAIN";
 #define TRY(expr) ESP_RETURN_ON_ERROR((expr), TAG, "%s:%d", __func__, __LINE__)
 
-#define START_FLAG 0x7E
+// Commands published to <prefix>/<MAC>/cmd, forwarded by the gateway.
+static void on_command(const uint8_t *src_addr, const uint8_t *data, size_t len, __attribute__((unused)) void *arg) {
+    ESP_LOGI(TAG, "command from " MACSTR ": %.*s", MAC2STR(src_addr), (int)len, (const char *)data);
+}
+
+// Encodes one telemetry sample, returns frame length or 0 if it does not fit.
+static size_t encode_sample(uint8_t *frame, size_t cap, uint32_t counter) {
+    const size_t hdr_len = proto_write_hdr(frame, PROTO_FLAG_TLV);
 
-typedef struct {
-    uint8_t start_flag;
-} __attribute__((packed)) packet_data_t;
+    proto_tlv_writer_t w;
+    proto_tlv_writer_init(&w, frame + hdr_len, cap - hdr_len);
+    proto_put_counter(&w, counter);
+    proto_put_uptime_s(&w, (uint64_t)(esp_timer_get_time() / 1000000));
+
+    return w.overflow ? 0 : hdr_len + w.len;
+}
 
 __attribute__((cold)) static esp_err_t app_run() {
-    TRY(node_init(ESPNOW_CHANNEL, NULL));
+    // Channel 0: search the gateway, it follows the channel of its upstream AP. With no gateway in range the node
+    // is up all the same, so keep searching until one answers.
+    esp_err_t err = node_init(0, NULL);
+    while (err == ESP_ERR_NOT_FOUND) {
+        ESP_LOGW(TAG, "No gateway found, searching again");
+        vTaskDelay(SCAN_RETRY_DELAY);
+        err = node_scan(NULL);
+    }
+    TRY(err);
+    TRY(node_set_recv_cb(on_command, NULL));
 
-    packet_data_t data = {
-        .start_flag = START_FLAG,
-    };
+    uint8_t frame[ESP_NOW_MAX_DATA_LEN];
+    uint32_t counter = 0;
 
     node_send_status_t status;
-    esp_err_t err;
 
     for (;;) {
-        err = node_broadcast((const uint8_t *)&data, sizeof(packet_data_t), &status, WAIT_NOTIFICATION);
+        const size_t len = encode_sample(frame, sizeof(frame), counter++);
+        err = node_broadcast(frame, len, &status, WAIT_NOTIFICATION);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "Failed to send broadcast: %s", esp_err_to_name(err));
         } else {
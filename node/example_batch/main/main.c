@@ -0,0 +1,129 @@
+#include <inttypes.h>
+#include <string.h>
+
+#include "esp_check.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "node.h"
+#include "proto_batch.h"
+#include "proto_schema.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Synthetic sample-rate sweep: the same telemetry stream is sent once per sample and then through a batch
+// accumulator, and frames, estimated airtime and achieved sample rate are logged for every rate.
+
+#define STEP_MS 5000 // duration of one rate in one mode
+#define BATCH_MAX_AGE pdMS_TO_TICKS(100)
+#define SEND_TIMEOUT pdMS_TO_TICKS(100)
+
+// ESP-NOW data rides in an 802.11 vendor action frame: MAC header 24, category 1, OUI 3, random 4, vendor
+// element 7 and FCS 4 bytes, sent with a long preamble at 1 Mbps, the ESP-NOW default rate.
+#define FRAME_OVERHEAD_BYTES 43
+#define PREAMBLE_US 192
+#define US_PER_BYTE 8
+
+static const char *TAG = "MAIN";
+#define TRY(expr) ESP_RETURN_ON_ERROR((expr), TAG, "%s:%d", __func__, __LINE__)
+
+static const uint32_t s_rates_hz[] = {10, 50, 100, 250, 500};
+
+typedef struct {
+    uint32_t samples;
+    uint32_t frames;
+    uint64_t payload_bytes; // ESP-NOW payload of all frames
+    int64_t elapsed_us;
+} step_result_t;
+
+// Encodes one sample as TLV record, returns its length or 0 if it does not fit.
+static size_t encode_record(uint8_t *out, size_t cap, uint32_t counter) {
+    proto_tlv_writer_t w;
+    proto_tlv_writer_init(&w, out, cap);
+    proto_put_counter(&w, counter);
+    proto_put_uptime_s(&w, (uint64_t)(esp_timer_get_time() / 1000000));
+
+    return w.overflow ? 0 : w.len;
+}
+
+static uint64_t airtime_us(const step_result_t *r) {
+    return (uint64_t)r->frames * (PREAMBLE_US + FRAME_OVERHEAD_BYTES * US_PER_BYTE) + r->payload_bytes * US_PER_BYTE;
+}
+
+static void run_step(uint32_t rate_hz, bool batched, step_result_t *out) {
+    TickType_t period = pdMS_TO_TICKS(1000 / rate_hz);
+    if (period == 0) {
+        period = 1;
+    }
+    const TickType_t steps = pdMS_TO_TICKS(STEP_MS) / period;
+
+    node_batch_t batch;
+    node_batch_init(&batch, (const uint8_t[ESP_NOW_ETH_ALEN]){0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}, PROTO_FLAG_TLV,
+                    BATCH_MAX_AGE);
+
+    uint8_t frame[ESP_NOW_MAX_DATA_LEN];
+    const int64_t start = esp_timer_get_time();
+    TickType_t wake = xTaskGetTickCount();
+    memset(out, 0, sizeof(*out));
+
+    for (TickType_t i = 0; i < steps; i++) {
+        if (batched) {
+            uint8_t rec[32];
+            const size_t len = encode_record(rec, sizeof(rec), out->samples);
+            if (node_batch_add(&batch, rec, len, SEND_TIMEOUT) == ESP_OK) {
+                out->samples++;
+                out->payload_bytes += PROTO_BATCH_REC_HDR_LEN + len;
+            }
+            node_batch_poll(&batch, SEND_TIMEOUT);
+        } else {
+            const size_t hdr_len = proto_write_hdr(frame, PROTO_FLAG_TLV);
+            const size_t len = hdr_len + encode_record(frame + hdr_len, sizeof(frame) - hdr_len, out->samples);
+            if (node_broadcast(frame, len, NULL, SEND_TIMEOUT) == ESP_OK) {
+                out->samples++;
+                out->frames++;
+                out->payload_bytes += len;
+            }
+        }
+        // Falls behind instead of bursting when sending takes longer than the period.
+        if (xTaskDelayUntil(&wake, period) == pdFALSE) {
+            wake = xTaskGetTickCount();
+        }
+    }
+
+    if (batched) {
+        node_batch_flush(&batch, SEND_TIMEOUT);
+        out->frames = batch.frames;
+        out->payload_bytes += (uint64_t)batch.frames * PROTO_HDR_LEN;
+    }
+    out->elapsed_us = esp_timer_get_time() - start;
+}
+
+static void log_step(uint32_t rate_hz, const char *mode, const step_result_t *r) {
+    const uint64_t air = airtime_us(r);
+    ESP_LOGI(TAG,
+             "%4" PRIu32 " Hz %-7s %6" PRIu32 " samples %6" PRIu32 " frames, %5.1f samples/s, airtime %6" PRIu64
+             " us/s (%4.2f%%)",
+             rate_hz, mode, r->samples, r->frames, r->samples * 1e6 / r->elapsed_us, air * 1000000 / r->elapsed_us,
+             air * 100.0 / r->elapsed_us);
+}
+
+__attribute__((cold)) static esp_err_t app_run() {
+    TRY(node_init(0, NULL));
+
+    for (size_t i = 0; i < sizeof(s_rates_hz) / sizeof(s_rates_hz[0]); i++) {
+        step_result_t single, batched;
+        run_step(s_rates_hz[i], false, &single);
+        run_step(s_rates_hz[i], true, &batched);
+        log_step(s_rates_hz[i], "single", &single);
+        log_step(s_rates_hz[i], "batched", &batched);
+    }
+
+    ESP_LOGI(TAG, "sweep done");
+    return ESP_OK;
+}
+
+void app_main(void) {
+    ESP_ERROR_CHECK(app_run());
+}
@@ -0,0 +1,103 @@
+#include <inttypes.h>
+
+#include "esp_check.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+
+#include "node.h"
+#include "proto_schema.h"
+
+#include "freertos/FreeRTOS.h"
+
+// Duty-cycled node: wakes up, sends one sample, collects queued commands and sleeps again.
+// Logs the awake time of every cycle, measured from application start to node_sleep(), and the steps of node_init().
+
+#define REPLY_WINDOW pdMS_TO_TICKS(50)
+#define SLEEP_US (10ULL * 1000000)
+
+static const char *TAG = "MAIN";
+#define TRY(expr) ESP_RETURN_ON_ERROR((expr), TAG, "%s:%d", __func__, __LINE__)
+
+static void on_command(const uint8_t *src_addr, const uint8_t *data, size_t len, __attribute__((unused)) void *arg) {
+    ESP_LOGI(TAG, "command from " MACSTR ": %.*s", MAC2STR(src_addr), (int)len, (const char *)data);
+}
+
+// Encodes one telemetry sample, returns frame length or 0 if it does not fit.
+static size_t encode_sample(uint8_t *frame, size_t cap, uint32_t counter) {
+    const size_t hdr_len = proto_write_hdr(frame, PROTO_FLAG_TLV);
+
+    proto_tlv_writer_t w;
+    proto_tlv_writer_init(&w, frame + hdr_len, cap - hdr_len);
+    proto_put_counter(&w, counter);
+
+    return w.overflow ? 0 : hdr_len + w.len;
+}
+
+static void log_cycles(void) {
+    node_cycle_stats_t stats;
+    if (node_cycle_stats(&stats) != ESP_OK || stats.cycles == 0) {
+        ESP_LOGI(TAG, "first cycle after power-on");
+        return;
+    }
+
+    ESP_LOGI(TAG, "cycle %" PRIu32 ": last awake %" PRIu32 " us, max %" PRIu32 " us, avg %" PRIu64 " us",
+             stats.cycles, stats.last_awake_us, stats.max_awake_us, stats.total_awake_us / stats.cycles);
+}
+
+static void log_scans(void) {
+    node_scan_stats_t scans;
+    if (node_scan_stats(&scans) != ESP_OK || scans.scans == 0) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "gateway searches: %" PRIu32 " (%" PRIu32 " failed), %" PRIu32 " channels, last %" PRIu32
+                  " us, total %" PRIu64 " us",
+             scans.scans, scans.failed, scans.channels, scans.last_scan_us, scans.total_scan_us);
+}
+
+static void log_boot(void) {
+    node_boot_timeline_t boot;
+    if (node_boot_timeline(&boot) != ESP_OK) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "node_init at %" PRId64 " us", boot.init_us);
+    for (int i = 0; i < NODE_BOOT_PHASES; i++) {
+        if (boot.phase_us[i] != 0) {
+            ESP_LOGI(TAG, "  %-10s %6" PRIu32 " us", node_boot_phase_name(i), boot.phase_us[i]);
+        }
+    }
+}
+
+__attribute__((cold)) static esp_err_t app_run() {
+    log_cycles();
+
+    // Channel 0: reuse the channel of the last cycle, search the gateway on the first one.
+    TRY(node_init(0, NULL));
+    TRY(node_set_recv_cb(on_command, NULL));
+
+    node_cycle_stats_t stats;
+    TRY(node_cycle_stats(&stats));
+
+    uint8_t frame[ESP_NOW_MAX_DATA_LEN];
+    const size_t len = encode_sample(frame, sizeof(frame), stats.cycles);
+
+    const int64_t start_us = esp_timer_get_time();
+    const esp_err_t err = node_poll(NULL, frame, len, REPLY_WINDOW);
+    const int64_t poll_us = esp_timer_get_time() - start_us;
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "no reply after %" PRId64 " us: %s", poll_us, esp_err_to_name(err));
+    } else {
+        ESP_LOGI(TAG, "reply after %" PRId64 " us", poll_us);
+    }
+    log_boot();
+    log_scans();
+
+    node_sleep(SLEEP_US);
+}
+
+void app_main(void) {
+    ESP_ERROR_CHECK(app_run());
+}
@@ -8,14 +8,128 @@ extern "C" {
 #include "esp_err.h"
 #include "esp_now.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "proto_delta.h"
 
 typedef esp_now_send_status_t node_send_status_t;
 
+/** Identifies a frame queued by node_send_async(), increases monotonically and wraps around. */
+typedef uint32_t node_ticket_t;
+
+/**
+ * @brief Send completion callback
+ * @note Called from the WiFi task (or ISR) context in send order; it must not block.
+ */
+typedef void (*node_send_cb_t)(node_ticket_t ticket, node_send_status_t status, void *arg);
+
+/**
+ * @brief Receive callback
+ * @param src_addr MAC address of the sender, normally the gateway
+ * @param data Message, only valid during the call
+ * @param len Message length
+ * @param arg Passed to node_set_recv_cb()
+ * @note Called from the WiFi task once per message, messages the gateway coalesced into one frame arrive as
+ *       separate calls. It must not block.
+ */
+typedef void (*node_recv_cb_t)(const uint8_t *src_addr, const uint8_t *data, size_t len, void *arg);
+
+/**
+ * @brief Duty cycle timing, kept in RTC memory across deep sleep
+ */
+typedef struct {
+    uint32_t cycles;         /**< node_sleep() calls since power-on */
+    uint32_t last_awake_us;  /**< Awake time of the previous cycle, from application start to node_sleep() */
+    uint32_t max_awake_us;   /**< Longest awake time of any cycle */
+    uint64_t total_awake_us; /**< Sum of all awake times, divide by cycles for the average */
+} node_cycle_stats_t;
+
+/**
+ * @brief Gateway searches since power-on, kept in RTC memory across deep sleep
+ * @note The radio is on for the whole search, so scan time is its radio-on cost.
+ */
+typedef struct {
+    uint32_t scans;         /**< Searches run */
+    uint32_t failed;        /**< Searches that found no gateway */
+    uint32_t channels;      /**< Channels probed, one probe and at most CONFIG_NODE_SCAN_DWELL_MS each */
+    uint32_t last_scan_us;  /**< Duration of the last search */
+    uint64_t total_scan_us; /**< Duration of all searches */
+    uint8_t channel;        /**< Channel found by the last successful search */
+} node_scan_stats_t;
+
+/**
+ * @brief Key exchanges with the gateway since power-on (CONFIG_NODE_ENCRYPT), kept in RTC memory across deep sleep
+ * @note Frames themselves are encrypted by the radio, a handshake is the only cost a node pays in time.
+ */
+typedef struct {
+    uint32_t pairings;           /**< Keys received from node_pair() */
+    uint32_t handshakes;         /**< Sessions started, one per lease */
+    uint32_t rekeys;             /**< Keys replaced after a rotation on the gateway */
+    uint32_t failures;           /**< Handshakes and pairings the gateway did not answer */
+    uint32_t forged;             /**< Answers to a handshake that did not check out under the node's key */
+    uint32_t last_handshake_us;  /**< Duration of the last handshake, from request to answer */
+    uint64_t total_handshake_us; /**< Duration of all handshakes */
+    uint32_t epoch;              /**< Epoch of the current key, 0 when unpaired */
+} node_key_stats_t;
+
+/**
+ * @brief Steps of node_init() and the first transmission, in order
+ */
+typedef enum {
+    NODE_BOOT_NVS,        /**< nvs_flash_init() */
+    NODE_BOOT_NETIF,      /**< esp_netif_init(), skipped with CONFIG_NODE_FAST_START */
+    NODE_BOOT_EVENT_LOOP, /**< esp_event_loop_create_default(), skipped with CONFIG_NODE_FAST_START */
+    NODE_BOOT_WIFI_INIT,  /**< esp_wifi_init() including PHY calibration */
+    NODE_BOOT_WIFI_START, /**< Mode, esp_wifi_start() and channel */
+    NODE_BOOT_ESPNOW,     /**< esp_now_init() and the broadcast peer */
+    NODE_BOOT_SCAN,       /**< Gateway search, only without a known channel */
+    NODE_BOOT_FIRST_TX,   /**< From the end of node_init() to the first send callback */
+    NODE_BOOT_PHASES,
+} node_boot_phase_t;
+
+/**
+ * @brief Time spent in each boot step, 0 for skipped steps and steps not reached yet
+ */
+typedef struct {
+    int64_t init_us;                     /**< Time since startup when node_init() was called */
+    uint32_t phase_us[NODE_BOOT_PHASES]; /**< Duration of each step */
+} node_boot_timeline_t;
+
+/**
+ * @brief Accumulator packing small records into one frame, see node_batch_init()
+ * @note Not thread-safe, use one per task or guard it.
+ */
+typedef struct {
+    uint8_t peer_addr[ESP_NOW_ETH_ALEN];
+    uint8_t frame[ESP_NOW_MAX_DATA_LEN]; /**< Frame header, then records */
+    size_t len;                          /**< Bytes used in frame, the header alone when empty */
+    size_t cap;                          /**< Usable bytes of frame, room is left for the sequence header */
+    size_t records;                      /**< Records in frame */
+    TickType_t first;                    /**< When the oldest record was added */
+    TickType_t max_age;                  /**< Oldest record is sent after this long */
+    uint32_t frames;                     /**< Frames sent */
+    uint32_t sent_records;               /**< Records sent */
+    proto_delta_ref_t ref;               /**< Previous record in frame, with PROTO_FLAG_DELTA */
+} node_batch_t;
+
+/**
+ * @brief How to report completion of an asynchronous send. All fields are optional.
+ */
+typedef struct {
+    node_send_cb_t cb;        /**< Called with the ticket and the send status */
+    void *arg;                /**< Passed to cb */
+    EventGroupHandle_t group; /**< Event group to signal */
+    EventBits_t ok_bits;      /**< Bits set in group on ESP_NOW_SEND_SUCCESS */
+    EventBits_t fail_bits;    /**< Bits set in group on ESP_NOW_SEND_FAIL */
+} node_completion_t;
+
 /**
  * @brief Initialize ESP-NOW node
- * @param channel WiFi channel (1-13)
+ * @param channel WiFi channel (1-13), 0 to find the gateway: the channel of the previous cycle is reused, otherwise
+ *        the one stored in NVS, otherwise node_scan() runs. With 0 the node also scans again after
+ *        CONFIG_NODE_RESCAN_FAILURES unicast frames in a row were not acknowledged or polls not answered.
  * @param mac Optional MAC address, NULL to use default
- * @return ESP_OK on success
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if channel is 0 and no gateway answered, the node is initialized
+ *         then and node_scan() can search again
  * @note This function should be called exactly once from application code, when the application starts up.
  */
 esp_err_t node_init(uint8_t channel, const uint8_t *mac);
@@ -26,8 +140,9 @@ esp_err_t node_init(uint8_t channel, const uint8_t *mac);
  * @param data Payload data
  * @param len Payload length
  * @param out_status Optional send status (ESP_NOW_SEND_SUCCESS or ESP_NOW_SEND_FAIL). Pass NULL to ignore.
- * @param xTicksToWait Timeout in FreeRTOS ticks
+ * @param xTicksToWait Timeout in FreeRTOS ticks for the whole call, retries included
  * @return ESP_OK on success, ESP_ERR_TIMEOUT on timeout
+ * @note Failed frames are resent up to CONFIG_NODE_SEND_RETRIES times with the same sequence number.
  */
 esp_err_t node_send(const uint8_t *peer_addr, const uint8_t *data, size_t len, esp_now_send_status_t *out_status,
                     TickType_t xTicksToWait);
@@ -42,6 +157,182 @@ esp_err_t node_send(const uint8_t *peer_addr, const uint8_t *data, size_t len, e
  */
 esp_err_t node_broadcast(const uint8_t *data, size_t len, node_send_status_t *out_status, TickType_t xTicksToWait);
 
+/**
+ * @brief Queue unicast message without waiting for the send callback
+ * @param peer_addr MAC address of peer
+ * @param data Payload data, copied by ESP-NOW before return
+ * @param len Payload length
+ * @param done Optional completion, NULL to fire and forget
+ * @param out_ticket Optional ticket of the queued frame, reported back to done->cb
+ * @param xTicksToWait Timeout in FreeRTOS ticks for a free slot in the in-flight window
+ * @return ESP_OK when queued, ESP_ERR_TIMEOUT if the window stayed full,
+ *         ESP_ERR_INVALID_SIZE if the payload does not fit next to the sequence header (CONFIG_NODE_SEQ)
+ * @note Safe to call from several tasks. At most CONFIG_NODE_TX_WINDOW frames are in flight.
+ */
+esp_err_t node_send_async(const uint8_t *peer_addr, const uint8_t *data, size_t len, const node_completion_t *done,
+                          node_ticket_t *out_ticket, TickType_t xTicksToWait);
+
+/**
+ * @brief Send message of any length up to 65535 bytes, split into fragments
+ * @param peer_addr MAC address of peer
+ * @param data Payload data
+ * @param len Payload length
+ * @param out_status Optional send status, ESP_NOW_SEND_FAIL if any fragment failed. Pass NULL to ignore.
+ * @param xTicksToWait Timeout in FreeRTOS ticks for the whole message
+ * @return ESP_OK on success, ESP_ERR_TIMEOUT on timeout, ESP_ERR_INVALID_SIZE if message is too large
+ * @note Fragments are pipelined through node_send_async() and share its in-flight window.
+ *       The gateway reassembles fragments and publishes only complete messages.
+ */
+esp_err_t node_send_large(const uint8_t *peer_addr, const uint8_t *data, size_t len, node_send_status_t *out_status,
+                          TickType_t xTicksToWait);
+
+/**
+ * @brief Prepare a batch accumulator
+ * @param b Accumulator
+ * @param peer_addr Destination, the gateway or the broadcast address
+ * @param flags PROTO_FLAG_TLV when records are telemetry, 0 for opaque records. Add PROTO_FLAG_DELTA to telemetry
+ *              to delta encode records against the previous one in the frame.
+ * @param max_age Ticks a record may wait for others before the frame is sent
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for bad arguments
+ * @note Records travel in one PROTO_FLAG_BATCH frame, which saves the per-frame radio overhead of sensors sampling
+ *       faster than they report. The gateway publishes them as separate messages with CONFIG_GATEWAY_UNBATCH.
+ * @note PROTO_FLAG_DELTA fits more slowly changing readings into a frame, it needs a gateway built with
+ *       CONFIG_GATEWAY_DELTA. Older gateways forward such frames raw.
+ */
+esp_err_t node_batch_init(node_batch_t *b, const uint8_t *peer_addr, uint8_t flags, TickType_t max_age);
+
+/**
+ * @brief Add one record, sending the frame when it is full or its oldest record is due
+ * @param b Accumulator
+ * @param data Record, at most 255 bytes
+ * @param len Record length
+ * @param xTicksToWait Timeout in FreeRTOS ticks for a free slot in the in-flight window
+ * @return ESP_OK, ESP_ERR_INVALID_SIZE if the record can never fit a frame, ESP_ERR_INVALID_ARG if a delta
+ *         encoded record is not valid telemetry, or the error of node_send_async()
+ * @note Frames are sent with node_send_async(), this does not wait for the send callback.
+ */
+esp_err_t node_batch_add(node_batch_t *b, const uint8_t *data, size_t len, TickType_t xTicksToWait);
+
+/**
+ * @brief Send the frame when its oldest record is due
+ * @param b Accumulator
+ * @param xTicksToWait Timeout in FreeRTOS ticks for a free slot in the in-flight window
+ * @return Ticks until the next record is due, portMAX_DELAY when empty. Sleep at most this long between samples.
+ */
+TickType_t node_batch_poll(node_batch_t *b, TickType_t xTicksToWait);
+
+/**
+ * @brief Send pending records now
+ * @param b Accumulator
+ * @param xTicksToWait Timeout in FreeRTOS ticks for a free slot in the in-flight window
+ * @return ESP_OK, also when nothing was pending, or the error of node_send_async(), the records are kept then
+ */
+esp_err_t node_batch_flush(node_batch_t *b, TickType_t xTicksToWait);
+
+/**
+ * @brief Set callback for messages sent to this node, e.g. MQTT commands forwarded by the gateway
+ * @param cb Callback, NULL to ignore incoming messages
+ * @param arg Passed to cb
+ * @return ESP_OK
+ * @note Only unicast frames are delivered, broadcasts of other nodes are ignored. Sequenced frames received twice
+ *       are delivered once. Fragmented frames are not supported and dropped.
+ */
+esp_err_t node_set_recv_cb(node_recv_cb_t cb, void *arg);
+
+/**
+ * @brief Send message and wait for the gateway to reply with the messages queued for this node
+ * @param gateway_addr MAC address of the gateway, NULL for the one that replied last, or broadcast if none did
+ * @param data Payload data, NULL to only check for queued messages
+ * @param len Payload length
+ * @param window Timeout in FreeRTOS ticks for sending and the reply together
+ * @return ESP_OK when the reply arrived, ESP_ERR_TIMEOUT if it did not within window,
+ *         ESP_ERR_INVALID_SIZE if the payload does not fit next to the frame header
+ * @note Messages of the reply are passed to the receive callback before this returns. The gateway replies even
+ *       when nothing is queued, so a node running on a duty cycle can go back to sleep right away.
+ */
+esp_err_t node_poll(const uint8_t *gateway_addr, const uint8_t *data, size_t len, TickType_t window);
+
+/**
+ * @brief Enter deep sleep until the next duty cycle
+ * @param sleep_us Time to sleep in microseconds
+ * @note The application restarts on wake-up. Sequence numbers, the duplicate filter of received frames and the
+ *       gateway address are kept in RTC memory, so node_init() after a wake-up continues where this cycle ended.
+ */
+void node_sleep(uint64_t sleep_us) __attribute__((noreturn));
+
+/**
+ * @brief Get awake times of the duty cycles since power-on
+ * @param out Copy of the statistics
+ * @return ESP_OK, ESP_ERR_INVALID_ARG if out is NULL
+ */
+esp_err_t node_cycle_stats(node_cycle_stats_t *out);
+
+/**
+ * @brief Search all channels for a gateway beacon
+ * @param out_channel Optional channel found
+ * @return ESP_OK, ESP_ERR_NOT_FOUND if no gateway answered, the previous channel is kept then
+ * @note The last known channel is probed first. On every channel a probe is broadcast and the gateway answers with a
+ *       beacon right away, so each channel costs at most CONFIG_NODE_SCAN_DWELL_MS. The channel is kept in RTC
+ *       memory, and in NVS when the application initialized it. Frames already queued complete first, sends of
+ *       other tasks wait until the search is done and count it against their timeout.
+ */
+esp_err_t node_scan(uint8_t *out_channel);
+
+/**
+ * @brief Get gateway search statistics
+ * @param out Copy of the statistics
+ * @return ESP_OK, ESP_ERR_INVALID_ARG if out is NULL
+ */
+esp_err_t node_scan_stats(node_scan_stats_t *out);
+
+/**
+ * @brief Authenticate all following frames, CONFIG_NODE_AUTH
+ * @param key Device key of PROTO_AUTH_KEY_LEN bytes, proto_auth_derive() of the gateway's master key and this node's
+ *        MAC address, NULL to send unauthenticated frames again
+ * @return ESP_OK, ESP_ERR_INVALID_STATE before node_init(), ESP_ERR_NOT_SUPPORTED without CONFIG_NODE_AUTH, or the
+ *         NVS error if the frame counter could not be stored, authentication stays as it was then
+ * @note The key is not stored, set it after every node_init(). The frame counter is kept in NVS, initialized by
+ *       node_init() or, with CONFIG_NODE_FAST_START, by the application: every 1024 frames a send stores the next
+ *       block and fails with the NVS error if that fails, the frame is not sent. Frames sealed by the application
+ *       already are refused with ESP_ERR_INVALID_ARG.
+ */
+esp_err_t node_set_auth_key(const uint8_t *key);
+
+/**
+ * @brief Get a key of this node from the gateway, CONFIG_NODE_ENCRYPT
+ * @param gateway_addr Gateway to pair with, NULL for whichever answers
+ * @param pair_key Pair key of PROTO_KEY_LEN bytes, proto_key_derive_pair() of the gateway's master key and this node's
+ *        MAC address, provisioned with the firmware
+ * @param xTicksToWait Timeout in FreeRTOS ticks
+ * @return ESP_OK, ESP_ERR_TIMEOUT if no gateway answered, pairing may not be open there or the pair key is wrong,
+ *         ESP_ERR_INVALID_ARG if pair_key is NULL, ESP_ERR_NOT_SUPPORTED without CONFIG_NODE_ENCRYPT
+ * @note The gateway answers while pairing is open, e.g. after POST /pair. The key is kept in RTC memory and, when the
+ *       application initialized it, NVS. Afterwards unicasts to that gateway are encrypted: the first one of each lease
+ *       is preceded by a handshake of two short frames, which moves the node to a new key after a rotation too.
+ *       A key stored in NVS keeps a handshake count there too, a handshake fails with the NVS error if it cannot
+ *       be stored.
+ */
+esp_err_t node_pair(const uint8_t *gateway_addr, const uint8_t *pair_key, TickType_t xTicksToWait);
+
+/**
+ * @brief Get key exchange statistics
+ * @param out Copy of the statistics
+ * @return ESP_OK, ESP_ERR_INVALID_ARG if out is NULL
+ */
+esp_err_t node_key_stats(node_key_stats_t *out);
+
+/**
+ * @brief Get the boot timeline of this cycle
+ * @param out Copy of the timeline
+ * @return ESP_OK, ESP_ERR_INVALID_ARG if out is NULL
+ */
+esp_err_t node_boot_timeline(node_boot_timeline_t *out);
+
+/**
+ * @brief Get the name of a boot step, e.g. "wifi_init"
+ */
+const char *node_boot_phase_name(node_boot_phase_t phase);
+
 #ifdef __cplusplus
 }
 #endif
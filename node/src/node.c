@@ -1,3 +1,7 @@
+#include <inttypes.h>
+#include <string.h>
+
+#include "esp_attr.h"
 #include "esp_check.h"
 #include "esp_err.h"
 #include "esp_event.h"
@@ -5,23 +9,205 @@
 #include "esp_mac.h"
 #include "esp_netif.h"
 #include "esp_now.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
+#include "nvs.h"
 #include "nvs_flash.h"
 
+#include "freertos/semphr.h"
+
+#include "proto_batch.h"
+#include "proto_beacon.h"
+#include "proto_frag.h"
+#include "proto_seq.h"
+#if CONFIG_NODE_AUTH
+#include "proto_auth.h"
+#endif
+#if CONFIG_NODE_ENCRYPT
+#include "esp_random.h"
+#include "proto_key.h"
+#endif
+
 #include "node.h"
 
 static const char *TAG = "NODE";
 static const uint8_t BROADCAST_MAC[ESP_NOW_ETH_ALEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
-static TaskHandle_t s_task_to_notify = NULL;
+#if CONFIG_NODE_TX_WINDOW
+#define NODE_TX_WINDOW CONFIG_NODE_TX_WINDOW
+#else
+#define NODE_TX_WINDOW 8
+#endif
+
+#if CONFIG_NODE_SEND_RETRIES
+#define NODE_SEND_RETRIES CONFIG_NODE_SEND_RETRIES
+#else
+#define NODE_SEND_RETRIES 0
+#endif
+
+#if CONFIG_NODE_SEQ
+#define NODE_SEQ_OVERHEAD PROTO_SEQ_HDR_LEN
+#else
+#define NODE_SEQ_OVERHEAD 0
+#endif
+
+#if CONFIG_NODE_AUTH
+#define NODE_AUTH_OVERHEAD PROTO_AUTH_OVERHEAD
+#define NODE_AUTH_RESERVE 1024 // counters reserved in NVS per write
+#else
+#define NODE_AUTH_OVERHEAD 0
+#endif
+
+#if CONFIG_NODE_ENCRYPT
+#define NODE_HELLO_RESERVE 64 // handshake counts reserved in NVS per write
+#endif
+
+#define NODE_STAMP_OVERHEAD (NODE_SEQ_OVERHEAD + NODE_AUTH_OVERHEAD) // added by queue_frame() to framed payloads
+
+#if CONFIG_NODE_SCAN_DWELL_MS
+#define NODE_SCAN_DWELL_MS CONFIG_NODE_SCAN_DWELL_MS
+#else
+#define NODE_SCAN_DWELL_MS 20
+#endif
+
+#if CONFIG_NODE_RESCAN_FAILURES
+#define NODE_RESCAN_FAILURES CONFIG_NODE_RESCAN_FAILURES
+#else
+#define NODE_RESCAN_FAILURES 3
+#endif
+
+#if CONFIG_NODE_SCAN_MAX_CHANNEL
+#define NODE_SCAN_MAX_CHANNEL CONFIG_NODE_SCAN_MAX_CHANNEL
+#else
+#define NODE_SCAN_MAX_CHANNEL 13
+#endif
+
+#if CONFIG_NODE_KEY_TIMEOUT_MS
+#define NODE_KEY_TIMEOUT_MS CONFIG_NODE_KEY_TIMEOUT_MS
+#else
+#define NODE_KEY_TIMEOUT_MS 50
+#endif
+
+#if CONFIG_NODE_KEY_RETRIES
+#define NODE_KEY_RETRIES CONFIG_NODE_KEY_RETRIES
+#else
+#define NODE_KEY_RETRIES 0
+#endif
+
+#define NVS_NAMESPACE "node"
+#define NVS_KEY_CHANNEL "channel"
+#define NVS_KEY_LMK "lmk"
+#define NVS_KEY_KEY_EPOCH "key_epoch"
+#define NVS_KEY_KEY_GATEWAY "key_gateway"
+#define NVS_KEY_AUTH_COUNTER "auth_counter"
+#define NVS_KEY_HELLO_COUNT "hello_count"
+
+#define PLACEHOLDER_PMK "pmk1234567890123" // Kconfig default, refused by the gateway too
+
+#define SEQ_NEW UINT32_MAX // queue_frame() assigns the next sequence number
+
+// Frames handed to ESP-NOW, its send callbacks fire in the same order.
+typedef struct {
+    node_ticket_t ticket;
+    node_completion_t done;
+} pending_t;
+
+static pending_t s_pending[NODE_TX_WINDOW];
+static uint32_t s_pending_head = 0; // consumed by send_cb only
+static uint32_t s_pending_tail = 0; // advanced under s_tx_lock only
+static node_ticket_t s_next_ticket = 0;
+// RTC_DATA_ATTR state is loaded on power-on and survives deep sleep, so a wake-up continues the previous cycle:
+// the gateway keeps its duplicate filter for this node between cycles too.
+static RTC_DATA_ATTR uint16_t s_next_seq = 0;
+
+static SemaphoreHandle_t s_tx_window = NULL; // free slots of s_pending
+static SemaphoreHandle_t s_tx_lock = NULL;   // keeps s_pending in esp_now_send order
+static SemaphoreHandle_t s_scan_lock = NULL; // recursive, held by node_scan() and around every frame handed over
+
+static RTC_DATA_ATTR uint16_t s_msg_id = 0;
+
+static portMUX_TYPE s_recv_lock = portMUX_INITIALIZER_UNLOCKED; // pairs s_recv_cb with s_recv_arg, guards s_recv_seq
+static node_recv_cb_t s_recv_cb = NULL;
+static void *s_recv_arg = NULL;
+static RTC_DATA_ATTR proto_seq_t s_recv_seq; // frames come from a single gateway
+
+static SemaphoreHandle_t s_reply = NULL; // given for every gateway frame, taken by node_poll()
+static RTC_DATA_ATTR uint8_t s_gateway[ESP_NOW_ETH_ALEN];
+static RTC_DATA_ATTR bool s_has_gateway = false;
+static RTC_DATA_ATTR node_cycle_stats_t s_cycle_stats;
+static RTC_DATA_ATTR uint8_t s_channel = 0;
+static RTC_DATA_ATTR uint32_t s_epoch = 0; // of the gateway, from its last beacon
+static RTC_DATA_ATTR node_scan_stats_t s_scan_stats;
+
+static bool s_auto_channel = false; // node_init() got channel 0, rescan after failures
+static uint32_t s_fail_streak = 0;  // consecutive unicast frames not acknowledged, and polls not answered
+static SemaphoreHandle_t s_beacon_sem = NULL; // given for every beacon, taken by node_scan()
+static proto_beacon_t s_beacon;               // last beacon, written by the WiFi task before s_beacon_sem
+
+#if CONFIG_NODE_AUTH
+static RTC_DATA_ATTR uint32_t s_auth_counter = 0; // of the last sealed frame
+static RTC_DATA_ATTR uint32_t s_auth_limit = 0;   // reserved in NVS up to here, 0 until the first key after power-on
+static proto_hmac_key_t s_auth_key;               // under s_tx_lock, like s_auth_on
+static bool s_auth_on = false;
+#endif
+
+#if CONFIG_NODE_ENCRYPT
+static RTC_DATA_ATTR uint8_t s_lmk[ESP_NOW_KEY_LEN];
+static RTC_DATA_ATTR uint8_t s_key_gateway[ESP_NOW_ETH_ALEN]; // the gateway s_lmk is shared with
+static RTC_DATA_ATTR uint32_t s_key_epoch = 0;
+static RTC_DATA_ATTR uint32_t s_hello_count = 0; // of the last HELLO, its answers echo it
+static RTC_DATA_ATTR uint32_t s_hello_limit = 0; // reserved in NVS up to here, 0 until the first HELLO after power-on
+static RTC_DATA_ATTR bool s_has_key = false;
+static RTC_DATA_ATTR bool s_key_stored = false; // s_lmk is in NVS, a power-on keeps it
+static RTC_DATA_ATTR node_key_stats_t s_key_stats;
+
+static int64_t s_session_until_us = 0;      // the esp_timer clock restarts on wake-up, so does the session
+static SemaphoreHandle_t s_key_lock = NULL; // one key exchange at a time, guards the key state
+static SemaphoreHandle_t s_key_sem = NULL;  // given for every key message of a gateway
+static proto_key_msg_t s_key_msg;           // last one, written by the WiFi task before s_key_sem
+static uint8_t s_key_src[ESP_NOW_ETH_ALEN];
+#endif
+
+static node_boot_timeline_t s_boot;
+static int64_t s_phase_start = 0;
+static bool s_first_tx = false; // first send callback seen
+
+static const char *const s_phase_names[NODE_BOOT_PHASES] = {
+    [NODE_BOOT_NVS] = "nvs",
+    [NODE_BOOT_NETIF] = "netif",
+    [NODE_BOOT_EVENT_LOOP] = "event_loop",
+    [NODE_BOOT_WIFI_INIT] = "wifi_init",
+    [NODE_BOOT_WIFI_START] = "wifi_start",
+    [NODE_BOOT_ESPNOW] = "espnow",
+    [NODE_BOOT_SCAN] = "scan",
+    [NODE_BOOT_FIRST_TX] = "first_tx",
+};
 
 #define TRY(expr) ESP_RETURN_ON_ERROR((expr), TAG, "%s:%d", __func__, __LINE__)
 
+// Closes the current boot step and starts the next one.
+static void phase_done(node_boot_phase_t phase) {
+    const int64_t now = esp_timer_get_time();
+    s_boot.phase_us[phase] = (uint32_t)(now - s_phase_start);
+    s_phase_start = now;
+}
+
 __attribute__((cold)) static esp_err_t wifi_init(uint8_t channel, const uint8_t *mac) {
+#if !CONFIG_NODE_FAST_START
     TRY(esp_netif_init());
+    phase_done(NODE_BOOT_NETIF);
     TRY(esp_event_loop_create_default());
-    const wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    phase_done(NODE_BOOT_EVENT_LOOP);
+#endif
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+#if CONFIG_NODE_FAST_START
+    cfg.nvs_enable = false; // storage is RAM anyway
+#endif
     TRY(esp_wifi_init(&cfg));
+    phase_done(NODE_BOOT_WIFI_INIT);
+
     TRY(esp_wifi_set_storage(WIFI_STORAGE_RAM));
     TRY(esp_wifi_set_mode(WIFI_MODE_STA));
     TRY(esp_wifi_start());
@@ -30,10 +216,12 @@ __attribute__((cold)) static esp_err_t wifi_init(uint8_t channel, const uint8_t
     if (mac != NULL) {
         TRY(esp_wifi_set_mac(WIFI_IF_STA, mac));
     }
+    phase_done(NODE_BOOT_WIFI_START);
 
     return ESP_OK;
 }
 
+#if !CONFIG_NODE_FAST_START || CONFIG_ESP_PHY_CALIBRATION_AND_DATA_STORAGE
 __attribute__((cold)) static esp_err_t nvs_init() {
     esp_err_t ret = nvs_flash_init();
     if (unlikely(ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)) {
@@ -43,21 +231,502 @@ __attribute__((cold)) static esp_err_t nvs_init() {
 
     return ret;
 }
+#endif
+
+static void complete(const node_completion_t *done, node_ticket_t ticket, node_send_status_t status) {
+    if (done->group != NULL) {
+        const EventBits_t bits = status == ESP_NOW_SEND_SUCCESS ? done->ok_bits : done->fail_bits;
+        if (bits != 0) {
+            if (xPortInIsrContext()) {
+                BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+                xEventGroupSetBitsFromISR(done->group, bits, &xHigherPriorityTaskWoken);
+                if (xHigherPriorityTaskWoken) {
+                    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+                }
+            } else {
+                xEventGroupSetBits(done->group, bits);
+            }
+        }
+    }
+
+    if (done->cb != NULL) {
+        done->cb(ticket, status, done->arg);
+    }
+}
+
+static void send_cb(const esp_now_send_info_t *tx_info, esp_now_send_status_t status) {
+    if (unlikely(!s_first_tx)) {
+        s_first_tx = true;
+        phase_done(NODE_BOOT_FIRST_TX);
+    }
+
+    // Broadcasts are never acknowledged, only unicasts tell whether the gateway is still on this channel.
+    if (tx_info != NULL && tx_info->des_addr != NULL && memcmp(tx_info->des_addr, BROADCAST_MAC, ESP_NOW_ETH_ALEN) != 0) {
+        if (status == ESP_NOW_SEND_SUCCESS) {
+            __atomic_store_n(&s_fail_streak, 0, __ATOMIC_RELAXED);
+        } else {
+            __atomic_add_fetch(&s_fail_streak, 1, __ATOMIC_RELAXED);
+        }
+    }
 
-static void send_cb(__attribute__((unused)) const esp_now_send_info_t *tx_info, esp_now_send_status_t status) {
-    TaskHandle_t to_notify = __atomic_load_n(&s_task_to_notify, __ATOMIC_SEQ_CST);
-    if (unlikely(to_notify == NULL)) {
+    const uint32_t head = s_pending_head;
+    if (unlikely(head == __atomic_load_n(&s_pending_tail, __ATOMIC_ACQUIRE))) {
         return;
     }
 
+    const pending_t pending = s_pending[head % NODE_TX_WINDOW];
+    __atomic_store_n(&s_pending_head, head + 1, __ATOMIC_RELEASE);
+
     if (xPortInIsrContext()) {
         BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-        xTaskNotifyFromISR(to_notify, status, eSetValueWithOverwrite, &xHigherPriorityTaskWoken);
+        xSemaphoreGiveFromISR(s_tx_window, &xHigherPriorityTaskWoken);
+        complete(&pending.done, pending.ticket, status);
         if (xHigherPriorityTaskWoken) {
             portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
         }
     } else {
-        xTaskNotify(to_notify, status, eSetValueWithOverwrite);
+        xSemaphoreGive(s_tx_window);
+        complete(&pending.done, pending.ticket, status);
+    }
+}
+
+// Forgets the numbers of an earlier gateway run, its new frames must not look like duplicates.
+static void recv_window_reset(void) {
+    portENTER_CRITICAL(&s_recv_lock);
+    memset(&s_recv_seq, 0, sizeof(s_recv_seq));
+    portEXIT_CRITICAL(&s_recv_lock);
+}
+
+static void on_beacon(const proto_frame_t *frame) {
+    proto_beacon_t beacon;
+    // Empty payloads are probes of other nodes.
+    if (proto_beacon_parse(frame->payload, frame->payload_len, &beacon) != PROTO_OK) {
+        return;
+    }
+
+    if (beacon.epoch != s_epoch && (!s_has_gateway || memcmp(beacon.mac_addr, s_gateway, ESP_NOW_ETH_ALEN) == 0)) {
+        // Our gateway restarted and numbers its frames anew. node_scan() does the same when it moves to another
+        // gateway.
+        recv_window_reset();
+        s_epoch = beacon.epoch;
+    }
+
+    s_beacon = beacon;
+    xSemaphoreGive(s_beacon_sem);
+}
+
+#if CONFIG_NODE_ENCRYPT
+// Pairing responses are broadcast, the answers to a handshake are sent to this node, the rest comes from other nodes.
+static void on_key(const uint8_t *src_addr, const proto_frame_t *frame, bool broadcast) {
+    proto_key_msg_t msg;
+    if (proto_key_parse(frame->payload, frame->payload_len, &msg) != PROTO_OK ||
+        (broadcast ? msg.type != PROTO_KEY_PAIR_RESP : msg.type != PROTO_KEY_READY && msg.type != PROTO_KEY_REKEY)) {
+        return;
+    }
+
+    s_key_msg = msg;
+    memcpy(s_key_src, src_addr, ESP_NOW_ETH_ALEN);
+    xSemaphoreGive(s_key_sem);
+}
+#endif
+
+static void recv_cb(const esp_now_recv_info_t *recv_info, const uint8_t *data, int len) {
+    if (unlikely(recv_info == NULL || data == NULL || len <= 0)) {
+        return;
+    }
+
+    if (memcmp(recv_info->des_addr, BROADCAST_MAC, ESP_NOW_ETH_ALEN) == 0) {
+        // Of broadcasts only gateway beacons and pairing responses are of interest, the rest comes from other nodes.
+        proto_frame_t frame;
+        if (len > PROTO_HDR_LEN && data[0] == PROTO_MAGIC && (data[1] & (PROTO_FLAG_BEACON | PROTO_FLAG_EXT)) &&
+            proto_parse(data, (size_t)len, &frame) == PROTO_OK) {
+            if (frame.flags & PROTO_FLAG_BEACON) {
+                on_beacon(&frame);
+#if CONFIG_NODE_ENCRYPT
+            } else if (frame.flags2 & PROTO_FLAG2_KEY) {
+                on_key(recv_info->src_addr, &frame, true);
+#endif
+            }
+        }
+        return;
+    }
+
+    portENTER_CRITICAL(&s_recv_lock);
+    const node_recv_cb_t cb = s_recv_cb;
+    void *const arg = s_recv_arg;
+    portEXIT_CRITICAL(&s_recv_lock);
+
+    proto_frame_t frame;
+    const proto_err_t err = proto_parse(data, (size_t)len, &frame);
+    // Raw payload, or framing this node does not understand: deliver as is.
+    if (err == PROTO_ERR_NOT_FRAMED ||
+        (err == PROTO_OK &&
+         ((frame.flags & ~PROTO_FLAGS_KNOWN) != 0 || (frame.flags2 & ~PROTO_FLAGS2_KNOWN) != 0))) {
+        if (cb != NULL) {
+            cb(recv_info->src_addr, data, (size_t)len, arg);
+        }
+        return;
+    }
+    if (err == PROTO_OK && (frame.flags2 & PROTO_FLAG2_KEY)) {
+#if CONFIG_NODE_ENCRYPT
+        on_key(recv_info->src_addr, &frame, false);
+#endif
+        return; // key exchange, nothing for the application
+    }
+    if (unlikely(err != PROTO_OK || (frame.flags & PROTO_FLAG_FRAG))) {
+        ESP_LOGD(TAG, "frame from " MACSTR " dropped", MAC2STR(recv_info->src_addr));
+        return;
+    }
+
+    // The gateway resends an unacknowledged frame with the same number, the first copy may have arrived.
+    bool duplicate = false;
+    if (frame.flags & PROTO_FLAG_SEQ) {
+        portENTER_CRITICAL(&s_recv_lock);
+        duplicate = proto_seq_check(&s_recv_seq, frame.seq) == PROTO_ERR_DUPLICATE;
+        portEXIT_CRITICAL(&s_recv_lock);
+    }
+
+    if (cb != NULL && !duplicate && !(frame.flags & PROTO_FLAG_BATCH)) {
+        cb(recv_info->src_addr, frame.payload, frame.payload_len, arg);
+    } else if (cb != NULL && !duplicate) {
+        proto_batch_reader_t r;
+        proto_batch_reader_init(&r, frame.payload, frame.payload_len);
+        const uint8_t *msg;
+        size_t msg_len;
+        while (proto_batch_next(&r, &msg, &msg_len) == PROTO_OK) {
+            cb(recv_info->src_addr, msg, msg_len, arg);
+        }
+    }
+
+    // Only the gateway sends batches, a copy answers a poll as well.
+    if (frame.flags & PROTO_FLAG_BATCH) {
+        memcpy(s_gateway, recv_info->src_addr, ESP_NOW_ETH_ALEN);
+        s_has_gateway = true;
+        xSemaphoreGive(s_reply);
+    }
+}
+
+esp_err_t node_set_recv_cb(node_recv_cb_t cb, void *arg) {
+    portENTER_CRITICAL(&s_recv_lock);
+    s_recv_cb = cb;
+    s_recv_arg = arg;
+    portEXIT_CRITICAL(&s_recv_lock);
+
+    return ESP_OK;
+}
+
+#if CONFIG_NODE_ENCRYPT
+static esp_err_t session_ensure(const uint8_t *peer_addr, TickType_t xTicksToWait);
+#endif
+
+#if CONFIG_NODE_AUTH
+// Counters are reserved in NVS a block at a time: a power loss skips the rest of the block but never reuses one. No
+// counter is used beyond what NVS holds, after a power-on the gateway would take the frames for replays.
+static esp_err_t auth_reserve(void) {
+    const uint32_t limit = s_auth_counter + NODE_AUTH_RESERVE;
+
+    nvs_handle_t nvs;
+    ESP_RETURN_ON_ERROR(nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs), TAG, "auth counter: nvs_open");
+    esp_err_t err = nvs_set_u32(nvs, NVS_KEY_AUTH_COUNTER, limit);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+
+    if (unlikely(err != ESP_OK)) {
+        ESP_LOGE(TAG, "auth counter not reserved: %s", esp_err_to_name(err));
+        return err;
+    }
+    s_auth_limit = limit;
+    return ESP_OK;
+}
+
+static uint32_t auth_load(void) {
+    nvs_handle_t nvs;
+    uint32_t counter = 0;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        nvs_get_u32(nvs, NVS_KEY_AUTH_COUNTER, &counter);
+        nvs_close(nvs);
+    }
+
+    return counter;
+}
+#endif
+
+// Stamps, seals and sends one frame, see queue_frame(). Called with s_scan_lock held.
+static esp_err_t hand_over(const uint8_t *peer_addr, const uint8_t *data, size_t len, const node_completion_t *done,
+                           node_ticket_t *out_ticket, TickType_t xTicksToWait, uint32_t *seq) {
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+
+    if (xSemaphoreTake(s_tx_window, xTicksToWait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    if (xSemaphoreTake(s_tx_lock, portMAX_DELAY) != pdTRUE) {
+        xSemaphoreGive(s_tx_window);
+        return ESP_FAIL;
+    }
+
+#if CONFIG_NODE_SEQ
+    uint8_t stamped[ESP_NOW_MAX_DATA_LEN];
+    size_t stamped_len;
+    const uint16_t stamp = *seq == SEQ_NEW ? s_next_seq : (uint16_t)*seq;
+    const proto_err_t perr = proto_stamp_seq(data, len, stamp, stamped, sizeof(stamped), &stamped_len);
+    if (unlikely(perr == PROTO_ERR_TOO_LARGE)) {
+        xSemaphoreGive(s_tx_lock);
+        xSemaphoreGive(s_tx_window);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    // Frames the application stamped itself, or malformed ones, go out unchanged.
+    if (perr == PROTO_OK) {
+        data = stamped;
+        len = stamped_len;
+    }
+#endif
+
+#if CONFIG_NODE_AUTH
+    // Sealed last, the tag covers the sequence number too.
+    uint8_t sealed[ESP_NOW_MAX_DATA_LEN];
+    if (s_auth_on) {
+        const esp_err_t rerr = s_auth_counter >= s_auth_limit ? auth_reserve() : ESP_OK;
+        if (unlikely(rerr != ESP_OK)) {
+            xSemaphoreGive(s_tx_lock);
+            xSemaphoreGive(s_tx_window);
+            return rerr;
+        }
+        size_t sealed_len;
+        const proto_err_t aerr =
+            proto_auth_seal(&s_auth_key, s_auth_counter + 1, data, len, sealed, sizeof(sealed), &sealed_len);
+        if (unlikely(aerr != PROTO_OK)) {
+            xSemaphoreGive(s_tx_lock);
+            xSemaphoreGive(s_tx_window);
+            return aerr == PROTO_ERR_TOO_LARGE ? ESP_ERR_INVALID_SIZE : ESP_ERR_INVALID_ARG;
+        }
+        data = sealed;
+        len = sealed_len;
+    }
+#endif
+
+    // The entry is published before esp_now_send() because the callback may fire before it returns.
+    const uint32_t tail = s_pending_tail;
+    const node_ticket_t ticket = s_next_ticket;
+    pending_t *pending = &s_pending[tail % NODE_TX_WINDOW];
+    pending->ticket = ticket;
+    pending->done = done != NULL ? *done : (node_completion_t){0};
+    __atomic_store_n(&s_pending_tail, tail + 1, __ATOMIC_RELEASE);
+
+    esp_err_t err;
+    // ESP-NOW has its own TX queue, give it a tick to drain while the deadline allows.
+    while ((err = esp_now_send(peer_addr, data, len)) == ESP_ERR_ESPNOW_NO_MEM &&
+           xTaskCheckForTimeOut(&timeout, &xTicksToWait) == pdFALSE) {
+        vTaskDelay(1);
+    }
+
+    if (unlikely(err != ESP_OK)) {
+        // No callback will fire for this frame, and the lock keeps the entry last in the ring.
+        __atomic_store_n(&s_pending_tail, tail, __ATOMIC_RELEASE);
+        xSemaphoreGive(s_tx_lock);
+        xSemaphoreGive(s_tx_window);
+        return err == ESP_ERR_ESPNOW_NO_MEM ? ESP_ERR_TIMEOUT : err;
+    }
+
+    s_next_ticket++;
+#if CONFIG_NODE_SEQ
+    if (*seq == SEQ_NEW && perr == PROTO_OK) {
+        *seq = s_next_seq++;
+    }
+#else
+    (void)seq;
+#endif
+#if CONFIG_NODE_AUTH
+    if (s_auth_on) {
+        s_auth_counter++;
+    }
+#endif
+    xSemaphoreGive(s_tx_lock);
+
+    if (out_ticket != NULL) {
+        *out_ticket = ticket;
+    }
+
+    return ESP_OK;
+}
+
+// Hands one frame to ESP-NOW. With CONFIG_NODE_SEQ, *seq is stamped into it; SEQ_NEW takes the next number and
+// stores it back, so a retry can resend the same number.
+static esp_err_t queue_frame(const uint8_t *peer_addr, const uint8_t *data, size_t len, const node_completion_t *done,
+                             node_ticket_t *out_ticket, TickType_t xTicksToWait, uint32_t *seq) {
+    if (unlikely(s_tx_window == NULL)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+
+#if CONFIG_NODE_ENCRYPT
+    // The first unicast of a lease waits for the handshake, which counts against the deadline.
+    const esp_err_t serr = session_ensure(peer_addr, xTicksToWait);
+    if (unlikely(serr != ESP_OK)) {
+        return serr;
+    }
+    if (xTaskCheckForTimeOut(&timeout, &xTicksToWait) == pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+#endif
+
+    // A scan moves the radio from channel to channel, frames of other tasks wait until it is done. Taken after the
+    // handshake, which holds s_key_lock and sends through here too.
+    if (xSemaphoreTakeRecursive(s_scan_lock, xTicksToWait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    esp_err_t err = ESP_ERR_TIMEOUT;
+    if (xTaskCheckForTimeOut(&timeout, &xTicksToWait) == pdFALSE) {
+        err = hand_over(peer_addr, data, len, done, out_ticket, xTicksToWait, seq);
+    }
+    xSemaphoreGiveRecursive(s_scan_lock);
+
+    return err;
+}
+
+esp_err_t node_send_async(const uint8_t *peer_addr, const uint8_t *data, size_t len, const node_completion_t *done,
+                          node_ticket_t *out_ticket, TickType_t xTicksToWait) {
+    if (unlikely(peer_addr == NULL || data == NULL || len == 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint32_t seq = SEQ_NEW;
+    return queue_frame(peer_addr, data, len, done, out_ticket, xTicksToWait, &seq);
+}
+
+// Blocking sends wait on a context from a static pool, which returns to the pool with its last reference, so late
+// callbacks stay safe after the sender gives up. A context given up holds at least one frame of the window.
+#define SEND_WAITERS (NODE_TX_WINDOW + 4) // plus tasks waiting in a blocking send at the same time
+
+typedef struct {
+    TaskHandle_t task;
+    uint32_t refs;    // sender plus one per frame in flight, 0 when free
+    uint32_t pending; // frames not completed yet
+    uint32_t failed;
+} send_wait_t;
+
+static send_wait_t s_waiters[SEND_WAITERS];
+
+static send_wait_t *send_wait_new(void) {
+    for (size_t i = 0; i < SEND_WAITERS; i++) {
+        send_wait_t *w = &s_waiters[i];
+        uint32_t free_refs = 0;
+        if (__atomic_compare_exchange_n(&w->refs, &free_refs, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            w->pending = 0;
+            w->failed = 0;
+            __atomic_store_n(&w->task, xTaskGetCurrentTaskHandle(), __ATOMIC_RELEASE);
+            return w;
+        }
+    }
+
+    return NULL;
+}
+
+static void send_wait_unref(send_wait_t *w) {
+    __atomic_sub_fetch(&w->refs, 1, __ATOMIC_ACQ_REL);
+}
+
+static void send_wait_done(__attribute__((unused)) node_ticket_t ticket, node_send_status_t status, void *arg) {
+    send_wait_t *w = arg;
+    if (status != ESP_NOW_SEND_SUCCESS) {
+        __atomic_add_fetch(&w->failed, 1, __ATOMIC_RELAXED);
+    }
+
+    TaskHandle_t task = __atomic_load_n(&w->task, __ATOMIC_ACQUIRE);
+    __atomic_sub_fetch(&w->pending, 1, __ATOMIC_ACQ_REL);
+    if (task != NULL) {
+        if (xPortInIsrContext()) {
+            vTaskNotifyGiveFromISR(task, NULL);
+        } else {
+            xTaskNotifyGive(task);
+        }
+    }
+
+    send_wait_unref(w);
+}
+
+static esp_err_t send_wait_frame(send_wait_t *w, const uint8_t *peer_addr, const uint8_t *data, size_t len,
+                                 TickType_t xTicksToWait, uint32_t *seq) {
+    const node_completion_t done = {.cb = send_wait_done, .arg = w};
+
+    __atomic_add_fetch(&w->refs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&w->pending, 1, __ATOMIC_RELAXED);
+
+    const esp_err_t err = queue_frame(peer_addr, data, len, &done, NULL, xTicksToWait, seq);
+    if (unlikely(err != ESP_OK)) {
+        __atomic_sub_fetch(&w->pending, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&w->refs, 1, __ATOMIC_RELAXED);
+    }
+
+    return err;
+}
+
+// Waits for the frames of @p w until the deadline the caller started, *remaining is updated.
+static esp_err_t send_wait_finish(send_wait_t *w, esp_err_t err, node_send_status_t *out_status, TimeOut_t *timeout,
+                                  TickType_t *remaining) {
+    while (__atomic_load_n(&w->pending, __ATOMIC_ACQUIRE) > 0) {
+        if (xTaskCheckForTimeOut(timeout, remaining) == pdTRUE) {
+            err = err == ESP_OK ? ESP_ERR_TIMEOUT : err;
+            break;
+        }
+        ulTaskNotifyTake(pdTRUE, *remaining);
+    }
+
+    if (out_status != NULL) {
+        *out_status = __atomic_load_n(&w->failed, __ATOMIC_RELAXED) == 0 ? ESP_NOW_SEND_SUCCESS : ESP_NOW_SEND_FAIL;
+    }
+
+    __atomic_store_n(&w->task, NULL, __ATOMIC_RELEASE);
+    send_wait_unref(w);
+
+    return err;
+}
+
+static esp_err_t send_blocking(const uint8_t *peer_addr, const uint8_t *data, size_t len,
+                               node_send_status_t *out_status, TickType_t xTicksToWait) {
+    uint32_t seq = SEQ_NEW;
+    node_send_status_t status = ESP_NOW_SEND_FAIL;
+    esp_err_t err = ESP_OK;
+
+    // One deadline for all attempts, each wait gets what is left of it.
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+
+    for (int attempt = 0; attempt <= NODE_SEND_RETRIES; attempt++) {
+        if (attempt > 0 && xTaskCheckForTimeOut(&timeout, &xTicksToWait) == pdTRUE) {
+            err = ESP_ERR_TIMEOUT;
+            break;
+        }
+
+        send_wait_t *w = send_wait_new();
+        if (unlikely(w == NULL)) {
+            return ESP_ERR_NO_MEM;
+        }
+
+        err = send_wait_frame(w, peer_addr, data, len, xTicksToWait, &seq);
+        err = send_wait_finish(w, err, &status, &timeout, &xTicksToWait);
+        if (err != ESP_OK || status == ESP_NOW_SEND_SUCCESS) {
+            break;
+        }
+    }
+
+    if (out_status != NULL) {
+        *out_status = status;
+    }
+
+    return err;
+}
+
+// Searches the gateway again once it stopped answering on the cached channel.
+static void rescan_if_lost(void) {
+    if (s_auto_channel && __atomic_load_n(&s_fail_streak, __ATOMIC_RELAXED) >= NODE_RESCAN_FAILURES) {
+        ESP_LOGI(TAG, "gateway lost on channel %u, scanning", s_channel);
+        node_scan(NULL);
     }
 }
 
@@ -67,44 +736,756 @@ esp_err_t node_send(const uint8_t *peer_addr, const uint8_t *data, size_t len, e
         return ESP_ERR_INVALID_ARG;
     }
 
-    __atomic_store_n(&s_task_to_notify, xTaskGetCurrentTaskHandle(), __ATOMIC_SEQ_CST);
+    rescan_if_lost();
+    return send_blocking(peer_addr, data, len, out_status, xTicksToWait);
+}
 
-    const esp_err_t err = esp_now_send(peer_addr, data, len);
+esp_err_t node_broadcast(const uint8_t *data, size_t len, node_send_status_t *out_status, TickType_t xTicksToWait) {
+    return node_send(BROADCAST_MAC, data, len, out_status, xTicksToWait);
+}
+
+esp_err_t node_send_large(const uint8_t *peer_addr, const uint8_t *data, size_t len, node_send_status_t *out_status,
+                          TickType_t xTicksToWait) {
+    if (unlikely(peer_addr == NULL || data == NULL || len == 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    proto_fragmenter_t frag;
+    const uint16_t msg_id = __atomic_fetch_add(&s_msg_id, 1, __ATOMIC_RELAXED);
+    if (unlikely(proto_frag_begin(&frag, msg_id, data, len, ESP_NOW_MAX_DATA_LEN - NODE_STAMP_OVERHEAD) != PROTO_OK)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    send_wait_t *w = send_wait_new();
+    if (unlikely(w == NULL)) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint8_t frame[ESP_NOW_MAX_DATA_LEN];
+    esp_err_t err = ESP_OK;
+    size_t frame_len;
+
+    // The deadline covers the whole message, each fragment waits for a window slot with what is left of it.
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+
+    while (err == ESP_OK && (frame_len = proto_frag_next(&frag, frame)) > 0) {
+        uint32_t seq = SEQ_NEW;
+        err = xTaskCheckForTimeOut(&timeout, &xTicksToWait) == pdTRUE
+                  ? ESP_ERR_TIMEOUT
+                  : send_wait_frame(w, peer_addr, frame, frame_len, xTicksToWait, &seq);
+    }
+
+    return send_wait_finish(w, err, out_status, &timeout, &xTicksToWait);
+}
+
+// Unicast needs the destination in the ESP-NOW peer table.
+static esp_err_t peer_ensure(const uint8_t *peer_addr) {
+    if (esp_now_is_peer_exist(peer_addr)) {
+        return ESP_OK;
+    }
+
+    // Channel 0 follows the home channel, which changes when the gateway moved.
+    esp_now_peer_info_t peer = {.channel = 0, .ifidx = ESP_IF_WIFI_STA, .encrypt = false};
+    memcpy(peer.peer_addr, peer_addr, ESP_NOW_ETH_ALEN);
+
+    const esp_err_t err = esp_now_add_peer(&peer);
+    return err == ESP_ERR_ESPNOW_EXIST ? ESP_OK : err;
+}
+
+#if CONFIG_NODE_ENCRYPT
+// Registers the paired gateway as encrypted peer with the current key.
+static esp_err_t key_peer_apply(void) {
+    esp_now_peer_info_t peer = {.channel = 0, .ifidx = ESP_IF_WIFI_STA, .encrypt = true};
+    memcpy(peer.peer_addr, s_key_gateway, ESP_NOW_ETH_ALEN);
+    memcpy(peer.lmk, s_lmk, ESP_NOW_KEY_LEN);
+
+    return esp_now_is_peer_exist(s_key_gateway) ? esp_now_mod_peer(&peer) : esp_now_add_peer(&peer);
+}
+
+// Keeps the key for the next power-on, NVS is left alone when the application did not initialize it.
+static void key_store(void) {
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+
+    if (nvs_set_blob(nvs, NVS_KEY_LMK, s_lmk, sizeof(s_lmk)) == ESP_OK &&
+        nvs_set_blob(nvs, NVS_KEY_KEY_GATEWAY, s_key_gateway, sizeof(s_key_gateway)) == ESP_OK &&
+        nvs_set_u32(nvs, NVS_KEY_KEY_EPOCH, s_key_epoch) == ESP_OK && nvs_commit(nvs) == ESP_OK) {
+        s_key_stored = true;
+    }
+    nvs_close(nvs);
+}
+
+static bool key_load(void) {
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+
+    size_t lmk_len = sizeof(s_lmk);
+    size_t gateway_len = sizeof(s_key_gateway);
+    s_has_key = nvs_get_blob(nvs, NVS_KEY_LMK, s_lmk, &lmk_len) == ESP_OK && lmk_len == sizeof(s_lmk) &&
+                nvs_get_blob(nvs, NVS_KEY_KEY_GATEWAY, s_key_gateway, &gateway_len) == ESP_OK &&
+                gateway_len == sizeof(s_key_gateway) && nvs_get_u32(nvs, NVS_KEY_KEY_EPOCH, &s_key_epoch) == ESP_OK;
+    s_key_stored = s_has_key;
+    nvs_close(nvs);
+
+    return s_has_key;
+}
+
+// Takes the count of the next HELLO, the gateway refuses every count it has seen. A key kept in NVS outlives RTC
+// memory, so does its count: counts are reserved a block at a time like auth counters. A key only held in RTC memory
+// is paired again after a power-on, which lets the count start over on the gateway too.
+static esp_err_t hello_count_next(uint32_t *out) {
+    if (s_key_stored && s_hello_count >= s_hello_limit) {
+        nvs_handle_t nvs;
+        ESP_RETURN_ON_ERROR(nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs), TAG, "hello count: nvs_open");
+        if (s_hello_limit == 0) {
+            // Power-on: continue above every count an earlier run may have used.
+            uint32_t stored = 0;
+            nvs_get_u32(nvs, NVS_KEY_HELLO_COUNT, &stored);
+            s_hello_count = stored > s_hello_count ? stored : s_hello_count;
+        }
+        const uint32_t limit = s_hello_count + NODE_HELLO_RESERVE;
+        esp_err_t err = nvs_set_u32(nvs, NVS_KEY_HELLO_COUNT, limit);
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+
+        if (unlikely(err != ESP_OK)) {
+            ESP_LOGE(TAG, "hello count not reserved: %s", esp_err_to_name(err));
+            return err;
+        }
+        s_hello_limit = limit;
+    }
+
+    *out = ++s_hello_count;
+    return ESP_OK;
+}
+
+// Waits for the next answer of a gateway to req: the pairing response with its nonce, or READY or REKEY with the count
+// of the HELLO. The caller checks the tag.
+static bool key_wait(const uint8_t *src_addr, const proto_key_msg_t *req, TickType_t wait, proto_key_msg_t *out,
+                     uint8_t *out_src) {
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+
+    while (xTaskCheckForTimeOut(&timeout, &wait) == pdFALSE && xSemaphoreTake(s_key_sem, wait) == pdTRUE) {
+        const proto_key_msg_t msg = s_key_msg;
+        uint8_t src[ESP_NOW_ETH_ALEN];
+        memcpy(src, s_key_src, ESP_NOW_ETH_ALEN);
+
+        const bool pairing = req->type == PROTO_KEY_PAIR_REQ;
+        if ((src_addr != NULL && memcmp(src, src_addr, ESP_NOW_ETH_ALEN) != 0) ||
+            pairing != (msg.type == PROTO_KEY_PAIR_RESP) ||
+            (pairing ? memcmp(msg.nonce, req->nonce, PROTO_KEY_NONCE_LEN) != 0 : msg.count != req->count)) {
+            continue;
+        }
+
+        *out = msg;
+        if (out_src != NULL) {
+            memcpy(out_src, src, ESP_NOW_ETH_ALEN);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+static TickType_t key_attempt_ticks(TickType_t left) {
+    const TickType_t attempt = pdMS_TO_TICKS(NODE_KEY_TIMEOUT_MS);
+    return attempt < left ? attempt : left;
+}
+
+// Announces the epoch of the key, the gateway answers under that key: READY with the lease, or REKEY with the key of
+// its current epoch wrapped under the old one, then the node says hello again. An answer that does not check out under
+// the key counts as none. Called with s_key_lock held.
+static esp_err_t handshake(TickType_t xTicksToWait) {
+    const int64_t start = esp_timer_get_time();
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+
+    uint8_t mac[ESP_NOW_ETH_ALEN];
+    TRY(esp_wifi_get_mac(WIFI_IF_STA, mac));
+
+    int attempt = 0;
+    int rekeys = 0;
+    // Only unanswered handshakes use up attempts.
+    while (attempt <= NODE_KEY_RETRIES && rekeys < 2 && xTaskCheckForTimeOut(&timeout, &xTicksToWait) == pdFALSE) {
+        // Signed with the key it announces, the gateway opens no session for a node without it. The count makes
+        // each hello good for one handshake only.
+        proto_key_msg_t hello = {.type = PROTO_KEY_HELLO, .epoch = s_key_epoch};
+        TRY(hello_count_next(&hello.count));
+        proto_hmac_key_t key;
+        proto_hmac_key_init(&key, s_lmk, sizeof(s_lmk));
+        proto_key_sign(&key, mac, &hello);
+        uint8_t frame[PROTO_KEY_MAX_LEN];
+        const size_t len = proto_key_write(frame, sizeof(frame), &hello);
+
+        xSemaphoreTake(s_key_sem, 0);
+        uint32_t seq = SEQ_NEW;
+        const esp_err_t err = queue_frame(BROADCAST_MAC, frame, len, NULL, NULL, xTicksToWait, &seq);
+        if (unlikely(err != ESP_OK)) {
+            return err;
+        }
+
+        proto_key_msg_t msg;
+        if (!key_wait(s_key_gateway, &hello, key_attempt_ticks(xTicksToWait), &msg, NULL)) {
+            attempt++;
+            continue;
+        }
+
+        uint8_t next[PROTO_KEY_LEN];
+        if (msg.type == PROTO_KEY_READY ? proto_key_verify(&key, mac, &msg) != PROTO_OK
+                                        : proto_key_unwrap(&key, mac, &msg, next) != PROTO_OK) {
+            s_key_stats.forged++;
+            attempt++;
+            continue;
+        }
+
+        if (msg.type == PROTO_KEY_READY && msg.epoch == s_key_epoch) {
+            // The gateway started the lease when the hello arrived, end it early to stay inside.
+            s_session_until_us = esp_timer_get_time() + (int64_t)msg.lease_s * 1000000 * 7 / 8;
+
+            const int64_t elapsed = esp_timer_get_time() - start;
+            s_key_stats.handshakes++;
+            s_key_stats.last_handshake_us = (uint32_t)elapsed;
+            s_key_stats.total_handshake_us += (uint64_t)elapsed;
+            return ESP_OK;
+        }
+        if (msg.type == PROTO_KEY_REKEY && msg.epoch > s_key_epoch) {
+            memcpy(s_lmk, next, ESP_NOW_KEY_LEN);
+            s_key_epoch = msg.epoch;
+            TRY(key_peer_apply());
+            key_store();
+            s_key_stats.rekeys++;
+            rekeys++;
+            ESP_LOGI(TAG, "key epoch %" PRIu32, s_key_epoch);
+        }
+    }
+
+    s_key_stats.failures++;
+    ESP_LOGW(TAG, "no handshake with " MACSTR, MAC2STR(s_key_gateway));
+    return ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t session_ensure(const uint8_t *peer_addr, TickType_t xTicksToWait) {
+    if (!s_has_key || memcmp(peer_addr, s_key_gateway, ESP_NOW_ETH_ALEN) != 0) {
+        return ESP_OK;
+    }
+
+    if (xSemaphoreTake(s_key_lock, xTicksToWait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    const esp_err_t err = esp_timer_get_time() < s_session_until_us ? ESP_OK : handshake(xTicksToWait);
+    xSemaphoreGive(s_key_lock);
+
+    return err;
+}
+#endif
+
+esp_err_t node_set_auth_key(const uint8_t *key) {
+#if CONFIG_NODE_AUTH
+    if (unlikely(s_tx_lock == NULL)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(s_tx_lock, portMAX_DELAY);
+    if (key != NULL && s_auth_limit == 0) {
+        // Power-on: continue above every counter an earlier run may have used.
+        s_auth_counter = auth_load();
+        err = auth_reserve();
+    }
+    if (err == ESP_OK) {
+        if (key != NULL) {
+            proto_hmac_key_init(&s_auth_key, key, PROTO_AUTH_KEY_LEN);
+        }
+        s_auth_on = key != NULL;
+    }
+    xSemaphoreGive(s_tx_lock);
+
+    return err;
+#else
+    (void)key;
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t node_pair(const uint8_t *gateway_addr, const uint8_t *pair_key, TickType_t xTicksToWait) {
+#if CONFIG_NODE_ENCRYPT
+    if (unlikely(pair_key == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (unlikely(s_key_lock == NULL)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // The gateway binds the key to the address it received the request from.
+    uint8_t mac[ESP_NOW_ETH_ALEN];
+    TRY(esp_wifi_get_mac(WIFI_IF_STA, mac));
+
+    proto_hmac_key_t pair;
+    proto_hmac_key_init(&pair, pair_key, PROTO_KEY_LEN);
+    proto_key_msg_t req = {.type = PROTO_KEY_PAIR_REQ};
+    esp_fill_random(req.nonce, sizeof(req.nonce));
+    proto_key_sign(&pair, mac, &req);
+    uint8_t frame[PROTO_KEY_MAX_LEN];
+    const size_t len = proto_key_write(frame, sizeof(frame), &req);
+
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+    if (xSemaphoreTake(s_key_lock, xTicksToWait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t err = ESP_ERR_TIMEOUT;
+    for (int attempt = 0; attempt <= NODE_KEY_RETRIES && xTaskCheckForTimeOut(&timeout, &xTicksToWait) == pdFALSE;
+         attempt++) {
+        xSemaphoreTake(s_key_sem, 0);
+        uint32_t seq = SEQ_NEW;
+        err = queue_frame(BROADCAST_MAC, frame, len, NULL, NULL, xTicksToWait, &seq);
+        if (unlikely(err != ESP_OK)) {
+            break;
+        }
+
+        err = ESP_ERR_TIMEOUT;
+        proto_key_msg_t resp;
+        uint8_t src[ESP_NOW_ETH_ALEN];
+        uint8_t lmk[PROTO_KEY_LEN];
+        if (!key_wait(gateway_addr, &req, key_attempt_ticks(xTicksToWait), &resp, src) ||
+            proto_key_unwrap(&pair, mac, &resp, lmk) != PROTO_OK) {
+            continue;
+        }
+
+        memcpy(s_lmk, lmk, ESP_NOW_KEY_LEN);
+        memcpy(s_key_gateway, src, ESP_NOW_ETH_ALEN);
+        s_key_epoch = resp.epoch;
+        s_has_key = true;
+        s_session_until_us = 0;
+        err = key_peer_apply();
+        if (err == ESP_OK) {
+            key_store();
+            s_key_stats.pairings++;
+            ESP_LOGI(TAG, "paired with " MACSTR ", key epoch %" PRIu32, MAC2STR(src), s_key_epoch);
+        }
+        break;
+    }
+    if (err == ESP_ERR_TIMEOUT) {
+        s_key_stats.failures++;
+    }
+    xSemaphoreGive(s_key_lock);
+
+    return err;
+#else
+    (void)gateway_addr;
+    (void)pair_key;
+    (void)xTicksToWait;
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t node_key_stats(node_key_stats_t *out) {
+    if (unlikely(out == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+#if CONFIG_NODE_ENCRYPT
+    *out = s_key_stats;
+    out->epoch = s_has_key ? s_key_epoch : 0;
+#else
+    memset(out, 0, sizeof(*out));
+#endif
+    return ESP_OK;
+}
+
+esp_err_t node_batch_init(node_batch_t *b, const uint8_t *peer_addr, uint8_t flags, TickType_t max_age) {
+    if (unlikely(b == NULL || peer_addr == NULL || (flags & ~(PROTO_FLAG_TLV | PROTO_FLAG_DELTA)) != 0 ||
+                 flags == PROTO_FLAG_DELTA)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (memcmp(peer_addr, BROADCAST_MAC, ESP_NOW_ETH_ALEN) != 0) {
+        TRY(peer_ensure(peer_addr));
+    }
+
+    memset(b, 0, sizeof(*b));
+    memcpy(b->peer_addr, peer_addr, ESP_NOW_ETH_ALEN);
+    b->len = proto_write_hdr(b->frame, PROTO_FLAG_BATCH | flags);
+    b->cap = ESP_NOW_MAX_DATA_LEN - NODE_STAMP_OVERHEAD;
+    b->max_age = max_age;
+    proto_delta_ref_init(&b->ref);
+
+    return ESP_OK;
+}
+
+esp_err_t node_batch_flush(node_batch_t *b, TickType_t xTicksToWait) {
+    if (b->records == 0) {
+        return ESP_OK;
+    }
+
+    // ESP-NOW copies the frame before node_send_async() returns, so the buffer is free right away.
+    const esp_err_t err = node_send_async(b->peer_addr, b->frame, b->len, NULL, NULL, xTicksToWait);
     if (unlikely(err != ESP_OK)) {
         return err;
     }
 
-    const BaseType_t xResult = xTaskNotifyWait(pdFALSE, ULONG_MAX, (uint32_t *)out_status, xTicksToWait);
+    b->frames++;
+    b->sent_records += (uint32_t)b->records;
+    b->len = PROTO_HDR_LEN;
+    b->records = 0;
+    proto_delta_ref_init(&b->ref);
 
-    if (unlikely(xResult != pdPASS)) {
+    return ESP_OK;
+}
+
+TickType_t node_batch_poll(node_batch_t *b, TickType_t xTicksToWait) {
+    if (b->records == 0) {
+        return portMAX_DELAY;
+    }
+
+    const TickType_t age = xTaskGetTickCount() - b->first;
+    if (age < b->max_age) {
+        return b->max_age - age;
+    }
+
+    // A failed send keeps the records, try again on the next tick.
+    return node_batch_flush(b, xTicksToWait) == ESP_OK ? portMAX_DELAY : 1;
+}
+
+// Appends a record, delta encoded with PROTO_FLAG_DELTA. Returns bytes used, 0 if it does not fit.
+static size_t batch_put(node_batch_t *b, const uint8_t *data, size_t len) {
+    if ((b->frame[1] & PROTO_FLAG_DELTA) == 0) {
+        return proto_batch_put(b->frame + b->len, b->cap - b->len, data, len);
+    }
+
+    // Against an empty reference the record is copied, later ones may also grow, they start a new frame then.
+    uint8_t rec[PROTO_BATCH_REC_MAX_LEN];
+    size_t rec_len;
+    proto_delta_ref_t next = b->ref;
+    if (proto_delta_encode(&next, data, len, rec, sizeof(rec), &rec_len) != PROTO_OK) {
+        return 0;
+    }
+
+    const size_t put = proto_batch_put(b->frame + b->len, b->cap - b->len, rec, rec_len);
+    if (put > 0) {
+        b->ref = next;
+    }
+    return put;
+}
+
+esp_err_t node_batch_add(node_batch_t *b, const uint8_t *data, size_t len, TickType_t xTicksToWait) {
+    if (unlikely(data == NULL && len > 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (unlikely(len > PROTO_BATCH_REC_MAX_LEN || PROTO_HDR_LEN + PROTO_BATCH_REC_HDR_LEN + len > b->cap)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    size_t put = batch_put(b, data, len);
+    if (put == 0) {
+        ESP_RETURN_ON_ERROR(node_batch_flush(b, xTicksToWait), TAG, "batch flush");
+        put = batch_put(b, data, len);
+    }
+    if (unlikely(put == 0)) {
+        return ESP_ERR_INVALID_ARG; // only a malformed delta record fails in an empty frame
+    }
+
+    if (b->records == 0) {
+        b->first = xTaskGetTickCount();
+    }
+    b->len += put;
+    b->records++;
+
+    // A full frame goes now, waiting would not make it any cheaper.
+    if (b->cap - b->len <= PROTO_BATCH_REC_HDR_LEN || xTaskGetTickCount() - b->first >= b->max_age) {
+        return node_batch_flush(b, xTicksToWait);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t node_poll(const uint8_t *gateway_addr, const uint8_t *data, size_t len, TickType_t window) {
+    if (unlikely(data == NULL && len > 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (unlikely(s_reply == NULL)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    rescan_if_lost();
+
+    uint8_t dest[ESP_NOW_ETH_ALEN];
+    memcpy(dest, gateway_addr != NULL ? gateway_addr : s_has_gateway ? s_gateway : BROADCAST_MAC, ESP_NOW_ETH_ALEN);
+
+    uint8_t frame[ESP_NOW_MAX_DATA_LEN - NODE_STAMP_OVERHEAD];
+    size_t frame_len;
+    if (proto_add_flags(data, len, PROTO_FLAG_POLL, frame, sizeof(frame), &frame_len) != PROTO_OK) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    TRY(peer_ensure(dest));
+
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+
+    // A late reply to an earlier poll must not end this one.
+    xSemaphoreTake(s_reply, 0);
+
+    esp_err_t err = send_blocking(dest, frame, frame_len, NULL, window);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (xTaskCheckForTimeOut(&timeout, &window) == pdTRUE || xSemaphoreTake(s_reply, window) != pdTRUE) {
+        // A broadcast poll is never acknowledged, a missing reply is the only sign of a lost gateway.
+        __atomic_add_fetch(&s_fail_streak, 1, __ATOMIC_RELAXED);
         return ESP_ERR_TIMEOUT;
     }
 
+    __atomic_store_n(&s_fail_streak, 0, __ATOMIC_RELAXED);
     return ESP_OK;
 }
 
-esp_err_t node_broadcast(const uint8_t *data, size_t len, node_send_status_t *out_status, TickType_t xTicksToWait) {
-    return node_send(BROADCAST_MAC, data, len, out_status, xTicksToWait);
+// Keeps the channel for the next power-on, NVS is left alone when the application did not initialize it.
+static void channel_store(uint8_t channel) {
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+
+    uint8_t stored = 0;
+    if (nvs_get_u8(nvs, NVS_KEY_CHANNEL, &stored) != ESP_OK || stored != channel) {
+        if (nvs_set_u8(nvs, NVS_KEY_CHANNEL, channel) == ESP_OK) {
+            nvs_commit(nvs);
+        }
+    }
+    nvs_close(nvs);
+}
+
+static uint8_t channel_load(void) {
+    nvs_handle_t nvs;
+    uint8_t channel = 0;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        nvs_get_u8(nvs, NVS_KEY_CHANNEL, &channel);
+        nvs_close(nvs);
+    }
+
+    return channel >= 1 && channel <= NODE_SCAN_MAX_CHANNEL ? channel : 0;
+}
+
+// Probes one channel, true if a beacon arrived within the dwell time.
+static bool scan_channel(uint8_t channel, const uint8_t *probe, size_t probe_len) {
+    if (esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE) != ESP_OK) {
+        return false;
+    }
+    s_scan_stats.channels++;
+
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+    TickType_t dwell = pdMS_TO_TICKS(NODE_SCAN_DWELL_MS);
+
+    xSemaphoreTake(s_beacon_sem, 0);
+    if (send_blocking(BROADCAST_MAC, probe, probe_len, NULL, dwell) != ESP_OK) {
+        return false;
+    }
+
+    return xTaskCheckForTimeOut(&timeout, &dwell) == pdFALSE && xSemaphoreTake(s_beacon_sem, dwell) == pdTRUE;
+}
+
+// Searches all channels, called with s_scan_lock held and nothing in flight.
+static esp_err_t scan_locked(uint8_t *out_channel) {
+    const int64_t start = esp_timer_get_time();
+    uint8_t probe[PROTO_HDR_LEN];
+    const size_t probe_len = proto_write_hdr(probe, PROTO_FLAG_BEACON);
+
+    // The last known channel is the likeliest one.
+    bool found = s_channel != 0 && scan_channel(s_channel, probe, probe_len);
+    for (uint8_t ch = 1; !found && ch <= NODE_SCAN_MAX_CHANNEL; ch++) {
+        if (ch != s_channel) {
+            found = scan_channel(ch, probe, probe_len);
+        }
+    }
+
+    const int64_t elapsed = esp_timer_get_time() - start;
+    s_scan_stats.scans++;
+    s_scan_stats.last_scan_us = (uint32_t)elapsed;
+    s_scan_stats.total_scan_us += (uint64_t)elapsed;
+
+    // Either way the next search waits for another run of failures, a missing gateway must not cost a search per send.
+    __atomic_store_n(&s_fail_streak, 0, __ATOMIC_RELAXED);
+
+    if (!found) {
+        s_scan_stats.failed++;
+        if (s_channel != 0) {
+            esp_wifi_set_channel(s_channel, WIFI_SECOND_CHAN_NONE);
+        }
+        ESP_LOGW(TAG, "no gateway found after %" PRId64 " us", elapsed);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const proto_beacon_t beacon = s_beacon;
+    if (beacon.channel >= 1 && beacon.channel <= NODE_SCAN_MAX_CHANNEL) {
+        // The beacon names the channel the gateway stays on.
+        s_channel = beacon.channel;
+    }
+    TRY(esp_wifi_set_channel(s_channel, WIFI_SECOND_CHAN_NONE));
+
+    if (beacon.epoch != s_epoch) {
+        // A restarted gateway numbers its frames anew.
+        recv_window_reset();
+        s_epoch = beacon.epoch;
+    }
+    memcpy(s_gateway, beacon.mac_addr, ESP_NOW_ETH_ALEN);
+    s_has_gateway = true;
+    s_scan_stats.channel = s_channel;
+    channel_store(s_channel);
+
+    ESP_LOGI(TAG, "gateway " MACSTR " on channel %u, found in %" PRId64 " us", MAC2STR(s_gateway), s_channel,
+             elapsed);
+
+    if (out_channel != NULL) {
+        *out_channel = s_channel;
+    }
+    return ESP_OK;
+}
+
+esp_err_t node_scan(uint8_t *out_channel) {
+    if (unlikely(s_beacon_sem == NULL)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Frames of other tasks wait for the lock, those already handed over complete on the channel they were sent on.
+    xSemaphoreTakeRecursive(s_scan_lock, portMAX_DELAY);
+    for (size_t i = 0; i < NODE_TX_WINDOW; i++) {
+        xSemaphoreTake(s_tx_window, portMAX_DELAY);
+    }
+    for (size_t i = 0; i < NODE_TX_WINDOW; i++) {
+        xSemaphoreGive(s_tx_window);
+    }
+
+    const esp_err_t err = scan_locked(out_channel);
+    xSemaphoreGiveRecursive(s_scan_lock);
+
+    return err;
+}
+
+esp_err_t node_scan_stats(node_scan_stats_t *out) {
+    if (unlikely(out == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *out = s_scan_stats;
+    return ESP_OK;
 }
 
-__attribute__((cold)) static esp_err_t espnow_init(uint8_t channel) {
+void node_sleep(uint64_t sleep_us) {
+    const int64_t awake_us = esp_timer_get_time();
+
+    s_cycle_stats.cycles++;
+    s_cycle_stats.last_awake_us = (uint32_t)awake_us;
+    if (s_cycle_stats.last_awake_us > s_cycle_stats.max_awake_us) {
+        s_cycle_stats.max_awake_us = s_cycle_stats.last_awake_us;
+    }
+    s_cycle_stats.total_awake_us += (uint64_t)awake_us;
+
+    esp_deep_sleep(sleep_us);
+}
+
+esp_err_t node_boot_timeline(node_boot_timeline_t *out) {
+    if (unlikely(out == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *out = s_boot;
+    return ESP_OK;
+}
+
+const char *node_boot_phase_name(node_boot_phase_t phase) {
+    return phase < NODE_BOOT_PHASES ? s_phase_names[phase] : "unknown";
+}
+
+esp_err_t node_cycle_stats(node_cycle_stats_t *out) {
+    if (unlikely(out == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *out = s_cycle_stats;
+    return ESP_OK;
+}
+
+__attribute__((cold)) static esp_err_t espnow_init(void) {
+    s_tx_window = xSemaphoreCreateCounting(NODE_TX_WINDOW, NODE_TX_WINDOW);
+    s_tx_lock = xSemaphoreCreateMutex();
+    s_scan_lock = xSemaphoreCreateRecursiveMutex();
+    s_reply = xSemaphoreCreateBinary();
+    s_beacon_sem = xSemaphoreCreateBinary();
+    ESP_RETURN_ON_FALSE(s_tx_window != NULL && s_tx_lock != NULL && s_scan_lock != NULL && s_reply != NULL &&
+                            s_beacon_sem != NULL,
+                        ESP_ERR_NO_MEM, TAG, "semaphores");
+
     TRY(esp_now_init());
     TRY(esp_now_register_send_cb(send_cb));
+    TRY(esp_now_register_recv_cb(recv_cb));
 
-    const esp_now_peer_info_t peer = {.channel = channel,
+    const esp_now_peer_info_t peer = {.channel = 0, // the home channel, see node_scan()
                                       .ifidx = ESP_IF_WIFI_STA,
                                       .encrypt = false,
                                       .peer_addr = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}};
 
     TRY(esp_now_add_peer(&peer));
 
+#if CONFIG_NODE_ENCRYPT
+    ESP_RETURN_ON_FALSE(strlen(CONFIG_NODE_ENCRYPT_PMK) == ESP_NOW_KEY_LEN, ESP_ERR_INVALID_ARG, TAG,
+                        "PMK must have %d characters", ESP_NOW_KEY_LEN);
+    ESP_RETURN_ON_FALSE(strcmp(CONFIG_NODE_ENCRYPT_PMK, PLACEHOLDER_PMK) != 0, ESP_ERR_INVALID_ARG, TAG,
+                        "set a PMK of your own");
+    s_key_lock = xSemaphoreCreateMutex();
+    s_key_sem = xSemaphoreCreateBinary();
+    ESP_RETURN_ON_FALSE(s_key_lock != NULL && s_key_sem != NULL, ESP_ERR_NO_MEM, TAG, "key semaphores");
+
+    TRY(esp_now_set_pmk((const uint8_t *)CONFIG_NODE_ENCRYPT_PMK));
+    // The key is only kept in RTC memory over deep sleep, after other resets NVS may still have it.
+    if (s_has_key || key_load()) {
+        TRY(key_peer_apply());
+    }
+#endif
+    phase_done(NODE_BOOT_ESPNOW);
+
     return ESP_OK;
 }
 
 __attribute__((cold)) esp_err_t node_init(uint8_t channel, const uint8_t *mac) {
+    s_phase_start = esp_timer_get_time();
+    s_boot.init_us = s_phase_start;
+
+    ESP_RETURN_ON_FALSE(channel <= 14, ESP_ERR_INVALID_ARG, TAG, "channel %u", channel);
+
+#if !CONFIG_NODE_FAST_START || CONFIG_ESP_PHY_CALIBRATION_AND_DATA_STORAGE
+    // Fast start still needs NVS here: esp_wifi_init() loads the PHY calibration data from it.
     TRY(nvs_init());
-    TRY(wifi_init(channel, mac));
-    TRY(espnow_init(channel));
+    phase_done(NODE_BOOT_NVS);
+#endif
+
+    s_auto_channel = channel == 0;
+    if (s_auto_channel && s_channel == 0) {
+        // s_channel is only kept over deep sleep, after other resets NVS may still know it.
+        s_channel = channel_load();
+    } else if (!s_auto_channel) {
+        s_channel = channel;
+    }
+
+    TRY(wifi_init(s_channel != 0 ? s_channel : 1, mac));
+    TRY(espnow_init());
+
+    if (s_auto_channel && s_channel == 0) {
+        const esp_err_t err = node_scan(NULL);
+        phase_done(NODE_BOOT_SCAN);
+        return err;
+    }
 
     return ESP_OK;
 }
\ No newline at end of file
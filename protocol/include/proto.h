@@ -0,0 +1,178 @@
+#ifndef _PROTO_H_
+#define _PROTO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Every framed ESP-NOW payload starts with a 2-byte header:
+ *
+ *   u8 magic   PROTO_MAGIC
+ *   u8 flags   PROTO_FLAG_*
+ *
+ * Optional extension headers follow in the order of their flag bits, then
+ * the application payload. Frames that do not start with PROTO_MAGIC are
+ * raw payloads from nodes that do not use the framing.
+ *
+ * All multi-byte integers are little-endian.
+ */
+#define PROTO_MAGIC 0xE5
+#define PROTO_HDR_LEN 2
+
+#define PROTO_FLAG_FRAG 0x01 // proto_frag_hdr_t follows
+#define PROTO_FLAG_TLV 0x02  // payload is proto_tlv encoded, no extension header
+#define PROTO_FLAG_SEQ 0x04  // u16 per-sender frame sequence number follows
+#define PROTO_FLAG_BATCH 0x08 // payload is proto_batch records, no extension header
+#define PROTO_FLAG_POLL 0x10  // sender listens for a reply with its queued downlink data, no extension header
+#define PROTO_FLAG_BEACON 0x20 // payload is a proto_beacon, or empty to ask for one, no extension header
+#define PROTO_FLAG_DELTA 0x40  // batch of TLV records, later records proto_delta encoded, no extension header
+#define PROTO_FLAG_EXT 0x80    // u8 second flags byte follows, PROTO_FLAG2_*
+
+#define PROTO_FLAG2_KEY 0x01  // payload is a proto_key message, no extension header
+#define PROTO_FLAG2_AUTH 0x02 // u32 counter follows, the frame ends with a proto_auth tag
+
+#define PROTO_FRAG_HDR_LEN 10
+#define PROTO_SEQ_HDR_LEN 2
+#define PROTO_EXT_HDR_LEN 1
+#define PROTO_AUTH_HDR_LEN 4
+#define PROTO_AUTH_TAG_LEN 8
+#define PROTO_FLAGS_KNOWN                                                                                              \
+    (PROTO_FLAG_FRAG | PROTO_FLAG_TLV | PROTO_FLAG_SEQ | PROTO_FLAG_BATCH | PROTO_FLAG_POLL | PROTO_FLAG_BEACON |     \
+     PROTO_FLAG_DELTA | PROTO_FLAG_EXT)
+#define PROTO_FLAGS2_KNOWN (PROTO_FLAG2_KEY | PROTO_FLAG2_AUTH)
+#define PROTO_FLAGS_NO_EXT                                                                                             \
+    (PROTO_FLAG_TLV | PROTO_FLAG_BATCH | PROTO_FLAG_POLL | PROTO_FLAG_BEACON |                                          \
+     PROTO_FLAG_DELTA) // flags without extension header
+
+typedef enum {
+    PROTO_OK = 0,
+    PROTO_ERR_INVALID_ARG,
+    PROTO_ERR_NOT_FRAMED, // no PROTO_MAGIC, payload is raw
+    PROTO_ERR_TRUNCATED,
+    PROTO_ERR_TOO_LARGE,
+    PROTO_ERR_NO_MEM,
+    PROTO_ERR_CRC,
+    PROTO_ERR_DUPLICATE,
+    PROTO_ERR_INCOMPLETE, // accepted, more data needed
+    PROTO_ERR_END,        // no more fields to read
+} proto_err_t;
+
+/**
+ * @brief Parsed view of a framed payload.
+ */
+typedef struct {
+    uint8_t flags;
+    uint8_t flags2;         // PROTO_FLAG2_* if PROTO_FLAG_EXT is set, 0 otherwise
+    const uint8_t *ext;     // first extension header
+    size_t ext_len;         // bytes from ext to end of frame
+    uint16_t seq;           // valid if PROTO_FLAG_SEQ is set
+    uint32_t counter;       // valid if PROTO_FLAG2_AUTH is set
+    const uint8_t *payload; // past all known extension headers
+    size_t payload_len;     // without the PROTO_FLAG2_AUTH tag
+} proto_frame_t;
+
+/**
+ * @brief Parses common frame header.
+ *
+ * @param data Frame bytes.
+ * @param len Frame length.
+ * @param[out] out Parsed view pointing into @p data.
+ * @return PROTO_OK on success, PROTO_ERR_NOT_FRAMED if @p data is a raw
+ *         payload, PROTO_ERR_TRUNCATED if a header is incomplete.
+ * @note payload is only meaningful when flags has no bits outside
+ *       PROTO_FLAGS_KNOWN and flags2 none outside PROTO_FLAGS2_KNOWN,
+ *       unknown extension headers cannot be skipped.
+ */
+proto_err_t proto_parse(const uint8_t *data, size_t len, proto_frame_t *out);
+
+/**
+ * @brief Copies a payload adding a PROTO_FLAG_SEQ header.
+ *
+ * Raw payloads get wrapped into a frame, framed payloads get the sequence
+ * header inserted after the extension headers that precede it.
+ *
+ * @param data Raw payload or frame without PROTO_FLAG_SEQ.
+ * @param len Length of @p data.
+ * @param seq Sequence number.
+ * @param out Destination, must not overlap @p data.
+ * @param cap Capacity of @p out.
+ * @param[out] out_len Length of the stamped frame.
+ * @return PROTO_OK, PROTO_ERR_TOO_LARGE if it does not fit @p cap, or
+ *         PROTO_ERR_INVALID_ARG if @p data already carries a sequence number.
+ */
+proto_err_t proto_stamp_seq(const uint8_t *data, size_t len, uint16_t seq, uint8_t *out, size_t cap,
+                            size_t *out_len);
+
+/**
+ * @brief Copies a payload setting flags that have no extension header.
+ *
+ * Raw payloads get wrapped into a frame, framed payloads get the flags
+ * added to their header.
+ *
+ * @param data Raw payload or frame, may be empty.
+ * @param len Length of @p data.
+ * @param flags Bits within PROTO_FLAGS_NO_EXT.
+ * @param out Destination, must not overlap @p data.
+ * @param cap Capacity of @p out.
+ * @param[out] out_len Length of the resulting frame.
+ * @return PROTO_OK, PROTO_ERR_TOO_LARGE if it does not fit @p cap, or
+ *         PROTO_ERR_INVALID_ARG for flags with an extension header.
+ */
+proto_err_t proto_add_flags(const uint8_t *data, size_t len, uint8_t flags, uint8_t *out, size_t cap,
+                            size_t *out_len);
+
+/**
+ * @brief Writes common frame header.
+ *
+ * @param out Destination, at least PROTO_HDR_LEN bytes.
+ * @param flags PROTO_FLAG_* bits.
+ * @return Number of bytes written.
+ */
+size_t proto_write_hdr(uint8_t *out, uint8_t flags);
+
+/**
+ * @brief Writes frame header with a second flags byte.
+ *
+ * @param out Destination, at least PROTO_HDR_LEN + PROTO_EXT_HDR_LEN bytes.
+ * @param flags PROTO_FLAG_* bits without extension header, PROTO_FLAG_EXT is added.
+ * @param flags2 PROTO_FLAG2_* bits.
+ * @return Number of bytes written.
+ */
+size_t proto_write_hdr2(uint8_t *out, uint8_t flags, uint8_t flags2);
+
+/**
+ * @brief Updates CRC-32 (IEEE 802.3, reflected) over @p data.
+ *
+ * Start with @p crc = 0 and feed chunks sequentially.
+ */
+uint32_t proto_crc32(uint32_t crc, const uint8_t *data, size_t len);
+
+static inline void proto_put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline uint16_t proto_get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline void proto_put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t proto_get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PROTO_H_ */
@@ -0,0 +1,79 @@
+#ifndef _PROTO_AUTH_H_
+#define _PROTO_AUTH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proto.h"
+#include "proto_sha256.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Authenticated frames (PROTO_FLAG_EXT with PROTO_FLAG2_AUTH) prove their
+ * sender, broadcasts included, which ESP-NOW cannot encrypt. The second
+ * flags byte is followed by
+ *
+ *   u32 counter   per sender, strictly increasing, lower ones are replays
+ *
+ * and the frame ends with
+ *
+ *   u8[8] tag     HMAC-SHA256(device key, all bytes before the tag)[0..8)
+ *
+ * Each device has its own key, derived from a master key that only the
+ * gateway and the provisioning tool know:
+ *
+ *   device key = HMAC-SHA256(master, "auth" | MAC)[0..16)
+ *
+ * Verifiers keep a proto_hmac_key_t per device, then a tag costs two SHA-256
+ * blocks plus one per 64 bytes of frame.
+ */
+#define PROTO_AUTH_KEY_LEN 16
+#define PROTO_AUTH_OVERHEAD (PROTO_EXT_HDR_LEN + PROTO_AUTH_HDR_LEN + PROTO_AUTH_TAG_LEN) // framed payloads
+
+/**
+ * @brief Derives the key of a device.
+ */
+void proto_auth_derive(const proto_hmac_key_t *master, const uint8_t mac_addr[6], uint8_t key[PROTO_AUTH_KEY_LEN]);
+
+/**
+ * @brief Copies a payload adding the counter and the tag.
+ *
+ * Raw payloads get wrapped into a frame, framed payloads get the second
+ * flags byte if they have none and the counter inserted after it. Seal last,
+ * anything changed afterwards breaks the tag.
+ *
+ * @param key Key schedule of the sender's device key.
+ * @param counter Greater than that of any frame sealed before with this key.
+ * @param data Raw payload or frame without PROTO_FLAG2_AUTH.
+ * @param len Length of @p data.
+ * @param out Destination, must not overlap @p data.
+ * @param cap Capacity of @p out.
+ * @param[out] out_len Length of the sealed frame.
+ * @return PROTO_OK, PROTO_ERR_TOO_LARGE if it does not fit @p cap,
+ *         PROTO_ERR_TRUNCATED for a malformed frame, or PROTO_ERR_INVALID_ARG
+ *         if @p data is sealed already.
+ */
+proto_err_t proto_auth_seal(const proto_hmac_key_t *key, uint32_t counter, const uint8_t *data, size_t len,
+                            uint8_t *out, size_t cap, size_t *out_len);
+
+/**
+ * @brief Checks the tag of a frame that proto_parse() found PROTO_FLAG2_AUTH in.
+ *
+ * The counter is left to the caller, it knows the last one of the sender.
+ *
+ * @param key Key schedule of the sender's device key.
+ * @param data Complete frame.
+ * @param len Length of @p data.
+ * @return PROTO_OK, PROTO_ERR_TRUNCATED if there is no room for a tag, or
+ *         PROTO_ERR_CRC if the tag does not match.
+ */
+proto_err_t proto_auth_verify(const proto_hmac_key_t *key, const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PROTO_AUTH_H_ */
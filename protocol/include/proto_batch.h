@@ -0,0 +1,59 @@
+#ifndef _PROTO_BATCH_H_
+#define _PROTO_BATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Batch payload (PROTO_FLAG_BATCH) packs several short messages into one
+ * frame, so a node that wakes up briefly gets everything queued for it in a
+ * single exchange:
+ *
+ *   u8 length, then length bytes, repeated to the end of the payload
+ *
+ * Empty records are allowed.
+ */
+#define PROTO_BATCH_REC_HDR_LEN 1
+#define PROTO_BATCH_REC_MAX_LEN UINT8_MAX
+
+/**
+ * @brief Appends one record.
+ *
+ * @param out Destination, the free part of a payload buffer.
+ * @param cap Capacity of @p out.
+ * @return Number of bytes written, 0 if the record does not fit or is
+ *         longer than PROTO_BATCH_REC_MAX_LEN.
+ */
+size_t proto_batch_put(uint8_t *out, size_t cap, const uint8_t *data, size_t len);
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+} proto_batch_reader_t;
+
+static inline void proto_batch_reader_init(proto_batch_reader_t *r, const uint8_t *data, size_t len) {
+    r->p = data;
+    r->end = data + len;
+}
+
+/**
+ * @brief Reads next record.
+ *
+ * @param[out] data Record bytes, pointing into the reader's buffer.
+ * @param[out] len Record length.
+ * @return PROTO_OK, PROTO_ERR_END when the payload is exhausted, or
+ *         PROTO_ERR_TRUNCATED if the last record is cut short.
+ */
+proto_err_t proto_batch_next(proto_batch_reader_t *r, const uint8_t **data, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PROTO_BATCH_H_ */
@@ -0,0 +1,55 @@
+#ifndef _PROTO_BEACON_H_
+#define _PROTO_BEACON_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Beacon payload (PROTO_FLAG_BEACON), broadcast by the gateway so nodes find
+ * the channel it currently listens on:
+ *
+ *   u8[6] gateway MAC
+ *   u8    channel
+ *   u32   epoch, changes when the gateway restarts
+ *
+ * A frame with PROTO_FLAG_BEACON and an empty payload is a probe: a scanning
+ * node asks for a beacon instead of waiting for the next periodic one.
+ * Longer payloads are accepted, later fields may be appended.
+ */
+#define PROTO_BEACON_PAYLOAD_LEN 11
+#define PROTO_BEACON_LEN (PROTO_HDR_LEN + PROTO_BEACON_PAYLOAD_LEN)
+
+typedef struct {
+    uint8_t mac_addr[6];
+    uint8_t channel;
+    uint32_t epoch;
+} proto_beacon_t;
+
+/**
+ * @brief Writes a complete beacon frame.
+ *
+ * @param out Destination, at least PROTO_BEACON_LEN bytes.
+ * @return Number of bytes written, 0 if @p cap is too small.
+ */
+size_t proto_beacon_write(uint8_t *out, size_t cap, const proto_beacon_t *beacon);
+
+/**
+ * @brief Decodes a beacon payload.
+ *
+ * @param payload Payload of a frame with PROTO_FLAG_BEACON.
+ * @param len Payload length.
+ * @return PROTO_OK, or PROTO_ERR_TRUNCATED for probes and short payloads.
+ */
+proto_err_t proto_beacon_parse(const uint8_t *payload, size_t len, proto_beacon_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PROTO_BEACON_H_ */
@@ -0,0 +1,84 @@
+#ifndef _PROTO_DELTA_H_
+#define _PROTO_DELTA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Delta encoding of telemetry batches (PROTO_FLAG_DELTA, set together with
+ * PROTO_FLAG_BATCH and PROTO_FLAG_TLV).
+ *
+ * The first record of the frame is a plain TLV payload. In every later
+ * record a PROTO_WT_VARINT field whose id also appeared as a varint in the
+ * previous record carries zigzag(value - previous value) instead of its
+ * value, both taken as raw wire values. Other fields are unchanged. A slowly
+ * changing reading then takes one byte whatever its magnitude.
+ *
+ * Only the first PROTO_DELTA_MAX_FIELDS varint fields of a record, and the
+ * first occurrence of an id, serve as reference. Frames never refer to each
+ * other, so a lost frame costs nothing but its own records.
+ */
+#define PROTO_DELTA_MAX_FIELDS 16
+
+/**
+ * @brief Varint fields of the previous record, decoded.
+ */
+typedef struct {
+    size_t count;
+    struct {
+        uint32_t id;
+        uint64_t value;
+    } fields[PROTO_DELTA_MAX_FIELDS];
+} proto_delta_ref_t;
+
+/**
+ * @brief Empties the reference, the next record is the first of a frame.
+ */
+static inline void proto_delta_ref_init(proto_delta_ref_t *ref) {
+    ref->count = 0;
+}
+
+/**
+ * @brief Delta encodes one TLV record.
+ *
+ * @param ref Previous record, replaced by @p rec on success.
+ * @param rec Plain TLV record.
+ * @param out Destination, must not overlap @p rec.
+ * @param[out] out_len Length of the encoded record, may exceed @p len.
+ * @return PROTO_OK, PROTO_ERR_TOO_LARGE if it does not fit @p cap, or the
+ *         error of a malformed @p rec.
+ */
+proto_err_t proto_delta_encode(proto_delta_ref_t *ref, const uint8_t *rec, size_t len, uint8_t *out, size_t cap,
+                               size_t *out_len);
+
+/**
+ * @brief Restores one TLV record, the reverse of proto_delta_encode().
+ *
+ * @param ref Previous record, replaced by the restored one on success.
+ */
+proto_err_t proto_delta_decode(proto_delta_ref_t *ref, const uint8_t *rec, size_t len, uint8_t *out, size_t cap,
+                               size_t *out_len);
+
+/**
+ * @brief Restores a whole PROTO_FLAG_DELTA batch payload.
+ *
+ * @param payload Delta encoded batch records.
+ * @param out Receives the same records in plain TLV, a proto_batch payload.
+ * @param[out] out_len Length of the restored payload.
+ * @return PROTO_OK, PROTO_ERR_TOO_LARGE if the records do not fit @p cap or
+ *         one grows past PROTO_BATCH_REC_MAX_LEN, or the error of a
+ *         malformed record.
+ */
+proto_err_t proto_delta_unpack(const uint8_t *payload, size_t len, uint8_t *out, size_t cap, size_t *out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PROTO_DELTA_H_ */
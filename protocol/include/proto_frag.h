@@ -0,0 +1,217 @@
+#ifndef _PROTO_FRAG_H_
+#define _PROTO_FRAG_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fragment extension header (PROTO_FLAG_FRAG):
+ *
+ *   u16 msg_id      sender-local message counter
+ *   u8  index       fragment number, 0..count-1
+ *   u8  count       total number of fragments, >= 1
+ *   u16 total_len   length of reassembled message
+ *   u32 crc         proto_crc32() of reassembled message
+ *
+ * The message is split evenly: every fragment but the last carries
+ * ceil(total_len / count) bytes, so the receiver can place any fragment
+ * without having seen the others.
+ */
+#define PROTO_FRAG_OVERHEAD (PROTO_HDR_LEN + PROTO_FRAG_HDR_LEN)
+#define PROTO_FRAG_MAX_COUNT 255
+#define PROTO_FRAG_MAX_LEN UINT16_MAX
+
+typedef struct {
+    uint16_t msg_id;
+    uint8_t index;
+    uint8_t count;
+    uint16_t total_len;
+    uint32_t crc;
+} proto_frag_hdr_t;
+
+/**
+ * @brief Parses fragment extension header.
+ *
+ * @param p Extension header bytes (proto_frame_t::ext).
+ * @param len Bytes available at @p p.
+ * @param[out] out Parsed header.
+ * @return PROTO_OK, PROTO_ERR_TRUNCATED or PROTO_ERR_INVALID_ARG for
+ *         inconsistent index/count/length.
+ */
+proto_err_t proto_frag_hdr_parse(const uint8_t *p, size_t len, proto_frag_hdr_t *out);
+
+/**
+ * @brief Returns payload length every fragment but the last one carries.
+ */
+static inline size_t proto_frag_chunk(uint16_t total_len, uint8_t count) {
+    return ((size_t)total_len + count - 1) / count;
+}
+
+/**
+ * @brief Splits a message into framed fragments.
+ *
+ * @c flags is PROTO_FLAG_FRAG after proto_frag_begin(); OR flags without an
+ * extension header (e.g. PROTO_FLAG_TLV) into it to mark the whole message.
+ */
+typedef struct {
+    uint8_t flags;
+    const uint8_t *data;
+    proto_frag_hdr_t hdr;
+    size_t chunk;
+    size_t offset;
+} proto_fragmenter_t;
+
+/**
+ * @brief Prepares fragmenter for a message.
+ *
+ * @param f Fragmenter state.
+ * @param msg_id Message id stamped into every fragment.
+ * @param data Message bytes, must stay valid until the last fragment is produced.
+ * @param len Message length, 1..PROTO_FRAG_MAX_LEN.
+ * @param mtu Maximum frame length, e.g. ESP_NOW_MAX_DATA_LEN.
+ * @return PROTO_OK, PROTO_ERR_INVALID_ARG, or PROTO_ERR_TOO_LARGE if the
+ *         message needs more than PROTO_FRAG_MAX_COUNT fragments.
+ */
+proto_err_t proto_frag_begin(proto_fragmenter_t *f, uint16_t msg_id, const uint8_t *data, size_t len, size_t mtu);
+
+/**
+ * @brief Writes next fragment frame.
+ *
+ * @param f Fragmenter state.
+ * @param out Destination, at least @p mtu bytes passed to proto_frag_begin().
+ * @return Frame length, or 0 when all fragments were produced.
+ */
+size_t proto_frag_next(proto_fragmenter_t *f, uint8_t *out);
+
+/**
+ * @brief Complete message returned by the reassembler.
+ */
+typedef struct {
+    uint8_t mac_addr[6];
+    uint16_t msg_id;
+    const uint8_t *data;
+    size_t len;
+    void *buf_; // owned buffer, released by proto_reasm_release()
+} proto_msg_t;
+
+typedef struct {
+    bool used;
+    uint8_t mac_addr[6];
+    uint16_t msg_id;
+    uint8_t count;
+    uint8_t received;
+    uint16_t total_len;
+    uint32_t crc;
+    uint32_t started_ms;
+    uint32_t seen[(PROTO_FRAG_MAX_COUNT + 31) / 32];
+    uint8_t *buf;
+} proto_reasm_slot_t;
+
+/**
+ * @brief Recently completed message.
+ *
+ * A restarted sender counts msg_id from 0 again, so a later fragment only
+ * matches when length and CRC are the same too, and only within the
+ * reassembly timeout.
+ */
+typedef struct {
+    bool used;
+    uint8_t mac_addr[6];
+    uint16_t msg_id;
+    uint16_t total_len;
+    uint32_t crc;
+    uint32_t done_ms;
+} proto_reasm_done_t;
+
+#define PROTO_REASM_DONE_HISTORY 8
+
+typedef struct {
+    uint32_t completed;
+    uint32_t duplicates;
+    uint32_t timeouts;
+    uint32_t evicted;
+    uint32_t crc_errors;
+    uint32_t malformed;
+} proto_reasm_stats_t;
+
+/**
+ * @brief Bounded reassembly table.
+ *
+ * At most @c nslots messages are in flight and their buffers never exceed
+ * @c mem_cap bytes in total. When either limit is hit, the oldest partial
+ * message is evicted. Not thread-safe.
+ */
+typedef struct {
+    proto_reasm_slot_t *slots;
+    size_t nslots;
+    size_t mem_cap;
+    size_t mem_used;
+    uint32_t timeout_ms;
+    proto_reasm_done_t done[PROTO_REASM_DONE_HISTORY]; // recently completed, to drop late duplicates
+    size_t done_next;
+    proto_reasm_stats_t stats;
+} proto_reasm_t;
+
+/**
+ * @brief Initializes reassembler over caller-provided slots.
+ *
+ * @param r Reassembler state.
+ * @param slots Slot storage.
+ * @param nslots Number of slots.
+ * @param mem_cap Maximum bytes allocated for partial messages.
+ * @param timeout_ms Time after which a partial message is dropped.
+ * @return PROTO_OK or PROTO_ERR_INVALID_ARG.
+ */
+proto_err_t proto_reasm_init(proto_reasm_t *r, proto_reasm_slot_t *slots, size_t nslots, size_t mem_cap,
+                             uint32_t timeout_ms);
+
+/**
+ * @brief Frees all partial messages.
+ */
+void proto_reasm_deinit(proto_reasm_t *r);
+
+/**
+ * @brief Feeds one fragment.
+ *
+ * @param r Reassembler state.
+ * @param mac_addr Sender MAC, messages are keyed by (MAC, msg_id).
+ * @param hdr Parsed fragment header.
+ * @param payload Fragment payload following the header.
+ * @param len Payload length.
+ * @param now_ms Monotonic time in milliseconds, may wrap.
+ * @param[out] out Completed message when PROTO_OK is returned; release it
+ *             with proto_reasm_release().
+ * @return PROTO_OK when a message completed, PROTO_ERR_INCOMPLETE when the
+ *         fragment was stored, PROTO_ERR_DUPLICATE, PROTO_ERR_CRC,
+ *         PROTO_ERR_NO_MEM or PROTO_ERR_INVALID_ARG when it was dropped.
+ */
+proto_err_t proto_reasm_push(proto_reasm_t *r, const uint8_t *mac_addr, const proto_frag_hdr_t *hdr,
+                             const uint8_t *payload, size_t len, uint32_t now_ms, proto_msg_t *out);
+
+/**
+ * @brief Releases message returned by proto_reasm_push().
+ */
+void proto_reasm_release(proto_reasm_t *r, proto_msg_t *msg);
+
+/**
+ * @brief Drops partial messages older than the timeout.
+ *
+ * @param r Reassembler state.
+ * @param now_ms Monotonic time in milliseconds.
+ * @return Milliseconds until the next partial message expires, or
+ *         UINT32_MAX if none is pending.
+ */
+uint32_t proto_reasm_expire(proto_reasm_t *r, uint32_t now_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PROTO_FRAG_H_ */
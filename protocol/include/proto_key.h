@@ -0,0 +1,144 @@
+#ifndef _PROTO_KEY_H_
+#define _PROTO_KEY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proto.h"
+#include "proto_sha256.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Key messages (PROTO_FLAG_EXT with PROTO_FLAG2_KEY) set up ESP-NOW
+ * encryption between a node and the gateway. The payload is a u8 type, a
+ * body by type and a u8[8] tag:
+ *
+ *   PAIR_REQ   node -> broadcast      u8[8] nonce
+ *   PAIR_RESP  gateway -> broadcast   u8[8] nonce, u32 epoch, u8[16] wrapped LMK
+ *   HELLO      node -> broadcast      u32 epoch of the node's LMK, u32 count
+ *   READY      gateway -> node        u32 epoch, u32 count of the HELLO, u16 lease in seconds
+ *   REKEY      gateway -> node        u32 epoch, u32 count of the HELLO, u8[16] wrapped LMK of that epoch
+ *
+ * The gateway derives every node key from one master key, nothing is stored
+ * per node:
+ *
+ *   pair key = HMAC-SHA256(master, "pair" | MAC)[0..16)
+ *   LMK      = HMAC-SHA256(master, "lmk" | MAC | epoch)[0..16)
+ *
+ * Every message is signed, MAC is always the node's address and body the
+ * type and fields in front of the tag:
+ *
+ *   tag      = HMAC(key, "tag" | MAC | body)[0..8)
+ *   wrapped  = LMK ^ HMAC(key, "wrap" | MAC | body up to the wrapped key)[0..16)
+ *
+ * The pair key is provisioned on its node, like a proto_auth device key. It
+ * signs the pairing request and wraps the LMK in the response, so a node
+ * learns its own keys only and nobody else on the channel learns any.
+ *
+ * A node announces the epoch of its key with HELLO, signed with that key,
+ * so a session is only ever opened for the holder of the LMK. The gateway
+ * answers under that very key and echoes the count, which binds the answer
+ * to the HELLO: READY for a current key, REKEY with the key of its current
+ * epoch wrapped for an older one. Neither the link layer nor the sender
+ * address is trusted, a node takes no key it cannot unwrap. A session lasts
+ * for the lease, then the node says HELLO again. The count of a node only
+ * goes up, the gateway refuses a count it has seen, so a recorded HELLO
+ * opens no session.
+ */
+#define PROTO_KEY_LEN 16
+#define PROTO_KEY_NONCE_LEN 8
+#define PROTO_KEY_TAG_LEN 8
+#define PROTO_KEY_MAX_LEN (PROTO_HDR_LEN + PROTO_EXT_HDR_LEN + 1 + PROTO_KEY_NONCE_LEN + 4 + PROTO_KEY_LEN + \
+                           PROTO_KEY_TAG_LEN) // PAIR_RESP, the longest
+
+typedef enum {
+    PROTO_KEY_PAIR_REQ = 1,
+    PROTO_KEY_PAIR_RESP = 2,
+    PROTO_KEY_HELLO = 3,
+    PROTO_KEY_READY = 4,
+    PROTO_KEY_REKEY = 5,
+} proto_key_type_t;
+
+/**
+ * @brief One key message, fields not used by its type are ignored.
+ */
+typedef struct {
+    uint8_t type; // proto_key_type_t
+    uint8_t nonce[PROTO_KEY_NONCE_LEN];
+    uint32_t epoch;
+    uint32_t count; // HELLO, echoed by READY and REKEY
+    uint16_t lease_s;
+    uint8_t key[PROTO_KEY_LEN]; // wrapped
+    uint8_t tag[PROTO_KEY_TAG_LEN];
+} proto_key_msg_t;
+
+/**
+ * @brief Writes a complete key frame.
+ *
+ * @param out Destination, PROTO_KEY_MAX_LEN bytes fit every type.
+ * @return Number of bytes written, 0 for an unknown type or if @p cap is too small.
+ */
+size_t proto_key_write(uint8_t *out, size_t cap, const proto_key_msg_t *msg);
+
+/**
+ * @brief Parses the payload of a key frame.
+ *
+ * @return PROTO_OK, PROTO_ERR_TRUNCATED, or PROTO_ERR_INVALID_ARG for an unknown type.
+ */
+proto_err_t proto_key_parse(const uint8_t *payload, size_t len, proto_key_msg_t *out);
+
+/**
+ * @brief Derives the LMK of a node for one epoch.
+ */
+void proto_key_derive(const proto_hmac_key_t *master, const uint8_t mac_addr[6], uint32_t epoch,
+                      uint8_t lmk[PROTO_KEY_LEN]);
+
+/**
+ * @brief Derives the pair key of a node, provisioned on it together with the firmware.
+ */
+void proto_key_derive_pair(const proto_hmac_key_t *master, const uint8_t mac_addr[6], uint8_t key[PROTO_KEY_LEN]);
+
+/**
+ * @brief Fills the tag of a PAIR_REQ, HELLO or READY whose other fields are set.
+ *
+ * @param key Key schedule of the pair key for PAIR_REQ, of the LMK of the HELLO for HELLO and READY.
+ * @param mac_addr The node's address, also when the gateway signs.
+ */
+void proto_key_sign(const proto_hmac_key_t *key, const uint8_t mac_addr[6], proto_key_msg_t *msg);
+
+/**
+ * @brief Checks the tag of a PAIR_REQ, HELLO or READY.
+ *
+ * @param key As for proto_key_sign().
+ * @return PROTO_OK, PROTO_ERR_CRC if the tag does not match, or
+ *         PROTO_ERR_INVALID_ARG for the wrapped types.
+ */
+proto_err_t proto_key_verify(const proto_hmac_key_t *key, const uint8_t mac_addr[6], const proto_key_msg_t *msg);
+
+/**
+ * @brief Fills key and tag of a PAIR_RESP or REKEY whose other fields are set.
+ *
+ * @param key Key schedule of the pair key of the node at @p mac_addr for PAIR_RESP, of the LMK of the HELLO for
+ *            REKEY.
+ */
+void proto_key_wrap(const proto_hmac_key_t *key, const uint8_t mac_addr[6], const uint8_t lmk[PROTO_KEY_LEN],
+                    proto_key_msg_t *msg);
+
+/**
+ * @brief Checks and unwraps a PAIR_RESP or REKEY addressed to @p mac_addr.
+ *
+ * @param key As for proto_key_wrap().
+ * @return PROTO_OK, PROTO_ERR_CRC if the tag does not match, or
+ *         PROTO_ERR_INVALID_ARG for the signed types.
+ */
+proto_err_t proto_key_unwrap(const proto_hmac_key_t *key, const uint8_t mac_addr[6], const proto_key_msg_t *msg,
+                             uint8_t lmk[PROTO_KEY_LEN]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PROTO_KEY_H_ */
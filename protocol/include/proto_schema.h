@@ -0,0 +1,90 @@
+#ifndef _PROTO_SCHEMA_H_
+#define _PROTO_SCHEMA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proto_tlv.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Field descriptors, ids and typed writers are generated at compile time
+ * from proto_schema.def, e.g. PROTO_FIELD(1, battery_mv, UINT, 0) yields
+ * PROTO_ID_battery_mv and proto_put_battery_mv(w, uint64_t).
+ */
+typedef enum {
+    PROTO_TYPE_UINT,
+    PROTO_TYPE_SINT,
+    PROTO_TYPE_FLOAT,
+    PROTO_TYPE_BYTES,
+} proto_type_t;
+
+typedef struct {
+    const char *name;
+    uint8_t id;
+    uint8_t type; // proto_type_t
+    uint8_t decimals;
+} proto_field_desc_t;
+
+enum {
+#define PROTO_FIELD(id_, name_, type_, decimals_) PROTO_ID_##name_ = (id_),
+#include "proto_schema.def"
+#undef PROTO_FIELD
+};
+
+// Upper bound of schema ids, sizes the id -> descriptor lookup table.
+#define PROTO_SCHEMA_MAX_ID 63
+
+#define PROTO_SCHEMA_PARAMS_UINT uint64_t v
+#define PROTO_SCHEMA_PARAMS_SINT int64_t v
+#define PROTO_SCHEMA_PARAMS_FLOAT float v
+#define PROTO_SCHEMA_PARAMS_BYTES const uint8_t *v, size_t len
+#define PROTO_SCHEMA_ARGS_UINT v
+#define PROTO_SCHEMA_ARGS_SINT v
+#define PROTO_SCHEMA_ARGS_FLOAT v
+#define PROTO_SCHEMA_ARGS_BYTES v, len
+#define PROTO_SCHEMA_PUT_UINT proto_tlv_put_uint
+#define PROTO_SCHEMA_PUT_SINT proto_tlv_put_sint
+#define PROTO_SCHEMA_PUT_FLOAT proto_tlv_put_float
+#define PROTO_SCHEMA_PUT_BYTES proto_tlv_put_bytes
+
+#define PROTO_FIELD(id_, name_, type_, decimals_)                                                                      \
+    static inline proto_err_t proto_put_##name_(proto_tlv_writer_t *w, PROTO_SCHEMA_PARAMS_##type_) {                 \
+        return PROTO_SCHEMA_PUT_##type_(w, (id_), PROTO_SCHEMA_ARGS_##type_);                                          \
+    }
+#include "proto_schema.def"
+#undef PROTO_FIELD
+
+/**
+ * @brief Returns descriptor of a schema field, NULL for unknown ids.
+ */
+const proto_field_desc_t *proto_schema_find(uint32_t id);
+
+/**
+ * @brief Formats one decoded field value as JSON (number, or string for BYTES).
+ *
+ * Unknown ids are rendered by wire type: varints as unsigned integers,
+ * fixed32 as float, bytes as hex.
+ *
+ * @return Characters written excluding the terminator, or -1 if @p cap is too small.
+ */
+int proto_schema_format_value(const proto_tlv_field_t *field, char *out, size_t cap);
+
+/**
+ * @brief Renders a TLV payload as a flat JSON object keyed by field name.
+ *
+ * Unknown ids use "f<id>" as key.
+ *
+ * @return Characters written excluding the terminator, or -1 on malformed
+ *         input or if @p cap is too small.
+ */
+int proto_schema_to_json(const uint8_t *data, size_t len, char *out, size_t cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PROTO_SCHEMA_H_ */
@@ -0,0 +1,59 @@
+#ifndef _PROTO_SEQ_H_
+#define _PROTO_SEQ_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Receiver side of PROTO_FLAG_SEQ: a 64-frame sliding window per sender.
+ *
+ * Bit i of the window is set if sequence number top - i was received. A
+ * frame inside the window is accepted once, copies are duplicates. A frame
+ * is counted lost when its bit leaves the window unset, so late frames
+ * within 63 positions are not miscounted. Only numbers from the window
+ * start on can be lost: positions before the first frame after a reset
+ * never were expected.
+ *
+ * Jumps ahead by more than PROTO_SEQ_RESYNC_GAP, and frames that fall
+ * behind the window, are taken as a sender restart and reset the window
+ * without counting loss. A restarted sender counts from 0 again, which
+ * lands behind the window; its frames must not be dropped as too old.
+ */
+#define PROTO_SEQ_WINDOW 64
+#define PROTO_SEQ_RESYNC_GAP 1024
+
+typedef struct {
+    uint64_t window;
+    uint16_t top;
+    uint8_t span; // positions of the window that came after its start, up to PROTO_SEQ_WINDOW
+    bool valid;
+    uint32_t accepted;
+    uint32_t duplicates;
+    uint32_t lost;
+    uint32_t resyncs;
+} proto_seq_t;
+
+/**
+ * @brief Resets tracker, the next frame starts a new window.
+ */
+void proto_seq_init(proto_seq_t *s);
+
+/**
+ * @brief Records a received sequence number.
+ *
+ * @return PROTO_OK if the frame is new, PROTO_ERR_DUPLICATE if it was
+ *         already seen within the window.
+ */
+proto_err_t proto_seq_check(proto_seq_t *s, uint16_t seq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PROTO_SEQ_H_ */
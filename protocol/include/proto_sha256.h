@@ -0,0 +1,71 @@
+#ifndef _PROTO_SHA256_H_
+#define _PROTO_SHA256_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * SHA-256 (FIPS 180-4) and HMAC-SHA256 (RFC 2104) in portable C, for key
+ * derivation and frame authentication on nodes, the gateway and host tools.
+ *
+ * A proto_hmac_key_t keeps the hash state after the inner and outer padded
+ * key blocks, so every message under a key skips those two compressions
+ * and the key bytes themselves are not kept.
+ */
+#define PROTO_SHA256_LEN 32
+#define PROTO_SHA256_BLOCK_LEN 64
+
+typedef struct {
+    uint32_t h[8];
+    uint64_t len; // bytes hashed so far
+    uint8_t buf[PROTO_SHA256_BLOCK_LEN];
+} proto_sha256_t;
+
+void proto_sha256_init(proto_sha256_t *s);
+void proto_sha256_update(proto_sha256_t *s, const void *data, size_t len);
+void proto_sha256_final(proto_sha256_t *s, uint8_t out[PROTO_SHA256_LEN]);
+
+/**
+ * @brief Precomputed HMAC key schedule.
+ */
+typedef struct {
+    uint32_t inner[8]; // state after key ^ ipad
+    uint32_t outer[8]; // state after key ^ opad
+} proto_hmac_key_t;
+
+/**
+ * @brief Computes the key schedule, keys longer than a block are hashed first.
+ */
+void proto_hmac_key_init(proto_hmac_key_t *k, const uint8_t *key, size_t len);
+
+/**
+ * @brief Starts a message under a key, continue with proto_sha256_update().
+ */
+void proto_hmac_start(const proto_hmac_key_t *k, proto_sha256_t *s);
+
+/**
+ * @brief Ends a message started with proto_hmac_start().
+ */
+void proto_hmac_finish(const proto_hmac_key_t *k, proto_sha256_t *s, uint8_t out[PROTO_SHA256_LEN]);
+
+/**
+ * @brief HMAC of one contiguous message.
+ */
+void proto_hmac(const proto_hmac_key_t *k, const void *data, size_t len, uint8_t out[PROTO_SHA256_LEN]);
+
+/**
+ * @brief Compares in time independent of the contents, for MACs.
+ *
+ * @return 0 if equal.
+ */
+int proto_ct_compare(const uint8_t *a, const uint8_t *b, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PROTO_SHA256_H_ */
@@ -0,0 +1,122 @@
+#ifndef _PROTO_TLV_H_
+#define _PROTO_TLV_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Telemetry payload (PROTO_FLAG_TLV) is a sequence of fields:
+ *
+ *   varint key     field_id << 2 | wire type
+ *   value          PROTO_WT_VARINT: varint
+ *                  PROTO_WT_FIXED32: 4 bytes, IEEE 754 float
+ *                  PROTO_WT_BYTES: varint length, then bytes
+ *
+ * Varints are LEB128, signed integers are zigzag encoded first, so small
+ * magnitudes of either sign take one byte. Field ids below 32 keep the key
+ * at one byte. Readers skip fields they do not know.
+ */
+#define PROTO_TLV_MAX_ID 0x3FFFFFFF
+#define PROTO_VARINT_MAX_LEN 10
+
+typedef enum {
+    PROTO_WT_VARINT = 0,
+    PROTO_WT_FIXED32 = 1,
+    PROTO_WT_BYTES = 2,
+} proto_wire_t;
+
+static inline uint64_t proto_zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t proto_unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/**
+ * @brief Writes LEB128 varint.
+ *
+ * @param out Destination, at least PROTO_VARINT_MAX_LEN bytes.
+ * @return Number of bytes written.
+ */
+size_t proto_varint_put(uint8_t *out, uint64_t v);
+
+/**
+ * @brief Reads LEB128 varint.
+ *
+ * @return Number of bytes consumed, 0 if truncated or longer than
+ *         PROTO_VARINT_MAX_LEN.
+ */
+size_t proto_varint_get(const uint8_t *p, size_t len, uint64_t *out);
+
+/**
+ * @brief Appends fields to a caller-owned buffer.
+ *
+ * Writes past @c cap are dropped and latch @c overflow, so a sequence of
+ * puts can be checked once at the end.
+ */
+typedef struct {
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+    bool overflow;
+} proto_tlv_writer_t;
+
+static inline void proto_tlv_writer_init(proto_tlv_writer_t *w, uint8_t *buf, size_t cap) {
+    w->buf = buf;
+    w->cap = cap;
+    w->len = 0;
+    w->overflow = false;
+}
+
+proto_err_t proto_tlv_put_uint(proto_tlv_writer_t *w, uint32_t id, uint64_t v);
+proto_err_t proto_tlv_put_sint(proto_tlv_writer_t *w, uint32_t id, int64_t v);
+proto_err_t proto_tlv_put_float(proto_tlv_writer_t *w, uint32_t id, float v);
+proto_err_t proto_tlv_put_bytes(proto_tlv_writer_t *w, uint32_t id, const uint8_t *data, size_t len);
+
+/**
+ * @brief One decoded field, values point into the reader's buffer.
+ */
+typedef struct {
+    uint32_t id;
+    proto_wire_t wire;
+    union {
+        uint64_t u;  // PROTO_WT_VARINT, raw (zigzag for signed fields)
+        float f;     // PROTO_WT_FIXED32
+        struct {     // PROTO_WT_BYTES
+            const uint8_t *data;
+            size_t len;
+        } bytes;
+    };
+} proto_tlv_field_t;
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+} proto_tlv_reader_t;
+
+static inline void proto_tlv_reader_init(proto_tlv_reader_t *r, const uint8_t *data, size_t len) {
+    r->p = data;
+    r->end = data + len;
+}
+
+/**
+ * @brief Reads next field.
+ *
+ * @return PROTO_OK, PROTO_ERR_END when the payload is exhausted, or
+ *         PROTO_ERR_TRUNCATED / PROTO_ERR_INVALID_ARG for malformed input.
+ */
+proto_err_t proto_tlv_next(proto_tlv_reader_t *r, proto_tlv_field_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PROTO_TLV_H_ */
@@ -0,0 +1,87 @@
+#include "proto_auth.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+void proto_auth_derive(const proto_hmac_key_t *master, const uint8_t mac_addr[6], uint8_t key[PROTO_AUTH_KEY_LEN]) {
+    uint8_t msg[4 + 6];
+    memcpy(msg, "auth", 4);
+    memcpy(msg + 4, mac_addr, 6);
+
+    uint8_t mac[PROTO_SHA256_LEN];
+    proto_hmac(master, msg, sizeof(msg), mac);
+    memcpy(key, mac, PROTO_AUTH_KEY_LEN);
+}
+
+static void tag_of(const proto_hmac_key_t *key, const uint8_t *data, size_t len, uint8_t tag[PROTO_AUTH_TAG_LEN]) {
+    uint8_t mac[PROTO_SHA256_LEN];
+    proto_hmac(key, data, len, mac);
+    memcpy(tag, mac, PROTO_AUTH_TAG_LEN);
+}
+
+proto_err_t proto_auth_seal(const proto_hmac_key_t *key, uint32_t counter, const uint8_t *data, size_t len,
+                            uint8_t *out, size_t cap, size_t *out_len) {
+    if (key == NULL || (data == NULL && len > 0) || out == NULL || out_len == NULL) {
+        return PROTO_ERR_INVALID_ARG;
+    }
+
+    size_t n;
+    if (len < PROTO_HDR_LEN || data[0] != PROTO_MAGIC) {
+        // Raw payload: a header of its own.
+        if (cap < PROTO_HDR_LEN + PROTO_AUTH_OVERHEAD || cap - PROTO_HDR_LEN - PROTO_AUTH_OVERHEAD < len) {
+            return PROTO_ERR_TOO_LARGE;
+        }
+        n = proto_write_hdr2(out, 0, PROTO_FLAG2_AUTH);
+        proto_put_u32(out + n, counter);
+        n += PROTO_AUTH_HDR_LEN;
+        if (len > 0) {
+            memcpy(out + n, data, len);
+        }
+        n += len;
+    } else {
+        // The second flags byte comes after the extension headers of the first.
+        const size_t at = PROTO_HDR_LEN + ((data[1] & PROTO_FLAG_FRAG) ? PROTO_FRAG_HDR_LEN : 0) +
+                          ((data[1] & PROTO_FLAG_SEQ) ? PROTO_SEQ_HDR_LEN : 0);
+        const bool ext = data[1] & PROTO_FLAG_EXT;
+        if (len < at + (ext ? PROTO_EXT_HDR_LEN : 0)) {
+            return PROTO_ERR_TRUNCATED;
+        }
+        if (ext && (data[at] & PROTO_FLAG2_AUTH)) {
+            return PROTO_ERR_INVALID_ARG;
+        }
+        const size_t grow = PROTO_AUTH_OVERHEAD - (ext ? PROTO_EXT_HDR_LEN : 0);
+        if (cap < grow || cap - grow < len) {
+            return PROTO_ERR_TOO_LARGE;
+        }
+
+        memcpy(out, data, at);
+        out[1] |= PROTO_FLAG_EXT;
+        out[at] = (ext ? data[at] : 0) | PROTO_FLAG2_AUTH;
+        n = at + PROTO_EXT_HDR_LEN;
+        proto_put_u32(out + n, counter);
+        n += PROTO_AUTH_HDR_LEN;
+
+        // Headers of lower PROTO_FLAG2_* bits would precede the counter, none of them has one yet.
+        const size_t rest = at + (ext ? PROTO_EXT_HDR_LEN : 0);
+        memcpy(out + n, data + rest, len - rest);
+        n += len - rest;
+    }
+
+    tag_of(key, out, n, out + n);
+    *out_len = n + PROTO_AUTH_TAG_LEN;
+
+    return PROTO_OK;
+}
+
+proto_err_t proto_auth_verify(const proto_hmac_key_t *key, const uint8_t *data, size_t len) {
+    if (key == NULL || data == NULL) {
+        return PROTO_ERR_INVALID_ARG;
+    }
+    if (len < PROTO_HDR_LEN + PROTO_AUTH_OVERHEAD) {
+        return PROTO_ERR_TRUNCATED;
+    }
+
+    uint8_t tag[PROTO_AUTH_TAG_LEN];
+    tag_of(key, data, len - PROTO_AUTH_TAG_LEN, tag);
+    return proto_ct_compare(tag, data + len - PROTO_AUTH_TAG_LEN, PROTO_AUTH_TAG_LEN) == 0 ? PROTO_OK : PROTO_ERR_CRC;
+}
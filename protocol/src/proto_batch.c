@@ -0,0 +1,32 @@
+#include "proto_batch.h"
+
+#include <string.h>
+
+size_t proto_batch_put(uint8_t *out, size_t cap, const uint8_t *data, size_t len) {
+    if (len > PROTO_BATCH_REC_MAX_LEN || cap < PROTO_BATCH_REC_HDR_LEN || cap - PROTO_BATCH_REC_HDR_LEN < len) {
+        return 0;
+    }
+
+    out[0] = (uint8_t)len;
+    if (len > 0) {
+        memcpy(out + PROTO_BATCH_REC_HDR_LEN, data, len);
+    }
+    return PROTO_BATCH_REC_HDR_LEN + len;
+}
+
+proto_err_t proto_batch_next(proto_batch_reader_t *r, const uint8_t **data, size_t *len) {
+    if (r->p >= r->end) {
+        return PROTO_ERR_END;
+    }
+
+    const size_t n = r->p[0];
+    if ((size_t)(r->end - r->p) - PROTO_BATCH_REC_HDR_LEN < n) {
+        r->p = r->end;
+        return PROTO_ERR_TRUNCATED;
+    }
+
+    *data = r->p + PROTO_BATCH_REC_HDR_LEN;
+    *len = n;
+    r->p += PROTO_BATCH_REC_HDR_LEN + n;
+    return PROTO_OK;
+}
@@ -0,0 +1,26 @@
+#include "proto_beacon.h"
+
+#include <string.h>
+
+size_t proto_beacon_write(uint8_t *out, size_t cap, const proto_beacon_t *beacon) {
+    if (cap < PROTO_BEACON_LEN) {
+        return 0;
+    }
+
+    uint8_t *p = out + proto_write_hdr(out, PROTO_FLAG_BEACON);
+    memcpy(p, beacon->mac_addr, sizeof(beacon->mac_addr));
+    p[6] = beacon->channel;
+    proto_put_u32(p + 7, beacon->epoch);
+    return PROTO_BEACON_LEN;
+}
+
+proto_err_t proto_beacon_parse(const uint8_t *payload, size_t len, proto_beacon_t *out) {
+    if (len < PROTO_BEACON_PAYLOAD_LEN) {
+        return PROTO_ERR_TRUNCATED;
+    }
+
+    memcpy(out->mac_addr, payload, sizeof(out->mac_addr));
+    out->channel = payload[6];
+    out->epoch = proto_get_u32(payload + 7);
+    return PROTO_OK;
+}
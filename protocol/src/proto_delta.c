@@ -0,0 +1,131 @@
+#include "proto_delta.h"
+
+#include <stdbool.h>
+
+#include "proto_batch.h"
+#include "proto_tlv.h"
+
+static const uint64_t *find(const proto_delta_ref_t *ref, uint32_t id) {
+    for (size_t i = 0; i < ref->count; i++) {
+        if (ref->fields[i].id == id) {
+            return &ref->fields[i].value;
+        }
+    }
+    return NULL;
+}
+
+static void remember(proto_delta_ref_t *ref, uint32_t id, uint64_t value) {
+    if (ref->count == PROTO_DELTA_MAX_FIELDS || find(ref, id) != NULL) {
+        return;
+    }
+    ref->fields[ref->count].id = id;
+    ref->fields[ref->count].value = value;
+    ref->count++;
+}
+
+// Both directions walk the same fields, only what is written for a referenced varint differs.
+static proto_err_t transform(proto_delta_ref_t *ref, const uint8_t *rec, size_t len, uint8_t *out, size_t cap,
+                             size_t *out_len, bool encode) {
+    if ((rec == NULL && len > 0) || out_len == NULL) {
+        return PROTO_ERR_INVALID_ARG;
+    }
+
+    proto_delta_ref_t next;
+    proto_delta_ref_init(&next);
+
+    proto_tlv_writer_t w;
+    proto_tlv_writer_init(&w, out, cap);
+
+    proto_tlv_reader_t r;
+    proto_tlv_reader_init(&r, rec, len);
+
+    proto_tlv_field_t f;
+    proto_err_t err;
+    while ((err = proto_tlv_next(&r, &f)) == PROTO_OK) {
+        switch (f.wire) {
+        case PROTO_WT_VARINT: {
+            const uint64_t *prev = find(ref, f.id);
+            uint64_t plain = f.u;
+            uint64_t put = f.u;
+            if (prev != NULL && encode) {
+                put = proto_zigzag((int64_t)(f.u - *prev));
+            } else if (prev != NULL) {
+                plain = *prev + (uint64_t)proto_unzigzag(f.u);
+                put = plain;
+            }
+            remember(&next, f.id, plain);
+            proto_tlv_put_uint(&w, f.id, put);
+            break;
+        }
+        case PROTO_WT_FIXED32:
+            proto_tlv_put_float(&w, f.id, f.f);
+            break;
+        case PROTO_WT_BYTES:
+            proto_tlv_put_bytes(&w, f.id, f.bytes.data, f.bytes.len);
+            break;
+        }
+    }
+
+    if (err != PROTO_ERR_END) {
+        return err;
+    }
+    if (w.overflow) {
+        return PROTO_ERR_TOO_LARGE;
+    }
+
+    *ref = next;
+    *out_len = w.len;
+    return PROTO_OK;
+}
+
+proto_err_t proto_delta_encode(proto_delta_ref_t *ref, const uint8_t *rec, size_t len, uint8_t *out, size_t cap,
+                               size_t *out_len) {
+    return transform(ref, rec, len, out, cap, out_len, true);
+}
+
+proto_err_t proto_delta_decode(proto_delta_ref_t *ref, const uint8_t *rec, size_t len, uint8_t *out, size_t cap,
+                               size_t *out_len) {
+    return transform(ref, rec, len, out, cap, out_len, false);
+}
+
+proto_err_t proto_delta_unpack(const uint8_t *payload, size_t len, uint8_t *out, size_t cap, size_t *out_len) {
+    if ((payload == NULL && len > 0) || out == NULL || out_len == NULL) {
+        return PROTO_ERR_INVALID_ARG;
+    }
+
+    proto_delta_ref_t ref;
+    proto_delta_ref_init(&ref);
+
+    proto_batch_reader_t r;
+    proto_batch_reader_init(&r, payload, len);
+
+    size_t n = 0;
+    const uint8_t *rec;
+    size_t rec_len;
+    proto_err_t err;
+    while ((err = proto_batch_next(&r, &rec, &rec_len)) == PROTO_OK) {
+        if (cap - n < PROTO_BATCH_REC_HDR_LEN) {
+            return PROTO_ERR_TOO_LARGE;
+        }
+
+        size_t room = cap - n - PROTO_BATCH_REC_HDR_LEN;
+        if (room > PROTO_BATCH_REC_MAX_LEN) {
+            room = PROTO_BATCH_REC_MAX_LEN;
+        }
+
+        size_t plain_len;
+        err = proto_delta_decode(&ref, rec, rec_len, out + n + PROTO_BATCH_REC_HDR_LEN, room, &plain_len);
+        if (err != PROTO_OK) {
+            return err;
+        }
+        out[n] = (uint8_t)plain_len;
+        n += PROTO_BATCH_REC_HDR_LEN + plain_len;
+    }
+
+    if (err != PROTO_ERR_END) {
+        return err;
+    }
+
+    *out_len = n;
+    return PROTO_OK;
+}
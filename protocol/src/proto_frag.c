@@ -0,0 +1,312 @@
+#include "proto_frag.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+proto_err_t proto_frag_hdr_parse(const uint8_t *p, size_t len, proto_frag_hdr_t *out) {
+    if (p == NULL || out == NULL) {
+        return PROTO_ERR_INVALID_ARG;
+    }
+    if (len < PROTO_FRAG_HDR_LEN) {
+        return PROTO_ERR_TRUNCATED;
+    }
+
+    out->msg_id = proto_get_u16(p);
+    out->index = p[2];
+    out->count = p[3];
+    out->total_len = proto_get_u16(p + 4);
+    out->crc = proto_get_u32(p + 6);
+
+    if (out->count == 0 || out->index >= out->count || out->total_len < out->count) {
+        return PROTO_ERR_INVALID_ARG;
+    }
+
+    return PROTO_OK;
+}
+
+proto_err_t proto_frag_begin(proto_fragmenter_t *f, uint16_t msg_id, const uint8_t *data, size_t len, size_t mtu) {
+    if (f == NULL || data == NULL || len == 0 || mtu <= PROTO_FRAG_OVERHEAD) {
+        return PROTO_ERR_INVALID_ARG;
+    }
+    if (len > PROTO_FRAG_MAX_LEN) {
+        return PROTO_ERR_TOO_LARGE;
+    }
+
+    const size_t max_payload = mtu - PROTO_FRAG_OVERHEAD;
+    const size_t count = (len + max_payload - 1) / max_payload;
+    if (count > PROTO_FRAG_MAX_COUNT) {
+        return PROTO_ERR_TOO_LARGE;
+    }
+
+    f->flags = PROTO_FLAG_FRAG;
+    f->data = data;
+    f->hdr.msg_id = msg_id;
+    f->hdr.index = 0;
+    f->hdr.count = (uint8_t)count;
+    f->hdr.total_len = (uint16_t)len;
+    f->hdr.crc = proto_crc32(0, data, len);
+    f->chunk = proto_frag_chunk(f->hdr.total_len, f->hdr.count);
+    f->offset = 0;
+
+    return PROTO_OK;
+}
+
+size_t proto_frag_next(proto_fragmenter_t *f, uint8_t *out) {
+    if (f->offset >= f->hdr.total_len) {
+        return 0;
+    }
+
+    size_t n = f->hdr.total_len - f->offset;
+    if (n > f->chunk) {
+        n = f->chunk;
+    }
+
+    uint8_t *p = out + proto_write_hdr(out, f->flags);
+    proto_put_u16(p, f->hdr.msg_id);
+    p[2] = f->hdr.index;
+    p[3] = f->hdr.count;
+    proto_put_u16(p + 4, f->hdr.total_len);
+    proto_put_u32(p + 6, f->hdr.crc);
+    p += PROTO_FRAG_HDR_LEN;
+
+    memcpy(p, f->data + f->offset, n);
+
+    f->offset += n;
+    f->hdr.index++;
+
+    return PROTO_FRAG_OVERHEAD + n;
+}
+
+proto_err_t proto_reasm_init(proto_reasm_t *r, proto_reasm_slot_t *slots, size_t nslots, size_t mem_cap,
+                             uint32_t timeout_ms) {
+    if (r == NULL || slots == NULL || nslots == 0) {
+        return PROTO_ERR_INVALID_ARG;
+    }
+
+    memset(r, 0, sizeof(*r));
+    memset(slots, 0, nslots * sizeof(*slots));
+    r->slots = slots;
+    r->nslots = nslots;
+    r->mem_cap = mem_cap;
+    r->timeout_ms = timeout_ms;
+
+    return PROTO_OK;
+}
+
+static void slot_free(proto_reasm_t *r, proto_reasm_slot_t *s) {
+    free(s->buf);
+    r->mem_used -= s->total_len;
+    memset(s, 0, sizeof(*s));
+}
+
+void proto_reasm_deinit(proto_reasm_t *r) {
+    for (size_t i = 0; i < r->nslots; i++) {
+        if (r->slots[i].used) {
+            slot_free(r, &r->slots[i]);
+        }
+    }
+}
+
+static bool recently_done(const proto_reasm_t *r, const uint8_t *mac_addr, const proto_frag_hdr_t *hdr,
+                          uint32_t now_ms) {
+    for (size_t i = 0; i < PROTO_REASM_DONE_HISTORY; i++) {
+        const proto_reasm_done_t *d = &r->done[i];
+        if (d->used && d->msg_id == hdr->msg_id && d->total_len == hdr->total_len && d->crc == hdr->crc &&
+            now_ms - d->done_ms < r->timeout_ms && memcmp(d->mac_addr, mac_addr, 6) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void remember_done(proto_reasm_t *r, const uint8_t *mac_addr, const proto_frag_hdr_t *hdr, uint32_t now_ms) {
+    proto_reasm_done_t *d = &r->done[r->done_next];
+    d->used = true;
+    memcpy(d->mac_addr, mac_addr, 6);
+    d->msg_id = hdr->msg_id;
+    d->total_len = hdr->total_len;
+    d->crc = hdr->crc;
+    d->done_ms = now_ms;
+    r->done_next = (r->done_next + 1) % PROTO_REASM_DONE_HISTORY;
+}
+
+static proto_reasm_slot_t *slot_find(proto_reasm_t *r, const uint8_t *mac_addr, uint16_t msg_id) {
+    for (size_t i = 0; i < r->nslots; i++) {
+        proto_reasm_slot_t *s = &r->slots[i];
+        if (s->used && s->msg_id == msg_id && memcmp(s->mac_addr, mac_addr, 6) == 0) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static proto_reasm_slot_t *slot_oldest(proto_reasm_t *r, uint32_t now_ms) {
+    proto_reasm_slot_t *oldest = NULL;
+    for (size_t i = 0; i < r->nslots; i++) {
+        proto_reasm_slot_t *s = &r->slots[i];
+        if (s->used && (oldest == NULL || now_ms - s->started_ms > now_ms - oldest->started_ms)) {
+            oldest = s;
+        }
+    }
+    return oldest;
+}
+
+static proto_reasm_slot_t *slot_open(proto_reasm_t *r, const uint8_t *mac_addr, const proto_frag_hdr_t *hdr,
+                                     uint32_t now_ms) {
+    if (hdr->total_len > r->mem_cap) {
+        return NULL;
+    }
+
+    proto_reasm_slot_t *free_slot = NULL;
+    for (;;) {
+        for (size_t i = 0; i < r->nslots && free_slot == NULL; i++) {
+            if (!r->slots[i].used) {
+                free_slot = &r->slots[i];
+            }
+        }
+
+        if (free_slot != NULL && r->mem_used + hdr->total_len <= r->mem_cap) {
+            break;
+        }
+
+        proto_reasm_slot_t *victim = slot_oldest(r, now_ms);
+        if (victim == NULL) {
+            return NULL;
+        }
+        slot_free(r, victim);
+        r->stats.evicted++;
+    }
+
+    uint8_t *buf = malloc(hdr->total_len);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    free_slot->used = true;
+    memcpy(free_slot->mac_addr, mac_addr, 6);
+    free_slot->msg_id = hdr->msg_id;
+    free_slot->count = hdr->count;
+    free_slot->total_len = hdr->total_len;
+    free_slot->crc = hdr->crc;
+    free_slot->started_ms = now_ms;
+    free_slot->buf = buf;
+    r->mem_used += hdr->total_len;
+
+    return free_slot;
+}
+
+proto_err_t proto_reasm_push(proto_reasm_t *r, const uint8_t *mac_addr, const proto_frag_hdr_t *hdr,
+                             const uint8_t *payload, size_t len, uint32_t now_ms, proto_msg_t *out) {
+    if (r == NULL || mac_addr == NULL || hdr == NULL || payload == NULL || out == NULL) {
+        return PROTO_ERR_INVALID_ARG;
+    }
+
+    const size_t chunk = proto_frag_chunk(hdr->total_len, hdr->count);
+    const size_t offset = (size_t)hdr->index * chunk;
+    const size_t expected = (hdr->index + 1 < hdr->count) ? chunk : (size_t)hdr->total_len - offset;
+    if (offset >= hdr->total_len || len != expected) {
+        r->stats.malformed++;
+        return PROTO_ERR_INVALID_ARG;
+    }
+
+    if (recently_done(r, mac_addr, hdr, now_ms)) {
+        r->stats.duplicates++;
+        return PROTO_ERR_DUPLICATE;
+    }
+
+    if (hdr->count == 1) { // single fragment, hand out without copying
+        if (proto_crc32(0, payload, len) != hdr->crc) {
+            r->stats.crc_errors++;
+            return PROTO_ERR_CRC;
+        }
+        memcpy(out->mac_addr, mac_addr, 6);
+        out->msg_id = hdr->msg_id;
+        out->data = payload;
+        out->len = len;
+        out->buf_ = NULL;
+        remember_done(r, mac_addr, hdr, now_ms);
+        r->stats.completed++;
+        return PROTO_OK;
+    }
+
+    proto_reasm_slot_t *s = slot_find(r, mac_addr, hdr->msg_id);
+    if (s != NULL && (s->count != hdr->count || s->total_len != hdr->total_len || s->crc != hdr->crc)) {
+        // msg_id reused by a restarted sender, the old message can never complete.
+        slot_free(r, s);
+        r->stats.evicted++;
+        s = NULL;
+    }
+    if (s == NULL) {
+        s = slot_open(r, mac_addr, hdr, now_ms);
+        if (s == NULL) {
+            return PROTO_ERR_NO_MEM;
+        }
+    }
+
+    const uint32_t bit = UINT32_C(1) << (hdr->index % 32);
+    if (s->seen[hdr->index / 32] & bit) {
+        r->stats.duplicates++;
+        return PROTO_ERR_DUPLICATE;
+    }
+    s->seen[hdr->index / 32] |= bit;
+    s->received++;
+    memcpy(s->buf + offset, payload, len);
+
+    if (s->received < s->count) {
+        return PROTO_ERR_INCOMPLETE;
+    }
+
+    if (proto_crc32(0, s->buf, s->total_len) != s->crc) {
+        r->stats.crc_errors++;
+        slot_free(r, s);
+        return PROTO_ERR_CRC;
+    }
+
+    memcpy(out->mac_addr, s->mac_addr, 6);
+    out->msg_id = s->msg_id;
+    out->data = s->buf;
+    out->len = s->total_len;
+    out->buf_ = s->buf;
+
+    // Buffer ownership moves to the message, memory stays accounted until release.
+    remember_done(r, s->mac_addr, hdr, now_ms);
+    memset(s, 0, sizeof(*s));
+    r->stats.completed++;
+
+    return PROTO_OK;
+}
+
+void proto_reasm_release(proto_reasm_t *r, proto_msg_t *msg) {
+    if (r == NULL || msg == NULL || msg->buf_ == NULL) {
+        return;
+    }
+
+    free(msg->buf_);
+    r->mem_used -= msg->len;
+    msg->buf_ = NULL;
+    msg->data = NULL;
+}
+
+uint32_t proto_reasm_expire(proto_reasm_t *r, uint32_t now_ms) {
+    uint32_t next = UINT32_MAX;
+
+    for (size_t i = 0; i < r->nslots; i++) {
+        proto_reasm_slot_t *s = &r->slots[i];
+        if (!s->used) {
+            continue;
+        }
+
+        const uint32_t age = now_ms - s->started_ms;
+        if (age >= r->timeout_ms) {
+            slot_free(r, s);
+            r->stats.timeouts++;
+            continue;
+        }
+
+        if (r->timeout_ms - age < next) {
+            next = r->timeout_ms - age;
+        }
+    }
+
+    return next;
+}
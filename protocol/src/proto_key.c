@@ -0,0 +1,243 @@
+#include "proto_key.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#define WRAP_OFF_PAIR_RESP (1 + PROTO_KEY_NONCE_LEN + 4)
+#define WRAP_OFF_REKEY (1 + 4 + 4)
+
+// Body of a message: its type byte and fields, the tag last. Returns the length with the tag, 0 for an unknown
+// type. *wrap_off is where the wrapped key starts, 0 if the type has none.
+static size_t write_body(const proto_key_msg_t *msg, uint8_t *body, size_t *wrap_off) {
+    size_t n = 0;
+    *wrap_off = 0;
+
+    body[n++] = msg->type;
+    switch (msg->type) {
+    case PROTO_KEY_PAIR_REQ:
+        memcpy(body + n, msg->nonce, PROTO_KEY_NONCE_LEN);
+        n += PROTO_KEY_NONCE_LEN;
+        break;
+    case PROTO_KEY_PAIR_RESP:
+        memcpy(body + n, msg->nonce, PROTO_KEY_NONCE_LEN);
+        n += PROTO_KEY_NONCE_LEN;
+        proto_put_u32(body + n, msg->epoch);
+        n += 4;
+        *wrap_off = n;
+        memcpy(body + n, msg->key, PROTO_KEY_LEN);
+        n += PROTO_KEY_LEN;
+        break;
+    case PROTO_KEY_HELLO:
+        proto_put_u32(body + n, msg->epoch);
+        proto_put_u32(body + n + 4, msg->count);
+        n += 8;
+        break;
+    case PROTO_KEY_READY:
+        proto_put_u32(body + n, msg->epoch);
+        proto_put_u32(body + n + 4, msg->count);
+        proto_put_u16(body + n + 8, msg->lease_s);
+        n += 10;
+        break;
+    case PROTO_KEY_REKEY:
+        proto_put_u32(body + n, msg->epoch);
+        proto_put_u32(body + n + 4, msg->count);
+        n += 8;
+        *wrap_off = n;
+        memcpy(body + n, msg->key, PROTO_KEY_LEN);
+        n += PROTO_KEY_LEN;
+        break;
+    default:
+        return 0;
+    }
+
+    memcpy(body + n, msg->tag, PROTO_KEY_TAG_LEN);
+    return n + PROTO_KEY_TAG_LEN;
+}
+
+size_t proto_key_write(uint8_t *out, size_t cap, const proto_key_msg_t *msg) {
+    uint8_t body[PROTO_KEY_MAX_LEN];
+    size_t wrap_off;
+    const size_t n = write_body(msg, body, &wrap_off);
+
+    if (n == 0 || cap < PROTO_HDR_LEN + PROTO_EXT_HDR_LEN + n) {
+        return 0;
+    }
+    const size_t hdr = proto_write_hdr2(out, 0, PROTO_FLAG2_KEY);
+    memcpy(out + hdr, body, n);
+    return hdr + n;
+}
+
+proto_err_t proto_key_parse(const uint8_t *payload, size_t len, proto_key_msg_t *out) {
+    if (len < 1) {
+        return PROTO_ERR_TRUNCATED;
+    }
+
+    memset(out, 0, sizeof(*out));
+    out->type = payload[0];
+    const uint8_t *p = payload + 1;
+    size_t need;
+
+    switch (out->type) {
+    case PROTO_KEY_PAIR_REQ:
+        need = PROTO_KEY_NONCE_LEN;
+        break;
+    case PROTO_KEY_PAIR_RESP:
+        need = PROTO_KEY_NONCE_LEN + 4 + PROTO_KEY_LEN;
+        break;
+    case PROTO_KEY_HELLO:
+        need = 8;
+        break;
+    case PROTO_KEY_READY:
+        need = 10;
+        break;
+    case PROTO_KEY_REKEY:
+        need = 8 + PROTO_KEY_LEN;
+        break;
+    default:
+        return PROTO_ERR_INVALID_ARG;
+    }
+    if (len - 1 < need + PROTO_KEY_TAG_LEN) {
+        return PROTO_ERR_TRUNCATED;
+    }
+
+    switch (out->type) {
+    case PROTO_KEY_PAIR_REQ:
+        memcpy(out->nonce, p, PROTO_KEY_NONCE_LEN);
+        break;
+    case PROTO_KEY_PAIR_RESP:
+        memcpy(out->nonce, p, PROTO_KEY_NONCE_LEN);
+        out->epoch = proto_get_u32(p + PROTO_KEY_NONCE_LEN);
+        memcpy(out->key, p + PROTO_KEY_NONCE_LEN + 4, PROTO_KEY_LEN);
+        break;
+    case PROTO_KEY_HELLO:
+        out->epoch = proto_get_u32(p);
+        out->count = proto_get_u32(p + 4);
+        break;
+    case PROTO_KEY_READY:
+        out->epoch = proto_get_u32(p);
+        out->count = proto_get_u32(p + 4);
+        out->lease_s = proto_get_u16(p + 8);
+        break;
+    default: // PROTO_KEY_REKEY
+        out->epoch = proto_get_u32(p);
+        out->count = proto_get_u32(p + 4);
+        memcpy(out->key, p + 8, PROTO_KEY_LEN);
+        break;
+    }
+    memcpy(out->tag, p + need, PROTO_KEY_TAG_LEN);
+    return PROTO_OK;
+}
+
+void proto_key_derive(const proto_hmac_key_t *master, const uint8_t mac_addr[6], uint32_t epoch,
+                      uint8_t lmk[PROTO_KEY_LEN]) {
+    uint8_t msg[3 + 6 + 4];
+    memcpy(msg, "lmk", 3);
+    memcpy(msg + 3, mac_addr, 6);
+    proto_put_u32(msg + 9, epoch);
+
+    uint8_t mac[PROTO_SHA256_LEN];
+    proto_hmac(master, msg, sizeof(msg), mac);
+    memcpy(lmk, mac, PROTO_KEY_LEN);
+}
+
+void proto_key_derive_pair(const proto_hmac_key_t *master, const uint8_t mac_addr[6], uint8_t key[PROTO_KEY_LEN]) {
+    uint8_t msg[4 + 6];
+    memcpy(msg, "pair", 4);
+    memcpy(msg + 4, mac_addr, 6);
+
+    uint8_t mac[PROTO_SHA256_LEN];
+    proto_hmac(master, msg, sizeof(msg), mac);
+    memcpy(key, mac, PROTO_KEY_LEN);
+}
+
+// HMAC(key, label | MAC | data), the tags of all messages and the keystream of wrapped keys.
+static void key_mac(const proto_hmac_key_t *key, const char *label, const uint8_t mac_addr[6], const uint8_t *data,
+                    size_t len, uint8_t out[PROTO_SHA256_LEN]) {
+    proto_sha256_t s;
+    proto_hmac_start(key, &s);
+    proto_sha256_update(&s, label, strlen(label));
+    proto_sha256_update(&s, mac_addr, 6);
+    proto_sha256_update(&s, data, len);
+    proto_hmac_finish(key, &s, out);
+}
+
+static bool signed_type(uint8_t type) {
+    return type == PROTO_KEY_PAIR_REQ || type == PROTO_KEY_HELLO || type == PROTO_KEY_READY;
+}
+
+static bool wrapped_type(uint8_t type) {
+    return type == PROTO_KEY_PAIR_RESP || type == PROTO_KEY_REKEY;
+}
+
+// Tag over the body as it goes on the air, so every field of every type is covered.
+static void body_tag(const proto_hmac_key_t *key, const uint8_t mac_addr[6], const proto_key_msg_t *msg,
+                     uint8_t out[PROTO_SHA256_LEN]) {
+    uint8_t body[PROTO_KEY_MAX_LEN];
+    size_t wrap_off;
+    const size_t n = write_body(msg, body, &wrap_off);
+    key_mac(key, "tag", mac_addr, body, n - PROTO_KEY_TAG_LEN, out);
+}
+
+// Keystream of the wrapped key, over the fields in front of it.
+static void wrap_stream(const proto_hmac_key_t *key, const uint8_t mac_addr[6], const proto_key_msg_t *msg,
+                        uint8_t out[PROTO_SHA256_LEN]) {
+    uint8_t body[PROTO_KEY_MAX_LEN];
+    size_t wrap_off;
+    write_body(msg, body, &wrap_off);
+    key_mac(key, "wrap", mac_addr, body, wrap_off, out);
+}
+
+void proto_key_sign(const proto_hmac_key_t *key, const uint8_t mac_addr[6], proto_key_msg_t *msg) {
+    uint8_t tag[PROTO_SHA256_LEN];
+    if (signed_type(msg->type)) {
+        body_tag(key, mac_addr, msg, tag);
+        memcpy(msg->tag, tag, PROTO_KEY_TAG_LEN);
+    }
+}
+
+proto_err_t proto_key_verify(const proto_hmac_key_t *key, const uint8_t mac_addr[6], const proto_key_msg_t *msg) {
+    if (!signed_type(msg->type)) {
+        return PROTO_ERR_INVALID_ARG;
+    }
+
+    uint8_t tag[PROTO_SHA256_LEN];
+    body_tag(key, mac_addr, msg, tag);
+    return proto_ct_compare(tag, msg->tag, PROTO_KEY_TAG_LEN) == 0 ? PROTO_OK : PROTO_ERR_CRC;
+}
+
+void proto_key_wrap(const proto_hmac_key_t *key, const uint8_t mac_addr[6], const uint8_t lmk[PROTO_KEY_LEN],
+                    proto_key_msg_t *msg) {
+    if (!wrapped_type(msg->type)) {
+        return;
+    }
+
+    uint8_t stream[PROTO_SHA256_LEN];
+    wrap_stream(key, mac_addr, msg, stream);
+    for (size_t i = 0; i < PROTO_KEY_LEN; i++) {
+        msg->key[i] = lmk[i] ^ stream[i];
+    }
+
+    uint8_t tag[PROTO_SHA256_LEN];
+    body_tag(key, mac_addr, msg, tag);
+    memcpy(msg->tag, tag, PROTO_KEY_TAG_LEN);
+}
+
+proto_err_t proto_key_unwrap(const proto_hmac_key_t *key, const uint8_t mac_addr[6], const proto_key_msg_t *msg,
+                             uint8_t lmk[PROTO_KEY_LEN]) {
+    if (!wrapped_type(msg->type)) {
+        return PROTO_ERR_INVALID_ARG;
+    }
+
+    uint8_t tag[PROTO_SHA256_LEN];
+    body_tag(key, mac_addr, msg, tag);
+    if (proto_ct_compare(tag, msg->tag, PROTO_KEY_TAG_LEN) != 0) {
+        return PROTO_ERR_CRC;
+    }
+
+    uint8_t stream[PROTO_SHA256_LEN];
+    wrap_stream(key, mac_addr, msg, stream);
+    for (size_t i = 0; i < PROTO_KEY_LEN; i++) {
+        lmk[i] = msg->key[i] ^ stream[i];
+    }
+    return PROTO_OK;
+}
@@ -0,0 +1,125 @@
+#include "proto_schema.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+
+#define PROTO_FIELD(id_, name_, type_, decimals_)                                                                      \
+    _Static_assert((id_) >= 1 && (id_) <= PROTO_SCHEMA_MAX_ID, "schema id out of range: " #name_);                     \
+    _Static_assert((decimals_) <= 9, "too many decimals: " #name_);
+#include "proto_schema.def"
+#undef PROTO_FIELD
+
+// Indexed by id; a duplicate id trips -Woverride-init.
+static const proto_field_desc_t s_fields[PROTO_SCHEMA_MAX_ID + 1] = {
+#define PROTO_FIELD(id_, name_, type_, decimals_) [id_] = {#name_, (id_), PROTO_TYPE_##type_, (decimals_)},
+#include "proto_schema.def"
+#undef PROTO_FIELD
+};
+
+static const uint32_t s_pow10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+const proto_field_desc_t *proto_schema_find(uint32_t id) {
+    if (id > PROTO_SCHEMA_MAX_ID || s_fields[id].name == NULL) {
+        return NULL;
+    }
+    return &s_fields[id];
+}
+
+static int fit(int n, size_t cap) {
+    return n < 0 || (size_t)n >= cap ? -1 : n;
+}
+
+// Fixed-point rendering without floating point: 1234 with 2 decimals is "12.34".
+static int format_scaled(uint64_t mag, bool negative, uint8_t decimals, char *out, size_t cap) {
+    const char *sign = negative ? "-" : "";
+    if (decimals == 0) {
+        return fit(snprintf(out, cap, "%s%" PRIu64, sign, mag), cap);
+    }
+
+    const uint32_t scale = s_pow10[decimals];
+    return fit(snprintf(out, cap, "%s%" PRIu64 ".%0*" PRIu64, sign, mag / scale, (int)decimals, mag % scale), cap);
+}
+
+static int format_hex(const uint8_t *data, size_t len, char *out, size_t cap) {
+    if (cap < 2 * len + 3) {
+        return -1;
+    }
+
+    static const char digits[] = "0123456789abcdef";
+    char *p = out;
+    *p++ = '"';
+    for (size_t i = 0; i < len; i++) {
+        *p++ = digits[data[i] >> 4];
+        *p++ = digits[data[i] & 0x0F];
+    }
+    *p++ = '"';
+    *p = '\0';
+
+    return (int)(p - out);
+}
+
+int proto_schema_format_value(const proto_tlv_field_t *field, char *out, size_t cap) {
+    const proto_field_desc_t *desc = proto_schema_find(field->id);
+
+    switch (field->wire) {
+    case PROTO_WT_VARINT:
+        if (desc != NULL && desc->type == PROTO_TYPE_SINT) {
+            const int64_t v = proto_unzigzag(field->u);
+            const uint64_t mag = v < 0 ? -(uint64_t)v : (uint64_t)v;
+            return format_scaled(mag, v < 0, desc->decimals, out, cap);
+        }
+        return format_scaled(field->u, false, desc != NULL ? desc->decimals : 0, out, cap);
+
+    case PROTO_WT_FIXED32:
+        if (!isfinite(field->f)) {
+            return fit(snprintf(out, cap, "null"), cap);
+        }
+        return fit(snprintf(out, cap, "%g", (double)field->f), cap);
+
+    case PROTO_WT_BYTES:
+        return format_hex(field->bytes.data, field->bytes.len, out, cap);
+    }
+
+    return -1;
+}
+
+int proto_schema_to_json(const uint8_t *data, size_t len, char *out, size_t cap) {
+    if (cap < 3) {
+        return -1;
+    }
+
+    proto_tlv_reader_t r;
+    proto_tlv_reader_init(&r, data, len);
+
+    size_t n = 0;
+    out[n++] = '{';
+
+    proto_tlv_field_t field;
+    proto_err_t err;
+    while ((err = proto_tlv_next(&r, &field)) == PROTO_OK) {
+        const proto_field_desc_t *desc = proto_schema_find(field.id);
+
+        int w = desc != NULL ? snprintf(out + n, cap - n, "%s\"%s\":", n > 1 ? "," : "", desc->name)
+                             : snprintf(out + n, cap - n, "%s\"f%" PRIu32 "\":", n > 1 ? "," : "", field.id);
+        if (fit(w, cap - n) < 0) {
+            return -1;
+        }
+        n += (size_t)w;
+
+        w = proto_schema_format_value(&field, out + n, cap - n);
+        if (w < 0) {
+            return -1;
+        }
+        n += (size_t)w;
+    }
+
+    if (err != PROTO_ERR_END || cap - n < 2) {
+        return -1;
+    }
+
+    out[n++] = '}';
+    out[n] = '\0';
+
+    return (int)n;
+}
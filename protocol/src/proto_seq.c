@@ -0,0 +1,63 @@
+#include "proto_seq.h"
+
+#include <string.h>
+
+void proto_seq_init(proto_seq_t *s) {
+    memset(s, 0, sizeof(*s));
+}
+
+static void resync(proto_seq_t *s, uint16_t seq) {
+    s->window = 1;
+    s->top = seq;
+    s->span = 1;
+    s->valid = true;
+    s->accepted++;
+}
+
+// Bits of positions 0 .. span - 1, the only ones that can count as lost.
+static uint64_t span_mask(const proto_seq_t *s) {
+    return s->span >= PROTO_SEQ_WINDOW ? UINT64_MAX : ((uint64_t)1 << s->span) - 1;
+}
+
+proto_err_t proto_seq_check(proto_seq_t *s, uint16_t seq) {
+    if (!s->valid) {
+        resync(s, seq);
+        return PROTO_OK;
+    }
+
+    const int32_t diff = (int16_t)(uint16_t)(seq - s->top);
+
+    if (diff > PROTO_SEQ_RESYNC_GAP || diff <= -PROTO_SEQ_WINDOW) {
+        s->resyncs++;
+        resync(s, seq);
+        return PROTO_OK;
+    }
+
+    if (diff > 0) {
+        const uint64_t missing = span_mask(s) & ~s->window;
+        if (diff >= PROTO_SEQ_WINDOW) {
+            // Whole window leaves, plus numbers that never entered it.
+            s->lost += (uint32_t)__builtin_popcountll(missing);
+            s->lost += (uint32_t)(diff - PROTO_SEQ_WINDOW);
+            s->window = 1;
+        } else {
+            const uint64_t leaving = missing >> (PROTO_SEQ_WINDOW - diff);
+            s->lost += (uint32_t)__builtin_popcountll(leaving);
+            s->window = (s->window << diff) | 1;
+        }
+        s->span = (uint8_t)(s->span + diff < PROTO_SEQ_WINDOW ? s->span + diff : PROTO_SEQ_WINDOW);
+        s->top = seq;
+        s->accepted++;
+        return PROTO_OK;
+    }
+
+    const uint64_t bit = (uint64_t)1 << -diff;
+    if (s->window & bit) {
+        s->duplicates++;
+        return PROTO_ERR_DUPLICATE;
+    }
+
+    s->window |= bit;
+    s->accepted++;
+    return PROTO_OK;
+}
@@ -0,0 +1,168 @@
+#include "proto_sha256.h"
+
+#include <string.h>
+
+static const uint32_t s_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t s_h0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static inline uint32_t ror(uint32_t x, unsigned n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static void compress(uint32_t h[8], const uint8_t block[PROTO_SHA256_BLOCK_LEN]) {
+    uint32_t w[64];
+    for (size_t i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) |
+               ((uint32_t)block[4 * i + 2] << 8) | block[4 * i + 3];
+    }
+    for (size_t i = 16; i < 64; i++) {
+        const uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (size_t i = 0; i < 64; i++) {
+        const uint32_t t1 = hh + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + s_k[i] + w[i];
+        const uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        hh = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += hh;
+}
+
+void proto_sha256_init(proto_sha256_t *s) {
+    memcpy(s->h, s_h0, sizeof(s->h));
+    s->len = 0;
+}
+
+void proto_sha256_update(proto_sha256_t *s, const void *data, size_t len) {
+    const uint8_t *p = data;
+    size_t fill = (size_t)(s->len % PROTO_SHA256_BLOCK_LEN);
+    s->len += len;
+
+    if (fill > 0) {
+        const size_t n = len < PROTO_SHA256_BLOCK_LEN - fill ? len : PROTO_SHA256_BLOCK_LEN - fill;
+        memcpy(s->buf + fill, p, n);
+        p += n;
+        len -= n;
+        fill += n;
+        if (fill < PROTO_SHA256_BLOCK_LEN) {
+            return;
+        }
+        compress(s->h, s->buf);
+    }
+
+    for (; len >= PROTO_SHA256_BLOCK_LEN; p += PROTO_SHA256_BLOCK_LEN, len -= PROTO_SHA256_BLOCK_LEN) {
+        compress(s->h, p);
+    }
+    if (len > 0) {
+        memcpy(s->buf, p, len);
+    }
+}
+
+void proto_sha256_final(proto_sha256_t *s, uint8_t out[PROTO_SHA256_LEN]) {
+    const uint64_t bits = s->len * 8;
+    size_t fill = (size_t)(s->len % PROTO_SHA256_BLOCK_LEN);
+
+    s->buf[fill++] = 0x80;
+    if (fill > PROTO_SHA256_BLOCK_LEN - 8) {
+        memset(s->buf + fill, 0, PROTO_SHA256_BLOCK_LEN - fill);
+        compress(s->h, s->buf);
+        fill = 0;
+    }
+    memset(s->buf + fill, 0, PROTO_SHA256_BLOCK_LEN - 8 - fill);
+    for (size_t i = 0; i < 8; i++) {
+        s->buf[PROTO_SHA256_BLOCK_LEN - 1 - i] = (uint8_t)(bits >> (8 * i));
+    }
+    compress(s->h, s->buf);
+
+    for (size_t i = 0; i < 8; i++) {
+        out[4 * i] = (uint8_t)(s->h[i] >> 24);
+        out[4 * i + 1] = (uint8_t)(s->h[i] >> 16);
+        out[4 * i + 2] = (uint8_t)(s->h[i] >> 8);
+        out[4 * i + 3] = (uint8_t)s->h[i];
+    }
+}
+
+void proto_hmac_key_init(proto_hmac_key_t *k, const uint8_t *key, size_t len) {
+    uint8_t block[PROTO_SHA256_BLOCK_LEN] = {0};
+    if (len > PROTO_SHA256_BLOCK_LEN) {
+        proto_sha256_t s;
+        proto_sha256_init(&s);
+        proto_sha256_update(&s, key, len);
+        proto_sha256_final(&s, block);
+    } else if (len > 0) {
+        memcpy(block, key, len);
+    }
+
+    for (size_t i = 0; i < sizeof(block); i++) {
+        block[i] ^= 0x36;
+    }
+    memcpy(k->inner, s_h0, sizeof(k->inner));
+    compress(k->inner, block);
+
+    for (size_t i = 0; i < sizeof(block); i++) {
+        block[i] ^= 0x36 ^ 0x5c;
+    }
+    memcpy(k->outer, s_h0, sizeof(k->outer));
+    compress(k->outer, block);
+
+    memset(block, 0, sizeof(block));
+}
+
+void proto_hmac_start(const proto_hmac_key_t *k, proto_sha256_t *s) {
+    memcpy(s->h, k->inner, sizeof(s->h));
+    s->len = PROTO_SHA256_BLOCK_LEN;
+}
+
+void proto_hmac_finish(const proto_hmac_key_t *k, proto_sha256_t *s, uint8_t out[PROTO_SHA256_LEN]) {
+    uint8_t inner[PROTO_SHA256_LEN];
+    proto_sha256_final(s, inner);
+
+    memcpy(s->h, k->outer, sizeof(s->h));
+    s->len = PROTO_SHA256_BLOCK_LEN;
+    proto_sha256_update(s, inner, sizeof(inner));
+    proto_sha256_final(s, out);
+}
+
+void proto_hmac(const proto_hmac_key_t *k, const void *data, size_t len, uint8_t out[PROTO_SHA256_LEN]) {
+    proto_sha256_t s;
+    proto_hmac_start(k, &s);
+    proto_sha256_update(&s, data, len);
+    proto_hmac_finish(k, &s, out);
+}
+
+int proto_ct_compare(const uint8_t *a, const uint8_t *b, size_t len) {
+    uint8_t diff = 0;
+    for (size_t i = 0; i < len; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff;
+}
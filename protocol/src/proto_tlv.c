@@ -0,0 +1,137 @@
+#include "proto_tlv.h"
+
+#include <string.h>
+
+size_t proto_varint_put(uint8_t *out, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+size_t proto_varint_get(const uint8_t *p, size_t len, uint64_t *out) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < len && i < PROTO_VARINT_MAX_LEN; i++) {
+        v |= (uint64_t)(p[i] & 0x7F) << (7 * i);
+        if ((p[i] & 0x80) == 0) {
+            *out = v;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+// Writes key, value and optional trailing data as a whole, so an overflowing field leaves nothing behind.
+static proto_err_t put(proto_tlv_writer_t *w, uint32_t id, proto_wire_t wire, const uint8_t *val, size_t val_len,
+                       const uint8_t *data, size_t data_len) {
+    if (id > PROTO_TLV_MAX_ID) {
+        return PROTO_ERR_INVALID_ARG;
+    }
+
+    uint8_t key[PROTO_VARINT_MAX_LEN];
+    const size_t key_len = proto_varint_put(key, ((uint64_t)id << 2) | wire);
+
+    if (w->overflow || w->cap - w->len < key_len + val_len || w->cap - w->len - key_len - val_len < data_len) {
+        w->overflow = true;
+        return PROTO_ERR_TOO_LARGE;
+    }
+
+    uint8_t *p = w->buf + w->len;
+    memcpy(p, key, key_len);
+    memcpy(p + key_len, val, val_len);
+    if (data_len > 0) {
+        memcpy(p + key_len + val_len, data, data_len);
+    }
+    w->len += key_len + val_len + data_len;
+
+    return PROTO_OK;
+}
+
+proto_err_t proto_tlv_put_uint(proto_tlv_writer_t *w, uint32_t id, uint64_t v) {
+    uint8_t val[PROTO_VARINT_MAX_LEN];
+    return put(w, id, PROTO_WT_VARINT, val, proto_varint_put(val, v), NULL, 0);
+}
+
+proto_err_t proto_tlv_put_sint(proto_tlv_writer_t *w, uint32_t id, int64_t v) {
+    return proto_tlv_put_uint(w, id, proto_zigzag(v));
+}
+
+proto_err_t proto_tlv_put_float(proto_tlv_writer_t *w, uint32_t id, float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+
+    uint8_t val[4];
+    proto_put_u32(val, bits);
+    return put(w, id, PROTO_WT_FIXED32, val, sizeof(val), NULL, 0);
+}
+
+proto_err_t proto_tlv_put_bytes(proto_tlv_writer_t *w, uint32_t id, const uint8_t *data, size_t len) {
+    if (data == NULL && len > 0) {
+        return PROTO_ERR_INVALID_ARG;
+    }
+
+    uint8_t hdr[PROTO_VARINT_MAX_LEN];
+    return put(w, id, PROTO_WT_BYTES, hdr, proto_varint_put(hdr, len), data, len);
+}
+
+proto_err_t proto_tlv_next(proto_tlv_reader_t *r, proto_tlv_field_t *out) {
+    if (r->p >= r->end) {
+        return PROTO_ERR_END;
+    }
+
+    uint64_t key;
+    size_t n = proto_varint_get(r->p, (size_t)(r->end - r->p), &key);
+    if (n == 0) {
+        return PROTO_ERR_TRUNCATED;
+    }
+    if ((key >> 2) > PROTO_TLV_MAX_ID) {
+        return PROTO_ERR_INVALID_ARG;
+    }
+
+    const uint8_t *p = r->p + n;
+    const size_t left = (size_t)(r->end - p);
+
+    out->id = (uint32_t)(key >> 2);
+    out->wire = (proto_wire_t)(key & 0x03);
+
+    switch (out->wire) {
+    case PROTO_WT_VARINT:
+        n = proto_varint_get(p, left, &out->u);
+        if (n == 0) {
+            return PROTO_ERR_TRUNCATED;
+        }
+        p += n;
+        break;
+
+    case PROTO_WT_FIXED32: {
+        if (left < 4) {
+            return PROTO_ERR_TRUNCATED;
+        }
+        const uint32_t bits = proto_get_u32(p);
+        memcpy(&out->f, &bits, sizeof(out->f));
+        p += 4;
+        break;
+    }
+
+    case PROTO_WT_BYTES: {
+        uint64_t len;
+        n = proto_varint_get(p, left, &len);
+        if (n == 0 || len > left - n) {
+            return PROTO_ERR_TRUNCATED;
+        }
+        out->bytes.data = p + n;
+        out->bytes.len = (size_t)len;
+        p += n + (size_t)len;
+        break;
+    }
+
+    default:
+        return PROTO_ERR_INVALID_ARG;
+    }
+
+    r->p = p;
+    return PROTO_OK;
+}
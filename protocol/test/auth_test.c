@@ -0,0 +1,214 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "proto_auth.h"
+
+#include "check.h"
+
+// SHA-256 and HMAC against the FIPS 180-4 and RFC 4231 vectors, then sealed
+// frames: they parse back to the same payload and counter, every flipped bit
+// and every other key is refused, and the headers of framed payloads survive.
+
+#define MTU 250
+
+static const uint8_t s_mac_a[6] = {0x24, 0x6F, 0x28, 0x00, 0x00, 0x01};
+static const uint8_t s_mac_b[6] = {0x24, 0x6F, 0x28, 0x00, 0x00, 0x02};
+
+static void hex(const char *s, uint8_t *out) {
+    for (size_t i = 0; s[2 * i] != '\0'; i++) {
+        unsigned v;
+        sscanf(s + 2 * i, "%2x", &v);
+        out[i] = (uint8_t)v;
+    }
+}
+
+static void check_hmac(const uint8_t *key, size_t key_len, const char *msg, const char *expect) {
+    uint8_t want[PROTO_SHA256_LEN], got[PROTO_SHA256_LEN];
+    hex(expect, want);
+    proto_hmac_key_t k;
+    proto_hmac_key_init(&k, key, key_len);
+    proto_hmac(&k, msg, strlen(msg), got);
+    CHECK(memcmp(got, want, sizeof(got)) == 0);
+
+    // Split across updates, the schedule is reusable.
+    proto_sha256_t s;
+    proto_hmac_start(&k, &s);
+    proto_sha256_update(&s, msg, strlen(msg) / 3);
+    proto_sha256_update(&s, msg + strlen(msg) / 3, strlen(msg) - strlen(msg) / 3);
+    proto_hmac_finish(&k, &s, got);
+    CHECK(memcmp(got, want, sizeof(got)) == 0);
+}
+
+static void test_vectors(void) {
+    uint8_t want[PROTO_SHA256_LEN], got[PROTO_SHA256_LEN];
+    proto_sha256_t s;
+    proto_sha256_init(&s);
+    proto_sha256_update(&s, "abc", 3);
+    proto_sha256_final(&s, got);
+    hex("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", want);
+    CHECK(memcmp(got, want, sizeof(got)) == 0);
+
+    // A million 'a' in chunks that straddle block boundaries.
+    static uint8_t chunk[997];
+    memset(chunk, 'a', sizeof(chunk));
+    proto_sha256_init(&s);
+    for (size_t done = 0; done < 1000000;) {
+        const size_t n = 1000000 - done < sizeof(chunk) ? 1000000 - done : sizeof(chunk);
+        proto_sha256_update(&s, chunk, n);
+        done += n;
+    }
+    proto_sha256_final(&s, got);
+    hex("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0", want);
+    CHECK(memcmp(got, want, sizeof(got)) == 0);
+
+    uint8_t key[131];
+    memset(key, 0x0b, 20);
+    check_hmac(key, 20, "Hi There", "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7");
+    check_hmac((const uint8_t *)"Jefe", 4, "what do ya want for nothing?",
+               "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+    memset(key, 0xaa, sizeof(key));
+    check_hmac(key, sizeof(key), "Test Using Larger Than Block-Size Key - Hash Key First",
+               "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54");
+
+    CHECK(proto_ct_compare(want, want, sizeof(want)) == 0);
+    memcpy(got, want, sizeof(got));
+    got[31] ^= 0x80;
+    CHECK(proto_ct_compare(got, want, sizeof(want)) != 0);
+}
+
+static void device_key(const proto_hmac_key_t *master, const uint8_t *mac, proto_hmac_key_t *out) {
+    uint8_t key[PROTO_AUTH_KEY_LEN];
+    proto_auth_derive(master, mac, key);
+    proto_hmac_key_init(out, key, sizeof(key));
+}
+
+static void test_derive(void) {
+    proto_hmac_key_t master, other;
+    proto_hmac_key_init(&master, (const uint8_t *)"master", 6);
+    proto_hmac_key_init(&other, (const uint8_t *)"other", 5);
+
+    uint8_t a[PROTO_AUTH_KEY_LEN], a2[PROTO_AUTH_KEY_LEN], b[PROTO_AUTH_KEY_LEN], c[PROTO_AUTH_KEY_LEN];
+    proto_auth_derive(&master, s_mac_a, a);
+    proto_auth_derive(&master, s_mac_a, a2);
+    proto_auth_derive(&master, s_mac_b, b);
+    proto_auth_derive(&other, s_mac_a, c);
+    CHECK(memcmp(a, a2, sizeof(a)) == 0);
+    CHECK(memcmp(a, b, sizeof(a)) != 0);
+    CHECK(memcmp(a, c, sizeof(a)) != 0);
+}
+
+// A raw payload sealed, parsed and verified, then every single bit flip refused.
+static void test_raw_payload(void) {
+    proto_hmac_key_t master, key, wrong;
+    proto_hmac_key_init(&master, (const uint8_t *)"master", 6);
+    device_key(&master, s_mac_a, &key);
+    device_key(&master, s_mac_b, &wrong);
+
+    const uint8_t payload[] = "temperature=21.5";
+    uint8_t frame[MTU];
+    size_t len = 0;
+    CHECK_EQ(proto_auth_seal(&key, 0x01020304, payload, sizeof(payload), frame, sizeof(frame), &len), PROTO_OK);
+    CHECK_EQ(len, PROTO_HDR_LEN + PROTO_AUTH_OVERHEAD + sizeof(payload));
+
+    proto_frame_t f;
+    CHECK_EQ(proto_parse(frame, len, &f), PROTO_OK);
+    CHECK(f.flags & PROTO_FLAG_EXT);
+    CHECK_EQ(f.flags2, PROTO_FLAG2_AUTH);
+    CHECK_EQ(f.counter, 0x01020304);
+    CHECK_EQ(f.payload_len, sizeof(payload));
+    CHECK(memcmp(f.payload, payload, sizeof(payload)) == 0);
+
+    CHECK_EQ(proto_auth_verify(&key, frame, len), PROTO_OK);
+    CHECK_EQ(proto_auth_verify(&wrong, frame, len), PROTO_ERR_CRC);
+
+    size_t refused = 0;
+    for (size_t bit = 0; bit < len * 8; bit++) {
+        frame[bit / 8] ^= (uint8_t)(1u << (bit % 8));
+        refused += proto_auth_verify(&key, frame, len) != PROTO_OK;
+        frame[bit / 8] ^= (uint8_t)(1u << (bit % 8));
+    }
+    CHECK_EQ(refused, len * 8);
+
+    // Cut short or extended, the tag no longer lines up.
+    CHECK_EQ(proto_auth_verify(&key, frame, len - 1), PROTO_ERR_CRC);
+    frame[len] = 0;
+    CHECK_EQ(proto_auth_verify(&key, frame, len + 1), PROTO_ERR_CRC);
+    CHECK_EQ(proto_auth_verify(&key, frame, PROTO_HDR_LEN + PROTO_AUTH_OVERHEAD - 1), PROTO_ERR_TRUNCATED);
+
+    // An empty payload still carries counter and tag.
+    CHECK_EQ(proto_auth_seal(&key, 7, NULL, 0, frame, sizeof(frame), &len), PROTO_OK);
+    CHECK_EQ(len, PROTO_HDR_LEN + PROTO_AUTH_OVERHEAD);
+    CHECK_EQ(proto_parse(frame, len, &f), PROTO_OK);
+    CHECK_EQ(f.payload_len, 0);
+    CHECK_EQ(proto_auth_verify(&key, frame, len), PROTO_OK);
+}
+
+// Sequence number and flags without extension header stay in front of the counter.
+static void test_framed_payload(void) {
+    proto_hmac_key_t key;
+    proto_hmac_key_init(&key, (const uint8_t *)"device", 6);
+
+    const uint8_t payload[] = {1, 2, 3, 4, 5};
+    uint8_t tlv[MTU], stamped[MTU], frame[MTU];
+    size_t tlv_len = 0, stamped_len = 0, len = 0;
+    CHECK_EQ(proto_add_flags(payload, sizeof(payload), PROTO_FLAG_TLV, tlv, sizeof(tlv), &tlv_len), PROTO_OK);
+    CHECK_EQ(proto_stamp_seq(tlv, tlv_len, 513, stamped, sizeof(stamped), &stamped_len), PROTO_OK);
+    CHECK_EQ(proto_auth_seal(&key, 99, stamped, stamped_len, frame, sizeof(frame), &len), PROTO_OK);
+    CHECK_EQ(len, stamped_len + PROTO_AUTH_OVERHEAD);
+
+    proto_frame_t f;
+    CHECK_EQ(proto_parse(frame, len, &f), PROTO_OK);
+    CHECK_EQ(f.flags, PROTO_FLAG_TLV | PROTO_FLAG_SEQ | PROTO_FLAG_EXT);
+    CHECK_EQ(f.flags2, PROTO_FLAG2_AUTH);
+    CHECK_EQ(f.seq, 513);
+    CHECK_EQ(f.counter, 99);
+    CHECK_EQ(f.payload_len, sizeof(payload));
+    CHECK(memcmp(f.payload, payload, sizeof(payload)) == 0);
+    CHECK_EQ(proto_auth_verify(&key, frame, len), PROTO_OK);
+
+    // Sealed once only.
+    uint8_t again[MTU];
+    size_t again_len = 0;
+    CHECK_EQ(proto_auth_seal(&key, 100, frame, len, again, sizeof(again), &again_len), PROTO_ERR_INVALID_ARG);
+
+    // A second flags byte already present gains PROTO_FLAG2_AUTH without growing twice.
+    uint8_t keyed[MTU];
+    size_t keyed_len = proto_write_hdr2(keyed, 0, PROTO_FLAG2_KEY);
+    memcpy(keyed + keyed_len, payload, sizeof(payload));
+    keyed_len += sizeof(payload);
+    CHECK_EQ(proto_auth_seal(&key, 1, keyed, keyed_len, frame, sizeof(frame), &len), PROTO_OK);
+    CHECK_EQ(len, keyed_len + PROTO_AUTH_HDR_LEN + PROTO_AUTH_TAG_LEN);
+    CHECK_EQ(proto_parse(frame, len, &f), PROTO_OK);
+    CHECK_EQ(f.flags2, PROTO_FLAG2_KEY | PROTO_FLAG2_AUTH);
+    CHECK_EQ(f.payload_len, sizeof(payload));
+    CHECK(memcmp(f.payload, payload, sizeof(payload)) == 0);
+}
+
+static void test_capacity(void) {
+    proto_hmac_key_t key;
+    proto_hmac_key_init(&key, (const uint8_t *)"device", 6);
+
+    static uint8_t payload[MTU], frame[MTU];
+    const size_t fit = MTU - PROTO_HDR_LEN - PROTO_AUTH_OVERHEAD;
+    size_t len = 0;
+    CHECK_EQ(proto_auth_seal(&key, 1, payload, fit, frame, MTU, &len), PROTO_OK);
+    CHECK_EQ(len, MTU);
+    CHECK_EQ(proto_auth_seal(&key, 1, payload, fit + 1, frame, MTU, &len), PROTO_ERR_TOO_LARGE);
+    CHECK_EQ(proto_auth_seal(&key, 1, payload, 0, frame, PROTO_HDR_LEN + PROTO_AUTH_OVERHEAD - 1, &len),
+             PROTO_ERR_TOO_LARGE);
+
+    // A framed payload cut inside its headers.
+    uint8_t stamped[MTU];
+    size_t stamped_len = 0;
+    CHECK_EQ(proto_stamp_seq(payload, 4, 1, stamped, sizeof(stamped), &stamped_len), PROTO_OK);
+    CHECK_EQ(proto_auth_seal(&key, 1, stamped, PROTO_HDR_LEN + 1, frame, MTU, &len), PROTO_ERR_TRUNCATED);
+}
+
+int main(void) {
+    test_vectors();
+    test_derive();
+    test_raw_payload();
+    test_framed_payload();
+    test_capacity();
+    return check_result("auth_test");
+}
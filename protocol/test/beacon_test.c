@@ -0,0 +1,72 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "proto_beacon.h"
+
+#include "check.h"
+
+// Beacon frames: round trip through proto_parse, probes and short payloads
+// rejected, appended fields ignored.
+
+static void test_round_trip(void) {
+    const proto_beacon_t in = {
+        .mac_addr = {0x24, 0x6F, 0x28, 0xAA, 0xBB, 0xCC},
+        .channel = 11,
+        .epoch = 0xDEADBEEF,
+    };
+    uint8_t buf[PROTO_BEACON_LEN];
+    CHECK_EQ(proto_beacon_write(buf, sizeof(buf), &in), PROTO_BEACON_LEN);
+
+    proto_frame_t frame;
+    CHECK_EQ(proto_parse(buf, sizeof(buf), &frame), PROTO_OK);
+    CHECK(frame.flags & PROTO_FLAG_BEACON);
+    CHECK_EQ(frame.payload_len, PROTO_BEACON_PAYLOAD_LEN);
+
+    proto_beacon_t out;
+    CHECK_EQ(proto_beacon_parse(frame.payload, frame.payload_len, &out), PROTO_OK);
+    CHECK(memcmp(out.mac_addr, in.mac_addr, sizeof(in.mac_addr)) == 0);
+    CHECK_EQ(out.channel, in.channel);
+    CHECK_EQ(out.epoch, in.epoch);
+
+    // A different epoch changes only its bytes.
+    proto_beacon_t next = in;
+    next.epoch = in.epoch + 1;
+    uint8_t buf2[PROTO_BEACON_LEN];
+    proto_beacon_write(buf2, sizeof(buf2), &next);
+    CHECK(memcmp(buf, buf2, PROTO_BEACON_LEN - 4) == 0);
+    CHECK(memcmp(buf + PROTO_BEACON_LEN - 4, buf2 + PROTO_BEACON_LEN - 4, 4) != 0);
+}
+
+static void test_short(void) {
+    const proto_beacon_t in = {.channel = 1};
+    uint8_t buf[PROTO_BEACON_LEN + 8];
+    CHECK_EQ(proto_beacon_write(buf, PROTO_BEACON_LEN - 1, &in), 0);
+
+    // Probes carry no payload.
+    proto_beacon_t out;
+    CHECK_EQ(proto_beacon_parse(buf, 0, &out), PROTO_ERR_TRUNCATED);
+    for (size_t len = 1; len < PROTO_BEACON_PAYLOAD_LEN; len++) {
+        CHECK_EQ(proto_beacon_parse(buf + PROTO_HDR_LEN, len, &out), PROTO_ERR_TRUNCATED);
+    }
+}
+
+static void test_appended_fields(void) {
+    const proto_beacon_t in = {.mac_addr = {1, 2, 3, 4, 5, 6}, .channel = 6, .epoch = 42};
+    uint8_t buf[PROTO_BEACON_LEN + 4];
+    proto_beacon_write(buf, sizeof(buf), &in);
+    memset(buf + PROTO_BEACON_LEN, 0x5A, 4);
+
+    proto_frame_t frame;
+    CHECK_EQ(proto_parse(buf, sizeof(buf), &frame), PROTO_OK);
+    proto_beacon_t out;
+    CHECK_EQ(proto_beacon_parse(frame.payload, frame.payload_len, &out), PROTO_OK);
+    CHECK_EQ(out.channel, 6);
+    CHECK_EQ(out.epoch, 42);
+}
+
+int main(void) {
+    test_round_trip();
+    test_short();
+    test_appended_fields();
+    return check_result("beacon_test");
+}
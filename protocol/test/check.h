@@ -0,0 +1,39 @@
+#ifndef _CHECK_H_
+#define _CHECK_H_
+
+#include <stdio.h>
+
+// Minimal assertions for host tests: a failed CHECK prints its location and
+// marks the run as failed, the test keeps going so one run shows every
+// failure. main() returns check_result().
+
+static int s_check_failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);                                   \
+            s_check_failures++;                                                                                        \
+        }                                                                                                              \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                                                                 \
+    do {                                                                                                               \
+        const long long a_ = (long long)(a);                                                                           \
+        const long long b_ = (long long)(b);                                                                           \
+        if (a_ != b_) {                                                                                                \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, a_, b_);     \
+            s_check_failures++;                                                                                        \
+        }                                                                                                              \
+    } while (0)
+
+static inline int check_result(const char *name) {
+    if (s_check_failures != 0) {
+        fprintf(stderr, "%s: %d checks failed\n", name, s_check_failures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+#endif /* _CHECK_H_ */
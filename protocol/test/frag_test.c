@@ -0,0 +1,277 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "proto_frag.h"
+
+#include "check.h"
+
+// Fragmenter and reassembler over a lossy link: fragments are dropped,
+// duplicated and reordered, senders restart with msg_id 0, and the table
+// stays within its slot and memory limits.
+
+#define MTU 250
+#define MAX_FRAGS 64
+#define TIMEOUT_MS 2000
+
+typedef struct {
+    uint8_t data[MTU];
+    size_t len;
+} wire_t;
+
+static const uint8_t s_mac_a[6] = {0x24, 0x6F, 0x28, 0x00, 0x00, 0x01};
+static const uint8_t s_mac_b[6] = {0x24, 0x6F, 0x28, 0x00, 0x00, 0x02};
+
+static uint32_t s_rng = 12345;
+
+static uint32_t rnd(uint32_t n) {
+    s_rng = s_rng * 1103515245u + 12345u;
+    return (s_rng >> 8) % n;
+}
+
+static void fill(uint8_t *buf, size_t len, uint32_t seed) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(seed + i * 7);
+    }
+}
+
+static size_t split(uint16_t msg_id, const uint8_t *msg, size_t len, wire_t *out) {
+    proto_fragmenter_t f;
+    CHECK_EQ(proto_frag_begin(&f, msg_id, msg, len, MTU), PROTO_OK);
+    size_t n = 0;
+    while ((out[n].len = proto_frag_next(&f, out[n].data)) > 0) {
+        n++;
+    }
+    return n;
+}
+
+// Feeds one frame, returns the push result and copies a completed message.
+static proto_err_t feed(proto_reasm_t *r, const uint8_t *mac, const wire_t *w, uint32_t now_ms, uint8_t *got,
+                        size_t *got_len) {
+    proto_frame_t frame;
+    proto_frag_hdr_t hdr;
+    if (proto_parse(w->data, w->len, &frame) != PROTO_OK || !(frame.flags & PROTO_FLAG_FRAG) ||
+        proto_frag_hdr_parse(frame.ext, frame.ext_len, &hdr) != PROTO_OK) {
+        return PROTO_ERR_INVALID_ARG;
+    }
+
+    proto_msg_t msg;
+    const proto_err_t err = proto_reasm_push(r, mac, &hdr, frame.payload, frame.payload_len, now_ms, &msg);
+    if (err == PROTO_OK) {
+        memcpy(got, msg.data, msg.len);
+        *got_len = msg.len;
+        proto_reasm_release(r, &msg);
+    }
+    return err;
+}
+
+static void test_round_trip(void) {
+    proto_reasm_slot_t slots[4];
+    proto_reasm_t r;
+    proto_reasm_init(&r, slots, 4, 16384, TIMEOUT_MS);
+
+    static uint8_t msg[4000], got[4000];
+    static wire_t wire[MAX_FRAGS];
+    const size_t lens[] = {1, 200, 236, 237, 1000, 4000};
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        fill(msg, lens[i], (uint32_t)i);
+        const size_t n = split((uint16_t)i, msg, lens[i], wire);
+        proto_err_t err = PROTO_ERR_INCOMPLETE;
+        size_t got_len = 0;
+        for (size_t j = 0; j < n; j++) {
+            err = feed(&r, s_mac_a, &wire[j], 0, got, &got_len);
+        }
+        CHECK_EQ(err, PROTO_OK);
+        CHECK_EQ(got_len, lens[i]);
+        CHECK(memcmp(got, msg, lens[i]) == 0);
+    }
+    CHECK_EQ(r.mem_used, 0);
+    proto_reasm_deinit(&r);
+}
+
+// Every fragment is sent up to three times in random order, some never arrive: each message is delivered at most
+// once, and exactly once when all of its fragments got through.
+static void test_lossy_link(void) {
+    proto_reasm_slot_t slots[4];
+    proto_reasm_t r;
+    proto_reasm_init(&r, slots, 4, 16384, TIMEOUT_MS);
+
+    static uint8_t msg[3000], got[3000];
+    static wire_t wire[MAX_FRAGS], sent[3 * MAX_FRAGS];
+    uint32_t now_ms = 0;
+    size_t delivered = 0, complete = 0;
+
+    for (uint16_t id = 0; id < 300; id++) {
+        const size_t len = 1 + rnd(sizeof(msg));
+        fill(msg, len, id);
+        const size_t n = split(id, msg, len, wire);
+
+        size_t count = 0;
+        bool all = true;
+        for (size_t j = 0; j < n; j++) {
+            const uint32_t copies = rnd(10) == 0 ? 0 : 1 + rnd(3);
+            all &= copies > 0;
+            for (uint32_t c = 0; c < copies; c++) {
+                sent[count++] = wire[j];
+            }
+        }
+        for (size_t j = count; j > 1; j--) {
+            const size_t k = rnd((uint32_t)j);
+            const wire_t t = sent[j - 1];
+            sent[j - 1] = sent[k];
+            sent[k] = t;
+        }
+
+        size_t hits = 0;
+        for (size_t j = 0; j < count; j++) {
+            size_t got_len = 0;
+            if (feed(&r, s_mac_a, &sent[j], now_ms, got, &got_len) == PROTO_OK) {
+                CHECK_EQ(got_len, len);
+                CHECK(memcmp(got, msg, len) == 0);
+                hits++;
+            }
+        }
+        CHECK(hits <= 1);
+        CHECK_EQ(hits, all ? 1 : 0);
+        delivered += hits;
+        complete += all;
+
+        now_ms += 100;
+        proto_reasm_expire(&r, now_ms);
+    }
+
+    CHECK_EQ(delivered, complete);
+    CHECK(r.stats.duplicates > 0);
+    CHECK(r.mem_used <= r.mem_cap);
+    proto_reasm_expire(&r, now_ms + TIMEOUT_MS);
+    CHECK_EQ(r.mem_used, 0);
+    proto_reasm_deinit(&r);
+}
+
+// Two senders interleaved, each message complete: both arrive despite sharing msg_ids.
+static void test_interleaved_senders(void) {
+    proto_reasm_slot_t slots[4];
+    proto_reasm_t r;
+    proto_reasm_init(&r, slots, 4, 16384, TIMEOUT_MS);
+
+    static uint8_t msg_a[1500], msg_b[1500], got[1500];
+    static wire_t wire_a[MAX_FRAGS], wire_b[MAX_FRAGS];
+    fill(msg_a, sizeof(msg_a), 1);
+    fill(msg_b, sizeof(msg_b), 2);
+    const size_t n = split(7, msg_a, sizeof(msg_a), wire_a);
+    CHECK_EQ(split(7, msg_b, sizeof(msg_b), wire_b), n);
+
+    size_t done = 0, got_len = 0;
+    for (size_t j = 0; j < n; j++) {
+        done += feed(&r, s_mac_a, &wire_a[j], 0, got, &got_len) == PROTO_OK;
+        done += feed(&r, s_mac_b, &wire_b[j], 0, got, &got_len) == PROTO_OK;
+    }
+    CHECK_EQ(done, 2);
+    proto_reasm_deinit(&r);
+}
+
+// A sender restarts and reuses msg_id 0 for different messages: none may be taken for a duplicate.
+static void test_sender_restart(void) {
+    proto_reasm_slot_t slots[4];
+    proto_reasm_t r;
+    proto_reasm_init(&r, slots, 4, 16384, TIMEOUT_MS);
+
+    static uint8_t msg[800], got[800];
+    static wire_t wire[MAX_FRAGS];
+    for (uint32_t boot = 0; boot < 5; boot++) {
+        fill(msg, sizeof(msg), 100 + boot);
+        const size_t n = split(0, msg, sizeof(msg), wire);
+        proto_err_t err = PROTO_ERR_INCOMPLETE;
+        size_t got_len = 0;
+        for (size_t j = 0; j < n; j++) {
+            err = feed(&r, s_mac_a, &wire[j], boot * 10, got, &got_len);
+        }
+        CHECK_EQ(err, PROTO_OK);
+        CHECK(memcmp(got, msg, sizeof(msg)) == 0);
+
+        // Single fragment messages too.
+        fill(msg, 50, 200 + boot);
+        split(1, msg, 50, wire);
+        CHECK_EQ(feed(&r, s_mac_a, &wire[0], boot * 10, got, &got_len), PROTO_OK);
+    }
+
+    // The same message again is a late copy, unless the reassembly timeout passed.
+    split(1, msg, 50, wire);
+    size_t got_len = 0;
+    CHECK_EQ(feed(&r, s_mac_a, &wire[0], 100, got, &got_len), PROTO_ERR_DUPLICATE);
+    CHECK_EQ(feed(&r, s_mac_a, &wire[0], 100 + TIMEOUT_MS, got, &got_len), PROTO_OK);
+    proto_reasm_deinit(&r);
+}
+
+// More senders than slots and memory: oldest partial messages are evicted, limits hold.
+static void test_limits(void) {
+    proto_reasm_slot_t slots[2];
+    proto_reasm_t r;
+    proto_reasm_init(&r, slots, 2, 3000, TIMEOUT_MS);
+
+    static uint8_t msg[2000], got[2000];
+    static wire_t wire[MAX_FRAGS];
+    fill(msg, sizeof(msg), 9);
+    const size_t n = split(3, msg, sizeof(msg), wire);
+
+    uint8_t mac[6];
+    memcpy(mac, s_mac_a, sizeof(mac));
+    size_t got_len = 0;
+    for (uint8_t m = 0; m < 10; m++) {
+        mac[5] = m;
+        CHECK_EQ(feed(&r, mac, &wire[0], m, got, &got_len), PROTO_ERR_INCOMPLETE);
+        CHECK(r.mem_used <= r.mem_cap);
+    }
+    CHECK_EQ(r.stats.evicted, 9);
+
+    // The survivor still completes.
+    proto_err_t err = PROTO_ERR_INCOMPLETE;
+    for (size_t j = 1; j < n; j++) {
+        err = feed(&r, mac, &wire[j], 20, got, &got_len);
+    }
+    CHECK_EQ(err, PROTO_OK);
+
+    // Larger than the memory cap: rejected without evicting anything.
+    static uint8_t big[4000];
+    fill(big, sizeof(big), 1);
+    split(4, big, sizeof(big), wire);
+    CHECK_EQ(feed(&r, s_mac_b, &wire[0], 30, got, &got_len), PROTO_ERR_NO_MEM);
+    CHECK_EQ(r.mem_used, 0);
+    proto_reasm_deinit(&r);
+}
+
+static void test_corruption(void) {
+    proto_reasm_slot_t slots[2];
+    proto_reasm_t r;
+    proto_reasm_init(&r, slots, 2, 4096, TIMEOUT_MS);
+
+    static uint8_t msg[600], got[600];
+    static wire_t wire[MAX_FRAGS];
+    fill(msg, sizeof(msg), 5);
+    const size_t n = split(9, msg, sizeof(msg), wire);
+    wire[1].data[wire[1].len - 1] ^= 0x01;
+
+    proto_err_t err = PROTO_ERR_INCOMPLETE;
+    size_t got_len = 0;
+    for (size_t j = 0; j < n; j++) {
+        err = feed(&r, s_mac_a, &wire[j], 0, got, &got_len);
+    }
+    CHECK_EQ(err, PROTO_ERR_CRC);
+    CHECK_EQ(r.stats.crc_errors, 1);
+    CHECK_EQ(r.mem_used, 0);
+
+    // A fragment of the wrong length never enters the table.
+    wire[0].len--;
+    CHECK_EQ(feed(&r, s_mac_a, &wire[0], 0, got, &got_len), PROTO_ERR_INVALID_ARG);
+    proto_reasm_deinit(&r);
+}
+
+int main(void) {
+    test_round_trip();
+    test_lossy_link();
+    test_interleaved_senders();
+    test_sender_restart();
+    test_limits();
+    test_corruption();
+    return check_result("frag_test");
+}
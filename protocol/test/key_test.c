@@ -0,0 +1,281 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "proto_key.h"
+
+#include "check.h"
+
+// Key messages on the wire, then pairing and handshakes the way the gateway
+// and a node run them: only the node holding its pair key gets its LMK, a
+// response is useless to everyone else on the channel, a handshake is
+// accepted only when signed with the LMK it announces, and a node takes an
+// answer to its handshake only from the holder of that LMK.
+
+static const uint8_t s_mac_a[6] = {0x24, 0x6F, 0x28, 0x00, 0x00, 0x01};
+static const uint8_t s_mac_b[6] = {0x24, 0x6F, 0x28, 0x00, 0x00, 0x02};
+
+static proto_hmac_key_t s_master;
+
+static void pair_key(const uint8_t *mac, proto_hmac_key_t *out) {
+    uint8_t key[PROTO_KEY_LEN];
+    proto_key_derive_pair(&s_master, mac, key);
+    proto_hmac_key_init(out, key, sizeof(key));
+}
+
+static void lmk_key(const uint8_t *mac, uint32_t epoch, proto_hmac_key_t *out) {
+    uint8_t lmk[PROTO_KEY_LEN];
+    proto_key_derive(&s_master, mac, epoch, lmk);
+    proto_hmac_key_init(out, lmk, sizeof(lmk));
+}
+
+// Writes and parses a message, returns the frame length.
+static size_t round_trip(const proto_key_msg_t *msg, proto_key_msg_t *out) {
+    uint8_t frame[PROTO_KEY_MAX_LEN];
+    const size_t len = proto_key_write(frame, sizeof(frame), msg);
+    CHECK(len > 0);
+
+    proto_frame_t f;
+    CHECK_EQ(proto_parse(frame, len, &f), PROTO_OK);
+    CHECK_EQ(f.flags2, PROTO_FLAG2_KEY);
+    CHECK_EQ(proto_key_parse(f.payload, f.payload_len, out), PROTO_OK);
+    CHECK_EQ(out->type, msg->type);
+
+    // Every shorter payload is refused.
+    proto_key_msg_t cut;
+    for (size_t n = 0; n < f.payload_len; n++) {
+        CHECK_EQ(proto_key_parse(f.payload, n, &cut), PROTO_ERR_TRUNCATED);
+    }
+    // Too small a buffer writes nothing.
+    CHECK_EQ(proto_key_write(frame, len - 1, msg), 0);
+    return len;
+}
+
+static void test_messages(void) {
+    proto_key_msg_t msg = {.epoch = 0x01020304, .count = 0x0A0B0C0D, .lease_s = 600}, got;
+    for (size_t i = 0; i < PROTO_KEY_NONCE_LEN; i++) {
+        msg.nonce[i] = (uint8_t)(0xA0 + i);
+    }
+    for (size_t i = 0; i < PROTO_KEY_LEN; i++) {
+        msg.key[i] = (uint8_t)(0x10 + i);
+    }
+    for (size_t i = 0; i < PROTO_KEY_TAG_LEN; i++) {
+        msg.tag[i] = (uint8_t)(0xC0 + i);
+    }
+
+    msg.type = PROTO_KEY_PAIR_REQ;
+    round_trip(&msg, &got);
+    CHECK(memcmp(got.nonce, msg.nonce, PROTO_KEY_NONCE_LEN) == 0);
+    CHECK(memcmp(got.tag, msg.tag, PROTO_KEY_TAG_LEN) == 0);
+
+    msg.type = PROTO_KEY_PAIR_RESP;
+    CHECK_EQ(round_trip(&msg, &got), PROTO_KEY_MAX_LEN);
+    CHECK(memcmp(got.nonce, msg.nonce, PROTO_KEY_NONCE_LEN) == 0);
+    CHECK_EQ(got.epoch, msg.epoch);
+    CHECK(memcmp(got.key, msg.key, PROTO_KEY_LEN) == 0);
+    CHECK(memcmp(got.tag, msg.tag, PROTO_KEY_TAG_LEN) == 0);
+
+    msg.type = PROTO_KEY_HELLO;
+    round_trip(&msg, &got);
+    CHECK_EQ(got.epoch, msg.epoch);
+    CHECK_EQ(got.count, msg.count);
+    CHECK(memcmp(got.tag, msg.tag, PROTO_KEY_TAG_LEN) == 0);
+
+    msg.type = PROTO_KEY_READY;
+    round_trip(&msg, &got);
+    CHECK_EQ(got.epoch, msg.epoch);
+    CHECK_EQ(got.count, msg.count);
+    CHECK_EQ(got.lease_s, msg.lease_s);
+    CHECK(memcmp(got.tag, msg.tag, PROTO_KEY_TAG_LEN) == 0);
+
+    msg.type = PROTO_KEY_REKEY;
+    round_trip(&msg, &got);
+    CHECK_EQ(got.epoch, msg.epoch);
+    CHECK_EQ(got.count, msg.count);
+    CHECK(memcmp(got.key, msg.key, PROTO_KEY_LEN) == 0);
+    CHECK(memcmp(got.tag, msg.tag, PROTO_KEY_TAG_LEN) == 0);
+
+    uint8_t frame[PROTO_KEY_MAX_LEN];
+    msg.type = 0;
+    CHECK_EQ(proto_key_write(frame, sizeof(frame), &msg), 0);
+    const uint8_t unknown[] = {9, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    CHECK_EQ(proto_key_parse(unknown, sizeof(unknown), &got), PROTO_ERR_INVALID_ARG);
+}
+
+static void test_derive(void) {
+    uint8_t a1[PROTO_KEY_LEN], a1_again[PROTO_KEY_LEN], a2[PROTO_KEY_LEN], b1[PROTO_KEY_LEN];
+    uint8_t pair_a[PROTO_KEY_LEN], pair_b[PROTO_KEY_LEN];
+    proto_key_derive(&s_master, s_mac_a, 1, a1);
+    proto_key_derive(&s_master, s_mac_a, 1, a1_again);
+    proto_key_derive(&s_master, s_mac_a, 2, a2);
+    proto_key_derive(&s_master, s_mac_b, 1, b1);
+    proto_key_derive_pair(&s_master, s_mac_a, pair_a);
+    proto_key_derive_pair(&s_master, s_mac_b, pair_b);
+
+    CHECK(memcmp(a1, a1_again, PROTO_KEY_LEN) == 0);
+    CHECK(memcmp(a1, a2, PROTO_KEY_LEN) != 0);
+    CHECK(memcmp(a1, b1, PROTO_KEY_LEN) != 0);
+    CHECK(memcmp(pair_a, pair_b, PROTO_KEY_LEN) != 0);
+    CHECK(memcmp(pair_a, a1, PROTO_KEY_LEN) != 0);
+
+    proto_hmac_key_t other;
+    proto_hmac_key_init(&other, (const uint8_t *)"another master key", 18);
+    uint8_t other_a1[PROTO_KEY_LEN];
+    proto_key_derive(&other, s_mac_a, 1, other_a1);
+    CHECK(memcmp(a1, other_a1, PROTO_KEY_LEN) != 0);
+}
+
+// A node pairs: the request is accepted only under its own pair key, the response unwraps only for it.
+static void test_pairing(void) {
+    proto_hmac_key_t pair_a, pair_b;
+    pair_key(s_mac_a, &pair_a);
+    pair_key(s_mac_b, &pair_b);
+
+    // Node A signs its request.
+    proto_key_msg_t req = {.type = PROTO_KEY_PAIR_REQ, .nonce = {1, 2, 3, 4, 5, 6, 7, 8}};
+    proto_key_sign(&pair_a, s_mac_a, &req);
+    CHECK_EQ(proto_key_verify(&pair_a, s_mac_a, &req), PROTO_OK);
+
+    // Node B asking for A's key, with its own pair key or A's request replayed from its MAC, is refused.
+    proto_key_msg_t forged = req;
+    proto_key_sign(&pair_b, s_mac_a, &forged);
+    CHECK_EQ(proto_key_verify(&pair_a, s_mac_a, &forged), PROTO_ERR_CRC);
+    CHECK_EQ(proto_key_verify(&pair_b, s_mac_b, &req), PROTO_ERR_CRC);
+    forged = req;
+    forged.nonce[0] ^= 1;
+    CHECK_EQ(proto_key_verify(&pair_a, s_mac_a, &forged), PROTO_ERR_CRC);
+
+    // The gateway answers.
+    uint8_t lmk[PROTO_KEY_LEN], got[PROTO_KEY_LEN];
+    proto_key_derive(&s_master, s_mac_a, 7, lmk);
+    proto_key_msg_t resp = {.type = PROTO_KEY_PAIR_RESP, .epoch = 7};
+    memcpy(resp.nonce, req.nonce, PROTO_KEY_NONCE_LEN);
+    proto_key_wrap(&pair_a, s_mac_a, lmk, &resp);
+    CHECK(memcmp(resp.key, lmk, PROTO_KEY_LEN) != 0);
+
+    CHECK_EQ(proto_key_unwrap(&pair_a, s_mac_a, &resp, got), PROTO_OK);
+    CHECK(memcmp(got, lmk, PROTO_KEY_LEN) == 0);
+
+    // Overheard by B: neither its own pair key nor A's MAC gets the LMK out.
+    CHECK_EQ(proto_key_unwrap(&pair_b, s_mac_a, &resp, got), PROTO_ERR_CRC);
+    CHECK_EQ(proto_key_unwrap(&pair_b, s_mac_b, &resp, got), PROTO_ERR_CRC);
+    CHECK_EQ(proto_key_unwrap(&pair_a, s_mac_b, &resp, got), PROTO_ERR_CRC);
+
+    // Any changed field breaks the tag.
+    proto_key_msg_t bad = resp;
+    bad.epoch++;
+    CHECK_EQ(proto_key_unwrap(&pair_a, s_mac_a, &bad, got), PROTO_ERR_CRC);
+    bad = resp;
+    bad.nonce[7] ^= 0x80;
+    CHECK_EQ(proto_key_unwrap(&pair_a, s_mac_a, &bad, got), PROTO_ERR_CRC);
+    for (size_t i = 0; i < PROTO_KEY_LEN; i++) {
+        bad = resp;
+        bad.key[i] ^= 0x01;
+        CHECK_EQ(proto_key_unwrap(&pair_a, s_mac_a, &bad, got), PROTO_ERR_CRC);
+    }
+
+    // The same LMK under another nonce looks unrelated on the air.
+    proto_key_msg_t resp2 = resp;
+    resp2.nonce[0] ^= 0xFF;
+    proto_key_wrap(&pair_a, s_mac_a, lmk, &resp2);
+    CHECK(memcmp(resp2.key, resp.key, PROTO_KEY_LEN) != 0);
+
+    // A wrapped key is only taken together with its tag.
+    CHECK_EQ(proto_key_verify(&pair_a, s_mac_a, &resp), PROTO_ERR_INVALID_ARG);
+    CHECK_EQ(proto_key_unwrap(&pair_a, s_mac_a, &req, got), PROTO_ERR_INVALID_ARG);
+}
+
+// Handshakes open a session only for the holder of the announced LMK.
+static void test_hello(void) {
+    proto_hmac_key_t lmk_a1, lmk_a2, lmk_b1;
+    lmk_key(s_mac_a, 1, &lmk_a1);
+    lmk_key(s_mac_a, 2, &lmk_a2);
+    lmk_key(s_mac_b, 1, &lmk_b1);
+
+    proto_key_msg_t hello = {.type = PROTO_KEY_HELLO, .epoch = 1, .count = 5};
+    proto_key_sign(&lmk_a1, s_mac_a, &hello);
+
+    proto_key_msg_t got;
+    round_trip(&hello, &got);
+    CHECK_EQ(proto_key_verify(&lmk_a1, s_mac_a, &got), PROTO_OK);
+
+    // Spoofed from another MAC, claiming another epoch, or with another count.
+    CHECK_EQ(proto_key_verify(&lmk_b1, s_mac_b, &got), PROTO_ERR_CRC);
+    got.count = 6;
+    CHECK_EQ(proto_key_verify(&lmk_a1, s_mac_a, &got), PROTO_ERR_CRC);
+    got.count = 5;
+    got.epoch = 2;
+    CHECK_EQ(proto_key_verify(&lmk_a2, s_mac_a, &got), PROTO_ERR_CRC);
+
+    // A node without any key guessing tags.
+    proto_key_msg_t guess = {.type = PROTO_KEY_HELLO, .epoch = 1};
+    size_t accepted = 0;
+    for (uint32_t i = 0; i < 1000; i++) {
+        proto_put_u32(guess.tag, i);
+        accepted += proto_key_verify(&lmk_a1, s_mac_a, &guess) == PROTO_OK;
+    }
+    CHECK_EQ(accepted, 0);
+}
+
+// The answers to a handshake: only the gateway holding the LMK of the HELLO can make one the node takes.
+static void test_answers(void) {
+    proto_hmac_key_t lmk_a1, lmk_b1;
+    lmk_key(s_mac_a, 1, &lmk_a1);
+    lmk_key(s_mac_b, 1, &lmk_b1);
+
+    proto_key_msg_t ready = {.type = PROTO_KEY_READY, .epoch = 1, .count = 5, .lease_s = 600}, got;
+    proto_key_sign(&lmk_a1, s_mac_a, &ready);
+    round_trip(&ready, &got);
+    CHECK_EQ(proto_key_verify(&lmk_a1, s_mac_a, &got), PROTO_OK);
+
+    // Answering another HELLO, with a longer lease, meant for another node, or from anyone without the key.
+    proto_key_msg_t bad = got;
+    bad.count = 4;
+    CHECK_EQ(proto_key_verify(&lmk_a1, s_mac_a, &bad), PROTO_ERR_CRC);
+    bad = got;
+    bad.lease_s = 60000;
+    CHECK_EQ(proto_key_verify(&lmk_a1, s_mac_a, &bad), PROTO_ERR_CRC);
+    CHECK_EQ(proto_key_verify(&lmk_b1, s_mac_b, &got), PROTO_ERR_CRC);
+    bad = got;
+    proto_key_sign(&lmk_b1, s_mac_a, &bad);
+    CHECK_EQ(proto_key_verify(&lmk_a1, s_mac_a, &bad), PROTO_ERR_CRC);
+
+    // REKEY carries the key of the new epoch wrapped under the old one.
+    uint8_t lmk2[PROTO_KEY_LEN], out[PROTO_KEY_LEN];
+    proto_key_derive(&s_master, s_mac_a, 2, lmk2);
+    proto_key_msg_t rekey = {.type = PROTO_KEY_REKEY, .epoch = 2, .count = 5};
+    proto_key_wrap(&lmk_a1, s_mac_a, lmk2, &rekey);
+    CHECK(memcmp(rekey.key, lmk2, PROTO_KEY_LEN) != 0);
+    round_trip(&rekey, &got);
+    CHECK_EQ(proto_key_unwrap(&lmk_a1, s_mac_a, &got, out), PROTO_OK);
+    CHECK(memcmp(out, lmk2, PROTO_KEY_LEN) == 0);
+
+    // A key of the attacker's choosing, sent in the clear or wrapped under a key of its own, is never taken.
+    proto_key_msg_t forged = {.type = PROTO_KEY_REKEY, .epoch = 2, .count = 5};
+    memset(forged.key, 0x42, PROTO_KEY_LEN);
+    CHECK_EQ(proto_key_unwrap(&lmk_a1, s_mac_a, &forged, out), PROTO_ERR_CRC);
+    proto_key_wrap(&lmk_b1, s_mac_a, lmk2, &forged);
+    CHECK_EQ(proto_key_unwrap(&lmk_a1, s_mac_a, &forged, out), PROTO_ERR_CRC);
+
+    // Replayed against a later HELLO, or moved to another epoch.
+    bad = rekey;
+    bad.count = 6;
+    CHECK_EQ(proto_key_unwrap(&lmk_a1, s_mac_a, &bad, out), PROTO_ERR_CRC);
+    bad = rekey;
+    bad.epoch = 3;
+    CHECK_EQ(proto_key_unwrap(&lmk_a1, s_mac_a, &bad, out), PROTO_ERR_CRC);
+
+    // A READY is no REKEY: the type is covered by the tag.
+    bad = ready;
+    bad.type = PROTO_KEY_HELLO;
+    CHECK_EQ(proto_key_verify(&lmk_a1, s_mac_a, &bad), PROTO_ERR_CRC);
+}
+
+int main(void) {
+    proto_hmac_key_init(&s_master, (const uint8_t *)"0123456789abcdef master", 23);
+    test_messages();
+    test_derive();
+    test_pairing();
+    test_hello();
+    test_answers();
+    return check_result("key_test");
+}
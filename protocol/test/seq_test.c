@@ -0,0 +1,113 @@
+#include <stdint.h>
+
+#include "proto_seq.h"
+
+#include "check.h"
+
+// proto_seq_t: loss only for numbers the window could have seen, duplicates
+// within the window, and sender restarts landing anywhere behind it.
+
+static void test_clean_link(void) {
+    proto_seq_t s;
+    proto_seq_init(&s);
+    for (uint16_t seq = 0; seq < 100; seq++) {
+        CHECK_EQ(proto_seq_check(&s, seq), PROTO_OK);
+    }
+    CHECK_EQ(s.accepted, 100);
+    CHECK_EQ(s.lost, 0);
+    CHECK_EQ(s.duplicates, 0);
+    CHECK_EQ(s.resyncs, 0);
+}
+
+static void test_start_mid_stream(void) {
+    proto_seq_t s;
+    proto_seq_init(&s);
+    for (uint16_t seq = 40000; seq < 40500; seq++) {
+        proto_seq_check(&s, seq);
+    }
+    CHECK_EQ(s.lost, 0);
+}
+
+static void test_loss(void) {
+    proto_seq_t s;
+    proto_seq_init(&s);
+    for (uint16_t seq = 0; seq < 300; seq++) {
+        if (seq % 10 != 3) {
+            proto_seq_check(&s, seq);
+        }
+    }
+    // The gaps still in the window are not lost yet.
+    CHECK_EQ(s.lost, 24);
+
+    // A jump beyond the window counts everything skipped.
+    proto_seq_init(&s);
+    proto_seq_check(&s, 0);
+    proto_seq_check(&s, 200);
+    CHECK_EQ(s.lost, 199 - 63);
+    CHECK_EQ(s.resyncs, 0);
+}
+
+static void test_reorder_and_duplicates(void) {
+    proto_seq_t s;
+    proto_seq_init(&s);
+    for (uint16_t seq = 0; seq < 100; seq += 2) {
+        proto_seq_check(&s, seq);
+    }
+    for (uint16_t seq = 99; seq > 40; seq -= 2) {
+        CHECK_EQ(proto_seq_check(&s, seq), PROTO_OK);
+    }
+    CHECK_EQ(proto_seq_check(&s, 97), PROTO_ERR_DUPLICATE);
+    CHECK_EQ(proto_seq_check(&s, 98), PROTO_ERR_DUPLICATE);
+    for (uint16_t seq = 100; seq < 300; seq++) {
+        proto_seq_check(&s, seq);
+    }
+    CHECK_EQ(s.lost, 20); // odd numbers 1..39, 1..35 too late to enter the window
+    CHECK_EQ(s.duplicates, 2);
+}
+
+static void test_wraparound(void) {
+    proto_seq_t s;
+    proto_seq_init(&s);
+    for (uint32_t i = 0; i < 200; i++) {
+        CHECK_EQ(proto_seq_check(&s, (uint16_t)(65500 + i)), PROTO_OK);
+        if (i == 60) {
+            CHECK_EQ(proto_seq_check(&s, 65530), PROTO_ERR_DUPLICATE);
+        }
+    }
+    CHECK_EQ(s.lost, 0);
+    CHECK_EQ(s.resyncs, 0);
+}
+
+static void test_sender_restart(void) {
+    // Restart landing just behind the window.
+    proto_seq_t s;
+    proto_seq_init(&s);
+    for (uint16_t seq = 0; seq < 500; seq++) {
+        proto_seq_check(&s, seq);
+    }
+    for (uint16_t seq = 0; seq < 3; seq++) {
+        CHECK_EQ(proto_seq_check(&s, seq), PROTO_OK);
+    }
+    CHECK_EQ(s.resyncs, 1);
+    CHECK_EQ(s.duplicates, 0);
+    CHECK_EQ(s.lost, 0);
+
+    // Restart landing far behind, and far ahead.
+    proto_seq_init(&s);
+    proto_seq_check(&s, 5000);
+    CHECK_EQ(proto_seq_check(&s, 10), PROTO_OK);
+    CHECK_EQ(proto_seq_check(&s, 11), PROTO_OK);
+    CHECK_EQ(proto_seq_check(&s, 30000), PROTO_OK);
+    CHECK_EQ(s.resyncs, 2);
+    CHECK_EQ(s.lost, 0);
+}
+
+int main(void) {
+    test_clean_link();
+    test_start_mid_stream();
+    test_loss();
+    test_reorder_and_duplicates();
+    test_wraparound();
+    test_sender_restart();
+    return check_result("seq_test");
+}
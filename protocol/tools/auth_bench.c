@@ -0,0 +1,176 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "proto.h"
+#include "proto_auth.h"
+
+// Host benchmark of PROTO_FLAG2_AUTH verification:
+//
+//   auth_bench [devices]
+//
+// Frames of typical sizes from a number of devices (default 64) are sealed
+// once, then verified round robin the way a gateway worker does: with the
+// key schedule of each device cached, and for comparison with the device key
+// derived and its schedule computed for every frame. Prints host time per
+// frame and frames per second, and checks that forged and truncated frames
+// fail.
+
+#define FRAME_LEN 250 // ESP_NOW_MAX_DATA_LEN
+#define DEFAULT_DEVICES 64
+#define FRAMES 20000
+
+typedef struct {
+    uint8_t data[FRAME_LEN];
+    size_t len;
+    uint8_t mac[6];
+} frame_t;
+
+static const size_t s_payload_lens[] = {8, 32, 96, FRAME_LEN - PROTO_HDR_LEN - PROTO_SEQ_HDR_LEN - PROTO_AUTH_OVERHEAD};
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void mac_of(size_t device, uint8_t mac[6]) {
+    const uint8_t base[6] = {0x24, 0x6F, 0x28, 0x00, 0x00, 0x00};
+    memcpy(mac, base, sizeof(base));
+    mac[3] = (uint8_t)(device >> 16);
+    mac[4] = (uint8_t)(device >> 8);
+    mac[5] = (uint8_t)device;
+}
+
+// Seals one frame per slot, devices taking turns, with a TLV payload header and a sequence number like a node.
+static void seal_all(const proto_hmac_key_t *keys, size_t devices, size_t payload_len, frame_t *frames) {
+    uint8_t raw[FRAME_LEN];
+    for (size_t i = 0; i < FRAMES; i++) {
+        frame_t *f = &frames[i];
+        const size_t device = i % devices;
+        mac_of(device, f->mac);
+
+        size_t n = proto_write_hdr(raw, PROTO_FLAG_TLV | PROTO_FLAG_SEQ);
+        proto_put_u16(raw + n, (uint16_t)i);
+        n += PROTO_SEQ_HDR_LEN;
+        for (size_t j = 0; j < payload_len; j++) {
+            raw[n++] = (uint8_t)(i + j);
+        }
+
+        if (proto_auth_seal(&keys[device], (uint32_t)(i / devices + 1), raw, n, f->data, sizeof(f->data),
+                            &f->len) != PROTO_OK) {
+            fprintf(stderr, "seal failed at %zu bytes\n", payload_len);
+            exit(1);
+        }
+    }
+}
+
+static bool verify_cached(const proto_hmac_key_t *keys, size_t devices, const frame_t *frames) {
+    bool ok = true;
+    for (size_t i = 0; i < FRAMES; i++) {
+        ok &= proto_auth_verify(&keys[i % devices], frames[i].data, frames[i].len) == PROTO_OK;
+    }
+    return ok;
+}
+
+static bool verify_uncached(const proto_hmac_key_t *master, const frame_t *frames) {
+    bool ok = true;
+    for (size_t i = 0; i < FRAMES; i++) {
+        uint8_t key[PROTO_AUTH_KEY_LEN];
+        proto_hmac_key_t schedule;
+        proto_auth_derive(master, frames[i].mac, key);
+        proto_hmac_key_init(&schedule, key, sizeof(key));
+        ok &= proto_auth_verify(&schedule, frames[i].data, frames[i].len) == PROTO_OK;
+    }
+    return ok;
+}
+
+// A flipped bit anywhere, a wrong key and a cut tag must all fail.
+static bool check_rejects(const proto_hmac_key_t *keys, size_t devices, const frame_t *frames) {
+    frame_t f = frames[0];
+    for (size_t bit = 0; bit < f.len * 8; bit++) {
+        f.data[bit / 8] ^= (uint8_t)(1u << (bit % 8));
+        if (proto_auth_verify(&keys[0], f.data, f.len) != PROTO_ERR_CRC) {
+            return false;
+        }
+        f.data[bit / 8] ^= (uint8_t)(1u << (bit % 8));
+    }
+
+    proto_frame_t parsed;
+    return (devices < 2 || proto_auth_verify(&keys[1], f.data, f.len) == PROTO_ERR_CRC) &&
+           proto_auth_verify(&keys[0], f.data, PROTO_HDR_LEN + 2) == PROTO_ERR_TRUNCATED &&
+           proto_parse(f.data, f.len, &parsed) == PROTO_OK && (parsed.flags2 & PROTO_FLAG2_AUTH) &&
+           parsed.counter == 1 && parsed.payload + parsed.payload_len + PROTO_AUTH_TAG_LEN == f.data + f.len;
+}
+
+int main(int argc, char **argv) {
+    const size_t devices = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_DEVICES;
+    if (devices == 0 || devices > FRAMES) {
+        fprintf(stderr, "usage: %s [devices]\n", argv[0]);
+        return 1;
+    }
+
+    proto_hmac_key_t master;
+    proto_hmac_key_init(&master, (const uint8_t *)"bench master key", 16);
+
+    proto_hmac_key_t *keys = calloc(devices, sizeof(*keys));
+    frame_t *frames = calloc(FRAMES, sizeof(*frames));
+    if (keys == NULL || frames == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    double start = now_ns();
+    for (size_t d = 0; d < devices; d++) {
+        uint8_t mac[6];
+        uint8_t key[PROTO_AUTH_KEY_LEN];
+        mac_of(d, mac);
+        proto_auth_derive(&master, mac, key);
+        proto_hmac_key_init(&keys[d], key, sizeof(key));
+    }
+    const double schedule_ns = (now_ns() - start) / (double)devices;
+
+    printf("devices         %zu, key schedule %zu bytes and %.0f ns each\n", devices, sizeof(proto_hmac_key_t),
+           schedule_ns);
+    printf("%-8s %12s %12s %12s %12s\n", "payload", "seal ns", "cached ns", "frames/s", "uncached ns");
+
+    for (size_t s = 0; s < sizeof(s_payload_lens) / sizeof(s_payload_lens[0]); s++) {
+        const size_t payload_len = s_payload_lens[s];
+
+        start = now_ns();
+        seal_all(keys, devices, payload_len, frames);
+        const double seal_ns = (now_ns() - start) / FRAMES;
+
+        if (!check_rejects(keys, devices, frames)) {
+            fprintf(stderr, "forged frame accepted at %zu bytes\n", payload_len);
+            return 1;
+        }
+
+        start = now_ns();
+        const bool cached_ok = verify_cached(keys, devices, frames);
+        const double cached_ns = (now_ns() - start) / FRAMES;
+
+        start = now_ns();
+        const bool uncached_ok = verify_uncached(&master, frames);
+        const double uncached_ns = (now_ns() - start) / FRAMES;
+
+        if (!cached_ok || !uncached_ok) {
+            fprintf(stderr, "genuine frame rejected at %zu bytes\n", payload_len);
+            return 1;
+        }
+
+        printf("%-8zu %12.0f %12.0f %12.0f %12.0f\n", payload_len, seal_ns, cached_ns, 1e9 / cached_ns,
+               uncached_ns);
+    }
+
+    printf("overhead        %d bytes per framed payload, %d for raw ones\n", PROTO_AUTH_OVERHEAD,
+           PROTO_HDR_LEN + PROTO_AUTH_OVERHEAD);
+
+    free(frames);
+    free(keys);
+    return 0;
+}
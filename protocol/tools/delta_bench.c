@@ -0,0 +1,310 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "proto.h"
+#include "proto_batch.h"
+#include "proto_delta.h"
+#include "proto_schema.h"
+
+// Host benchmark of PROTO_FLAG_DELTA over a telemetry trace:
+//
+//   delta_bench [trace.csv]
+//
+// The trace starts with a line of schema field names, e.g.
+// "battery_mv,temperature,humidity", then holds one sample per line in
+// display units, e.g. "3012,21.37,48.2". Without a trace a random walk of
+// 2000 samples is used. Samples are packed into ESP-NOW sized batch frames
+// the way node_batch_add() does, once plain and once delta encoded, and
+// sizes, frames and host time per frame are printed. The codec itself does
+// not allocate, its whole state is one proto_delta_ref_t.
+
+#define FRAME_LEN 250 // ESP_NOW_MAX_DATA_LEN
+#define MAX_COLUMNS 16
+#define SYNTHETIC_SAMPLES 2000
+#define REPEAT 200
+
+typedef struct {
+    uint8_t data[PROTO_BATCH_REC_MAX_LEN];
+    size_t len;
+} record_t;
+
+typedef struct {
+    uint8_t data[FRAME_LEN];
+    size_t len;
+} frame_t;
+
+typedef struct {
+    record_t *records;
+    size_t count;
+    size_t cap;
+} trace_t;
+
+static record_t *trace_add(trace_t *t) {
+    if (t->count == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 256;
+        t->records = realloc(t->records, t->cap * sizeof(*t->records));
+        if (t->records == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    return &t->records[t->count++];
+}
+
+static const proto_field_desc_t *find_by_name(const char *name) {
+    for (uint32_t id = 1; id <= PROTO_SCHEMA_MAX_ID; id++) {
+        const proto_field_desc_t *d = proto_schema_find(id);
+        if (d != NULL && strcmp(d->name, name) == 0) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+static bool put_value(proto_tlv_writer_t *w, const proto_field_desc_t *d, const char *text) {
+    const double scaled = strtod(text, NULL) * pow(10, d->decimals);
+    switch (d->type) {
+    case PROTO_TYPE_UINT:
+        return proto_tlv_put_uint(w, d->id, (uint64_t)llround(scaled)) == PROTO_OK;
+    case PROTO_TYPE_SINT:
+        return proto_tlv_put_sint(w, d->id, llround(scaled)) == PROTO_OK;
+    case PROTO_TYPE_FLOAT:
+        return proto_tlv_put_float(w, d->id, (float)scaled) == PROTO_OK;
+    default:
+        return proto_tlv_put_bytes(w, d->id, (const uint8_t *)text, strlen(text)) == PROTO_OK;
+    }
+}
+
+static bool load_csv(const char *path, trace_t *t) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    const proto_field_desc_t *columns[MAX_COLUMNS];
+    size_t ncolumns = 0;
+    char line[1024];
+    bool ok = true;
+
+    while (ok && fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+
+        if (ncolumns == 0) {
+            for (char *tok = strtok(line, ","); tok != NULL && ok; tok = strtok(NULL, ",")) {
+                columns[ncolumns] = find_by_name(tok);
+                if (columns[ncolumns] == NULL || ++ncolumns == MAX_COLUMNS) {
+                    fprintf(stderr, "%s: unknown field or too many columns at '%s'\n", path, tok);
+                    ok = false;
+                }
+            }
+            continue;
+        }
+
+        record_t *rec = trace_add(t);
+        proto_tlv_writer_t w;
+        proto_tlv_writer_init(&w, rec->data, sizeof(rec->data));
+        size_t col = 0;
+        for (char *tok = strtok(line, ","); tok != NULL && col < ncolumns; tok = strtok(NULL, ","), col++) {
+            if (!put_value(&w, columns[col], tok)) {
+                fprintf(stderr, "%s: sample %zu does not fit a record\n", path, t->count);
+                ok = false;
+            }
+        }
+        rec->len = w.len;
+    }
+
+    fclose(f);
+    return ok && t->count > 0;
+}
+
+static uint32_t xorshift(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// Readings of a battery powered climate sensor: slow drifts, small noise, a counter.
+static void synthesize(trace_t *t) {
+    uint32_t rng = 0x2545F491;
+    int64_t battery_mv = 3300;
+    int64_t temperature = 2150; // 0.01 degC
+    int64_t humidity = 480;     // 0.1 %
+    int64_t pressure_pa = 101325;
+
+    for (uint32_t i = 0; i < SYNTHETIC_SAMPLES; i++) {
+        if (xorshift(&rng) % 64 == 0) {
+            battery_mv--;
+        }
+        temperature += (int64_t)(xorshift(&rng) % 7) - 3;
+        humidity += (int64_t)(xorshift(&rng) % 5) - 2;
+        pressure_pa += (int64_t)(xorshift(&rng) % 21) - 10;
+
+        record_t *rec = trace_add(t);
+        proto_tlv_writer_t w;
+        proto_tlv_writer_init(&w, rec->data, sizeof(rec->data));
+        proto_put_battery_mv(&w, (uint64_t)battery_mv);
+        proto_put_temperature(&w, temperature);
+        proto_put_humidity(&w, (uint64_t)humidity);
+        proto_put_pressure_pa(&w, (uint64_t)pressure_pa);
+        proto_put_counter(&w, i);
+        rec->len = w.len;
+    }
+}
+
+// Packs records into batch frames, delta encoded or not, returns the number of frames.
+static size_t pack(const trace_t *t, bool delta, frame_t *frames) {
+    const uint8_t flags = PROTO_FLAG_BATCH | PROTO_FLAG_TLV | (delta ? PROTO_FLAG_DELTA : 0);
+    size_t nframes = 0;
+    frame_t *fr = NULL;
+    proto_delta_ref_t ref;
+
+    for (size_t i = 0; i < t->count; i++) {
+        const record_t *rec = &t->records[i];
+        uint8_t enc[PROTO_BATCH_REC_MAX_LEN];
+        size_t enc_len = 0;
+
+        for (int attempt = 0; attempt < 2; attempt++) {
+            if (fr == NULL) {
+                fr = &frames[nframes++];
+                fr->len = proto_write_hdr(fr->data, flags);
+                proto_delta_ref_init(&ref);
+            }
+
+            const uint8_t *data = rec->data;
+            enc_len = rec->len;
+            proto_delta_ref_t next = ref;
+            if (delta) {
+                if (proto_delta_encode(&next, rec->data, rec->len, enc, sizeof(enc), &enc_len) != PROTO_OK) {
+                    fprintf(stderr, "record %zu: encode failed\n", i);
+                    exit(1);
+                }
+                data = enc;
+            }
+
+            const size_t n = proto_batch_put(fr->data + fr->len, sizeof(fr->data) - fr->len, data, enc_len);
+            if (n > 0) {
+                fr->len += n;
+                ref = next;
+                break;
+            }
+            fr = NULL;
+        }
+    }
+
+    return nframes;
+}
+
+// Restores delta frames and checks they carry the original records, returns false on any mismatch.
+static bool unpack_all(const trace_t *t, const frame_t *frames, size_t nframes, bool verify) {
+    size_t next = 0;
+    for (size_t i = 0; i < nframes; i++) {
+        proto_frame_t fr;
+        uint8_t plain[FRAME_LEN * 4];
+        size_t plain_len;
+        if (proto_parse(frames[i].data, frames[i].len, &fr) != PROTO_OK ||
+            proto_delta_unpack(fr.payload, fr.payload_len, plain, sizeof(plain), &plain_len) != PROTO_OK) {
+            return false;
+        }
+        if (!verify) {
+            continue;
+        }
+
+        proto_batch_reader_t r;
+        proto_batch_reader_init(&r, plain, plain_len);
+        const uint8_t *rec;
+        size_t rec_len;
+        while (proto_batch_next(&r, &rec, &rec_len) == PROTO_OK) {
+            if (next == t->count || rec_len != t->records[next].len ||
+                memcmp(rec, t->records[next].data, rec_len) != 0) {
+                return false;
+            }
+            next++;
+        }
+    }
+    return !verify || next == t->count;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static size_t total_len(const frame_t *frames, size_t nframes) {
+    size_t n = 0;
+    for (size_t i = 0; i < nframes; i++) {
+        n += frames[i].len;
+    }
+    return n;
+}
+
+int main(int argc, char **argv) {
+    trace_t t = {0};
+    if (argc > 1) {
+        if (!load_csv(argv[1], &t)) {
+            return 1;
+        }
+    } else {
+        synthesize(&t);
+    }
+
+    size_t record_bytes = 0;
+    for (size_t i = 0; i < t.count; i++) {
+        record_bytes += t.records[i].len;
+    }
+
+    frame_t *plain = calloc(t.count, sizeof(*plain));
+    frame_t *delta = calloc(t.count, sizeof(*delta));
+    if (plain == NULL || delta == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    const size_t plain_frames = pack(&t, false, plain);
+    const size_t delta_frames = pack(&t, true, delta);
+    if (!unpack_all(&t, delta, delta_frames, true)) {
+        fprintf(stderr, "round trip mismatch\n");
+        return 1;
+    }
+
+    double start = now_ns();
+    for (int i = 0; i < REPEAT; i++) {
+        pack(&t, true, delta);
+    }
+    const double encode_ns = (now_ns() - start) / REPEAT / (double)delta_frames;
+
+    start = now_ns();
+    for (int i = 0; i < REPEAT; i++) {
+        unpack_all(&t, delta, delta_frames, false);
+    }
+    const double decode_ns = (now_ns() - start) / REPEAT / (double)delta_frames;
+
+    const size_t plain_bytes = total_len(plain, plain_frames);
+    const size_t delta_bytes = total_len(delta, delta_frames);
+
+    printf("samples         %zu (%zu TLV bytes)\n", t.count, record_bytes);
+    printf("plain           %zu frames, %zu bytes\n", plain_frames, plain_bytes);
+    printf("delta           %zu frames, %zu bytes\n", delta_frames, delta_bytes);
+    printf("ratio           %.2f bytes, %.2f frames\n", (double)plain_bytes / (double)delta_bytes,
+           (double)plain_frames / (double)delta_frames);
+    printf("encode          %.0f ns/frame\n", encode_ns);
+    printf("decode          %.0f ns/frame\n", decode_ns);
+    printf("codec state     %zu bytes, no heap\n", sizeof(proto_delta_ref_t));
+
+    free(plain);
+    free(delta);
+    free(t.records);
+    return 0;
+}
@@ -0,0 +1,177 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "proto_schema.h"
+#include "proto_tlv.h"
+
+// Host benchmark of PROTO_FLAG_TLV payloads:
+//
+//   tlv_bench
+//
+// Encodes a stream of sensor samples with the generated proto_put_<name>()
+// writers, decodes them with proto_tlv_next(), and renders them with
+// proto_schema_to_json() the way the gateway does for JSON topics. Values
+// drift like real readings, so varint lengths vary. Prints host time per
+// field for each step, bytes per sample against a packed C struct of the
+// same fields, and checks that every decoded value matches.
+
+#define SAMPLES 200000
+#define FIELDS 7 // per sample, all schema fields but the float and bytes ones
+#define MAX_SAMPLE_LEN 64
+
+typedef struct {
+    uint16_t battery_mv;
+    int16_t temperature; // centi-degrees
+    uint16_t humidity;   // per mille
+    uint32_t pressure_pa;
+    int8_t rssi;
+    uint32_t uptime_s;
+    uint32_t counter;
+} sample_t;
+
+typedef struct {
+    uint8_t data[MAX_SAMPLE_LEN];
+    uint8_t len;
+} encoded_t;
+
+static sample_t s_samples[SAMPLES];
+static encoded_t s_encoded[SAMPLES];
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void make_samples(void) {
+    uint32_t rng = 12345;
+    for (size_t i = 0; i < SAMPLES; i++) {
+        rng = rng * 1103515245u + 12345u;
+        const int32_t r = (int32_t)(rng >> 16) % 200 - 100;
+        s_samples[i] = (sample_t){
+            .battery_mv = (uint16_t)(3300 + r * 5),
+            .temperature = (int16_t)(r * 35), // -35.00 .. 34.65
+            .humidity = (uint16_t)(500 + r * 4),
+            .pressure_pa = (uint32_t)(101325 + r * 20),
+            .rssi = (int8_t)(-60 + r / 4),
+            .uptime_s = (uint32_t)(i * 30),
+            .counter = (uint32_t)i,
+        };
+    }
+}
+
+static bool encode(const sample_t *s, encoded_t *out) {
+    proto_tlv_writer_t w;
+    proto_tlv_writer_init(&w, out->data, sizeof(out->data));
+    proto_put_battery_mv(&w, s->battery_mv);
+    proto_put_temperature(&w, s->temperature);
+    proto_put_humidity(&w, s->humidity);
+    proto_put_pressure_pa(&w, s->pressure_pa);
+    proto_put_rssi(&w, s->rssi);
+    proto_put_uptime_s(&w, s->uptime_s);
+    proto_put_counter(&w, s->counter);
+    out->len = (uint8_t)w.len;
+    return !w.overflow;
+}
+
+static bool decode(const encoded_t *in, sample_t *out) {
+    proto_tlv_reader_t r;
+    proto_tlv_reader_init(&r, in->data, in->len);
+    proto_tlv_field_t f;
+    proto_err_t err;
+    size_t fields = 0;
+    while ((err = proto_tlv_next(&r, &f)) == PROTO_OK) {
+        fields++;
+        switch (f.id) {
+        case PROTO_ID_battery_mv:
+            out->battery_mv = (uint16_t)f.u;
+            break;
+        case PROTO_ID_temperature:
+            out->temperature = (int16_t)proto_unzigzag(f.u);
+            break;
+        case PROTO_ID_humidity:
+            out->humidity = (uint16_t)f.u;
+            break;
+        case PROTO_ID_pressure_pa:
+            out->pressure_pa = (uint32_t)f.u;
+            break;
+        case PROTO_ID_rssi:
+            out->rssi = (int8_t)proto_unzigzag(f.u);
+            break;
+        case PROTO_ID_uptime_s:
+            out->uptime_s = (uint32_t)f.u;
+            break;
+        case PROTO_ID_counter:
+            out->counter = (uint32_t)f.u;
+            break;
+        default:
+            break;
+        }
+    }
+    return err == PROTO_ERR_END && fields == FIELDS;
+}
+
+static bool same(const sample_t *a, const sample_t *b) {
+    return a->battery_mv == b->battery_mv && a->temperature == b->temperature && a->humidity == b->humidity &&
+           a->pressure_pa == b->pressure_pa && a->rssi == b->rssi && a->uptime_s == b->uptime_s &&
+           a->counter == b->counter;
+}
+
+int main(void) {
+    make_samples();
+
+    double start = now_ns();
+    bool ok = true;
+    for (size_t i = 0; i < SAMPLES; i++) {
+        ok &= encode(&s_samples[i], &s_encoded[i]);
+    }
+    const double encode_ns = (now_ns() - start) / SAMPLES / FIELDS;
+    if (!ok) {
+        fprintf(stderr, "sample does not fit %d bytes\n", MAX_SAMPLE_LEN);
+        return 1;
+    }
+
+    static sample_t decoded[SAMPLES];
+    start = now_ns();
+    for (size_t i = 0; i < SAMPLES; i++) {
+        ok &= decode(&s_encoded[i], &decoded[i]);
+    }
+    const double decode_ns = (now_ns() - start) / SAMPLES / FIELDS;
+
+    char json[256];
+    size_t json_bytes = 0;
+    start = now_ns();
+    for (size_t i = 0; i < SAMPLES; i++) {
+        const int n = proto_schema_to_json(s_encoded[i].data, s_encoded[i].len, json, sizeof(json));
+        ok &= n > 0;
+        json_bytes += (size_t)n;
+    }
+    const double json_ns = (now_ns() - start) / SAMPLES / FIELDS;
+
+    size_t wire_bytes = 0, min_len = SIZE_MAX, max_len = 0;
+    for (size_t i = 0; i < SAMPLES; i++) {
+        ok &= same(&s_samples[i], &decoded[i]);
+        wire_bytes += s_encoded[i].len;
+        min_len = s_encoded[i].len < min_len ? s_encoded[i].len : min_len;
+        max_len = s_encoded[i].len > max_len ? s_encoded[i].len : max_len;
+    }
+    if (!ok) {
+        fprintf(stderr, "decoded sample differs from the encoded one\n");
+        return 1;
+    }
+
+    const size_t packed = sizeof(uint16_t) * 3 + sizeof(uint32_t) * 3 + sizeof(int8_t);
+    printf("samples         %d of %d fields\n", SAMPLES, FIELDS);
+    printf("encode          %.1f ns per field\n", encode_ns);
+    printf("decode          %.1f ns per field\n", decode_ns);
+    printf("to json         %.1f ns per field, %.1f bytes per sample\n", json_ns, (double)json_bytes / SAMPLES);
+    printf("wire            %.1f bytes per sample (%zu..%zu), packed struct %zu\n", (double)wire_bytes / SAMPLES,
+           min_len, max_len, packed);
+    return 0;
+}
@@ -0,0 +1,73 @@
+package main
+
+import (
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"net"
+)
+
+// Batch payload layout produced by the gateway with CONFIG_GATEWAY_MQTT_BATCH
+// (see gateway/main/mqtt_batch.h):
+//
+//	u8 version, u8 flags, then records until end of payload
+//	record: [mac 6 bytes, only with batchFlagMAC] u16le len, data[len]
+const (
+	batchVersion = 1
+	batchFlagMAC = 0x01
+	batchHdrLen  = 2
+	macLen       = 6
+)
+
+var errBatchTruncated = errors.New("batch truncated")
+
+type batchRecord struct {
+	MAC  net.HardwareAddr // nil when records are published on a per-device topic
+	Data []byte
+}
+
+func decodeBatch(payload []byte) ([]batchRecord, error) {
+	if len(payload) < batchHdrLen {
+		return nil, errBatchTruncated
+	}
+
+	if payload[0] != batchVersion {
+		return nil, fmt.Errorf("unsupported batch version %d", payload[0])
+	}
+
+	withMAC := payload[1]&batchFlagMAC != 0
+	p := payload[batchHdrLen:]
+
+	var records []batchRecord
+
+	for len(p) > 0 {
+		var rec batchRecord
+
+		if withMAC {
+			if len(p) < macLen {
+				return records, errBatchTruncated
+			}
+
+			rec.MAC = net.HardwareAddr(p[:macLen])
+			p = p[macLen:]
+		}
+
+		if len(p) < 2 {
+			return records, errBatchTruncated
+		}
+
+		n := int(binary.LittleEndian.Uint16(p))
+		p = p[2:]
+
+		if len(p) < n {
+			return records, errBatchTruncated
+		}
+
+		rec.Data = p[:n]
+		p = p[n:]
+
+		records = append(records, rec)
+	}
+
+	return records, nil
+}
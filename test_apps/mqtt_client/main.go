@@ -24,12 +24,35 @@ var f = func(logger *slog.Logger) mqtt.MessageHandler {
 	}
 }
 
+var fBatch = func(logger *slog.Logger) mqtt.MessageHandler {
+	return func(client mqtt.Client, msg mqtt.Message) {
+		records, err := decodeBatch(msg.Payload())
+		if err != nil {
+			logger.Error("batch decode", "topic", msg.Topic(), "err", err)
+		}
+
+		for _, rec := range records {
+			if rec.MAC != nil {
+				logger.Info("record", "topic", msg.Topic(), "mac", rec.MAC.String(), "payload", rec.Data)
+			} else {
+				logger.Info("record", "topic", msg.Topic(), "payload", rec.Data)
+			}
+		}
+	}
+}
+
 func main() {
 	if len(os.Args) < 4 {
-		fmt.Println("Usage: go run main.go <user> <password> <topic>")
+		fmt.Println("Usage: go run . <user> <password> <topic> [raw|batch]")
 		os.Exit(1)
 	}
 
+	handler := f
+
+	if len(os.Args) > 4 && os.Args[4] == "batch" {
+		handler = fBatch
+	}
+
 	logger := slog.New(slog.NewTextHandler(os.Stdout, &slog.HandlerOptions{
 		Level:       slog.LevelDebug,
 		ReplaceAttr: nil,
@@ -40,7 +63,7 @@ func main() {
 	opts.SetUsername(os.Args[1])
 	opts.SetPassword(os.Args[2])
 	opts.SetKeepAlive(keepAliveDuration)
-	opts.SetDefaultPublishHandler(f(logger.With("component", "mqtt-message-handler")))
+	opts.SetDefaultPublishHandler(handler(logger.With("component", "mqtt-message-handler")))
 	opts.SetPingTimeout(pingTimeout)
 	opts.SetConnectionNotificationHandler(func(client mqtt.Client, notification mqtt.ConnectionNotification) {
 		l := logger.With("component", "mqtt-connection-notifier")